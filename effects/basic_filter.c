@@ -1,5 +1,6 @@
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 #include <math.h>
 
 #include <xmmintrin.h>
@@ -7,9 +8,17 @@
 
 #define BASIC_FILTER_PARAM_FC   (0)
 #define BASIC_FILTER_NUM_PARAMS (1)
+
 #define SQRT_OF_2               (1.41421356f)
 #define HALF_OF_TAU             (3.14159265f)
 
+/* The filter coefficients are worked out once per BASIC_FILTER_CONTROL_FRAMES samples, for where the
+ * smoothed cutoff will be at the end of the block, and interpolated in between. If the cutoff has
+ * moved less than BASIC_FILTER_FC_THRESHOLD they're left alone.
+ */
+#define BASIC_FILTER_CONTROL_FRAMES (16)
+#define BASIC_FILTER_FC_THRESHOLD   (1.0e-5f)
+
 const char *BasicFilterName = "BasicFilter 1.0";
 
 typedef struct
@@ -67,17 +76,23 @@ void BiquadComputeNewButterworthHPF(biquad *Biquad, float Fc, float Fs)
 	Biquad->a2 = (double)k2/(double)k0;
 }
 
-float BiquadProcess(biquad *Biquad, float NewSample)
+/* Runs the coefficients of Coefs over the state in v, so channels can share a set of coefficients. */
+static inline float BiquadProcessShared(const biquad *Coefs, float *v, float NewSample)
 {
-	float v = NewSample - Biquad->a2 * Biquad->v[1] - Biquad->a1 * Biquad->v[0];
-	float y = v * Biquad->b0 + Biquad->b1 * Biquad->v[0] + Biquad->b2 * Biquad->v[1];
+	float w = NewSample - Coefs->a2 * v[1] - Coefs->a1 * v[0];
+	float y = w * Coefs->b0 + Coefs->b1 * v[0] + Coefs->b2 * v[1];
 
-	Biquad->v[1] = Biquad->v[0];
-	Biquad->v[0] = v; 
+	v[1] = v[0];
+	v[0] = w; 
 
 	return y;
 }
 
+float BiquadProcess(biquad *Biquad, float NewSample)
+{
+	return BiquadProcessShared(Biquad, Biquad->v, NewSample);
+}
+
 static inline float BasicFilterParamToHz(float Value)
 {
 	/* log mapping from 100Hz to 18kHz .. ish
@@ -97,7 +112,15 @@ typedef struct
 
 	float        SmoothedFC;
 
+	/* Both channels use the coefficients in LPF[0], LPF[1] only holds the right channel's state.
+	 * Step is added to them every sample until they reach Target, at the end of the control block.
+	 */
 	biquad       LPF[2];
+	biquad       Step;
+	biquad       Target;
+	int          ControlFramesLeft;
+	float        CoefFC;
+	float        CoefFs;
 } basic_filter_state;
 
 void *BasicFilterOpen(void)
@@ -105,14 +128,13 @@ void *BasicFilterOpen(void)
 	basic_filter_state *bs = malloc(sizeof(basic_filter_state));
 	memset(bs, 0, sizeof(basic_filter_state));
 
-	_MM_SET_FLUSH_ZERO_MODE(_MM_FLUSH_ZERO_ON);
-	_MM_SET_DENORMALS_ZERO_MODE(_MM_DENORMALS_ZERO_ON);
-
 	bs->SmoothedFC = 0.475f;
 
 	float Fc = BasicFilterParamToHz(bs->SmoothedFC);
 	BiquadComputeNewButterworthLPF(&bs->LPF[0], Fc, 48000.0f);
-	BiquadComputeNewButterworthLPF(&bs->LPF[1], Fc, 48000.0f);
+	bs->Target = bs->LPF[0];
+	bs->CoefFC = bs->SmoothedFC;
+	bs->CoefFs = 48000.0f;
 
 	return bs;
 }
@@ -122,24 +144,65 @@ void BasicFilterClose(basic_filter_state *state)
 	free(state);
 }
 
+static void BasicFilterStartControlBlock(basic_filter_state *state, float Cutoff_Normalised, float Fs)
+{
+	int k;
+
+	/* land exactly on the last block's target */
+	state->LPF[0].b0 = state->Target.b0;
+	state->LPF[0].b1 = state->Target.b1;
+	state->LPF[0].b2 = state->Target.b2;
+	state->LPF[0].a1 = state->Target.a1;
+	state->LPF[0].a2 = state->Target.a2;
+
+	for (k = 0; k < BASIC_FILTER_CONTROL_FRAMES; k++)
+	{
+		state->SmoothedFC += 0.01f * (Cutoff_Normalised - state->SmoothedFC);
+	}
+
+	state->ControlFramesLeft = BASIC_FILTER_CONTROL_FRAMES;
+
+	if (fabsf(state->SmoothedFC - state->CoefFC) < BASIC_FILTER_FC_THRESHOLD && Fs == state->CoefFs)
+	{
+		memset(&state->Step, 0, sizeof(biquad));
+		return;
+	}
+
+	state->CoefFC = state->SmoothedFC;
+	state->CoefFs = Fs;
+	BiquadComputeNewButterworthLPF(&state->Target, BasicFilterParamToHz(state->SmoothedFC), Fs);
+
+	state->Step.b0 = (state->Target.b0 - state->LPF[0].b0) / BASIC_FILTER_CONTROL_FRAMES;
+	state->Step.b1 = (state->Target.b1 - state->LPF[0].b1) / BASIC_FILTER_CONTROL_FRAMES;
+	state->Step.b2 = (state->Target.b2 - state->LPF[0].b2) / BASIC_FILTER_CONTROL_FRAMES;
+	state->Step.a1 = (state->Target.a1 - state->LPF[0].a1) / BASIC_FILTER_CONTROL_FRAMES;
+	state->Step.a2 = (state->Target.a2 - state->LPF[0].a2) / BASIC_FILTER_CONTROL_FRAMES;
+}
+
 void basic_filter_process(basic_filter_state *state, float **Input, float **Output, int32_t NumSamples)
 {
 	int s;
 	float Fs                  = state->SampleRate ? state->SampleRate : 48000.0f;
 	float Cutoff_Normalised   = state->Params[BASIC_FILTER_PARAM_FC];
-	float Cutoff_Hz;
-
-	
+	biquad *Coefs             = &state->LPF[0];
 
 	for (s = 0; s < NumSamples; s++)
 	{
-		state->SmoothedFC += 0.01f * (Cutoff_Normalised - state->SmoothedFC);
-		Cutoff_Hz = BasicFilterParamToHz(state->SmoothedFC);
-		BiquadComputeNewButterworthLPF(&state->LPF[0], Cutoff_Hz, Fs);
-		BiquadComputeNewButterworthLPF(&state->LPF[1], Cutoff_Hz, Fs);	
+		if (state->ControlFramesLeft == 0)
+		{
+			BasicFilterStartControlBlock(state, Cutoff_Normalised, Fs);
+		}
+
+		state->ControlFramesLeft--;
+
+		Coefs->b0 += state->Step.b0;
+		Coefs->b1 += state->Step.b1;
+		Coefs->b2 += state->Step.b2;
+		Coefs->a1 += state->Step.a1;
+		Coefs->a2 += state->Step.a2;
 
-		Output[0][s] = BiquadProcess(&state->LPF[0], Input[0][s]);
-		Output[1][s] = BiquadProcess(&state->LPF[1], Input[1][s]);
+		Output[0][s] = BiquadProcessShared(Coefs, state->LPF[0].v, Input[0][s]);
+		Output[1][s] = BiquadProcessShared(Coefs, state->LPF[1].v, Input[1][s]);
 	}
 }
 
@@ -177,6 +240,7 @@ void BasicFilterPopulateDSPStruct(dsp_effect *DSPEffect)
 	DSPEffect->Close         = BasicFilterClose;
 	DSPEffect->GetParameter  = BasicFilterGetParameter;
 	DSPEffect->SetParameter  = BasicFilterSetParameter;
+	DSPEffect->ReserveParameter = 0;
 	DSPEffect->Name          = BasicFilterName;
 	DSPEffect->SetSampleRate = BasicFilterSetSampleRate;
 	DSPEffect->NumParameters = BASIC_FILTER_NUM_PARAMS;
@@ -16,6 +16,7 @@ typedef void *deInitEffect(unsigned int NumChannelsIn, unsigned int NumChannelsO
 typedef void  (*deProcessAudio)(void *State, float **Input, float **Output, int32_t NumSamples);
 typedef void  (*deSetParameter)(void *State, int32_t index, float value);
 typedef float (*deGetParameter)(void *State, int32_t index); 
+typedef void  (*deReserveParameter)(void *State, int32_t index, float value);
 
 struct dsp_effect_parameter_s;
 
@@ -45,6 +46,12 @@ typedef struct
 	deSetParameter  SetParameter;
 	deGetParameter  GetParameter;
 
+	/* May be NULL. Called before processing with the highest value a parameter
+	 * will be set to, for effects that size memory from a parameter.
+	 * SetParameter() never allocates, it clamps to what was reserved.
+	 */
+	deReserveParameter ReserveParameter;
+
 	/* Parameter stuff .. */
 	unsigned int    NumParameters;
 
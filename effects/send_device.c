@@ -0,0 +1,169 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#define SEND_DEVICE_PAR_AMOUNT   (0)
+#define SEND_DEVICE_PAR_PANNING  (1)
+#define SEND_DEVICE_NUM_PARAMS   (2)
+
+const char *SendDeviceName = "Send 1.0";
+
+/* Renoise's #Send device. It doesn't change the audio going through it (unless it mutes it), it copies
+ * it out, scaled by the amount and panned, into a tap that the host gives it. The host sums the taps
+ * into the send track they are routed to, so any number of tracks can share the effects on a send.
+ */
+typedef struct
+{
+	float  Params[SEND_DEVICE_NUM_PARAMS];
+	float  SampleRate;
+
+	/* The gains the last block ended on, each block ramps from these to the parameters. The first block
+	 * starts on the parameters instead.
+	 */
+	float  GainL;
+	float  GainR;
+	int    bStarted;
+
+	int    bMuteSource;
+
+	/* Where the next block is written, see SendDeviceSetTap(). */
+	float *Tap[2];
+} send_device_state;
+
+void *SendDeviceOpen(void)
+{
+	send_device_state *state = malloc(sizeof(send_device_state));
+	memset(state, 0, sizeof(send_device_state));
+
+	state->Params[SEND_DEVICE_PAR_AMOUNT]  = 1.0f;
+	state->Params[SEND_DEVICE_PAR_PANNING] = 0.5f;
+
+	return state;
+}
+
+void SendDeviceClose(send_device_state *state)
+{
+	free(state);
+}
+
+/* Balance rather than a pan law, the centre sends both channels at the full amount. */
+static void SendDeviceTargetGains(send_device_state *state, float *L, float *R)
+{
+	float Amount = state->Params[SEND_DEVICE_PAR_AMOUNT];
+	float Pan    = state->Params[SEND_DEVICE_PAR_PANNING];
+
+	*L = Amount * ((Pan <= 0.5f) ? 1.0f : 2.0f * (1.0f - Pan));
+	*R = Amount * ((Pan >= 0.5f) ? 1.0f : 2.0f * Pan);
+}
+
+/* Points the device at the buffers the next blocks go into, one after the other. The host calls this at
+ * the start of every span, NULL if the send isn't routed anywhere.
+ */
+void SendDeviceSetTap(send_device_state *state, float *TapL, float *TapR)
+{
+	state->Tap[0] = TapL;
+	state->Tap[1] = TapR;
+}
+
+void send_device_process(send_device_state *state, float **Input, float **Output, int32_t NumSamples)
+{
+	int s;
+	float TargetL, TargetR;
+	float StepL, StepR;
+
+	SendDeviceTargetGains(state, &TargetL, &TargetR);
+
+	if (!state->bStarted)
+	{
+		state->GainL    = TargetL;
+		state->GainR    = TargetR;
+		state->bStarted = 1;
+	}
+
+	StepL = (TargetL - state->GainL) / NumSamples;
+	StepR = (TargetR - state->GainR) / NumSamples;
+
+	if (state->Tap[0])
+	{
+		float GainL = state->GainL;
+		float GainR = state->GainR;
+
+		for (s = 0; s < NumSamples; s++)
+		{
+			GainL += StepL;
+			GainR += StepR;
+
+			state->Tap[0][s] = GainL * Input[0][s];
+			state->Tap[1][s] = GainR * Input[1][s];
+		}
+
+		state->Tap[0] += NumSamples;
+		state->Tap[1] += NumSamples;
+	}
+
+	state->GainL = TargetL;
+	state->GainR = TargetR;
+
+	if (state->bMuteSource)
+	{
+		memset(Output[0], 0, sizeof(float) * NumSamples);
+		memset(Output[1], 0, sizeof(float) * NumSamples);
+	}
+	else if (Output != Input)
+	{
+		memmove(Output[0], Input[0], sizeof(float) * NumSamples);
+		memmove(Output[1], Input[1], sizeof(float) * NumSamples);
+	}
+}
+
+float SendDeviceGetParameter(send_device_state *state, int32_t index)
+{
+	if (index >= 0 && index < SEND_DEVICE_NUM_PARAMS)
+		return state->Params[index];
+	return 0.0f;
+}
+
+void SendDeviceSetParameter(send_device_state *state, int32_t index, float value)
+{
+	if (index >= 0 && index < SEND_DEVICE_NUM_PARAMS)
+		state->Params[index] = value;
+}
+
+void SendDeviceSetMuteSource(send_device_state *state, int bMuteSource)
+{
+	state->bMuteSource = bMuteSource;
+}
+
+void SendDeviceSetSampleRate(send_device_state *state, float SampleRate)
+{
+	state->SampleRate = SampleRate;
+}
+
+#ifdef DSP_WRAPPERS
+
+void SendDevicePopulateDSPStruct(dsp_effect *DSPEffect)
+{
+	DSPEffect->State         = 0;
+	DSPEffect->Process       = send_device_process;
+	DSPEffect->Open          = SendDeviceOpen;
+	DSPEffect->Close         = SendDeviceClose;
+	DSPEffect->GetParameter  = SendDeviceGetParameter;
+	DSPEffect->SetParameter  = SendDeviceSetParameter;
+	DSPEffect->ReserveParameter = 0;
+	DSPEffect->Name          = SendDeviceName;
+	DSPEffect->SetSampleRate = SendDeviceSetSampleRate;
+	DSPEffect->NumParameters = SEND_DEVICE_NUM_PARAMS;
+
+	DSPEffect->Unique32BitCode = CCONST('s', 'E', 'n', 'D');
+
+	if (DSPEffect->NumParameters)
+	{
+		DSPEffect->Parameters = malloc(sizeof(dsp_effect_parameter) * DSPEffect->NumParameters);
+		CopyBytesUpToNAndAppendNULL(DSPEffect->Parameters[SEND_DEVICE_PAR_AMOUNT].Name, "Amount", PARAMETER_MAX_NAME);
+		DSPEffect->Parameters[SEND_DEVICE_PAR_AMOUNT].Format = DSPEffectPrintLinearToDB;
+		CopyBytesUpToNAndAppendNULL(DSPEffect->Parameters[SEND_DEVICE_PAR_PANNING].Name, "Panning", PARAMETER_MAX_NAME);
+		DSPEffect->Parameters[SEND_DEVICE_PAR_PANNING].Format = DSPEffectPrintLinearToLinear;
+	}
+}
+
+#endif
@@ -76,12 +76,26 @@ typedef struct
 
 	westverb_chain   Tank[2];
 
+	float           *AllpassMem;
+	float            AllpassMemScale;
+
 	float            DryGain;
 	float            LateGain;
 	float            EarlyGain;
 
 } westverb_state;
 
+/* The two tanks always share their parameters and only differ in their state, so they're run
+ * together, left tank in lane 0 and right tank in lane 1. The delay lines of the left tank are
+ * interleaved left/right frames (the right tank points at the same memory), so both taps of a
+ * stage come in with one 64-bit load.
+ */
+typedef struct
+{
+	__m128 b0, b1, b2, a1, a2;
+	__m128 v0, v1;
+} westverb_biquad_x2;
+
 /* Gain used for the mix level on wet, dry, output
  */
 float WestVerbParam2LinGain(float P)
@@ -151,6 +165,43 @@ float ComputeTankNorm(westverb_chain *Tank)
     return sqrt((1.0f - LoopGain)/ForwardGain);
 }
 
+/* Every allpass stage needs a delay line, fairly long as the prime delay times grow. Rather than the
+ * worst case (density 2.0) these are sized for the highest density reserved, all in one block, see
+ * WestVerbReserveParameter(). Setting the density any higher clamps to what is allocated.
+ */
+static void WestVerbSizeAllpasses(westverb_state *W, float Scale)
+{
+	int i;
+	int TotalFrames = 0;
+	float *DLMem;
+	westverb_chain *TankL = &W->Tank[0];
+	westverb_chain *TankR = &W->Tank[1];
+
+	for (i = 0; i < TankL->NumStages; i++)
+	{
+		int MaxDelay = (int) ceil(2.0f * Scale * WestVerbPrimeDelays[i]);
+		if (MaxDelay < 1) MaxDelay = 1;
+
+		TankL->Allpasses[i].MaxDelay = MaxDelay;
+		TankR->Allpasses[i].MaxDelay = MaxDelay;
+		TotalFrames += MaxDelay;
+	}
+
+	free(W->AllpassMem);
+	W->AllpassMem      = calloc(2 * TotalFrames, sizeof(float));
+	W->AllpassMemScale = Scale;
+
+	for (DLMem = W->AllpassMem, i = 0; i < TankL->NumStages; i++)
+	{
+		TankL->Allpasses[i].DelayLine = DLMem;
+		TankR->Allpasses[i].DelayLine = DLMem;
+		TankL->Allpasses[i].idx       = 0;
+		TankR->Allpasses[i].idx       = 0;
+
+		DLMem += 2 * TankL->Allpasses[i].MaxDelay;
+	}
+}
+
 void *WestVerbOpen(void)
 {
 	int i, ch, j;
@@ -162,22 +213,7 @@ void *WestVerbOpen(void)
 
 	unsigned int MemSz = sizeof(westverb_state);
 
-	/* Every allpass stage requires a delayline, often
-	 * fairly long as the prime delay times grow. Allocate
-	 * all this memory together, and index the total buffer
-	 * for each allpass.
-	 *
-	 * To avoid re-allocation (aside from sample rate changes), 
-	 * we will allocate the worst-case delay lines for each,
-	 * given by the maximum value of density * WestVerbPrimeDelays[i].
-	 *
-	 */
-
-	for (i = 0; i < NumStages; i++)
-	{
-		MemSz += (2 /* num channels */) * sizeof(float) * ((int) ceil(WESTVERB_DELAY_SCALE_MAX * WestVerbPrimeDelays[i]));
-	}
-
+	/* The allpass delay lines live in their own block, see WestVerbSizeAllpasses(). */
 	MemSz += 2 * sizeof(float) * ((int) ceil(WESTVERB_EARLY_TIME_MS_MAX * 48000.0f / 1000.0f));
 
 	char *VerbMem = malloc(MemSz);
@@ -203,19 +239,23 @@ void *WestVerbOpen(void)
 			ap->g          = 0.7f;
 			ap->a          = 1.0f;
 			ap->Delay      = (int) ceil(2.0f * W->Params[WESTVERB_PAR_DELAY_SCALE] * WestVerbPrimeDelays[i]);
-			ap->MaxDelay   = (int) ceil(WESTVERB_DELAY_SCALE_MAX * WestVerbPrimeDelays[i]);
 			ap->BranchGain = 1.0f / (i + 1.0f);
 
 			BiquadInit(&ap->FDF);
 			BiquadComputeNewButterworthLPF(&ap->FDF, 8000.0f, 48000.0f);
-			
-			ap->DelayLine = (float *) DLMem;
-			DLMem += sizeof(float) * ap->MaxDelay;
 		}
 
 		Tank->MaxDelay  = ceil(WESTVERB_EARLY_TIME_MS_MAX * 48000.0f / 1000.0f);
-		Tank->DelayLine = (float *) DLMem;
-		DLMem += sizeof(float) * Tank->MaxDelay;
+
+		if (ch == 0)
+		{
+			Tank->DelayLine = (float *) DLMem;
+			DLMem += 2 * sizeof(float) * Tank->MaxDelay;
+		}
+		else
+		{
+			Tank->DelayLine = W->Tank[0].DelayLine;
+		}
 
 		Tank->Tau = 0.5f;
 
@@ -246,6 +286,8 @@ void *WestVerbOpen(void)
 		BiquadComputeNewButterworthHPF(&Tank->HPF, BasicFilterParamToHz(W->Params[WESTVERB_PAR_HPF_FC]), 48000.0f);
 	}
 
+	WestVerbSizeAllpasses(W, W->Params[WESTVERB_PAR_DELAY_SCALE]);
+
 	W->Params[WESTVERB_PAR_DRY_GAIN]   = 1.0;
 	W->Params[WESTVERB_PAR_ROOM_GAIN]  = 1.0;
 	// W->Params[WESTVERB_PAR_EARLY_GAIN] = 1.0;
@@ -259,64 +301,159 @@ void *WestVerbOpen(void)
 
 void WestVerbClose(westverb_state *state)
 {
+	free(state->AllpassMem);
 	free(state);
 }
 
-float AllpassProcess(westverb_allpass *ap, float In)
+static inline void WestVerbLoadBiquadX2(westverb_biquad_x2 *Bq, biquad *L, biquad *R)
 {
-	float OldSample = ap->DelayLine[(ap->idx - ap->Delay + ap->MaxDelay) % ap->MaxDelay];
-	float DecayPath = BiquadProcess(&ap->FDF, OldSample);
-	float y = DecayPath * ap->a + ap->g * In;
-	ap->DelayLine[ap->idx] = In - ap->g * y;
-	ap->idx = (ap->idx + 1) % ap->MaxDelay;
+	Bq->b0 = _mm_set1_ps(L->b0);
+	Bq->b1 = _mm_set1_ps(L->b1);
+	Bq->b2 = _mm_set1_ps(L->b2);
+	Bq->a1 = _mm_set1_ps(L->a1);
+	Bq->a2 = _mm_set1_ps(L->a2);
+	Bq->v0 = _mm_setr_ps(L->v[0], R->v[0], 0.0f, 0.0f);
+	Bq->v1 = _mm_setr_ps(L->v[1], R->v[1], 0.0f, 0.0f);
+}
+
+static inline void WestVerbStoreBiquadX2(westverb_biquad_x2 *Bq, biquad *L, biquad *R)
+{
+	float v0[4], v1[4];
+
+	_mm_storeu_ps(v0, Bq->v0);
+	_mm_storeu_ps(v1, Bq->v1);
+
+	L->v[0] = v0[0];
+	L->v[1] = v1[0];
+	R->v[0] = v0[1];
+	R->v[1] = v1[1];
+}
+
+/* Same order of operations as BiquadProcess, so each lane matches it exactly. */
+static inline __m128 BiquadProcessX2(westverb_biquad_x2 *Bq, __m128 In)
+{
+	__m128 v = _mm_sub_ps(_mm_sub_ps(In, _mm_mul_ps(Bq->a2, Bq->v1)), _mm_mul_ps(Bq->a1, Bq->v0));
+	__m128 y = _mm_add_ps(_mm_add_ps(_mm_mul_ps(v, Bq->b0), _mm_mul_ps(Bq->b1, Bq->v0)), _mm_mul_ps(Bq->b2, Bq->v1));
+
+	Bq->v1 = Bq->v0;
+	Bq->v0 = v;
 
 	return y;
 }
 
+static inline __m128 WestVerbLoadFrame(float *DelayLine, int idx)
+{
+	return _mm_loadl_pi(_mm_setzero_ps(), (__m64 const *) &DelayLine[2 * idx]);
+}
+
+static inline void WestVerbStoreFrame(float *DelayLine, int idx, __m128 Frame)
+{
+	_mm_storel_pi((__m64 *) &DelayLine[2 * idx], Frame);
+}
+
 void westverb_process(westverb_state *state, float **Input, float **Output, int32_t NumSamples)
 {
-	int i, s, p;
+	int s, p;
+	westverb_chain *TankL  = &state->Tank[0];
+	westverb_chain *TankR  = &state->Tank[1];
+	int NumStages          = TankL->NumStages;
+
+	westverb_biquad_x2 FDF[WESTVERB_MAX_STAGES];
+	westverb_biquad_x2 LPF;
+	westverb_biquad_x2 HPF;
+	__m128 G[WESTVERB_MAX_STAGES];
+	__m128 A[WESTVERB_MAX_STAGES];
+	__m128 BranchGain[WESTVERB_MAX_STAGES];
+	__m128 EarlyGains[3];
+
+	__m128 Tau      = _mm_set1_ps(TankL->Tau);
+	__m128 Norm     = _mm_set1_ps(TankL->Norm);
+	__m128 LateGain = _mm_set1_ps(state->LateGain);
+	__m128 DryGain  = _mm_set1_ps(state->Params[WESTVERB_PAR_DRY_GAIN]);
+	__m128 Feedback = _mm_setr_ps(TankL->FeedbackSample, TankR->FeedbackSample, 0.0f, 0.0f);
+	float Out[4];
+
 	state->NumInputChannels  = 2;
 	state->NumOutputChannels = 2;
 
-	for (i = 0; i < state->NumInputChannels; i++)
+	for (p = 0; p < NumStages; p++)
 	{
-		westverb_chain *Tank = &state->Tank[i];
+		westverb_allpass *ap = &TankL->Allpasses[p];
 
-		for (s = 0; s < NumSamples; s++)
+		WestVerbLoadBiquadX2(&FDF[p], &ap->FDF, &TankR->Allpasses[p].FDF);
+		G[p]          = _mm_set1_ps(ap->g);
+		A[p]          = _mm_set1_ps(ap->a);
+		BranchGain[p] = _mm_set1_ps(ap->BranchGain);
+	}
+
+	for (p = 0; p < 3; p++)
+	{
+		EarlyGains[p] = _mm_set1_ps(TankL->EarlyGains[p]);
+	}
+
+	WestVerbLoadBiquadX2(&LPF, &TankL->LPF, &TankR->LPF);
+	WestVerbLoadBiquadX2(&HPF, &TankL->HPF, &TankR->HPF);
+
+	for (s = 0; s < NumSamples; s++)
+	{
+		__m128 Dry      = _mm_setr_ps(Input[0][s], Input[1][s], 0.0f, 0.0f);
+		__m128 In       = _mm_add_ps(Dry, _mm_mul_ps(Feedback, Tau));
+		__m128 EarlyOut = _mm_setzero_ps();
+		__m128 LateOut  = _mm_setzero_ps();
+		__m128 Room;
+
+		WestVerbStoreFrame(TankL->DelayLine, TankL->idx, Dry);
+
+		for (p = 0; p < 3; p++)
 		{
-			float Room     = 0.0f;
-			float In       = Input[i][s] + Tank->FeedbackSample * Tank->Tau;
-			float EarlyOut = 0.0f;
-			float LateOut  = 0.0f;
+			int idx = TankL->idx - TankL->EarlyDelays[p];
+			if (idx < 0) idx += TankL->MaxDelay;
 
-			Tank->DelayLine[Tank->idx] = Input[i][s];
+			EarlyOut = _mm_add_ps(EarlyOut, _mm_mul_ps(EarlyGains[p], WestVerbLoadFrame(TankL->DelayLine, idx)));
+		}
 
-			for (p = 0; p < 3; p++)
-			{
-				int idx = (Tank->idx - Tank->EarlyDelays[p] + Tank->MaxDelay) % Tank->MaxDelay;
-				EarlyOut += Tank->EarlyGains[p] * Tank->DelayLine[idx];
-			}
+		if (++TankL->idx == TankL->MaxDelay) TankL->idx = 0;
 
-			Tank->idx = (Tank->idx + 1) % Tank->MaxDelay;
+		for (p = 0; p < NumStages; p++)
+		{
+			westverb_allpass *ap = &TankL->Allpasses[p];
+			__m128 DecayPath, y;
 
-			for (p = 0; p < Tank->NumStages; p++)
-			{
-				westverb_allpass *ap = &Tank->Allpasses[p];
-				In = AllpassProcess(ap, In);
-				LateOut += In * ap->BranchGain;
-			}
+			int idx = ap->idx - ap->Delay;
+			if (idx < 0) idx += ap->MaxDelay;
 
-			Tank->FeedbackSample = In;
+			DecayPath = BiquadProcessX2(&FDF[p], WestVerbLoadFrame(ap->DelayLine, idx));
+			y         = _mm_add_ps(_mm_mul_ps(DecayPath, A[p]), _mm_mul_ps(G[p], In));
 
-			Room = state->LateGain * (LateOut + EarlyOut);
-			Room = BiquadProcess(&Tank->LPF, Room);
-			Room = BiquadProcess(&Tank->HPF, Room);
+			WestVerbStoreFrame(ap->DelayLine, ap->idx, _mm_sub_ps(In, _mm_mul_ps(G[p], y)));
+			if (++ap->idx == ap->MaxDelay) ap->idx = 0;
 
-			Output[i][s] = state->Params[WESTVERB_PAR_DRY_GAIN] * Input[i][s]
-			             + Room * Tank->Norm;
+			In      = y;
+			LateOut = _mm_add_ps(LateOut, _mm_mul_ps(In, BranchGain[p]));
 		}
+
+		Feedback = In;
+
+		Room = _mm_mul_ps(LateGain, _mm_add_ps(LateOut, EarlyOut));
+		Room = BiquadProcessX2(&LPF, Room);
+		Room = BiquadProcessX2(&HPF, Room);
+
+		_mm_storeu_ps(Out, _mm_add_ps(_mm_mul_ps(DryGain, Dry), _mm_mul_ps(Room, Norm)));
+		Output[0][s] = Out[0];
+		Output[1][s] = Out[1];
+	}
+
+	for (p = 0; p < NumStages; p++)
+	{
+		WestVerbStoreBiquadX2(&FDF[p], &TankL->Allpasses[p].FDF, &TankR->Allpasses[p].FDF);
 	}
+
+	WestVerbStoreBiquadX2(&LPF, &TankL->LPF, &TankR->LPF);
+	WestVerbStoreBiquadX2(&HPF, &TankL->HPF, &TankR->HPF);
+
+	_mm_storeu_ps(Out, Feedback);
+	TankL->FeedbackSample = Out[0];
+	TankR->FeedbackSample = Out[1];
 }
 
 
@@ -431,6 +568,9 @@ void WestVerbSetParameter(westverb_state *state, int32_t index, float value)
 			}
 			case WESTVERB_PAR_DELAY_SCALE:
 			{
+				/* Never re-allocate from here, it may be the audio thread. */
+				float Scale = (value > state->AllpassMemScale) ? state->AllpassMemScale : value;
+
 				for (ch = 0; ch < 2; ch++)
 				{
 					westverb_chain *Tank = &state->Tank[ch];
@@ -438,7 +578,7 @@ void WestVerbSetParameter(westverb_state *state, int32_t index, float value)
 					for (i = 0; i < Tank->NumStages; i++)
 					{
 						westverb_allpass *ap = &Tank->Allpasses[i];
-						ap->Delay = (int) ceil(2.0f * value * WestVerbPrimeDelays[i]);
+						ap->Delay = (int) ceil(2.0f * Scale * WestVerbPrimeDelays[i]);
 					}
 				}
 
@@ -484,6 +624,18 @@ void WestVerbSetParameter(westverb_state *state, int32_t index, float value)
 	}
 }
 
+/* Grows the allpass delay lines for the highest density the reverb will be set to. This allocates
+ * (and loses the tail), so call it before processing starts.
+ */
+void WestVerbReserveParameter(westverb_state *state, int32_t index, float value)
+{
+	if (index == WESTVERB_PAR_DELAY_SCALE && value > state->AllpassMemScale)
+	{
+		WestVerbSizeAllpasses(state, value);
+		WestVerbSetParameter(state, index, state->Params[index]);
+	}
+}
+
 void WestVerbSetSampleRate(westverb_state *state, float SampleRate)
 {
 	state->SampleRate = SampleRate;
@@ -500,6 +652,7 @@ void WestVerbPopulateDSPStruct(dsp_effect *DSPEffect)
 	DSPEffect->Close         = WestVerbClose;
 	DSPEffect->GetParameter  = WestVerbGetParameter;
 	DSPEffect->SetParameter  = WestVerbSetParameter;
+	DSPEffect->ReserveParameter = WestVerbReserveParameter;
 	DSPEffect->Name          = WestVerbName;
 	DSPEffect->SetSampleRate = WestVerbSetSampleRate;
 	DSPEffect->NumParameters = WESTVERB_NUM_PARAMS;
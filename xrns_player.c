@@ -38,7 +38,23 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 #include <math.h>
+#include <emmintrin.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 #include "xrns_player.h"
 
@@ -46,6 +62,7 @@
  */
 #include "effects/dsp.c"
 #include "effects/westverb.c"
+#include "effects/send_device.c"
 
 /* Used for decoding FLAC instrument samples.
  * https://miniaud.io/index.html
@@ -85,8 +102,31 @@
  */
 #define XRNS_ACTIVE_SAMPLER_COUNT      (128)
 
+/* Stems registered with xrns_register_stem(), each is a bitmask over the tracks.
+ */
+#define XRNS_MAX_STEMS                 (16)
+#define XRNS_TRACK_MASK_WORDS          ((XRNS_MAX_NUM_TRACKS + 63) / 64)
+
 #define XRNS_XFADE_MS                  (1)
 
+/* The engine renders in spans of frames between events (ticks, lines, delayed notes), this is the 
+ * longest span and so the size of the per-track span buffers.
+ */
+#define XRNS_MAX_SPAN_FRAMES           (256)
+
+/* Worker threads, used for decoding samples while loading and for rendering tracks in parallel. Spans
+ * shorter than XRNS_MIN_PARALLEL_SPAN_FRAMES aren't worth waking the workers up for.
+ */
+#define XRNS_WORKER_THREADS            (8)
+#define XRNS_MIN_PARALLEL_SPAN_FRAMES  (64)
+
+/* Instrument modulation envelopes are evaluated once every this many frames and ramped 
+ * linearly in between. Define it before including to trade accuracy for speed.
+ */
+#ifndef XRNS_ENVELOPE_CONTROL_FRAMES
+#define XRNS_ENVELOPE_CONTROL_FRAMES   (32)
+#endif
+
 #define XRNS_NOTE_BLANK                (0xFF)
 #define XRNS_NOTE_OFF                  (0xFE)
 #define XRNS_NOTE_EFFECT               (0xFD)
@@ -96,6 +136,7 @@
 
 #define XRNS_EFFECT_FILTER             (0)
 #define XRNS_EFFECT_REVERB             (1)
+#define XRNS_EFFECT_SEND               (2)
 
 #define XRNS_STORED_EFFECT_DU          (0)
 #define XRNS_STORED_EFFECT_IO          (1)
@@ -110,6 +151,27 @@
 #define XRNS_INTERPOLATION_NONE        (0)
 #define XRNS_INTERPOLATION_LINEAR      (1)
 #define XRNS_INTERPOLATION_CUBIC       (2)
+#define XRNS_INTERPOLATION_SINC        (3)
+
+/* Cubic and sinc interpolation use tables of filter taps, one row per fractional phase, with 
+ * linear interpolation between neighbouring rows.
+ */
+#define XRNS_CUBIC_TAPS                (4)
+#define XRNS_SINC_TAPS                 (16)
+#define XRNS_INTERPOLATION_PHASES      (256)
+
+/* Decoded PCM has this many frames of silence on either side of it, so that a kernel whose taps 
+ * hang off either end of a sample can read them straight out of the buffer.
+ */
+#define XRNS_PCM_GUARD_FRAMES          (XRNS_SINC_TAPS)
+
+/* Renoise's -6dB of output headroom, along with the int16 to float scale. Samples loaded with 
+ * XRNS_LOAD_FLOAT_SAMPLES have this applied up front.
+ */
+#define XRNS_OUTPUT_GAIN               (0.5011872336272722f * (3.0517578125e-5f))
+
+/* +3dB, the gain of a hard panned channel. */
+#define XRNS_PAN_LAW_GAIN              (1.4125375446227544f)
             
 #define XRNS_LOOP_MODE_OFF             (0)
 #define XRNS_LOOP_MODE_FORWARD         (1)
@@ -131,6 +193,22 @@
 #define XRNS_ENVELOPE_UNITS_MS         (1)
 #define XRNS_ENVELOPE_UNITS_LINES      (2)
 
+/* Longest table an envelope curve is baked into, see BakeEnvelope(). */
+#define XRNS_ENVELOPE_TABLE_MAX_LENGTH (4096)
+
+/* Track automation is read once every XRNS_AUTOMATION_CONTROL_FRAMES frames, and an effect parameter 
+ * is only set when the automated value has moved by more than XRNS_AUTOMATION_THRESHOLD.
+ */
+#define XRNS_AUTOMATION_CONTROL_FRAMES (32)
+#define XRNS_AUTOMATION_THRESHOLD      (1.0f / 65536.0f)
+
+/* -100dB, quieter than this going into and coming out of a track's effects counts as silence. A track's 
+ * effect chain only goes to sleep once its output has been silent for XRNS_EFFECT_SLEEP_SECONDS, which is
+ * well past anything still sitting in a delay line (WestVerb's early reflections are at most 100ms out).
+ */
+#define XRNS_SILENCE_THRESHOLD         (1.0e-5f)
+#define XRNS_EFFECT_SLEEP_SECONDS      (1.0)
+
 #define XRNS_MODULATION_TARGET_VOLUME  (0)
 #define XRNS_MODULATION_TARGET_PANNING (1)
 #define XRNS_MODULATION_TARGET_PITCH   (2)
@@ -174,9 +252,32 @@
 #define Megabytes(_amount) (Kilobytes(_amount) * 1024L)
 #define Gigabytes(_amount) (Megabytes(_amount) * 1024L)
 
+static inline int LowestSetBit(unsigned int Mask)
+{
+#if defined(_MSC_VER)
+    unsigned long Index;
+    _BitScanForward(&Index, Mask);
+    return (int) Index;
+#else
+    return __builtin_ctz(Mask);
+#endif
+}
+
+static inline int LowestSetBit64(uint64_t Mask)
+{
+#if defined(_MSC_VER)
+    unsigned long Index;
+    _BitScanForward64(&Index, Mask);
+    return (int) Index;
+#else
+    return __builtin_ctzll(Mask);
+#endif
+}
+
 #define XRNS_TAGS XRNS_KERNAL(AliasPatternIndex)\
 XRNS_KERNAL(AudioPluginDevice)\
 XRNS_KERNAL(Automations)\
+XRNS_KERNAL(DestSendTrack)\
 XRNS_KERNAL(Envelope)\
 XRNS_KERNAL(Envelopes)\
 XRNS_KERNAL(FilterDevices)\
@@ -198,6 +299,7 @@ XRNS_KERNAL(Pattern)\
 XRNS_KERNAL(PatternGroupTrack)\
 XRNS_KERNAL(PatternMasterTrack)\
 XRNS_KERNAL(Patterns)\
+XRNS_KERNAL(PatternSendTrack)\
 XRNS_KERNAL(PatternSequence)\
 XRNS_KERNAL(PatternTrack)\
 XRNS_KERNAL(PhraseGenerator)\
@@ -210,12 +312,17 @@ XRNS_KERNAL(SampleEnvelopeModulationDevice)\
 XRNS_KERNAL(SampleEnvelopes)\
 XRNS_KERNAL(Samples)\
 XRNS_KERNAL(SampleSplitMap)\
+XRNS_KERNAL(SendAmount)\
+XRNS_KERNAL(SendDevice)\
+XRNS_KERNAL(SendPan)\
+XRNS_KERNAL(SendTrackMixerDevice)\
 XRNS_KERNAL(SequenceEntries)\
 XRNS_KERNAL(SequenceEntry)\
 XRNS_KERNAL(SequencerGroupTrack)\
 XRNS_KERNAL(SequencerMasterTrack)\
 XRNS_KERNAL(SequencerMasterTrackDevice)\
 XRNS_KERNAL(SequencerSendTrack)\
+XRNS_KERNAL(SequencerSendTrackDevice)\
 XRNS_KERNAL(SequencerTrack)\
 XRNS_KERNAL(SequencerTrackDevice)\
 XRNS_KERNAL(SliceMarker)\
@@ -225,22 +332,6 @@ XRNS_KERNAL(TrackMixerDevice)\
 XRNS_KERNAL(Tracks)\
 XRNS_KERNAL(Volume)
 
-#define XRNS_SUBSET_TAGS XRNS_KERNAL(Instruments)\
-XRNS_KERNAL(Sample)\
-XRNS_KERNAL(Samples)\
-XRNS_KERNAL(PhraseGenerator)\
-XRNS_KERNAL(ModulationSet)\
-XRNS_KERNAL(SliceMarkers)\
-XRNS_KERNAL(GlobalProperties)\
-XRNS_KERNAL(Instruments)\
-XRNS_KERNAL(Patterns)\
-XRNS_KERNAL(Automations)\
-XRNS_KERNAL(Envelopes)\
-XRNS_KERNAL(Envelope)\
-XRNS_KERNAL(SequenceEntries)\
-XRNS_KERNAL(FilterDevices)\
-XRNS_KERNAL(Tracks)
-
 #define XRNS_TRACK_TAGS XRNS_KERNAL(SequencerSendTrack)\
 XRNS_KERNAL(SequencerMasterTrack)\
 XRNS_KERNAL(SequencerGroupTrack)\
@@ -249,6 +340,8 @@ XRNS_KERNAL(MasterTrackMixerDevice)\
 XRNS_KERNAL(SequencerMasterTrackDevice)\
 XRNS_KERNAL(SequencerTrackDevice)\
 XRNS_KERNAL(GroupTrackMixerDevice)\
+XRNS_KERNAL(SendTrackMixerDevice)\
+XRNS_KERNAL(SequencerSendTrackDevice)\
 XRNS_KERNAL(Volume)\
 XRNS_KERNAL(PostVolume)\
 XRNS_KERNAL(Surround)\
@@ -256,6 +349,10 @@ XRNS_KERNAL(Panning)\
 XRNS_KERNAL(PostPanning)\
 XRNS_KERNAL(FilterDevices)\
 XRNS_KERNAL(AudioPluginDevice)\
+XRNS_KERNAL(SendDevice)\
+XRNS_KERNAL(SendAmount)\
+XRNS_KERNAL(SendPan)\
+XRNS_KERNAL(DestSendTrack)\
 XRNS_KERNAL(IsActive)\
 XRNS_KERNAL(Parameters)\
 XRNS_KERNAL(Parameter)
@@ -287,12 +384,14 @@ XRNS_KERNAL(Pattern)\
 XRNS_KERNAL(PatternTrack)\
 XRNS_KERNAL(PatternMasterTrack)\
 XRNS_KERNAL(PatternGroupTrack)\
+XRNS_KERNAL(PatternSendTrack)\
 XRNS_KERNAL(AliasPatternIndex)\
 XRNS_KERNAL(Tracks)\
 XRNS_KERNAL(Patterns)\
 XRNS_KERNAL(SequencerGroupTrack)\
 XRNS_KERNAL(SequencerTrack)\
 XRNS_KERNAL(SequencerMasterTrack)\
+XRNS_KERNAL(SequencerSendTrack)\
 XRNS_KERNAL(PatternSequence)\
 XRNS_KERNAL(SequenceEntries)\
 XRNS_KERNAL(SequenceEntry)\
@@ -301,6 +400,29 @@ XRNS_KERNAL(Envelopes)\
 XRNS_KERNAL(Envelope)\
 XRNS_KERNAL(MutedTracks)
 
+/* Tags that are only ever matched, and don't get an entry in xrns_tag_set. */
+#define XRNS_VALUE_TAGS XRNS_KERNAL(Artist)\
+XRNS_KERNAL(BeatsPerMin)\
+XRNS_KERNAL(Delay)\
+XRNS_KERNAL(EffectColumn)\
+XRNS_KERNAL(EffectNumber)\
+XRNS_KERNAL(EffectValue)\
+XRNS_KERNAL(IsSectionStart)\
+XRNS_KERNAL(Lines)\
+XRNS_KERNAL(LinesPerBeat)\
+XRNS_KERNAL(MutedTrack)\
+XRNS_KERNAL(MuteSource)\
+XRNS_KERNAL(Name)\
+XRNS_KERNAL(Note)\
+XRNS_KERNAL(NoteColumn)\
+XRNS_KERNAL(Number)\
+XRNS_KERNAL(NumberOfLines)\
+XRNS_KERNAL(SamplePosition)\
+XRNS_KERNAL(SectionName)\
+XRNS_KERNAL(SongName)\
+XRNS_KERNAL(TicksPerLine)\
+XRNS_KERNAL(Value)
+
 /* ====================================================================================================================
  * ====================================================================================================================
  * ====================================================================================================================
@@ -369,12 +491,86 @@ typedef struct
 void xml_init(xml_ctx *g, char *xml)
 {
     int i;
-    for (i = 0; i < sizeof(xml); i++)
+    for (i = 0; i < sizeof(xml_ctx); i++)
         ((char *)g)[i] = 0;
 
     g->xml = xml;
 }
 
+/* The tokenizer skips over everything that can't change its state 16 characters at a time, looking for the 
+ * next structural character with SSE2. No load ever straddles a page, which is what makes reading past the 
+ * '\0' at the end of the document safe. Nearly all of the runs it skips are a handful of characters long, 
+ * which is why this doesn't go to 32 with AVX2; that measured slower.
+ */
+#define XML_SCAN_WIDTH          (16)
+#define XML_SCAN_PAGE_SIZE      (4096)
+
+#define XML_SCAN_CHAR           (0) /* the given character */
+#define XML_SCAN_NAME_END       (1) /* the end of an element name */
+#define XML_SCAN_ATTRIBUTE      (2) /* anything that matters once an attribute has been started */
+
+static inline unsigned int xml_scan_block(__m128i v, int Kind, char c)
+{
+    __m128i Match = _mm_cmpeq_epi8(v, _mm_setzero_si128());
+
+    switch (Kind)
+    {
+        case XML_SCAN_CHAR:
+        {
+            Match = _mm_or_si128(Match, _mm_cmpeq_epi8(v, _mm_set1_epi8(c)));
+            break;
+        }
+        case XML_SCAN_NAME_END:
+        {
+            Match = _mm_or_si128(Match, _mm_cmpeq_epi8(v, _mm_set1_epi8(' ')));
+            Match = _mm_or_si128(Match, _mm_cmpeq_epi8(v, _mm_set1_epi8('/')));
+            Match = _mm_or_si128(Match, _mm_cmpeq_epi8(v, _mm_set1_epi8('>')));
+            break;
+        }
+        case XML_SCAN_ATTRIBUTE:
+        {
+            Match = _mm_or_si128(Match, _mm_cmpeq_epi8(v, _mm_set1_epi8(' ')));
+            Match = _mm_or_si128(Match, _mm_cmpeq_epi8(v, _mm_set1_epi8('=')));
+            Match = _mm_or_si128(Match, _mm_cmpeq_epi8(v, _mm_set1_epi8('"')));
+            Match = _mm_or_si128(Match, _mm_cmpeq_epi8(v, _mm_set1_epi8('\'')));
+            Match = _mm_or_si128(Match, _mm_cmpeq_epi8(v, _mm_set1_epi8('<')));
+            Match = _mm_or_si128(Match, _mm_cmpeq_epi8(v, _mm_set1_epi8('>')));
+            break;
+        }
+    }
+
+    return (unsigned int) _mm_movemask_epi8(Match);
+}
+
+/* Returns the first character at or after p that Kind is looking for, or the '\0' at the end.
+ */
+static inline char *xml_scan(char *p, int Kind, char c)
+{
+    char         *Block;
+    unsigned int  Mask;
+
+    /* Names and values are short, so the first block starts at p whenever that stays within the page. 
+     * Starting from the aligned block before p instead would send a lot of them into a second block.
+     */
+    if (((uintptr_t) p & (XML_SCAN_PAGE_SIZE - 1)) <= XML_SCAN_PAGE_SIZE - XML_SCAN_WIDTH)
+    {
+        Mask = xml_scan_block(_mm_loadu_si128((const __m128i *) p), Kind, c);
+        if (Mask) return p + LowestSetBit(Mask);
+    }
+
+    Block = (char *)((uintptr_t) p & ~(uintptr_t)(XML_SCAN_WIDTH - 1));
+    Mask  = xml_scan_block(_mm_load_si128((const __m128i *) Block), Kind, c) >> (p - Block);
+
+    while (!Mask)
+    {
+        Block += XML_SCAN_WIDTH;
+        Mask   = xml_scan_block(_mm_load_si128((const __m128i *) Block), Kind, c);
+        p      = Block;
+    }
+
+    return p + LowestSetBit(Mask);
+}
+
 xml_res xml_parse_one_char(xml_ctx *g)
 {
     char *xmlptr = g->xml;
@@ -389,29 +585,46 @@ xml_res xml_parse_one_char(xml_ctx *g)
         {
             case '\0':
             {
+                /* Stays on the '\0', so that every call after this one is EOF as well. */
                 g->r.event_type = XML_EVENT_EOF;
-                goto xmlexit;           
+                goto stupid;
             }
             case '<':
             {
                 g->stack = xmlptr + 1;
 
-                if (xmlptr[1] == '?' || xmlptr[1] == '!') {xmlptr = strstr(xmlptr, ">"); goto xmlexit;}
+                if (xmlptr[1] == '?' || xmlptr[1] == '!')
+                {
+                    xmlptr = xml_scan(xmlptr, XML_SCAN_CHAR, '>');
+                    if (!*xmlptr) goto stupid;
+                    goto xmlexit;
+                }
                 if (xmlptr[1] == '/')
                 {
-                    xmlptr = strstr(xmlptr, ">");
-                    goto stupid;
+                    xmlptr = xml_scan(xmlptr, XML_SCAN_CHAR, '>');
+                    if (!*xmlptr) goto stupid;
+                    goto tag_close;
                 }
 
-                while (xmlptr[1] != ' ' && xmlptr[1] != '/' && xmlptr[1] != '>')
-                    xmlptr++;
+                /* Leaves xmlptr on the last character of the name. */
+                xmlptr = xml_scan(xmlptr + 1, XML_SCAN_NAME_END, 0) - 1;
 
                 g->b_parsing_attribute  = 0;
                 g->attribute_side       = 0;
 
+                /* Most tags have no attributes, so go straight to the '>' rather than around the loop. */
+                if (xmlptr[1] == '>')
+                {
+                    xmlptr++;
+                    goto tag_close;
+                }
+
                 break;
             }
             case '>':
+                /* One that comes before the first '<' doesn't close anything. */
+                if (!g->stack) break;
+            tag_close:
             {
                 if (xmlptr[-1] == '/')
                 {
@@ -437,12 +650,11 @@ xml_res xml_parse_one_char(xml_ctx *g)
 
                 g->b_parsing_attribute = 0;
 
-                xmlptr = strstr(xmlptr, "<");
+                xmlptr = xml_scan(xmlptr, XML_SCAN_CHAR, '<');
 
-                if (!xmlptr)
+                if (!*xmlptr)
                 {
                     g->r.event_type = XML_EVENT_EOF;
-                    goto xmlexit;
                 }
 
                 goto stupid;
@@ -487,10 +699,16 @@ xml_res xml_parse_one_char(xml_ctx *g)
                     g->r.event_type = XML_EVENT_ELEMENT_START;
                     g->r.name       = g->stack;
                 }
-                else if (!g->b_parsing_attribute)
+                else
                 {
-                    g->b_parsing_attribute = 1;
-                    g->attribute           = xmlptr;
+                    if (!g->b_parsing_attribute)
+                    {
+                        g->b_parsing_attribute = 1;
+                        g->attribute           = xmlptr;
+                    }
+
+                    /* Nothing before the next structural character can change the state now. */
+                    xmlptr = xml_scan(xmlptr + 1, XML_SCAN_ATTRIBUTE, 0) - 1;
                 }
                 break;
             }
@@ -552,6 +770,16 @@ void *galloc(galloc_ctx *g, size_t Bytes)
     return OutPtr;
 }
 
+/* What is left of the arena, 0 once it has been overrun. Anything whose size depends on the song has to
+ * be checked against this before it is allocated, galloc() can't stop a single allocation from running
+ * off the end.
+ */
+size_t galloc_bytes_left(galloc_ctx *g)
+{
+    size_t Used = g->CurrentAddress - g->BaseAddress;
+    return (Used < g->MaximumSizeBytes) ? g->MaximumSizeBytes - Used : 0;
+}
+
 void *galloc_aligned(galloc_ctx *g, size_t Bytes, int AlignmentBytes)
 {
     char *OutPtr;
@@ -608,6 +836,98 @@ void xrns_growing_buffer_free(xrns_growing_buffer *Buf)
     free(Buf->Memory);
 }
 
+/* Scratch memory for building something whose size isn't known until it's built, freed all at once. It is
+ * a chain of blocks, each twice the size of the last, so nothing in it moves. Arrays in it grow by being
+ * copied to the next power of two up, which xrns_scratch_grow() works out from their length, so an array
+ * has to have been grown from nothing by it.
+ */
+#define XRNS_SCRATCH_MIN_ARRAY         (4)
+
+typedef struct
+{
+    char   *Current;
+    char   *End;
+    void   *Blocks;      /* the newest, each one starts with a pointer to the one before it */
+    size_t  BlockBytes;
+} xrns_scratch;
+
+void xrns_scratch_init(xrns_scratch *s, size_t Bytes)
+{
+    s->Current    = NULL;
+    s->End        = NULL;
+    s->Blocks     = NULL;
+    s->BlockBytes = (Bytes > Kilobytes(1)) ? Bytes : Kilobytes(1);
+}
+
+void *xrns_scratch_alloc(xrns_scratch *s, size_t Bytes)
+{
+    Bytes = (Bytes + 7) & ~(size_t) 7;
+
+    if ((size_t)(s->End - s->Current) < Bytes)
+    {
+        if (s->Blocks) s->BlockBytes *= 2;
+        while (s->BlockBytes < Bytes + sizeof(void *)) s->BlockBytes *= 2;
+
+        void **Block = malloc(s->BlockBytes);
+        Block[0]     = s->Blocks;
+        s->Blocks    = Block;
+        s->Current   = (char *)(Block + 1);
+        s->End       = (char *) Block + s->BlockBytes;
+    }
+
+    char *OutPtr = s->Current;
+    s->Current  += Bytes;
+    return OutPtr;
+}
+
+static inline unsigned int xrns_scratch_capacity(unsigned int Length)
+{
+    unsigned int Capacity = XRNS_SCRATCH_MIN_ARRAY;
+
+    if (!Length) return 0;
+    while (Capacity < Length) Capacity *= 2;
+    return Capacity;
+}
+
+/* Takes an array of Length elements to NewLength, zeroing the new ones, and returns where it is now. */
+void *xrns_scratch_grow(xrns_scratch *s, void *Array, unsigned int Length, unsigned int NewLength, size_t ElementBytes)
+{
+    if (NewLength <= Length) return Array;
+
+    if (xrns_scratch_capacity(NewLength) != xrns_scratch_capacity(Length))
+    {
+        void *Grown = xrns_scratch_alloc(s, xrns_scratch_capacity(NewLength) * ElementBytes);
+        if (Length) memcpy(Grown, Array, Length * ElementBytes);
+        Array = Grown;
+    }
+
+    memset((char *) Array + Length * ElementBytes, 0, (NewLength - Length) * ElementBytes);
+    return Array;
+}
+
+/* The next element of _array, which has _length of them. */
+#define XRNS_SCRATCH_APPEND(_s, _array, _length) \
+    ((_array) = xrns_scratch_grow((_s), (_array), (_length), (_length) + 1, sizeof(*(_array))), \
+     &(_array)[(_length)++])
+
+/* Element _idx of _array, which has _length of them, growing it if it isn't there yet. */
+#define XRNS_SCRATCH_SLOT(_s, _array, _length, _idx) \
+    (((_idx) < (_length)) \
+        ? &(_array)[_idx] \
+        : ((_array) = xrns_scratch_grow((_s), (_array), (_length), (_idx) + 1, sizeof(*(_array))), \
+           (_length) = (_idx) + 1, \
+           &(_array)[_idx]))
+
+void xrns_scratch_free(xrns_scratch *s)
+{
+    while (s->Blocks)
+    {
+        void *Prev = *(void **) s->Blocks;
+        free(s->Blocks);
+        s->Blocks = Prev;
+    }
+}
+
 int MatchCharsToString(char *Chars, char *String)
 {
     int i;
@@ -624,6 +944,9 @@ int MatchCharsToString(char *Chars, char *String)
     return 1;    
 }
 
+/* Stereo interleaved frames. The size is a power of two, so positions wrap with RingBufferMask, and
+ * pushes and reads are at most two copies, one up to the end of the buffer and one from the start.
+ */
 typedef struct
 {
     float       *OutputRingBuffer;
@@ -631,11 +954,13 @@ typedef struct
     int          RingBufferWritePtr;
     int          RingBufferFreeSamples;
     int          RingBufferSz;
+    int          RingBufferMask;
 } xrns_ringbuffer;
 
 void InitRingBuffer(xrns_ringbuffer *Ringbuffer)
 {
     Ringbuffer->RingBufferSz          = 1<<13;
+    Ringbuffer->RingBufferMask        = Ringbuffer->RingBufferSz - 1;
     Ringbuffer->RingBufferWritePtr    = 0;
     Ringbuffer->RingBufferReadPtr     = 0;
     Ringbuffer->RingBufferFreeSamples = Ringbuffer->RingBufferSz;
@@ -647,22 +972,93 @@ void FreeRingBuffer(xrns_ringbuffer *Ringbuffer)
     free(Ringbuffer->OutputRingBuffer);
 }
 
+int RingBufferAvailableSamples(xrns_ringbuffer *Ringbuffer)
+{
+    return Ringbuffer->RingBufferSz - Ringbuffer->RingBufferFreeSamples;
+}
+
 void PushRingBuffer(xrns_ringbuffer *Ringbuffer, float *Samples, unsigned int NumSamples)
 {   
-    int i = 0;
-    while (i < NumSamples)
+    unsigned int First = Ringbuffer->RingBufferSz - Ringbuffer->RingBufferWritePtr;
+    if (First > NumSamples) First = NumSamples;
+
+    memcpy(&Ringbuffer->OutputRingBuffer[2 * Ringbuffer->RingBufferWritePtr], Samples, First * 2 * sizeof(float));
+    memcpy(Ringbuffer->OutputRingBuffer, Samples + 2 * First, (NumSamples - First) * 2 * sizeof(float));
+
+    Ringbuffer->RingBufferWritePtr     = (Ringbuffer->RingBufferWritePtr + NumSamples) & Ringbuffer->RingBufferMask;
+    Ringbuffer->RingBufferFreeSamples -= NumSamples;
+}
+
+void PushRingBufferSilence(xrns_ringbuffer *Ringbuffer, unsigned int NumSamples)
+{   
+    unsigned int First = Ringbuffer->RingBufferSz - Ringbuffer->RingBufferWritePtr;
+    if (First > NumSamples) First = NumSamples;
+
+    memset(&Ringbuffer->OutputRingBuffer[2 * Ringbuffer->RingBufferWritePtr], 0, First * 2 * sizeof(float));
+    memset(Ringbuffer->OutputRingBuffer, 0, (NumSamples - First) * 2 * sizeof(float));
+
+    Ringbuffer->RingBufferWritePtr     = (Ringbuffer->RingBufferWritePtr + NumSamples) & Ringbuffer->RingBufferMask;
+    Ringbuffer->RingBufferFreeSamples -= NumSamples;
+}
+
+void PushRingBufferPlanar(xrns_ringbuffer *Ringbuffer, float *Left, float *Right, unsigned int NumSamples)
+{   
+    unsigned int First = Ringbuffer->RingBufferSz - Ringbuffer->RingBufferWritePtr;
+    if (First > NumSamples) First = NumSamples;
+
+    float *Dest = &Ringbuffer->OutputRingBuffer[2 * Ringbuffer->RingBufferWritePtr];
+    for (unsigned int i = 0; i < First; i++)
+    {
+        Dest[2*i + 0] = Left[i];
+        Dest[2*i + 1] = Right[i];
+    }
+
+    Dest = Ringbuffer->OutputRingBuffer;
+    for (unsigned int i = First; i < NumSamples; i++)
     {
-        float *p_track_samples = &Ringbuffer->OutputRingBuffer[2 * Ringbuffer->RingBufferWritePtr];
+        Dest[2*(i - First) + 0] = Left[i];
+        Dest[2*(i - First) + 1] = Right[i];
+    }
+
+    Ringbuffer->RingBufferWritePtr     = (Ringbuffer->RingBufferWritePtr + NumSamples) & Ringbuffer->RingBufferMask;
+    Ringbuffer->RingBufferFreeSamples -= NumSamples;
+}
+
+/* Copies the oldest NumSamples frames out without consuming them. */
+void PeekRingBuffer(xrns_ringbuffer *Ringbuffer, float *Samples, unsigned int NumSamples)
+{
+    unsigned int First = Ringbuffer->RingBufferSz - Ringbuffer->RingBufferReadPtr;
+    if (First > NumSamples) First = NumSamples;
+
+    memcpy(Samples, &Ringbuffer->OutputRingBuffer[2 * Ringbuffer->RingBufferReadPtr], First * 2 * sizeof(float));
+    memcpy(Samples + 2 * First, Ringbuffer->OutputRingBuffer, (NumSamples - First) * 2 * sizeof(float));
+}
+
+/* Sums the oldest NumSamples frames into Samples without consuming them. */
+void AccumulateRingBuffer(xrns_ringbuffer *Ringbuffer, float *Samples, unsigned int NumSamples)
+{
+    unsigned int First = Ringbuffer->RingBufferSz - Ringbuffer->RingBufferReadPtr;
+    if (First > NumSamples) First = NumSamples;
 
-        p_track_samples[0] = Samples[2*i + 0];
-        p_track_samples[1] = Samples[2*i + 1];
+    const float *Src = &Ringbuffer->OutputRingBuffer[2 * Ringbuffer->RingBufferReadPtr];
+    for (unsigned int i = 0; i < 2 * First; i++)
+    {
+        Samples[i] += Src[i];
+    }
 
-        Ringbuffer->RingBufferWritePtr = (Ringbuffer->RingBufferWritePtr + 1) % Ringbuffer->RingBufferSz;
-        Ringbuffer->RingBufferFreeSamples--;
-        i++;
+    Src = Ringbuffer->OutputRingBuffer;
+    for (unsigned int i = 2 * First; i < 2 * NumSamples; i++)
+    {
+        Samples[i] += Src[i - 2 * First];
     }
 }
 
+void ConsumeRingBuffer(xrns_ringbuffer *Ringbuffer, unsigned int NumSamples)
+{
+    Ringbuffer->RingBufferReadPtr      = (Ringbuffer->RingBufferReadPtr + NumSamples) & Ringbuffer->RingBufferMask;
+    Ringbuffer->RingBufferFreeSamples += NumSamples;
+}
+
 /* ====================================================================================================================
  * ====================================================================================================================
  * ====================================================================================================================
@@ -848,12 +1244,13 @@ uint8_t *unzip_single_file(uint8_t *DeflateStream, uint8_t *Dest, mz_ulong *Comp
 
 uint8_t *unzip_single_file_allocate(uint8_t *p_deflate_stream, mz_ulong *compressed_size, mz_ulong *uncompressed_size)
 {
-    void *p_out_mem = malloc(*uncompressed_size);
+    /* One byte more than the file, so that it can be NUL terminated in place. */
+    void *p_out_mem = malloc(*uncompressed_size + 1);
     if (MZ_OK != mz_uncompress_skip_header(p_out_mem, uncompressed_size, p_deflate_stream, *compressed_size))
     {
         return NULL;
     }
-    p_out_mem = realloc(p_out_mem, *uncompressed_size);
+    p_out_mem = realloc(p_out_mem, *uncompressed_size + 1);
     return p_out_mem;
 }
 
@@ -1133,6 +1530,119 @@ static void *xrns_read_entire_file(char *p_filename, long *p_file_size)
     return file_mem;
 }
 
+/* A song mapped straight from disk. The mapping is copy-on-write, so the stored FLAC entries are
+ * decoded out of the page cache and no copy of the archive is made, while anything that writes into
+ * the buffer only gets private copies of the pages it touches.
+ */
+typedef struct
+{
+    void *p_mem;
+    long  file_size;
+    int   b_mapped;
+#if defined(_WIN32)
+    HANDLE File;
+    HANDLE Mapping;
+#endif
+} xrns_mapped_file;
+
+/* The readers expect some slack past the end of the archive (xrns_read_entire_file() pads by 32 bytes),
+ * which a mapping only has when the file doesn't end near a page boundary. Otherwise this falls back
+ * to reading the whole file.
+ */
+#define XRNS_MAPPED_FILE_SLACK (32)
+
+static int xrns_map_entire_file(char *p_filename, xrns_mapped_file *m)
+{
+    TracyCZoneN(ctx, "Map Entire File", 1);
+
+    memset(m, 0, sizeof(xrns_mapped_file));
+
+#if defined(_WIN32)
+    SYSTEM_INFO SystemInfo;
+    LARGE_INTEGER Size;
+
+    GetSystemInfo(&SystemInfo);
+
+    m->File = CreateFileA
+        (p_filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+
+    if (m->File != INVALID_HANDLE_VALUE && GetFileSizeEx(m->File, &Size) && Size.QuadPart > 0 && Size.QuadPart < LONG_MAX)
+    {
+        long page_size = SystemInfo.dwPageSize;
+        long tail      = (long) (Size.QuadPart & (page_size - 1));
+
+        if (tail && page_size - tail >= XRNS_MAPPED_FILE_SLACK)
+        {
+            m->Mapping = CreateFileMappingA(m->File, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+            if (m->Mapping) m->p_mem = MapViewOfFile(m->Mapping, FILE_MAP_COPY, 0, 0, 0);
+            m->file_size = (long) Size.QuadPart;
+        }
+    }
+
+    if (!m->p_mem)
+    {
+        if (m->Mapping) CloseHandle(m->Mapping);
+        if (m->File != INVALID_HANDLE_VALUE) CloseHandle(m->File);
+        m->Mapping = NULL;
+        m->File    = INVALID_HANDLE_VALUE;
+    }
+#else
+    struct stat st;
+    int fd = open(p_filename, O_RDONLY);
+
+    if (fd >= 0 && !fstat(fd, &st) && st.st_size > 0 && st.st_size < LONG_MAX)
+    {
+        long page_size = sysconf(_SC_PAGESIZE);
+        long tail      = (long) (st.st_size & (page_size - 1));
+
+        if (tail && page_size - tail >= XRNS_MAPPED_FILE_SLACK)
+        {
+            void *p = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+
+            if (p != MAP_FAILED)
+            {
+                madvise(p, st.st_size, MADV_SEQUENTIAL);
+                m->p_mem     = p;
+                m->file_size = (long) st.st_size;
+            }
+        }
+    }
+
+    if (fd >= 0) close(fd);
+#endif
+
+    m->b_mapped = (m->p_mem != NULL);
+
+    if (!m->b_mapped)
+    {
+        m->p_mem = xrns_read_entire_file(p_filename, &m->file_size);
+    }
+
+    TracyCZoneEnd(ctx);
+
+    return (m->p_mem != NULL);
+}
+
+static void xrns_unmap_entire_file(xrns_mapped_file *m)
+{
+    if (!m->b_mapped)
+    {
+        free(m->p_mem);
+    }
+    else
+    {
+#if defined(_WIN32)
+        UnmapViewOfFile(m->p_mem);
+        CloseHandle(m->Mapping);
+        CloseHandle(m->File);
+#else
+        munmap(m->p_mem, m->file_size);
+#endif
+    }
+
+    m->p_mem = NULL;
+}
+
 /* ====================================================================================================================
  * ====================================================================================================================
  * ====================================================================================================================
@@ -1140,22 +1650,6 @@ static void *xrns_read_entire_file(char *p_filename, long *p_file_size)
  * ====================================================================================================================
  */
 
-typedef struct 
-{
-    xrns_growing_buffer EnvelopesPerTrackPerPattern;
-    int          RenoiseVersion;
-    unsigned int NumTracks;
-    unsigned int NumInstruments;
-    unsigned int PatternSequenceLength;
-    unsigned int NumPatterns;
-    unsigned int NumSamplesPerInstrument[XRNS_MAX_NUM_INSTRUMENTS];
-    unsigned int NumSampleSplitMapsPerInstrument[XRNS_MAX_NUM_INSTRUMENTS];
-    unsigned int NumModulationSetsPerInstrument[XRNS_MAX_NUM_INSTRUMENTS];
-    unsigned int NumSliceRegionsPerInstrument[XRNS_MAX_NUM_INSTRUMENTS];
-    unsigned int NumEffectUnitsPerTrack[XRNS_MAX_NUM_TRACKS];
-    unsigned int NumEnvelopesPerTrack[XRNS_MAX_NUM_TRACKS];
-} xrns_file_counts;
-
 #pragma pack(push, 1)
 typedef struct
 {
@@ -1175,6 +1669,15 @@ typedef struct
 {
     int16_t     *PCM;
 
+    /* Only set when loaded with XRNS_LOAD_FLOAT_SAMPLES, PCM is NULL in that case. Planar, with the 
+     * right channel starting PlaneStride floats after the left. Mono samples have a PlaneStride of 0.
+     */
+    float       *PCMFloat;
+    int          PlaneStride;
+
+    /* What to free, the PCM sits between guard frames inside of it. */
+    void        *PCMAllocation;
+
     char        *Name;
     float        Volume;
     float        Panning;
@@ -1230,6 +1733,11 @@ typedef struct
     int           Polarity;
     int           DeviceIndex;
     int           ParameterIndex;
+
+    /* Baked at load time by BakeEnvelope(), NULL for envelopes that don't need it. */
+    float        *Table;
+    unsigned int  TableLength;
+    float         TableScale;
 } xrns_envelope;
 
 typedef struct
@@ -1238,6 +1746,12 @@ typedef struct
     int     Enabled;
     int     NumParameters;
     float   Parameters[32];
+
+    /* XRNS_EFFECT_SEND only. Which send track it goes to, counting the send tracks from 0, and whether
+     * the track's own audio stops at the send.
+     */
+    int     SendTrack;
+    int     bMuteSource;
 } dsp_effect_desc;
 
 typedef struct
@@ -1335,6 +1849,7 @@ typedef struct
     unsigned int     NumColumns;
     unsigned int     NumEffectColumns;
     char             bIsGroup;
+    char             bIsSend;
     unsigned int     WrapsNPreviousTracks;
     unsigned int     Depth;
     char            *Name;
@@ -1379,6 +1894,7 @@ typedef struct
     xrns_pattern_sequence_entry  *PatternSequence;
     unsigned int                  NumTracks;
     xrns_track_desc              *Tracks;
+    unsigned int                  MasterTrackIdx;
     unsigned int                  TotalColumns;
 } xrns_document;
 
@@ -1420,12 +1936,40 @@ typedef struct
     int              bActive;
 } pooled_threads_ctx;
 
+/* Song.xml is parsed in one pass. AddSongXMLJobs() reads the document itself, skipping over the <Instruments>,
+ * the <Tracks>, each <Pattern> and the <PatternSequence>, and each of those becomes a section that is parsed on 
+ * the pooled workers. A section builds what it parses in its own scratch memory, growing the arrays as it 
+ * goes, and leaves strings pointing into the XML. FinishSongXML() copies all of it into the document's galloc.
+ */
+#define XRNS_XML_SECTION_INSTRUMENTS   (0)
+#define XRNS_XML_SECTION_TRACKS        (1)
+#define XRNS_XML_SECTION_PATTERN       (2)
+#define XRNS_XML_SECTION_SEQUENCE      (3)
+
 typedef struct
 {
-    galloc_ctx    *g;
-    char          *xml;
-    size_t         xml_length;
+    int            Kind;
+    char          *Start;            /* the '<' of the element */
+    char          *End;              /* where the parser is once it has read the closing tag */
+    int            PatternIdx;
+    unsigned int   NumPatternTracks; /* how many Tracks the pattern has while it's in Scratch */
     xrns_document *xdoc;
+    xrns_scratch   Scratch;
+    int            bParsed;
+} xrns_xml_section;
+
+typedef struct
+{
+    galloc_ctx          *g;
+    char                *xml;
+    size_t               xml_length;
+    xrns_document       *xdoc;
+
+    /* Set up by AddSongXMLJobs(), and finished by FinishSongXML() once the jobs have run. */
+    char                 SavedTerminator;
+    int                  bParsed;    /* everything but the sections */
+    xrns_growing_buffer  Sections;
+    unsigned int         NumSections;
 } xrns_xml_parse_desc;
 
 typedef struct
@@ -1433,6 +1977,7 @@ typedef struct
     zip_entry      z;
     char           zipped_filename[2048];
     xrns_document *xdoc;
+    unsigned int   LoadFlags;
 } populate_instrument_desc;
 
 work_table *CreateWorkTable(int NumJobs)
@@ -1637,15 +2182,6 @@ int EffectTypeIdxFromEffectType(char *c)
     }
 }
 
-void ParsePointFromTriple(xrns_point *Point, char *XML)
-{   
-    Point->Pos = atoi(XML);
-    XML = strstr(XML, ",") + 1;
-    Point->Val = atof(XML);
-    XML = strstr(XML, ",") + 1;
-    Point->Bez = atof(XML);
-}
-
 void InitNote(xrns_note *Note)
 {
     Note->Type          = XRNS_NOTE_REAL;
@@ -1782,29 +2318,115 @@ unsigned int Parse2DigitEffectColumnOrDotsFromXML(char *XML)
     }
 }
 
-float ParseFloatFromXML(char *XML)
+/* The numbers in Song.xml are plain decimals, "-1" or "0.787401557", which are parsed here without going 
+ * through the C library. Anything else goes to atoi() or strtod(). A decimal of at most 15 significant 
+ * digits is exact as a double, and so is any power of ten up to 1e22, so dividing one by the other rounds 
+ * the same as strtod() does.
+ */
+static const double XRNSPowersOfTen[23] =
 {
-    return atof(XML);
-}
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
 
-int ParseIntegerFromXML(char *XML)
+double ParseDecimalFromXML(char *XML, char **End)
 {
-    return atoi(XML);
-}
+    char     *c         = XML;
+    int       bNegative = (*c == '-');
+    uint64_t  Mantissa  = 0;
+    int       Digits    = 0;    /* from the first non-zero one */
+    int       Places    = 0;
+    int       bDigits   = 0;
 
-int ParseIntegerOrDotsFromXML(char *XML)
-{
-    if (XML[0] == '.' && XML[1] == '.')
+    if (*c == '-' || *c == '+')
+        c++;
+
+    for (; *c >= '0' && *c <= '9'; c++)
     {
-        return XRNS_MISSING_VALUE;
+        Mantissa = Mantissa * 10 + (*c - '0');
+        Digits  += (Mantissa != 0);
+        bDigits  = 1;
     }
 
-    return atoi(XML);
-}
+    if (*c == '.')
+    {
+        for (c++; *c >= '0' && *c <= '9'; c++)
+        {
+            Mantissa = Mantissa * 10 + (*c - '0');
+            Digits  += (Mantissa != 0);
+            Places++;
+            bDigits  = 1;
+        }
+    }
 
-unsigned int XMLTagLength(char *xml)
-{
-    unsigned int len = 0;
+    /* Exponents, hex, inf and nan all carry on with a letter. */
+    if (   !bDigits 
+        || Digits > 15 
+        || Places > 22 
+        || (*c >= 'a' && *c <= 'z') 
+        || (*c >= 'A' && *c <= 'Z'))
+    {
+        return strtod(XML, End);
+    }
+
+    if (End) *End = c;
+
+    double Value = (double) Mantissa / XRNSPowersOfTen[Places];
+
+    return bNegative ? -Value : Value;
+}
+
+float ParseFloatFromXML(char *XML)
+{
+    return ParseDecimalFromXML(XML, NULL);
+}
+
+int ParseIntegerFromXML(char *XML)
+{
+    char *c         = XML;
+    int   bNegative = (*c == '-');
+    int   Value     = 0;
+    int   Digits    = 0;
+
+    if (*c == '-' || *c == '+')
+        c++;
+
+    /* Nine digits can't overflow. */
+    for (; *c >= '0' && *c <= '9' && Digits < 9; c++, Digits++)
+    {
+        Value = Value * 10 + (*c - '0');
+    }
+
+    if (!Digits || (*c >= '0' && *c <= '9'))
+        return atoi(XML);
+
+    return bNegative ? -Value : Value;
+}
+
+int ParseIntegerOrDotsFromXML(char *XML)
+{
+    if (XML[0] == '.' && XML[1] == '.')
+    {
+        return XRNS_MISSING_VALUE;
+    }
+
+    return ParseIntegerFromXML(XML);
+}
+
+void ParsePointFromTriple(xrns_point *Point, char *XML)
+{   
+    Point->Pos = ParseIntegerFromXML(XML);
+    XML = xml_scan(XML, XML_SCAN_CHAR, ',');
+    if (!*XML) return;
+    Point->Val = ParseDecimalFromXML(XML + 1, &XML);
+    XML = xml_scan(XML, XML_SCAN_CHAR, ',');
+    if (!*XML) return;
+    Point->Bez = ParseDecimalFromXML(XML + 1, NULL);
+}
+
+unsigned int XMLTagLength(char *xml)
+{
+    unsigned int len = 0;
     while (xml && *xml != '<')
         {xml++; len++;}
     return len;
@@ -1839,171 +2461,171 @@ typedef struct
 } xrns_tag_set;
 #undef XRNS_KERNAL 
 
-#define XRNS_KERNAL(_x) if (xmltagmatch(Tag, #_x))\
-{\
-    t->_x = BeginOtherwiseEnd;\
-    return;\
-}
-
-void UpdateXMLCountingTags(xrns_tag_set *t, char *Tag, int BeginOtherwiseEnd)
+/* Every tag in XRNS_TAGS and XRNS_VALUE_TAGS has an id, which is what the parsers compare against. The
+ * XRNS_TAGS come first, so their id is also the offset of their flag in xrns_tag_set. XMLTagId() looks a
+ * tag up by name in an open addressed hash table, which XRNSBuildTagTable() fills in once. The hash
+ * happens to be perfect for the tags as they are, adding one may cost a probe.
+ */
+#define XRNS_KERNAL(_x) XRNS_TAG_##_x,
+enum
 {
-    XRNS_SUBSET_TAGS
-}
+    XRNS_TAGS
+    XRNS_VALUE_TAGS
+    XRNS_TAG_COUNT
+};
+#undef XRNS_KERNAL
 
-void UpdateXMLTrackTags(xrns_tag_set *t, char *Tag, int BeginOtherwiseEnd)
-{
-    XRNS_TRACK_TAGS
-}
+#define XRNS_TAG_NONE                  (-1)
+#define XRNS_TAG_HASH_BITS             (8)
+#define XRNS_TAG_HASH_SIZE             (1 << XRNS_TAG_HASH_BITS)
+#define XRNS_TAG_HASH_FIRST            (0x6c7be37fu)
+#define XRNS_TAG_HASH_LAST             (0x42db5b4bu)
 
-void UpdateXMLTopLevelTags(xrns_tag_set *t, char *Tag, int BeginOtherwiseEnd)
-{
-    XRNS_TOPLEVEL_TAGS
-}
+#define XRNS_TAG_SUBSET_TRACK          (1 << 0)
+#define XRNS_TAG_SUBSET_TOPLEVEL       (1 << 1)
+#define XRNS_TAG_SUBSET_INSTRUMENT     (1 << 2)
 
-void UpdateXMLInstrumentTags(xrns_tag_set *t, char *Tag, int BeginOtherwiseEnd)
-{
-    XRNS_INSTRUMENT_TAGS
-}
+#define XRNS_KERNAL(_x) #_x,
+static const char *XRNSTagNames[XRNS_TAG_COUNT] = { XRNS_TAGS XRNS_VALUE_TAGS };
+#undef XRNS_KERNAL
 
+#define XRNS_KERNAL(_x) sizeof(#_x) - 1,
+static const unsigned char XRNSTagLengths[XRNS_TAG_COUNT] = { XRNS_TAGS XRNS_VALUE_TAGS };
 #undef XRNS_KERNAL
 
-void XRNSGetCounts(char *xml, size_t xml_length, xrns_file_counts *Counts)
-{
-    TracyCZoneN(ctx, "XRNS Get Counts", 1);
+/* Each slot holds a tag id plus 1, 0 is empty. */
+static unsigned char   XRNSTagTable[XRNS_TAG_HASH_SIZE];
+static unsigned char   XRNSTagSubsets[XRNS_TAG_COUNT];
+static volatile int    bXRNSTagTableBuilt = 0;
+static ma_spinlock     XRNSTagTableLock   = 0;
 
-    xml_ctx x;
-    xml_init(&x, xml);
+/* Hashes the first and last four characters of the name, and its length. */
+unsigned int XMLTagHash(char *Name, unsigned int Length)
+{
+    uint32_t First = 0;
+    uint32_t Last  = 0;
 
-    GZEROED(xrns_tag_set, t);
-    GZEROED(xml_res, r);
+    if (Length >= 4)
+    {
+        memcpy(&First, Name, 4);
+        memcpy(&Last, Name + Length - 4, 4);
+    }
+    else
+    {
+        memcpy(&First, Name, Length);
+        Last = First;
+    }
 
-    int bTracksCounted = 0;
-    int bCountedModulationDevice = 0;
+    return (First * XRNS_TAG_HASH_FIRST + (Last + Length) * XRNS_TAG_HASH_LAST) >> (32 - XRNS_TAG_HASH_BITS);
+}
 
-    int NumTrackEnvelopes = 0;
+void XRNSBuildTagTable(void)
+{
+    int i;
 
-    unsigned int xx = 0;
+    ma_spinlock_lock(&XRNSTagTableLock);
 
-    do
+    if (!bXRNSTagTableBuilt)
     {
-        r = xml_parse_one_char(&x);
-        if (r.event_type == XML_EVENT_ELEMENT_END)
+        for (i = 0; i < XRNS_TAG_COUNT; i++)
         {
-            if (t.Instruments && t.Samples && xmltagmatch(r.name, "Sample"))
-            {
-                Counts->NumSamplesPerInstrument[Counts->NumInstruments]++;
-            }
+            unsigned int Slot = XMLTagHash((char *) XRNSTagNames[i], XRNSTagLengths[i]);
 
-            if (Counts->RenoiseVersion == 3)
-            {
-                if (    t.Instruments 
-                    && !t.PhraseGenerator 
-                    && t.ModulationSet 
-                    && !bCountedModulationDevice 
-                    && xmltagmatch(r.name, "SampleEnvelopeModulationDevice"))
-                {
-                    Counts->NumModulationSetsPerInstrument[Counts->NumInstruments]++;
-                    bCountedModulationDevice = 1;
-                }
-            }
+            while (XRNSTagTable[Slot])
+                Slot = (Slot + 1) & (XRNS_TAG_HASH_SIZE - 1);
 
-            if (t.Instruments && t.SliceMarkers && !t.PhraseGenerator)
-            {
-                if (xmltagmatch(r.name, "SamplePosition"))
-                {
-                    Counts->NumSliceRegionsPerInstrument[Counts->NumInstruments]++;
-                }
-            }
+            XRNSTagTable[Slot] = (unsigned char)(i + 1);
+        }
 
-            if ((Counts->RenoiseVersion == 2 && (t.Instruments && !t.Samples && xmltagmatch(r.name, "NoteOnMapping")))
-                || (Counts->RenoiseVersion == 3 && (t.Sample && xmltagmatch(r.name, "Mapping") && !t.GlobalProperties)))
-            {
-                Counts->NumSampleSplitMapsPerInstrument[Counts->NumInstruments]++;
-            }
+#define XRNS_KERNAL(_x) XRNSTagSubsets[XRNS_TAG_##_x] |= XRNS_TAG_SUBSET_TRACK;
+        XRNS_TRACK_TAGS
+#undef XRNS_KERNAL
+#define XRNS_KERNAL(_x) XRNSTagSubsets[XRNS_TAG_##_x] |= XRNS_TAG_SUBSET_TOPLEVEL;
+        XRNS_TOPLEVEL_TAGS
+#undef XRNS_KERNAL
+#define XRNS_KERNAL(_x) XRNSTagSubsets[XRNS_TAG_##_x] |= XRNS_TAG_SUBSET_INSTRUMENT;
+        XRNS_INSTRUMENT_TAGS
+#undef XRNS_KERNAL
 
-            if (t.Instruments && xmltagmatch(r.name, "Instrument") && !t.PhraseGenerator)
-            {
-                Counts->NumInstruments++;
-            }
+        bXRNSTagTableBuilt = 1;
+    }
 
-            if (t.Patterns && xmltagmatch(r.name, "Pattern"))
-            {
-                Counts->NumPatterns++;
-                bTracksCounted = 1;
-            }
+    ma_spinlock_unlock(&XRNSTagTableLock);
+}
 
-            if (t.Automations && t.Envelopes)
-            {
-                if (xmltagmatch(r.name, "Envelope") && !t.Envelope)
-                {
-                    NumTrackEnvelopes++;
-                }
-            }
+/* The id of the tag whose name starts at Name, or XRNS_TAG_NONE. Matches the same names as xmltagmatch(),
+ * the name has to be followed by a ' ', '>' or '/'. Tag names are letters, digits and '_', which are all
+ * above '>' except the digits, so that's where the name stops.
+ */
+int XMLTagId(char *Name)
+{
+    unsigned int  Length = 0;
+    unsigned char c;
 
-            if (t.SequenceEntries && xmltagmatch(r.name, "SequenceEntry"))
-            {
-                Counts->PatternSequenceLength++;
-            }
+    while ((c = (unsigned char) Name[Length]) > '>' || (c >= '0' && c <= '9'))
+    {
+        Length++;
+    }
 
-            if (t.FilterDevices && xmltagmatch(r.name, "AudioPluginDevice") && !t.PhraseGenerator)
-            {
-                Counts->NumEffectUnitsPerTrack[Counts->NumTracks]++;
-            }
+    if (c != ' ' && c != '>' && c != '/')
+        return XRNS_TAG_NONE;
 
-            if (   !bTracksCounted
-                && t.Tracks
-                && (  xmltagmatch(r.name, "SequencerTrack") 
-                   || xmltagmatch(r.name, "SequencerGroupTrack") 
-                   || xmltagmatch(r.name, "SequencerMasterTrack")
-                   )
-                && !t.PhraseGenerator
-                )
-            {
-                Counts->NumTracks++;
-            }
+    unsigned int Slot = XMLTagHash(Name, Length);
 
-            if (  xmltagmatch(r.name, "PatternTrack") 
-               || xmltagmatch(r.name, "PatternGroupTrack") 
-               || xmltagmatch(r.name, "PatternMasterTrack")
-               )
-            {
-                xrns_magic_write_int(&Counts->EnvelopesPerTrackPerPattern, NumTrackEnvelopes, xx);
-                xx++;
-                NumTrackEnvelopes = 0;
-            }
+    while (XRNSTagTable[Slot])
+    {
+        int Tag = XRNSTagTable[Slot] - 1;
 
-            UpdateXMLCountingTags(&t, r.name, 0);
-        }
-        else if (r.event_type == XML_EVENT_ELEMENT_START)
-        {
-            if (xmltagmatch(r.name, "ModulationSet"))
-            {
-                bCountedModulationDevice = 0;
-            }
+        if (XRNSTagLengths[Tag] == Length && !memcmp(XRNSTagNames[Tag], Name, Length))
+            return Tag;
 
-            if (xmltagmatch(r.name, "Lines"))
-            {
-                x.xml = strstr(x.xml, "</Lines>");
-            }
+        Slot = (Slot + 1) & (XRNS_TAG_HASH_SIZE - 1);
+    }
 
-            UpdateXMLCountingTags(&t, r.name, 1);
-        }
-        else if (r.event_type == XML_EVENT_ATTR_VALUE)
-        {
-            if (MatchCharsToString(r.name, "doc_version"))
-            {
-                Counts->RenoiseVersion = 2;
-                int Version = ParseIntegerFromXML(r.value);
-                if (Version >= 54)
-                {
-                    Counts->RenoiseVersion = 3;
-                }
-            }
-        }
+    return XRNS_TAG_NONE;
+}
+
+/* XMLTagId() for the name of an element event, XRNS_TAG_NONE for anything else. A broken document can have 
+ * an element event before its first '<', which has no name.
+ */
+int XMLEventTagId(xml_res *r)
+{
+    if (   r->event_type != XML_EVENT_ELEMENT_START 
+        && r->event_type != XML_EVENT_ELEMENT_END 
+        && r->event_type != XML_EVENT_ELEMENT_SELFCLOSING)
+    {
+        return XRNS_TAG_NONE;
     }
-    while (r.event_type != XML_EVENT_EOF);
 
-    TracyCZoneEnd(ctx);
+    if (!r->name)
+    {
+        return XRNS_TAG_NONE;
+    }
+
+    return XMLTagId(r->name);
+}
+
+void UpdateXMLTags(xrns_tag_set *t, int Subset, int Tag, int BeginOtherwiseEnd)
+{
+    if (Tag != XRNS_TAG_NONE && (XRNSTagSubsets[Tag] & Subset))
+    {
+        ((char *) t)[Tag] = (char) BeginOtherwiseEnd;
+    }
+}
+
+void UpdateXMLTrackTags(xrns_tag_set *t, int Tag, int BeginOtherwiseEnd)
+{
+    UpdateXMLTags(t, XRNS_TAG_SUBSET_TRACK, Tag, BeginOtherwiseEnd);
+}
+
+void UpdateXMLTopLevelTags(xrns_tag_set *t, int Tag, int BeginOtherwiseEnd)
+{
+    UpdateXMLTags(t, XRNS_TAG_SUBSET_TOPLEVEL, Tag, BeginOtherwiseEnd);
+}
+
+void UpdateXMLInstrumentTags(xrns_tag_set *t, int Tag, int BeginOtherwiseEnd)
+{
+    UpdateXMLTags(t, XRNS_TAG_SUBSET_INSTRUMENT, Tag, BeginOtherwiseEnd);
 }
 
 xrns_envelope *GetModulationPointer(xrns_modulation_set *ModulationSet, int ModulationTarget)
@@ -2017,7 +2639,7 @@ xrns_envelope *GetModulationPointer(xrns_modulation_set *ModulationSet, int Modu
     return 0;
 }
 
-void ParseEnvelope(xrns_envelope *Envelope, xml_ctx *x, galloc_ctx *g)
+void ParseEnvelope(xrns_envelope *Envelope, xml_ctx *x, xrns_scratch *s)
 {
     if (!Envelope) return;
 
@@ -2094,17 +2716,7 @@ void ParseEnvelope(xrns_envelope *Envelope, xml_ctx *x, galloc_ctx *g)
                 TracyCZoneN(ctx2, "Parsing Points", 1);
                 if (xmltagmatch(r.name, "Point"))
                 {
-                    if (Envelope->NumPoints == 0)
-                    {
-                        Envelope->Points = galloc(g, sizeof(xrns_point));
-                    }
-                    else
-                    {
-                        galloc(g, sizeof(xrns_point));
-                    }
-
-                    Envelope->NumPoints++;
-                    xrns_point *Point = &Envelope->Points[Envelope->NumPoints - 1];
+                    xrns_point *Point = XRNS_SCRATCH_APPEND(s, Envelope->Points, Envelope->NumPoints);
                     ParsePointFromTriple(Point, r.value);
                 }
                 TracyCZoneEnd(ctx2);
@@ -2153,11 +2765,9 @@ void ParseEnvelope(xrns_envelope *Envelope, xml_ctx *x, galloc_ctx *g)
 }
 
 void ParseInstruments
-    (galloc_ctx    *g
+    (xrns_scratch  *s
     ,xrns_document *xdoc
-    ,int            PatternIdx
-    ,int            TrackIdx
-    ,xml_ctx    *x
+    ,xml_ctx       *x
     ,xrns_tag_set  *t
     )
 {
@@ -2170,6 +2780,10 @@ void ParseInstruments
     int ModulationTarget = 0;
     int SliceRegionIdx = 0;
 
+    /* Only the modulation sets with an envelope device count, the instrument gets these once it's done. */
+    unsigned int NumModulationSets = 0;
+    int bCountedModulationSet = 0;
+
     int bParsingTrackEnvelope = 0;
 
     xml_res r;
@@ -2180,9 +2794,13 @@ void ParseInstruments
     {
         r = xml_parse_one_char(x);
 
+        int Tag = XMLEventTagId(&r);
+
         if (r.event_type == XML_EVENT_ELEMENT_END)
         {
-            if (   !xdoc->Instruments[InstrumentIdx].Name 
+            xrns_instrument *Instrument = XRNS_SCRATCH_SLOT(s, xdoc->Instruments, xdoc->NumInstruments, InstrumentIdx);
+
+            if (   !Instrument->Name 
                 && !t->Samples 
                 && t->Instrument 
                 && xmltagmatch(r.name, "Name") 
@@ -2192,20 +2810,19 @@ void ParseInstruments
                 && !t->PluginGenerator
                )
             {
-                xdoc->Instruments[InstrumentIdx].Name = GallocStringFromXML(g, &r);
+                Instrument->Name = r.value;
             } 
             else if (t->Samples && t->Sample && !t->SampleEnvelopes && !t->PluginProperties)
             {
-                xrns_sample *Sample = &xdoc->Instruments[InstrumentIdx].Samples[SampleIdx];
+                xrns_sample *Sample = XRNS_SCRATCH_SLOT(s, Instrument->Samples, Instrument->NumSamples, SampleIdx);
                 if (xmltagmatch(r.name, "Name"))
                 {
-                    Sample->Name = GallocStringFromXML(g, &r);
-
-                    xrns_instrument *Instrument = &xdoc->Instruments[InstrumentIdx];
+                    Sample->Name = r.value;
 
                     if (Instrument->bIsSliced && SampleIdx)
                     {
-                        Sample->SampleStart = Instrument->SliceRegions[SampleIdx - 1];
+                        Sample->SampleStart = (SampleIdx - 1 < Instrument->NumSliceRegions) 
+                                            ? Instrument->SliceRegions[SampleIdx - 1] : 0;
                         Sample->bIsAlisedSample = 1;
                     }
                     else
@@ -2244,6 +2861,8 @@ void ParseInstruments
                         Sample->InterpolationMode = XRNS_INTERPOLATION_NONE;
                     else if (MatchCharsToString(r.value, "Linear"))
                         Sample->InterpolationMode = XRNS_INTERPOLATION_LINEAR;
+                    else if (MatchCharsToString(r.value, "Sinc"))
+                        Sample->InterpolationMode = XRNS_INTERPOLATION_SINC;
                     else
                         Sample->InterpolationMode = XRNS_INTERPOLATION_CUBIC;
                 }
@@ -2287,10 +2906,10 @@ void ParseInstruments
                 }
                 else if (t->SliceMarkers && t->SliceMarker && xmltagmatch(r.name, "SamplePosition"))
                 {
-                    xrns_instrument *Instrument = &xdoc->Instruments[InstrumentIdx];
                     Instrument->bIsSliced = 1;
 
-                    Instrument->SliceRegions[SliceRegionIdx] = ParseIntegerFromXML(r.value);
+                    *XRNS_SCRATCH_SLOT(s, Instrument->SliceRegions, Instrument->NumSliceRegions, SliceRegionIdx)
+                        = ParseIntegerFromXML(r.value);
                     SliceRegionIdx++;
                 }
             }
@@ -2308,7 +2927,8 @@ void ParseInstruments
 
             if (bNewSplitMapV2 || bNewSplitMapV3)
             {
-                xrns_ssm *SampleSM = &xdoc->Instruments[InstrumentIdx].SampleSplitMaps[SampleSplitIdx];
+                xrns_ssm *SampleSM 
+                    = XRNS_SCRATCH_SLOT(s, Instrument->SampleSplitMaps, Instrument->NumSampleSplitMaps, SampleSplitIdx);
 
                 if (xmltagmatch(r.name, "SampleIndex"))
                 {
@@ -2356,17 +2976,18 @@ void ParseInstruments
                     ModulationSetIdx++;
                 }
 
-                if (xdoc->Instruments[InstrumentIdx].NumModulationSets && xmltagmatch(r.name, "PitchModulationRange"))
+                /* Only kept if the instrument turns out to have a modulation set that counts. */
+                if (xmltagmatch(r.name, "PitchModulationRange"))
                 {
-                    xrns_modulation_set *ModulationSet 
-                        = &xdoc->Instruments[InstrumentIdx].ModulationSets[ModulationSetIdx];
+                    xrns_modulation_set *ModulationSet = XRNS_SCRATCH_SLOT
+                        (s, Instrument->ModulationSets, Instrument->NumModulationSets, ModulationSetIdx);
                     ModulationSet->PitchModulationRange = ParseIntegerFromXML(r.value);
                 }
 
                 if (t->SampleEnvelopeModulationDevice)
                 {
-                    xrns_modulation_set *ModulationSet 
-                        = &xdoc->Instruments[InstrumentIdx].ModulationSets[ModulationSetIdx];
+                    xrns_modulation_set *ModulationSet = XRNS_SCRATCH_SLOT
+                        (s, Instrument->ModulationSets, Instrument->NumModulationSets, ModulationSetIdx);
 
                     bParsingTrackEnvelope = 0;
 
@@ -2397,7 +3018,7 @@ void ParseInstruments
                     }
                     else if (Envelope)
                     {
-                        ParseEnvelope(Envelope, x, g);
+                        ParseEnvelope(Envelope, x, s);
                         t->SampleEnvelopeModulationDevice = 0;
                         Envelope = NULL;
                     }
@@ -2406,6 +3027,11 @@ void ParseInstruments
             
             if (xmltagmatch(r.name, "Instrument") && !t->PhraseGenerator)
             {
+                Instrument->ModulationSets = xrns_scratch_grow
+                    (s, Instrument->ModulationSets, Instrument->NumModulationSets, NumModulationSets, sizeof(xrns_modulation_set));
+                Instrument->NumModulationSets = NumModulationSets;
+
+                NumModulationSets = 0;
                 InstrumentIdx++;
                 SliceRegionIdx = 0;
                 SampleIdx = 0;
@@ -2414,6 +3040,7 @@ void ParseInstruments
             }
             else if (xmltagmatch(r.name, "Sample"))
             {
+                XRNS_SCRATCH_SLOT(s, Instrument->Samples, Instrument->NumSamples, SampleIdx);
                 SampleIdx++;
             }
             else if (  (xdoc->RenoiseVersion == 2 && xmltagmatch(r.name, "NoteOnMapping"))
@@ -2424,33 +3051,51 @@ void ParseInstruments
                        )
                     )
             {
+                XRNS_SCRATCH_SLOT(s, Instrument->SampleSplitMaps, Instrument->NumSampleSplitMaps, SampleSplitIdx);
                 SampleSplitIdx++;
             }
 
             if (xmltagmatch(r.name, "Instruments"))
             {
-                UpdateXMLInstrumentTags(t, r.name, 0);
+                UpdateXMLInstrumentTags(t, Tag, 0);
                 break;    
             }
 
-            UpdateXMLInstrumentTags(t, r.name, 0);
+            UpdateXMLInstrumentTags(t, Tag, 0);
         }
         else if (r.event_type == XML_EVENT_ELEMENT_START)
         {
-            UpdateXMLInstrumentTags(t, r.name, 1);
+            if (Tag == XRNS_TAG_ModulationSet)
+            {
+                bCountedModulationSet = 0;
+            }
+
+            /* The device's own end is read by ParseEnvelope(), so it's counted as it starts. */
+            if (   xdoc->RenoiseVersion == 3 
+                && Tag == XRNS_TAG_SampleEnvelopeModulationDevice 
+                && t->ModulationSet 
+                && !t->PhraseGenerator 
+                && !bCountedModulationSet)
+            {
+                NumModulationSets++;
+                bCountedModulationSet = 1;
+            }
+
+            UpdateXMLInstrumentTags(t, Tag, 1);
         }
     
     } while (r.event_type != XML_EVENT_EOF);
 
+    /* Anything after the last </Instrument> isn't one. */
+    xdoc->NumInstruments = InstrumentIdx;
+
     TracyCZoneEnd(ctx);
 }
 
 void ParseLines
-    (galloc_ctx    *g
-    ,xrns_document *xdoc
-    ,int            PatternIdx
-    ,int            TrackIdx
-    ,xml_ctx    *x
+    (xrns_scratch  *s
+    ,xrns_track    *Track
+    ,xml_ctx       *x
     ,xrns_tag_set  *t
     )
 {
@@ -2461,25 +3106,26 @@ void ParseLines
     int bInNoteColumn    = 0;
     int bInEffectColumn  = 0;
 
-    xrns_track *Track = &xdoc->PatternPool[PatternIdx].Tracks[TrackIdx];
-
     xml_res r;
 
     do
     {
         r = xml_parse_one_char(x);
 
+        int Tag = XMLEventTagId(&r);
+
         int bIsCol = 0;
         int bIsNoteCol = 0;
         int bIsEffectCol = 0;
 
         if (r.event_type > XML_EVENT_NOTHING && r.event_type <= XML_EVENT_ATTR_VALUE)
         {
-            if (!(bIsNoteCol = xmltagmatch(r.name, "NoteColumn")))
+            if (!(bIsNoteCol = Tag == XRNS_TAG_NoteColumn))
             {
-                bIsEffectCol = xmltagmatch(r.name, "EffectColumn");
+                bIsEffectCol = Tag == XRNS_TAG_EffectColumn;
             }
-            bIsCol = (((TrackIdx != xdoc->NumTracks - 1) && bIsNoteCol) || bIsEffectCol);
+            /* The master and the sends only have effect columns. */
+            bIsCol = ((!t->PatternMasterTrack && !t->PatternSendTrack && bIsNoteCol) || bIsEffectCol);
         }
 
         switch (r.event_type)
@@ -2493,18 +3139,7 @@ void ParseLines
             {
                 if (bIsCol)
                 {
-                    if (Track->NumNotes == 0)
-                    {
-                        Track->Notes = galloc(g, sizeof(xrns_note));
-                    }
-                    else
-                    {
-                        galloc(g, sizeof(xrns_note));
-                    }
-
-                    Track->NumNotes++;
-
-                    xrns_note *NewNote = &Track->Notes[Track->NumNotes - 1];
+                    xrns_note *NewNote = XRNS_SCRATCH_APPEND(s, Track->Notes, Track->NumNotes);
 
                     InitNote(NewNote);
                     NewNote->Column = ColumnCounter++;
@@ -2544,35 +3179,35 @@ void ParseLines
                     if (Track->NumNotes > 0)
                     {
                         xrns_note *Note = &Track->Notes[Track->NumNotes - 1];
-                        if (xmltagmatch(r.name, "Note"))
+                        if (Tag == XRNS_TAG_Note)
                         {
                             Note->Note = ParseXRNSNoteFromXML(r.value);
                         }
-                        else if (xmltagmatch(r.name, "Instrument"))
+                        else if (Tag == XRNS_TAG_Instrument)
                         {
                             Note->Instrument = Parse2DigitHexOrDotsFromXML(r.value);
                         }
-                        else if (xmltagmatch(r.name, "Volume"))
+                        else if (Tag == XRNS_TAG_Volume)
                         {
                             Note->Volume = Parse2DigitEffectColumnOrDotsFromXML(r.value);
                             Note->VolumeEffect[0] = r.value[0];
                             Note->VolumeEffect[1] = r.value[1];
                         }
-                        else if (xmltagmatch(r.name, "Delay"))
+                        else if (Tag == XRNS_TAG_Delay)
                         {
                             Note->Delay = Parse2DigitHexOrDotsFromXML(r.value);
                         }
-                        else if (xmltagmatch(r.name, "Panning"))
+                        else if (Tag == XRNS_TAG_Panning)
                         {
                             Note->Panning = Parse2DigitEffectColumnOrDotsFromXML(r.value);
                             Note->PanningEffect[0] = r.value[0];
                             Note->PanningEffect[1] = r.value[1];
                         }
-                        else if (xmltagmatch(r.name, "EffectNumber"))
+                        else if (Tag == XRNS_TAG_EffectNumber)
                         {         
                             Note->EffectTypeIdx = EffectTypeIdxFromEffectType(r.value);
                         }
-                        else if (xmltagmatch(r.name, "EffectValue"))
+                        else if (Tag == XRNS_TAG_EffectValue)
                         {
                             Note->EffectValue = Parse2DigitHexFromXML(r.value);
                         }
@@ -2583,10 +3218,10 @@ void ParseLines
                     if (Track->NumNotes > 0)
                     {
                         xrns_note *Note = &Track->Notes[Track->NumNotes - 1];
-                        if (xmltagmatch(r.name, "Value"))
+                        if (Tag == XRNS_TAG_Value)
                         {
                             Note->EffectValue = Parse2DigitHexFromXML(r.value);
-                        } else if (xmltagmatch(r.name, "Number"))
+                        } else if (Tag == XRNS_TAG_Number)
                         {
                             Note->EffectTypeIdx = EffectTypeIdxFromEffectType(r.value);    
                             Note->EffectTypeC[0] = r.value[0];
@@ -2601,7 +3236,7 @@ void ParseLines
                 if (bIsEffectCol)
                     bInEffectColumn = 0;
 
-                if (xmltagmatch(r.name, "Lines"))
+                if (Tag == XRNS_TAG_Lines)
                 {
                     TracyCZoneEnd(ctx);
                     return;
@@ -2617,7 +3252,7 @@ void ParseLines
 }
 
 void ParseTracks
-    (galloc_ctx    *g
+    (xrns_scratch  *s
     ,xrns_document *xdoc
     ,xml_ctx    *x
     ,xrns_tag_set  *t
@@ -2630,26 +3265,28 @@ void ParseTracks
     int ParameterIdx = 0;
     int TrackStackCounts[16] = {0};
 
+    /* Only the devices in FilterDevices count, the track gets this once it's done. */
+    unsigned int NumEffectUnits = 0;
+    int bFoundMaster = 0;
+
     xml_res r;
 
     do
     {
         r = xml_parse_one_char(x);
 
+        int Tag = XMLEventTagId(&r);
+
         if (r.event_type == XML_EVENT_ELEMENT_END)
         {
+            xrns_track_desc *Track = XRNS_SCRATCH_SLOT(s, xdoc->Tracks, xdoc->NumTracks, SequenceIdx);
+
             /* This is where the info about tracks is stored, their name, colour and 
              * grouping.
              */
-            if (t->SequencerSendTrack)
-            {
-                UpdateXMLTrackTags(t, r.name, 0);
-                continue;
-            }
-
             if (xmltagmatch(r.name, "Name"))
             {
-                xdoc->Tracks[SequenceIdx].Name = GallocStringFromXML(g, &r);
+                Track->Name = r.value;
                 EffectNumber = 0;
                 ParameterIdx = 0;
             }
@@ -2658,6 +3295,9 @@ void ParseTracks
                 int d;
                 int depth = ParseIntegerFromXML(r.value);
 
+                if (depth < 0) depth = 0;
+                if (depth > 15) depth = 15;
+
                 for (d = depth - 1; d >= 0; d--)
                     TrackStackCounts[d]++;
 
@@ -2665,39 +3305,41 @@ void ParseTracks
                 {
                     /* The master track magically wraps all the tracks in the song!
                      */
-                    xdoc->Tracks[SequenceIdx].bIsGroup = 1;
-                    xdoc->Tracks[SequenceIdx].Depth    = 0;
-                    xdoc->Tracks[SequenceIdx].WrapsNPreviousTracks = SequenceIdx;
+                    Track->bIsGroup = 1;
+                    Track->Depth    = 0;
+                    Track->WrapsNPreviousTracks = SequenceIdx;
                 }
                 else
                 {
-                    xdoc->Tracks[SequenceIdx].bIsGroup = (t->SequencerGroupTrack);
-                    xdoc->Tracks[SequenceIdx].Depth    = depth;
-                    xdoc->Tracks[SequenceIdx].WrapsNPreviousTracks = TrackStackCounts[depth];
+                    Track->bIsGroup = (t->SequencerGroupTrack);
+                    Track->Depth    = depth;
+                    Track->WrapsNPreviousTracks = TrackStackCounts[depth];
                 }
 
                 TrackStackCounts[depth] = 0;
             }
             else if (xmltagmatch(r.name, "NumberOfVisibleNoteColumns"))
             {
-                xdoc->Tracks[SequenceIdx].NumColumns = ParseIntegerFromXML(r.value);
+                Track->NumColumns = ParseIntegerFromXML(r.value);
             }
             else if (xmltagmatch(r.name, "NumberOfVisibleEffectColumns"))
             {
-                xdoc->Tracks[SequenceIdx].NumEffectColumns = ParseIntegerFromXML(r.value);
+                Track->NumEffectColumns = ParseIntegerFromXML(r.value);
             }
             else if (   t->TrackMixerDevice
                      || t->MasterTrackMixerDevice 
                      || t->SequencerTrackDevice 
                      || t->SequencerMasterTrackDevice 
                      || t->GroupTrackMixerDevice
+                     || t->SendTrackMixerDevice
+                     || t->SequencerSendTrackDevice
                     )
             {
                 if (t->Volume)
                 {
                     if (xmltagmatch(r.name, "Value"))
                     {
-                        xdoc->Tracks[SequenceIdx].InitialPreVolume = ParseFloatFromXML(r.value);
+                        Track->InitialPreVolume = ParseFloatFromXML(r.value);
                         /* This is the "pre volume" */
                     }
                 }
@@ -2706,36 +3348,69 @@ void ParseTracks
                     if (xmltagmatch(r.name, "Value"))
                     {
                         /* this is the post volume */
-                        xdoc->Tracks[SequenceIdx].InitialPostVolume = ParseFloatFromXML(r.value);
+                        Track->InitialPostVolume = ParseFloatFromXML(r.value);
                     }
                 }
                 else if (t->Surround)
                 {
                     if (xmltagmatch(r.name, "Value"))
                     {
-                        xdoc->Tracks[SequenceIdx].InitialWidth = ParseFloatFromXML(r.value);
+                        Track->InitialWidth = ParseFloatFromXML(r.value);
                     }
                 }
                 else if (t->Panning)
                 {
                     if (xmltagmatch(r.name, "Value"))
                     {
-                        xdoc->Tracks[SequenceIdx].InitialPanning = ParseFloatFromXML(r.value);
+                        Track->InitialPanning = ParseFloatFromXML(r.value);
                     }
                 }
                 else if (t->PostPanning)
                 {
                     if (xmltagmatch(r.name, "Value"))
                     {
-                        xdoc->Tracks[SequenceIdx].PostPanning = ParseFloatFromXML(r.value);
+                        Track->PostPanning = ParseFloatFromXML(r.value);
                     }
                 }                    
             }
             else if (t->FilterDevices)
             {
-                if (t->AudioPluginDevice)
+                if (Tag == XRNS_TAG_AudioPluginDevice || Tag == XRNS_TAG_SendDevice)
+                {
+                    NumEffectUnits++;
+                }
+
+                if (t->SendDevice && EffectNumber > 0)
+                {
+                    dsp_effect_desc *EffectDesc = XRNS_SCRATCH_SLOT
+                        (s, Track->DSPEffectDescs, Track->NumDSPEffectUnits, EffectNumber - 1);
+
+                    if (t->IsActive && xmltagmatch(r.name, "Value"))
+                    {
+                        EffectDesc->Enabled = (ParseFloatFromXML(r.value) != 0.0f);
+                    }
+                    else if (t->SendAmount && xmltagmatch(r.name, "Value"))
+                    {
+                        EffectDesc->Parameters[SEND_DEVICE_PAR_AMOUNT] = ParseFloatFromXML(r.value);
+                    }
+                    else if (t->SendPan && xmltagmatch(r.name, "Value"))
+                    {
+                        EffectDesc->Parameters[SEND_DEVICE_PAR_PANNING] = ParseFloatFromXML(r.value);
+                    }
+                    else if (t->DestSendTrack && xmltagmatch(r.name, "Value"))
+                    {
+                        EffectDesc->SendTrack = (int) ParseFloatFromXML(r.value);
+                    }
+                    else if (Tag == XRNS_TAG_MuteSource)
+                    {
+                        EffectDesc->bMuteSource = ParseBoolStringFromXML(r.value);
+                    }
+                }
+
+                if (t->AudioPluginDevice && EffectNumber > 0)
                 {
-                    dsp_effect_desc *EffectDesc = &xdoc->Tracks[SequenceIdx].DSPEffectDescs[EffectNumber - 1];
+                    dsp_effect_desc *EffectDesc = XRNS_SCRATCH_SLOT
+                        (s, Track->DSPEffectDescs, Track->NumDSPEffectUnits, EffectNumber - 1);
 
                     if (t->IsActive && xmltagmatch(r.name, "Value"))
                     {
@@ -2768,16 +3443,28 @@ void ParseTracks
                 }
             }
 
-            if (xmltagmatch(r.name, "SequencerTrack") || xmltagmatch(r.name, "SequencerGroupTrack"))
+            /* The sends come after the master. */
+            if (   xmltagmatch(r.name, "SequencerTrack") 
+                || xmltagmatch(r.name, "SequencerGroupTrack")
+                || xmltagmatch(r.name, "SequencerMasterTrack")
+                || xmltagmatch(r.name, "SequencerSendTrack")
+               )
+            {
+                Track->DSPEffectDescs = xrns_scratch_grow
+                    (s, Track->DSPEffectDescs, Track->NumDSPEffectUnits, NumEffectUnits, sizeof(dsp_effect_desc));
+                Track->NumDSPEffectUnits = NumEffectUnits;
+
+                NumEffectUnits = 0;
                 SequenceIdx++;
+            }
 
             if (xmltagmatch(r.name, "Tracks"))
             {
-                UpdateXMLTrackTags(t, r.name, 0);
+                UpdateXMLTrackTags(t, Tag, 0);
                 break;
             }
 
-            UpdateXMLTrackTags(t, r.name, 0);
+            UpdateXMLTrackTags(t, Tag, 0);
 
         }
         else if (r.event_type == XML_EVENT_ELEMENT_START || r.event_type == XML_EVENT_ELEMENT_SELFCLOSING)
@@ -2787,183 +3474,125 @@ void ParseTracks
                 EffectNumber++;
             }
 
-            UpdateXMLTrackTags(t, r.name, (r.event_type == XML_EVENT_ELEMENT_START));
+            /* A send is an effect unit like the plugins, so the device indices of the automation and the 
+             * effect commands still line up.
+             */
+            if (!t->SendDevice && Tag == XRNS_TAG_SendDevice && t->FilterDevices)
+            {
+                xrns_track_desc *Track = XRNS_SCRATCH_SLOT(s, xdoc->Tracks, xdoc->NumTracks, SequenceIdx);
+                dsp_effect_desc *EffectDesc;
+
+                EffectNumber++;
+                EffectDesc = XRNS_SCRATCH_SLOT(s, Track->DSPEffectDescs, Track->NumDSPEffectUnits, EffectNumber - 1);
+
+                EffectDesc->Type          = XRNS_EFFECT_SEND;
+                EffectDesc->Enabled       = 1;
+                EffectDesc->NumParameters = SEND_DEVICE_NUM_PARAMS;
+                EffectDesc->Parameters[SEND_DEVICE_PAR_AMOUNT]  = 1.0f;
+                EffectDesc->Parameters[SEND_DEVICE_PAR_PANNING] = 0.5f;
+            }
+
+            if (Tag == XRNS_TAG_SequencerMasterTrack)
+            {
+                xdoc->MasterTrackIdx = SequenceIdx;
+                bFoundMaster = 1;
+            }
+            else if (Tag == XRNS_TAG_SequencerSendTrack)
+            {
+                XRNS_SCRATCH_SLOT(s, xdoc->Tracks, xdoc->NumTracks, SequenceIdx)->bIsSend = 1;
+            }
+
+            UpdateXMLTrackTags(t, Tag, (r.event_type == XML_EVENT_ELEMENT_START));
         }
 
     } while (r.event_type != XML_EVENT_EOF);
 
+    /* Anything after the last track isn't one. */
+    xdoc->NumTracks = SequenceIdx;
+
+    if (!bFoundMaster)
+        xdoc->MasterTrackIdx = SequenceIdx - 1;
+
     TracyCZoneEnd(ctx);
 }
 
-int populateInstrumentsAndNotes(xrns_xml_parse_desc *ParseDesc)
+/* Runs on a pooled worker. Parses one section of Song.xml into Section->Scratch. 
+ */
+int ParseSongXMLSection(xrns_xml_section *Section)
 {
-    int i, k;
-
-    galloc_ctx    *g          = ParseDesc->g;
-    char          *xml        = ParseDesc->xml;
-    size_t         xml_length = ParseDesc->xml_length;
-    xrns_document *xdoc       = ParseDesc->xdoc;
+    xrns_scratch  *s    = &Section->Scratch;
+    xrns_document *xdoc = Section->xdoc;
+    int            Kind = Section->Kind;
 
-    char s = xml[xml_length];
-
-    xml[xml_length] = '\0';
+    xml_ctx x;
+    xml_init(&x, Section->Start);
 
-    xrns_file_counts Counts;
-    memset(&Counts, 0, sizeof(xrns_file_counts));
-    xrns_growing_buffer_init(&Counts.EnvelopesPerTrackPerPattern, Kilobytes(8));
+    GZEROED(xrns_tag_set, t);
+    GZEROED(xml_res, r);
 
-    XRNSGetCounts(xml, xml_length, &Counts);
+    unsigned int TrackIdx = 0;
+    unsigned int PatternSequenceIdx = 0;
 
-    xdoc->RenoiseVersion        = Counts.RenoiseVersion;
-    xdoc->NumInstruments        = Counts.NumInstruments;
-    xdoc->NumTracks             = Counts.NumTracks;
-    xdoc->NumPatterns           = Counts.NumPatterns;
-    xdoc->PatternSequenceLength = Counts.PatternSequenceLength;
+    xrns_pattern                *Pattern    = NULL;
+    xrns_track                  *Track      = NULL;
+    xrns_pattern_sequence_entry *PatternSeq = NULL;
 
-    xdoc->Instruments     = galloc(g, sizeof(xrns_instrument) * xdoc->NumInstruments);
-    xdoc->PatternPool     = galloc(g, sizeof(xrns_pattern) * xdoc->NumPatterns);
-    xdoc->PatternSequence = galloc(g, sizeof(xrns_pattern_sequence_entry) * xdoc->PatternSequenceLength);
+    xrns_scratch_init(s, (Section->End - Section->Start) / 2);
 
-    for (i = 0; i < xdoc->NumInstruments; i++)
+    if (Kind == XRNS_XML_SECTION_PATTERN)
     {
-        xrns_instrument *Instrument    = &xdoc->Instruments[i];
-        Instrument->NumSamples         = Counts.NumSamplesPerInstrument[i];
-        Instrument->Samples            = galloc(g, sizeof(xrns_sample) * Counts.NumSamplesPerInstrument[i]);
-        Instrument->NumSampleSplitMaps = Counts.NumSampleSplitMapsPerInstrument[i];
-        Instrument->SampleSplitMaps    = galloc(g, sizeof(xrns_ssm) * Counts.NumSampleSplitMapsPerInstrument[i]);
-        Instrument->NumModulationSets  = Counts.NumModulationSetsPerInstrument[i];
-
-        Instrument->ModulationSets     
-            = galloc(g, sizeof(xrns_modulation_set) * Counts.NumModulationSetsPerInstrument[i]);
-
-        Instrument->NumSliceRegions    = Counts.NumSliceRegionsPerInstrument[i];
-        Instrument->SliceRegions       = galloc(g, sizeof(unsigned int) * Counts.NumSliceRegionsPerInstrument[i]);
+        /* The <Patterns> around it is outside of the section. */
+        UpdateXMLTopLevelTags(&t, XRNS_TAG_Patterns, 1);
+        Pattern = &xdoc->PatternPool[Section->PatternIdx];
     }
 
-    xdoc->Tracks = galloc(g, sizeof(xrns_track_desc) * xdoc->NumTracks);
+    TracyCZoneN(ctx, "Parse Song.xml Section", 1);
 
-    for (i = 0; i < xdoc->NumTracks; i++)
+    do
     {
-        xdoc->Tracks[i].DSPEffectDescs    = galloc(g, sizeof(dsp_effect_desc) * Counts.NumEffectUnitsPerTrack[i]);
-        xdoc->Tracks[i].NumDSPEffectUnits = Counts.NumEffectUnitsPerTrack[i];
-    }
+        if (x.xml >= Section->End)
+            break;
 
-    for (i = 0; i < xdoc->NumPatterns; i++)
-    {
-        xrns_pattern *Pattern = &xdoc->PatternPool[i];
-        Pattern->Tracks       = galloc(g, sizeof(xrns_track) * xdoc->NumTracks);
-    }
+        r = xml_parse_one_char(&x);
 
-    for (i = 0; i < xdoc->NumPatterns; i++)
-    {
-        xrns_pattern *Pattern = &xdoc->PatternPool[i];
-        for (int xx = 0; xx < xdoc->NumTracks; xx++)
-        {
-            Pattern->Tracks[xx].NumEnvelopes
-                = ((int*)Counts.EnvelopesPerTrackPerPattern.Memory)[i*xdoc->NumTracks + xx];
+        int Tag = XMLEventTagId(&r);
 
-            Pattern->Tracks[xx].Envelopes    = galloc(g, sizeof(xrns_envelope) * Pattern->Tracks[xx].NumEnvelopes);
-        }
-    }
-
-    xml_ctx x;
-    xml_init(&x, xml);
-
-    GZEROED(xrns_tag_set, t);
-    GZEROED(xml_res, r);
-
-    int PatternIdx = 0;
-    int SequenceIdx = 0; /* these count as tracks */
-    int TrackIdx = 0;
-    int NoteIdx = 0;
-    int EffectIdx = 0;
-    int ColumnIdx = 0;
-    int EffectColumnIdx = 0;
-    int PatternSequenceIdx = 0;
-
-    int EffectNumber = 0;
-    int ParameterIdx = 0;
-
-    int CurrentLineIndex = 0;
-    int ColumnCounter = 0;
-  
-    int CurrentTrackEnvelope = 0;
-
-
-    int bParsingTrackEnvelope = 0;
-
-    float InitialBPMFromZTorZLCommand = -1.0f;
-
-    xrns_envelope *TrackEnvelope = NULL;
-
-    TracyCZoneN(ctx, "Top-Level Parse", 1);
-
-    do
-    {
-        r = xml_parse_one_char(&x);
         if (r.event_type == XML_EVENT_ELEMENT_END)
         {
-            if (xmltagmatch(r.name, "SongName"))
-            {
-                xdoc->SongName = GallocStringFromXML(g, &r);
-            }
-            else if (xmltagmatch(r.name, "Artist"))
-            {
-                xdoc->Artist = GallocStringFromXML(g, &r);
-            }
-            else if (xmltagmatch(r.name, "BeatsPerMin"))
-            {
-                xdoc->BeatsPerMin = ParseFloatFromXML(r.value);
-            }
-            else if (xmltagmatch(r.name, "LinesPerBeat"))
+            /* A section only ever fills in its own part of the document, whatever else a broken file has in it. */
+            if (Kind == XRNS_XML_SECTION_INSTRUMENTS && t.Instruments)
             {
-                xdoc->LinesPerBeat = ParseIntegerFromXML(r.value);
-            }
-            else if (xmltagmatch(r.name, "TicksPerLine"))
-            {
-                xdoc->TicksPerLine = ParseIntegerFromXML(r.value);
-            }
-            
-            if (t.Instruments)
-            {
-                ParseInstruments(g, xdoc, PatternIdx, TrackIdx, &x, &t);
+                ParseInstruments(s, xdoc, &x, &t);
                 continue;
             }
 
-            if (t.Patterns)
+            if (Kind == XRNS_XML_SECTION_PATTERN && t.Patterns)
             {
-                xrns_track *Track = &xdoc->PatternPool[PatternIdx].Tracks[TrackIdx];
-                if (   xmltagmatch(r.name, "PatternTrack")
-                    || xmltagmatch(r.name, "PatternMasterTrack") 
-                    || xmltagmatch(r.name, "PatternGroupTrack")
+                if (   Tag == XRNS_TAG_PatternTrack
+                    || Tag == XRNS_TAG_PatternMasterTrack 
+                    || Tag == XRNS_TAG_PatternGroupTrack
+                    || Tag == XRNS_TAG_PatternSendTrack
                    )
                 {
                     TrackIdx++;
-                    ColumnIdx = 0;
-                    EffectIdx = 0;
-                    EffectColumnIdx = 0;
-                    CurrentTrackEnvelope = 0;
-                }
-                else if (t.Pattern && xmltagmatch(r.name, "NumberOfLines"))
-                {
-                    xdoc->PatternPool[PatternIdx].NumberOfLines = ParseIntegerFromXML(r.value);
                 }
-                else if (t.Pattern && xmltagmatch(r.name, "Name"))
+                else if (t.Pattern && Tag == XRNS_TAG_NumberOfLines)
                 {
-                    xdoc->PatternPool[PatternIdx].Name = GallocStringFromXML(g, &r);
+                    Pattern->NumberOfLines = ParseIntegerFromXML(r.value);
                 }
-                else if (xmltagmatch(r.name, "Pattern"))
+                else if (t.Pattern && Tag == XRNS_TAG_Name)
                 {
-                    TrackIdx = 0;
-                    PatternIdx++;
-                    CurrentTrackEnvelope = 0;
+                    Pattern->Name = r.value;
                 }
 
-                if ((t.PatternTrack || t.PatternMasterTrack || t.PatternGroupTrack))
+                if ((t.PatternTrack || t.PatternMasterTrack || t.PatternGroupTrack || t.PatternSendTrack))
                 {
                     if (t.AliasPatternIndex)
                     {
                         int Alias = ParseIntegerFromXML(r.value);
+
+                        Track = XRNS_SCRATCH_SLOT(s, Pattern->Tracks, Section->NumPatternTracks, TrackIdx);
+
                         if (Alias == -1)
                         {
                             Track->bIsAlias = 0;
@@ -2976,105 +3605,247 @@ int populateInstrumentsAndNotes(xrns_xml_parse_desc *ParseDesc)
                     }
                 }
             }
-            else if (t.Tracks && !t.Patterns && (t.SequencerGroupTrack || t.SequencerTrack || t.SequencerMasterTrack))
-            {
-
-            }
-            else if (t.PatternSequence && t.SequenceEntries && t.SequenceEntry)
+            else if (Kind == XRNS_XML_SECTION_SEQUENCE && t.PatternSequence && t.SequenceEntries && t.SequenceEntry)
             {
-                xrns_pattern_sequence_entry *PatternSeq = &xdoc->PatternSequence[PatternSequenceIdx];
+                PatternSeq 
+                    = XRNS_SCRATCH_SLOT(s, xdoc->PatternSequence, xdoc->PatternSequenceLength, PatternSequenceIdx);
 
-                if (xmltagmatch(r.name, "IsSectionStart"))
+                if (Tag == XRNS_TAG_IsSectionStart)
                 {
                     PatternSeq->bIsSectionStart = ParseBoolStringFromXML(r.value);
                 }
-                else if (xmltagmatch(r.name, "SectionName"))
+                else if (Tag == XRNS_TAG_SectionName)
                 {
-                    PatternSeq->SectionName = GallocStringFromXML(g, &r);
+                    PatternSeq->SectionName = r.value;
                 }
-                else if (xmltagmatch(r.name, "Pattern"))
+                else if (Tag == XRNS_TAG_Pattern)
                 {
                     PatternSeq->PatternIdx = ParseIntegerFromXML(r.value);
                 }
                 else if (t.MutedTracks)
                 {
-                    if (xmltagmatch(r.name, "MutedTrack"))
+                    if (Tag == XRNS_TAG_MutedTrack && PatternSeq->NumMutedTracks)
                     {
                         PatternSeq->MutedTracks[PatternSeq->NumMutedTracks - 1] = ParseIntegerFromXML(r.value); 
                     }
                 }
             }
 
-            if (xmltagmatch(r.name, "SequenceEntry"))
+            if (Kind == XRNS_XML_SECTION_SEQUENCE && Tag == XRNS_TAG_SequenceEntry)
             {
                 PatternSequenceIdx++;
             }
 
-            UpdateXMLTopLevelTags(&t, r.name, 0);
+            UpdateXMLTopLevelTags(&t, Tag, 0);
         }
 
-        if ((r.event_type == XML_EVENT_ELEMENT_START) && xmltagmatch(r.name, "Tracks") && !t.Patterns)
+        if (Kind == XRNS_XML_SECTION_TRACKS && (r.event_type == XML_EVENT_ELEMENT_START) && Tag == XRNS_TAG_Tracks)
         {
-            ParseTracks(g, xdoc, &x, &t);
+            ParseTracks(s, xdoc, &x, &t);
             continue;
         }
 
-        if ((r.event_type == XML_EVENT_ELEMENT_START) && xmltagmatch(r.name, "Lines"))
+        if (Kind == XRNS_XML_SECTION_PATTERN && (r.event_type == XML_EVENT_ELEMENT_START) && Tag == XRNS_TAG_Lines)
         {
-            ParseLines(g, xdoc, PatternIdx, TrackIdx, &x, &t);
+            Track = XRNS_SCRATCH_SLOT(s, Pattern->Tracks, Section->NumPatternTracks, TrackIdx);
+            ParseLines(s, Track, &x, &t);
             continue;
         }
         
         if (r.event_type == XML_EVENT_ELEMENT_START || r.event_type == XML_EVENT_ELEMENT_SELFCLOSING)
         {
-            xrns_track *Track = &xdoc->PatternPool[PatternIdx].Tracks[TrackIdx];
-            xrns_pattern_sequence_entry *PatternSeq = &xdoc->PatternSequence[PatternSequenceIdx];
-
-            if (t.Automations && t.Envelopes)
+            if (Kind == XRNS_XML_SECTION_PATTERN && t.Automations && t.Envelopes)
             {
-                if (xmltagmatch(r.name, "Envelope") && !t.Envelope)
+                if (Tag == XRNS_TAG_Envelope && !t.Envelope)
                 {
-                    CurrentTrackEnvelope++;
-                    TrackEnvelope = &Track->Envelopes[CurrentTrackEnvelope - 1];
-                    ParseEnvelope(TrackEnvelope, &x, g);
+                    Track = XRNS_SCRATCH_SLOT(s, Pattern->Tracks, Section->NumPatternTracks, TrackIdx);
+                    ParseEnvelope(XRNS_SCRATCH_APPEND(s, Track->Envelopes, Track->NumEnvelopes), &x, s);
                 }
             }
-            else
+
+            if (Kind == XRNS_XML_SECTION_SEQUENCE && t.PatternSequence && Tag == XRNS_TAG_MutedTrack)
+            {
+                PatternSeq 
+                    = XRNS_SCRATCH_SLOT(s, xdoc->PatternSequence, xdoc->PatternSequenceLength, PatternSequenceIdx);
+                XRNS_SCRATCH_APPEND(s, PatternSeq->MutedTracks, PatternSeq->NumMutedTracks);
+            }
+
+            UpdateXMLTopLevelTags(&t, Tag, (r.event_type == XML_EVENT_ELEMENT_START));
+        }
+    }
+    while (r.event_type != XML_EVENT_EOF);
+
+    /* Whatever was started after the last one that was closed doesn't count. */
+    if (Kind == XRNS_XML_SECTION_PATTERN)
+    {
+        Pattern->Tracks = xrns_scratch_grow(s, Pattern->Tracks, Section->NumPatternTracks, TrackIdx, sizeof(xrns_track));
+        Section->NumPatternTracks = TrackIdx;
+    }
+    else if (Kind == XRNS_XML_SECTION_SEQUENCE)
+    {
+        xdoc->PatternSequence = xrns_scratch_grow
+            (s, xdoc->PatternSequence, xdoc->PatternSequenceLength, PatternSequenceIdx, sizeof(xrns_pattern_sequence_entry));
+        xdoc->PatternSequenceLength = PatternSequenceIdx;
+    }
+
+    TracyCZoneEnd(ctx);
+
+    Section->bParsed = 1;
+
+    return 1;
+}
+
+/* Where the tokenizer is once it has read the closing tag of the element whose '<' is at Start, found without 
+ * tokenizing what's in between, or the end of the document if it's never closed. NULL if the element closes 
+ * itself. None of the elements that Song.xml is split up at ever has one of the same name inside it.
+ */
+char *XMLSkipElement(char *Start, int Tag)
+{
+    char         Close[64];
+    unsigned int Length = XRNSTagLengths[Tag];
+
+    char *p = xml_scan(Start, XML_SCAN_CHAR, '>');
+    if (!*p) return p;
+    if (p[-1] == '/') return NULL;
+
+    Close[0] = '<';
+    Close[1] = '/';
+    memcpy(Close + 2, XRNSTagNames[Tag], Length);
+    Close[Length + 2] = '>';
+    Close[Length + 3] = '\0';
+
+    char *End = strstr(p, Close);
+    if (!End) return p + strlen(p);
+
+    return xml_scan(End + Length + 3, XML_SCAN_CHAR, '<');
+}
+
+/* Parses all of Song.xml but its sections, which it only finds the ends of, and adds each of them to 
+ * ParseDesc->Sections. Returns 0 if the file can't be loaded.
+ */
+int ParseSongXMLRest(xrns_xml_parse_desc *ParseDesc)
+{
+    galloc_ctx    *g    = ParseDesc->g;
+    xrns_document *xdoc = ParseDesc->xdoc;
+
+    xml_ctx x;
+    xml_init(&x, ParseDesc->xml);
+
+    GZEROED(xrns_tag_set, t);
+    GZEROED(xml_res, r);
+
+    /* There's only one of each of these, anything after the first is skipped. */
+    int bFoundInstruments = 0;
+    int bFoundTracks      = 0;
+    int bFoundSequence    = 0;
+
+    TracyCZoneN(ctx, "Parse Song.xml", 1);
+
+    do
+    {
+        r = xml_parse_one_char(&x);
+
+        int Tag = XMLEventTagId(&r);
+
+        if (r.event_type == XML_EVENT_ELEMENT_START)
+        {
+            int Kind = -1;
+            int bSkip = 0;
+
+            if (Tag == XRNS_TAG_Instruments)
+            {
+                Kind  = XRNS_XML_SECTION_INSTRUMENTS;
+                bSkip = bFoundInstruments;
+            }
+            else if (Tag == XRNS_TAG_Tracks && !t.Patterns)
+            {
+                Kind  = XRNS_XML_SECTION_TRACKS;
+                bSkip = bFoundTracks;
+            }
+            else if (Tag == XRNS_TAG_Pattern && t.Patterns)
             {
-                bParsingTrackEnvelope = 0;
+                Kind  = XRNS_XML_SECTION_PATTERN;
+            }
+            else if (Tag == XRNS_TAG_PatternSequence)
+            {
+                Kind  = XRNS_XML_SECTION_SEQUENCE;
+                bSkip = bFoundSequence;
             }
 
-            if (xmltagmatch(r.name, "MutedTrack"))
+            char *End = (Kind != -1) ? XMLSkipElement(r.name - 1, Tag) : NULL;
+
+            if (End)
             {
-                if (PatternSeq->NumMutedTracks == 0)
-                {
-                    PatternSeq->MutedTracks = galloc(g, sizeof(unsigned int));
-                }
-                else
+                if (!bSkip)
                 {
-                    galloc(g, sizeof(unsigned int));
+                    xrns_xml_section Section;
+                    memset(&Section, 0, sizeof(xrns_xml_section));
+                    Section.Kind  = Kind;
+                    Section.Start = r.name - 1;
+                    Section.End   = End;
+                    Section.xdoc  = xdoc;
+
+                    if (Kind == XRNS_XML_SECTION_PATTERN)
+                        Section.PatternIdx = xdoc->NumPatterns++;
+
+                    xrns_growing_buffer_append(&ParseDesc->Sections, &Section, sizeof(xrns_xml_section));
+                    ParseDesc->NumSections++;
                 }
-                PatternSeq->NumMutedTracks++;
+
+                bFoundInstruments |= (Kind == XRNS_XML_SECTION_INSTRUMENTS);
+                bFoundTracks      |= (Kind == XRNS_XML_SECTION_TRACKS);
+                bFoundSequence    |= (Kind == XRNS_XML_SECTION_SEQUENCE);
+
+                x.xml = End;
+                continue;
+            }
+
+            UpdateXMLTopLevelTags(&t, Tag, 1);
+        }
+        else if (r.event_type == XML_EVENT_ELEMENT_SELFCLOSING)
+        {
+            UpdateXMLTopLevelTags(&t, Tag, 0);
+        }
+        else if (r.event_type == XML_EVENT_ELEMENT_END)
+        {
+            if (Tag == XRNS_TAG_SongName)
+            {
+                xdoc->SongName = GallocStringFromXML(g, &r);
+            }
+            else if (Tag == XRNS_TAG_Artist)
+            {
+                xdoc->Artist = GallocStringFromXML(g, &r);
+            }
+            else if (Tag == XRNS_TAG_BeatsPerMin)
+            {
+                xdoc->BeatsPerMin = ParseFloatFromXML(r.value);
+            }
+            else if (Tag == XRNS_TAG_LinesPerBeat)
+            {
+                xdoc->LinesPerBeat = ParseIntegerFromXML(r.value);
             }
-            UpdateXMLTopLevelTags(&t, r.name, (r.event_type == XML_EVENT_ELEMENT_START));
+            else if (Tag == XRNS_TAG_TicksPerLine)
+            {
+                xdoc->TicksPerLine = ParseIntegerFromXML(r.value);
+            }
+
+            UpdateXMLTopLevelTags(&t, Tag, 0);
         }
         else if (r.event_type == XML_EVENT_ATTR_VALUE)
         {
+            /* It's on the root element, so this is set before any of the sections are parsed. */
             if (MatchCharsToString(r.name, "doc_version"))
             {
-                xdoc->RenoiseVersion = 2;
                 int Version = ParseIntegerFromXML(r.value);
 
+                /* We don't support XRNS files older than this. */
                 if (Version < 37)
                 {
-                    /* We don't support XRNS files older than this. */
+                    TracyCZoneEnd(ctx);
                     return 0;
                 }
 
-                if (Version >= 54)
-                {
-                    xdoc->RenoiseVersion = 3;
-                }
+                xdoc->RenoiseVersion = (Version >= 54) ? 3 : 2;
             }
         }
     }
@@ -3082,6 +3853,227 @@ int populateInstrumentsAndNotes(xrns_xml_parse_desc *ParseDesc)
 
     TracyCZoneEnd(ctx);
 
+    return 1;
+}
+
+/* Parses Song.xml but for its sections, then adds a job for each of them. FinishSongXML() has to be called 
+ * once the jobs have been farmed.
+ */
+void AddSongXMLJobs(xrns_xml_parse_desc *ParseDesc, work_table *Decoding)
+{
+    unsigned int i;
+
+    galloc_ctx    *g          = ParseDesc->g;
+    char          *xml        = ParseDesc->xml;
+    size_t         xml_length = ParseDesc->xml_length;
+    xrns_document *xdoc       = ParseDesc->xdoc;
+
+    ParseDesc->SavedTerminator = xml[xml_length];
+
+    xml[xml_length] = '\0';
+
+    xrns_growing_buffer_init(&ParseDesc->Sections, Kilobytes(4));
+    ParseDesc->NumSections = 0;
+
+    XRNSBuildTagTable();
+
+    ParseDesc->bParsed = ParseSongXMLRest(ParseDesc);
+
+    if (!ParseDesc->bParsed)
+        return;
+
+    if (sizeof(xrns_pattern) * xdoc->NumPatterns > galloc_bytes_left(g))
+    {
+        ParseDesc->bParsed = 0;
+        return;
+    }
+
+    xdoc->PatternPool = galloc(g, sizeof(xrns_pattern) * xdoc->NumPatterns);
+
+    xrns_xml_section *Sections = (xrns_xml_section *) ParseDesc->Sections.Memory;
+
+    xrns_job Job = {0};
+    Job.WorkFunction = (xrns_worker_fcn) ParseSongXMLSection;
+    Job.FreeData     = NULL;
+
+    for (i = 0; i < ParseDesc->NumSections; i++)
+    {
+        Job.Data = &Sections[i];
+        AddToWorkTable(Decoding, Job);
+    }
+}
+
+/* Bytes of galloc memory, starting with a copy of the CopyBytes at From and zeroed after that. NULL if Bytes
+ * is 0, or if it doesn't fit, which leaves the galloc full so that FinishSongXML() can tell.
+ */
+void *GallocCopy(galloc_ctx *g, void *From, size_t CopyBytes, size_t Bytes)
+{
+    if (!Bytes)
+        return NULL;
+
+    Bytes = (Bytes + 7) & ~(size_t) 7;
+
+    if (Bytes > galloc_bytes_left(g))
+    {
+        g->CurrentAddress = g->BaseAddress + g->MaximumSizeBytes;
+        return NULL;
+    }
+
+    char *To = galloc(g, Bytes);
+    if (CopyBytes) memcpy(To, From, CopyBytes);
+    memset(To + CopyBytes, 0, Bytes - CopyBytes);
+
+    return To;
+}
+
+#define GALLOC_COPY_ARRAY(_g, _array, _count) \
+    GallocCopy((_g), (_array), (_count) * sizeof(*(_array)), (_count) * sizeof(*(_array)))
+
+/* The text of an element, which runs up to the next '<', as a string in the galloc. */
+char *GallocXMLString(galloc_ctx *g, char *Value)
+{
+    if (!Value)
+        return NULL;
+
+    unsigned int Length = XMLTagLength(Value);
+    return GallocCopy(g, Value, Length, Length + 1);
+}
+
+/* Copies everything that a section parsed out of its scratch memory and the XML into the galloc, innermost 
+ * first, and points the document at it.
+ */
+void CompactSongXMLSection(galloc_ctx *g, xrns_xml_section *Section)
+{
+    unsigned int i, j;
+
+    xrns_document *xdoc = Section->xdoc;
+
+    if (Section->Kind == XRNS_XML_SECTION_INSTRUMENTS)
+    {
+        for (i = 0; i < xdoc->NumInstruments; i++)
+        {
+            xrns_instrument *Instrument = &xdoc->Instruments[i];
+            Instrument->Name = GallocXMLString(g, Instrument->Name);
+
+            for (j = 0; j < Instrument->NumSamples; j++)
+            {
+                Instrument->Samples[j].Name = GallocXMLString(g, Instrument->Samples[j].Name);
+            }
+
+            for (j = 0; j < Instrument->NumModulationSets; j++)
+            {
+                xrns_modulation_set *ModulationSet = &Instrument->ModulationSets[j];
+                xrns_envelope *Volume  = &ModulationSet->Volume;
+                xrns_envelope *Panning = &ModulationSet->Panning;
+                xrns_envelope *Pitch   = &ModulationSet->Pitch;
+
+                Volume->Points  = GALLOC_COPY_ARRAY(g, Volume->Points, Volume->NumPoints);
+                Panning->Points = GALLOC_COPY_ARRAY(g, Panning->Points, Panning->NumPoints);
+                Pitch->Points   = GALLOC_COPY_ARRAY(g, Pitch->Points, Pitch->NumPoints);
+            }
+
+            Instrument->Samples         = GALLOC_COPY_ARRAY(g, Instrument->Samples, Instrument->NumSamples);
+            Instrument->SampleSplitMaps = GALLOC_COPY_ARRAY(g, Instrument->SampleSplitMaps, Instrument->NumSampleSplitMaps);
+            Instrument->ModulationSets  = GALLOC_COPY_ARRAY(g, Instrument->ModulationSets, Instrument->NumModulationSets);
+            Instrument->SliceRegions    = GALLOC_COPY_ARRAY(g, Instrument->SliceRegions, Instrument->NumSliceRegions);
+        }
+
+        xdoc->Instruments = GALLOC_COPY_ARRAY(g, xdoc->Instruments, xdoc->NumInstruments);
+    }
+    else if (Section->Kind == XRNS_XML_SECTION_TRACKS)
+    {
+        for (i = 0; i < xdoc->NumTracks; i++)
+        {
+            xrns_track_desc *Track = &xdoc->Tracks[i];
+            Track->Name           = GallocXMLString(g, Track->Name);
+            Track->DSPEffectDescs = GALLOC_COPY_ARRAY(g, Track->DSPEffectDescs, Track->NumDSPEffectUnits);
+        }
+
+        xdoc->Tracks = GALLOC_COPY_ARRAY(g, xdoc->Tracks, xdoc->NumTracks);
+    }
+    else if (Section->Kind == XRNS_XML_SECTION_PATTERN)
+    {
+        xrns_pattern *Pattern = &xdoc->PatternPool[Section->PatternIdx];
+        Pattern->Name = GallocXMLString(g, Pattern->Name);
+
+        /* Every pattern has a track for each of the song's, whether it had the same number or not. */
+        unsigned int NumTracks = (Section->NumPatternTracks < xdoc->NumTracks) ? Section->NumPatternTracks : xdoc->NumTracks;
+
+        for (i = 0; i < NumTracks; i++)
+        {
+            xrns_track *Track = &Pattern->Tracks[i];
+            Track->Notes = GALLOC_COPY_ARRAY(g, Track->Notes, Track->NumNotes);
+
+            for (j = 0; j < Track->NumEnvelopes; j++)
+            {
+                xrns_envelope *Envelope = &Track->Envelopes[j];
+                Envelope->Points = GALLOC_COPY_ARRAY(g, Envelope->Points, Envelope->NumPoints);
+            }
+
+            Track->Envelopes = GALLOC_COPY_ARRAY(g, Track->Envelopes, Track->NumEnvelopes);
+        }
+
+        Pattern->Tracks = GallocCopy(g, Pattern->Tracks, sizeof(xrns_track) * NumTracks, sizeof(xrns_track) * xdoc->NumTracks);
+    }
+    else if (Section->Kind == XRNS_XML_SECTION_SEQUENCE)
+    {
+        for (i = 0; i < xdoc->PatternSequenceLength; i++)
+        {
+            xrns_pattern_sequence_entry *PatternSeq = &xdoc->PatternSequence[i];
+            PatternSeq->SectionName = GallocXMLString(g, PatternSeq->SectionName);
+            PatternSeq->MutedTracks = GALLOC_COPY_ARRAY(g, PatternSeq->MutedTracks, PatternSeq->NumMutedTracks);
+        }
+
+        xdoc->PatternSequence = GALLOC_COPY_ARRAY(g, xdoc->PatternSequence, xdoc->PatternSequenceLength);
+    }
+}
+
+/* Copies each section into the document's galloc, in the order of the file, then picks up the starting ZT, ZL 
+ * and ZK commands. Returns 0 if the file can't be loaded.
+ */
+int FinishSongXML(xrns_xml_parse_desc *ParseDesc)
+{
+    unsigned int i;
+
+    galloc_ctx       *g        = ParseDesc->g;
+    xrns_document    *xdoc     = ParseDesc->xdoc;
+    xrns_xml_section *Sections = (xrns_xml_section *) ParseDesc->Sections.Memory;
+
+    int bParsed = ParseDesc->bParsed;
+
+    for (i = 0; i < ParseDesc->NumSections; i++)
+    {
+        if (!Sections[i].bParsed)
+            bParsed = 0;
+    }
+
+    /* The engine keeps a bit for each track, and an instrument is a byte in a note. */
+    if (xdoc->NumTracks > XRNS_MAX_NUM_TRACKS || xdoc->NumInstruments > XRNS_MAX_NUM_INSTRUMENTS)
+        bParsed = 0;
+
+    TracyCZoneN(merge_ctx, "Compact Song.xml Sections", 1);
+
+    for (i = 0; i < ParseDesc->NumSections; i++)
+    {
+        if (bParsed)
+            CompactSongXMLSection(g, &Sections[i]);
+
+        xrns_scratch_free(&Sections[i].Scratch);
+    }
+
+    /* Something didn't fit. */
+    if (!galloc_bytes_left(g))
+        bParsed = 0;
+
+    TracyCZoneEnd(merge_ctx);
+
+    ParseDesc->xml[ParseDesc->xml_length] = ParseDesc->SavedTerminator;
+
+    xrns_growing_buffer_free(&ParseDesc->Sections);
+
+    if (!bParsed)
+        return 0;
+
     int bFoundStartingZT = 0;
     int bFoundStartingZL = 0;
     int bFoundStartingZK = 0;
@@ -3092,6 +4084,8 @@ int populateInstrumentsAndNotes(xrns_xml_parse_desc *ParseDesc)
     for (int PatternSeqIdx = 0; PatternSeqIdx < xdoc->PatternSequenceLength; PatternSeqIdx++)
     {
         unsigned int Pattern = xdoc->PatternSequence[PatternSeqIdx].PatternIdx;
+        if (Pattern >= xdoc->NumPatterns)
+            continue;
 
         for (int TrackIdx = 0; TrackIdx < xdoc->NumTracks; TrackIdx++)
         {
@@ -3136,11 +4130,7 @@ int populateInstrumentsAndNotes(xrns_xml_parse_desc *ParseDesc)
     if (bFoundStartingZK)
         xdoc->TicksPerLine = StartingZK;
 
-    xrns_growing_buffer_free(&Counts.EnvelopesPerTrackPerPattern);
-    xml[xml_length] = s;
-
     return 1;
-
 }
 
 xrns_sample *populateInstrumentSample(populate_instrument_desc *InstrumentDesc)
@@ -3202,22 +4192,69 @@ xrns_sample *populateInstrumentSample(populate_instrument_desc *InstrumentDesc)
     xrns_sample *Sample = malloc(sizeof(xrns_sample));
     memset(Sample, 0, sizeof(xrns_sample));
 
-    Sample->PCM           = PCM;
-    Sample->SampleRateHz  = Config.sampleRate;
-    Sample->NumChannels   = Config.channels;
-    Sample->LengthSamples = FrameCountOut;
-    Sample->InstrumentNumber = InstrumentNumber;
-    Sample->SampleNumber  = SampleNumber;
-
-    TracyCZoneEnd(ctx);
+    /* Move the decoded frames in between the guard frames, see XRNS_PCM_GUARD_FRAMES. */
+    if (ret == MA_SUCCESS && (InstrumentDesc->LoadFlags & XRNS_LOAD_FLOAT_SAMPLES))
+    {
+        /* Each plane is padded out to a whole number of 32 byte lines, so both start aligned. */
+        size_t PlaneStride = (FrameCountOut + 2 * XRNS_PCM_GUARD_FRAMES + 7) & ~((size_t) 7);
+        size_t  NumPlanes  = (Config.channels == 2) ? 2 : 1;
 
-    return Sample;
-}
+        char  *Allocation  = calloc(1, sizeof(float) * PlaneStride * NumPlanes + 32);
+        float *Planes      = (float *) (((unsigned long long) Allocation + 31) & ~31ull);
 
-int populateXRNSDocument(galloc_ctx *g, void *mem, size_t mem_sz, xrns_document *xdoc, pooled_threads_ctx *Workers)
-{
-    char c[2048];
-    int i;
+        for (size_t ch = 0; ch < NumPlanes; ch++)
+        {
+            float *Plane = Planes + ch * PlaneStride + XRNS_PCM_GUARD_FRAMES;
+
+            for (ma_uint64 i = 0; i < FrameCountOut; i++)
+            {
+                Plane[i] = PCM[i * Config.channels + ch] * XRNS_OUTPUT_GAIN;
+            }
+        }
+
+        ma_free(PCM, NULL);
+
+        Sample->PCMAllocation = Allocation;
+        Sample->PCMFloat      = Planes + XRNS_PCM_GUARD_FRAMES;
+        Sample->PlaneStride   = (NumPlanes == 2) ? (int) PlaneStride : 0;
+    }
+    else if (ret == MA_SUCCESS)
+    {
+        size_t GuardSamples = XRNS_PCM_GUARD_FRAMES * Config.channels;
+        size_t  DataSamples = FrameCountOut * Config.channels;
+
+        int16_t *GuardedPCM = malloc(sizeof(int16_t) * (DataSamples + 2 * GuardSamples));
+        memset(GuardedPCM, 0, sizeof(int16_t) * GuardSamples);
+        memcpy(GuardedPCM + GuardSamples, PCM, sizeof(int16_t) * DataSamples);
+        memset(GuardedPCM + GuardSamples + DataSamples, 0, sizeof(int16_t) * GuardSamples);
+        ma_free(PCM, NULL);
+
+        Sample->PCMAllocation = GuardedPCM;
+        Sample->PCM           = GuardedPCM + GuardSamples;
+    }
+
+    Sample->SampleRateHz  = Config.sampleRate;
+    Sample->NumChannels   = Config.channels;
+    Sample->LengthSamples = FrameCountOut;
+    Sample->InstrumentNumber = InstrumentNumber;
+    Sample->SampleNumber  = SampleNumber;
+
+    TracyCZoneEnd(ctx);
+
+    return Sample;
+}
+
+int populateXRNSDocument
+    (galloc_ctx         *g
+    ,void               *mem
+    ,size_t              mem_sz
+    ,xrns_document      *xdoc
+    ,pooled_threads_ctx *Workers
+    ,unsigned int        LoadFlags
+    )
+{
+    char c[2048];
+    int i;
 
     TracyCZoneN(main_ctx, "Parse ZIP", 1);
 
@@ -3227,6 +4264,7 @@ int populateXRNSDocument(galloc_ctx *g, void *mem, size_t mem_sz, xrns_document
     zip_start_parsing(&zs, mem, mem_sz);
 
     xrns_xml_parse_desc ParseDesc;
+    memset(&ParseDesc, 0, sizeof(xrns_xml_parse_desc));
 
     do
     {
@@ -3237,17 +4275,12 @@ int populateXRNSDocument(galloc_ctx *g, void *mem, size_t mem_sz, xrns_document
 
         if (!strcmp(c, "Song.xml"))
         {
-            xrns_job Job;
-            Job.WorkFunction = (xrns_worker_fcn) populateInstrumentsAndNotes;
-            Job.Data         = &ParseDesc;
-            Job.FreeData     = NULL;
-
             ParseDesc.g          = g;
             ParseDesc.xml        = z.p_mem;
             ParseDesc.xml_length = z.Header.UncompressedSize;
             ParseDesc.xdoc       = xdoc;
 
-            AddToWorkTable(Decoding, Job);
+            AddSongXMLJobs(&ParseDesc, Decoding);
         }
         else
         {
@@ -3255,6 +4288,7 @@ int populateXRNSDocument(galloc_ctx *g, void *mem, size_t mem_sz, xrns_document
             populate_instrument_desc *SampleDesc = malloc(sizeof(populate_instrument_desc));
             SampleDesc->z    = z;
             SampleDesc->xdoc = xdoc;
+            SampleDesc->LoadFlags = LoadFlags;
             strncpy(SampleDesc->zipped_filename, c, 2048);
             Job.FreeData     = SampleDesc;
             Job.Data         = SampleDesc;
@@ -3270,14 +4304,35 @@ int populateXRNSDocument(galloc_ctx *g, void *mem, size_t mem_sz, xrns_document
     
     FarmPooledThreads(Workers, Decoding);
 
+    int bParsed = 1;
+
+    if (ParseDesc.xml)
+    {
+        bParsed = FinishSongXML(&ParseDesc);
+    }
+
     for (i = 0; i < Decoding->NumJobs; i++)
     {
         xrns_job *Job = &Decoding->Jobs[i];
         if (Job->FreeData)
         {
             xrns_sample *Sample = (xrns_sample *) Job->Result;
+            /* The sample's number comes from its name in the zip, which Song.xml doesn't have to agree with. */
+            if (   !bParsed
+                || (unsigned int) Sample->InstrumentNumber >= xdoc->NumInstruments
+                || (unsigned int) Sample->SampleNumber >= xdoc->Instruments[Sample->InstrumentNumber].NumSamples
+               )
+            {
+                if (Sample->PCMAllocation) free(Sample->PCMAllocation);
+                free(Sample);
+                continue;
+            }
+
             xrns_sample *Dest   = &xdoc->Instruments[Sample->InstrumentNumber].Samples[Sample->SampleNumber];
             Dest->PCM           = Sample->PCM;
+            Dest->PCMFloat      = Sample->PCMFloat;
+            Dest->PlaneStride   = Sample->PlaneStride;
+            Dest->PCMAllocation = Sample->PCMAllocation;
             Dest->SampleRateHz  = Sample->SampleRateHz;
             Dest->NumChannels   = Sample->NumChannels;
             Dest->LengthSamples = Sample->LengthSamples;
@@ -3290,718 +4345,1520 @@ int populateXRNSDocument(galloc_ctx *g, void *mem, size_t mem_sz, xrns_document
 
     TracyCZoneEnd(ctx);
 
-    return 1;
+    return bParsed;
 }
 
 /* ====================================================================================================================
  * ====================================================================================================================
  * ====================================================================================================================
- * XRNS Playback Engine 
+ * XRNS Song Cache
  * ====================================================================================================================
  */
 
-#define PITCHING_TABLE_LENGTH (193)
-static const double PitchingTable[PITCHING_TABLE_LENGTH] = 
+/* A song cache is a fully loaded xrns_document written out flat, so that loading it back skips inflating
+ * Song.xml, parsing it and the FLAC decoding. The file is:
+ *
+ *     xrns_cache_header
+ *     The document graph: every struct, array and string the document points to, 16 byte aligned, with
+ *     each pointer replaced by its offset from the start of the graph plus 1 (0 stays NULL).
+ *     The sample data: each sample's PCM or PCMFloat (guard frames included) at its offset from the
+ *     start of this section plus 1, which is what the sample's PCM or PCMFloat holds in the graph.
+ *
+ * The graph is copied into galloc memory and relocated in place. The baked envelope tables aren't
+ * stored, CreateXRNSPlaybackState() bakes them again. Caches are tied to the build that wrote them:
+ * the layout of the structs is checked on load, and a stale cache just fails to load. So does one
+ * with any offset or count that would take an array, string or sample outside of its section.
+ */
+#define XRNS_CACHE_VERSION             (3)
+#define XRNS_CACHE_ALIGNMENT           (16)
+
+typedef struct
 {
-    0.00390625,
-    0.00413852771234,
-    0.00438461737621,
-    0.00464534029298,
-    0.00492156660115,
-    0.00521421818035,
-    0.00552427172802,
-    0.00585276201905,
-    0.00620078535925,
-    0.00656950324417,
-    0.00696014623547,
-    0.00737401806783,
-    0.0078125,
-    0.00827705542468,
-    0.00876923475242,
-    0.00929068058596,
-    0.0098431332023,
-    0.0104284363607,
-    0.011048543456,
-    0.0117055240381,
-    0.0124015707185,
-    0.0131390064883,
-    0.0139202924709,
-    0.0147480361357,
-    0.015625,
-    0.0165541108494,
-    0.0175384695048,
-    0.0185813611719,
-    0.0196862664046,
-    0.0208568727214,
-    0.0220970869121,
-    0.0234110480762,
-    0.024803141437,
-    0.0262780129767,
-    0.0278405849419,
-    0.0294960722713,
-    0.03125,
-    0.0331082216987,
-    0.0350769390097,
-    0.0371627223438,
-    0.0393725328092,
-    0.0417137454428,
-    0.0441941738242,
-    0.0468220961524,
-    0.049606282874,
-    0.0525560259534,
-    0.0556811698838,
-    0.0589921445426,
-    0.0625,
-    0.0662164433975,
-    0.0701538780193,
-    0.0743254446877,
-    0.0787450656184,
-    0.0834274908856,
-    0.0883883476483,
-    0.0936441923048,
-    0.099212565748,
-    0.105112051907,
-    0.111362339768,
-    0.117984289085,
-    0.125,
-    0.132432886795,
-    0.140307756039,
-    0.148650889375,
-    0.157490131237,
-    0.166854981771,
-    0.176776695297,
-    0.18728838461,
-    0.198425131496,
-    0.210224103813,
-    0.222724679535,
-    0.23596857817,
-    0.25,
-    0.26486577359,
-    0.280615512077,
-    0.297301778751,
-    0.314980262474,
-    0.333709963543,
-    0.353553390593,
-    0.374576769219,
-    0.396850262992,
-    0.420448207627,
-    0.44544935907,
-    0.471937156341,
-    0.5,
-    0.52973154718,
-    0.561231024155,
-    0.594603557501,
-    0.629960524947,
-    0.667419927085,
-    0.707106781187,
-    0.749153538438,
-    0.793700525984,
-    0.840896415254,
-    0.89089871814,
-    0.943874312682,
-    1.0,
-    1.05946309436,
-    1.12246204831,
-    1.189207115,
-    1.25992104989,
-    1.33483985417,
-    1.41421356237,
-    1.49830707688,
-    1.58740105197,
-    1.68179283051,
-    1.78179743628,
-    1.88774862536,
-    2.0,
-    2.11892618872,
-    2.24492409662,
-    2.37841423001,
-    2.51984209979,
-    2.66967970834,
-    2.82842712475,
-    2.99661415375,
-    3.17480210394,
-    3.36358566101,
-    3.56359487256,
-    3.77549725073,
-    4.0,
-    4.23785237744,
-    4.48984819324,
-    4.75682846001,
-    5.03968419958,
-    5.33935941668,
-    5.65685424949,
-    5.99322830751,
-    6.34960420787,
-    6.72717132203,
-    7.12718974512,
-    7.55099450145,
-    8.0,
-    8.47570475487,
-    8.97969638647,
-    9.51365692002,
-    10.0793683992,
-    10.6787188334,
-    11.313708499,
-    11.986456615,
-    12.6992084157,
-    13.4543426441,
-    14.2543794902,
-    15.1019890029,
-    16.0,
-    16.9514095097,
-    17.9593927729,
-    19.02731384,
-    20.1587367983,
-    21.3574376667,
-    22.627416998,
-    23.97291323,
-    25.3984168315,
-    26.9086852881,
-    28.5087589805,
-    30.2039780058,
-    32.0,
-    33.9028190195,
-    35.9187855459,
-    38.0546276801,
-    40.3174735966,
-    42.7148753334,
-    45.2548339959,
-    47.9458264601,
-    50.796833663,
-    53.8173705762,
-    57.017517961,
-    60.4079560116,
-    64.0,
-    67.805638039,
-    71.8375710918,
-    76.1092553602,
-    80.6349471933,
-    85.4297506669,
-    90.5096679919,
-    95.8916529201,
-    101.593667326,
-    107.634741152,
-    114.035035922,
-    120.815912023,
-    128.0,
-    135.611276078,
-    143.675142184,
-    152.21851072,
-    161.269894387,
-    170.859501334,
-    181.019335984,
-    191.78330584,
-    203.187334652,
-    215.269482305,
-    228.070071844,
-    241.631824047,
-    256.0
-};
+    char     Magic[8];
+    uint32_t Version;
+    uint32_t PointerSize;
+    uint32_t LayoutSizes[8];
+    uint64_t GraphOffset;
+    uint64_t GraphBytes;
+    uint64_t DocumentOffset;
+    uint64_t SampleDataOffset;
+    uint64_t SampleDataBytes;
+} xrns_cache_header;
+
+static void CacheLayoutSizes(uint32_t *LayoutSizes)
+{
+    LayoutSizes[0] = sizeof(xrns_document);
+    LayoutSizes[1] = sizeof(xrns_instrument);
+    LayoutSizes[2] = sizeof(xrns_sample);
+    LayoutSizes[3] = sizeof(xrns_envelope);
+    LayoutSizes[4] = sizeof(xrns_modulation_set);
+    LayoutSizes[5] = sizeof(xrns_pattern);
+    LayoutSizes[6] = sizeof(xrns_track);
+    LayoutSizes[7] = sizeof(xrns_track_desc) + sizeof(dsp_effect_desc) + sizeof(xrns_note);
+}
 
-static const float PianoPitches[120] = 
+/* Bytes of a sample's PCM or PCMFloat, guard frames included, laid out as populateInstrumentSample() does. */
+static size_t CacheSampleDataBytes(xrns_sample *Sample)
 {
-    25.9565f,
-    27.5000f,
-    29.1352f,
-    30.8677f,
-    32.7032f,
-    34.6478f,
-    36.7081f,
-    38.8909f,
-    41.2034f,
-    43.6535f,
-    46.2493f,
-    48.9994f,
-    51.9131f,
-    55.0000f,
-    58.2705f,
-    61.7354f,
-    65.4064f,
-    69.2957f,
-    73.4162f,
-    77.7817f,
-    82.4069f,
-    87.3071f,
-    92.4986f,
-    97.9989f,
-    103.8262f,
-    110.0000f,
-    116.5409f,
-    123.4708f,
-    130.8128f,
-    138.5913f,
-    146.8324f,
-    155.5635f,
-    164.8138f,
-    174.6141f,
-    184.9972f,
-    195.9977f,
-    207.6523f,
-    220.0000f,
-    233.0819f,
-    246.9417f,
-    261.6256f,
-    277.1826f,
-    293.6648f,
-    311.1270f,
-    329.6276f,
-    349.2282f,
-    369.9944f,
-    391.9954f,
-    415.3047f,
-    440.0000f,
-    466.1638f,
-    493.8833f,
-    523.2511f,
-    554.3653f,
-    587.3295f,
-    622.2540f,
-    659.2551f,
-    698.4565f,
-    739.9888f,
-    783.9909f,
-    830.6094f,
-    880.0000f,
-    932.3275f,
-    987.7666f,
-    1046.5023f,
-    1108.7305f,
-    1174.6591f,
-    1244.5079f,
-    1318.5102f,
-    1396.9129f,
-    1479.9777f,
-    1567.9817f,
-    1661.2188f,
-    1760.0000f,
-    1864.6550f,
-    1975.5332f,
-    2093.0045f,
-    2217.4610f,
-    2349.3181f,
-    2489.0159f,
-    2637.0205f,
-    2793.8259f,
-    2959.9554f,
-    3135.9635f,
-    3322.4376f,
-    3520.0000f,
-    3729.3101f,
-    3951.0664f,
-    4186.0090f,
-    4434.9221f,
-    4698.6363f,
-    4978.0317f,
-    5274.0409f,
-    5587.6517f,
-    5919.9108f,
-    6271.9270f,
-    6644.8752f,
-    7040.0000f,
-    7458.6202f,
-    7902.1328f,
-    8372.0181f,
-    8869.8442f,
-    9397.2726f,
-    9956.0635f,
-    10548.0818f,
-    11175.3034f,
-    11839.8215f,
-    12543.8540f,
-    13289.7503f,
-    14080.0000f,
-    14917.2404f,
-    15804.2656f,
-    16744.0362f,
-    17739.6884f,
-    18794.5451f,
-    19912.1270f,
-    21096.1636f,
-    22350.6068f,
-    23679.6431f,
-    25087.7079f
-};
+    if (Sample->PCMFloat)
+    {
+        size_t PlaneStride = ((size_t) Sample->LengthSamples + 2 * XRNS_PCM_GUARD_FRAMES + 7) & ~((size_t) 7);
+        size_t NumPlanes   = (Sample->NumChannels == 2) ? 2 : 1;
 
-// @Optimization: Remove this conditional.
-#define XRNS_ACCESS_STEREO_SAMPLE(x) ((x >= 0 && x < MaxLengthSamples*2) ? pcm[x] : 0)
-#define XRNS_ACCESS_MONO_SAMPLE(x) ((x >= 0 && x < MaxLengthSamples) ? pcm[x] : 0)
+        return sizeof(float) * PlaneStride * NumPlanes;
+    }
 
-typedef struct
+    if (Sample->PCM)
+    {
+        return sizeof(int16_t) * ((size_t) Sample->LengthSamples + 2 * XRNS_PCM_GUARD_FRAMES) * Sample->NumChannels;
+    }
+
+    return 0;
+}
+
+static char CachePadding[XRNS_CACHE_ALIGNMENT];
+
+static void *CacheAppend(xrns_growing_buffer *Buf, void *Mem, size_t Sz)
 {
-    float Left;
-    float Right;
-} xrns_panning_gains;
+    size_t Offset;
 
-typedef struct
+    if (!Mem || !Sz) return NULL;
+
+    xrns_growing_buffer_append(Buf, CachePadding, (XRNS_CACHE_ALIGNMENT - (Buf->CurrentSize % XRNS_CACHE_ALIGNMENT)) % XRNS_CACHE_ALIGNMENT);
+
+    Offset = Buf->CurrentSize;
+    xrns_growing_buffer_append(Buf, Mem, Sz);
+
+    return (void *) (uintptr_t) (Offset + 1);
+}
+
+static void *CacheAppendString(xrns_growing_buffer *Buf, char *String)
 {
-    float Val;
-    float Target;
-    float alpha;
-} LerpFloat;
+    return String ? CacheAppend(Buf, String, strlen(String) + 1) : NULL;
+}
 
+/* One section of a cache being loaded. bBad is set by the first offset that doesn't fit in it.
+ *
+ * In the graph, every object was written on its own XRNS_CACHE_ALIGNMENT aligned lines and nothing is
+ * pointed to twice. Claimed marks the lines that have been resolved so far, so that a second pointer 
+ * into an object can't get its pointers relocated again, or let one object's fields land on another's
+ * after they've been checked. Claimed is NULL for the sample data, which is only ever copied out.
+ */
 typedef struct
 {
-    double        p;
-    unsigned int  PrevPointIdx;
-    char          PlaybackDirection;
-    char          bSustaining;
-} xrns_envelope_playback_state;
+    char          *Base;
+    size_t         Bytes;
+    unsigned char *Claimed;
+    int            bBad;
+} xrns_cache_section;
 
-typedef struct
+static void CacheClaim(xrns_cache_section *Section, size_t Start, size_t Bytes)
 {
-    /* Envelope Positions */
-    xrns_envelope_playback_state VolumeEnvelope;
-    xrns_envelope_playback_state PanningEnvelope;
-    xrns_envelope_playback_state PitchEnvelope;
+    size_t Line;
 
-    char         Active;
-    char         bPlaying;
+    if (!Section->Claimed || !Bytes) return;
 
-    char         bMapped;
+    for (Line = Start / XRNS_CACHE_ALIGNMENT; Line <= (Start + Bytes - 1) / XRNS_CACHE_ALIGNMENT; Line++)
+    {
+        if (Section->Claimed[Line]) Section->bBad = 1;
+        Section->Claimed[Line] = 1;
+    }
+}
 
-    /* used to trigger the stuff before the 1st slice, if S00 is used on
-     * the "root" sample of a sliced instrument.
-     */
-    char         bPlay0Slice;
+/* Resolves the offset of Count objects of Size bytes. NULL stays NULL, unless there should be 
+ * something there. Anything that would run off the end of the section, or onto something already 
+ * resolved, resolves to NULL and marks the section bad.
+ */
+static void *CacheResolve(xrns_cache_section *Section, void *Offset, size_t Count, size_t Size)
+{
+    size_t Start = (size_t) (uintptr_t) Offset - 1;
 
-    double       PlaybackPosition;
+    if (!Offset)
+    {
+        if (Count && Size) Section->bBad = 1;
+        return NULL;
+    }
 
-    unsigned int CurrentSample;
-    unsigned int CurrentBaseNote;
-    unsigned int SamplesPlayedFor;
-    char         PlaybackDirection;
+    if (   Section->bBad
+        || Start >= Section->Bytes
+        || (Section->Claimed && Start % XRNS_CACHE_ALIGNMENT)
+        || (Size && Count > (Section->Bytes - Start) / Size)
+       )
+    {
+        Section->bBad = 1;
+        return NULL;
+    }
 
-    double       SxxStartPosition;
-    char         SxxPlaybackDirection;
+    CacheClaim(Section, Start, Count * Size);
 
-    /* Set the bounds on a sample,
-     * the most interesting case is when a slice of
-     * a non-aliased sliced instrument (the base sample)
-     * is triggered. There are actually three different
-     * points the sample may end at depending on the playback
-     * direction.
-     */
-    float        BackPosition0;
-    float        BackPosition1;
-    float        FrontPosition0;
+    return Section->bBad ? NULL : Section->Base + Start;
+}
 
-    int          CrossFade;
-    int          CrossFadeDuration;
-    int          IntroCrossFade;
-    int          IntroCrossFadeDuration;
+static char *CacheResolveString(xrns_cache_section *Section, void *Offset)
+{
+    char *String = CacheResolve(Section, Offset, 0, 0);
+    char *End;
 
-    char         bIntroIsCrossFading;
-    char         bIsCrossFading;
+    if (!String) return NULL;
 
-} xrns_sample_playback_state;
+    End = memchr(String, 0, Section->Bytes - (String - Section->Base));
 
-typedef struct
+    if (!End)
+    {
+        Section->bBad = 1;
+        return NULL;
+    }
+
+    CacheClaim(Section, String - Section->Base, End - String + 1);
+
+    return Section->bBad ? NULL : String;
+}
+
+/* Writing works on copies of each array, children first, so the pointers in the copy can be replaced 
+ * with the offsets the children were written at before the copy itself is written.
+ */
+static void CacheWriteEnvelope(xrns_growing_buffer *Graph, xrns_envelope *Envelope)
 {
-    xrns_sample_playback_state
-        PlaybackStates[XRNS_MAX_SAMPLES_PLAYING];
+    Envelope->Points      = CacheAppend(Graph, Envelope->Points, sizeof(xrns_point) * Envelope->NumPoints);
+    Envelope->Table       = NULL;
+    Envelope->TableLength = 0;
+    Envelope->TableScale  = 0.0f;
+}
 
-    char         Active;
-    char         bPlaying;
-    
-    unsigned int CurrentNote;
-    unsigned int CurrentInstrument;
-    LerpFloat    CurrentVolume;
+static void CacheReadEnvelope(xrns_cache_section *Graph, xrns_envelope *Envelope)
+{
+    Envelope->Points      = CacheResolve(Graph, Envelope->Points, Envelope->NumPoints, sizeof(xrns_point));
+    Envelope->Table       = NULL;
+    Envelope->TableLength = 0;
+}
 
-    xrns_note    OriginalNote;
+static void *CacheWriteEnvelopes(xrns_growing_buffer *Graph, xrns_envelope *Envelopes, unsigned int NumEnvelopes)
+{
+    unsigned int i;
+    void *Offset;
+    xrns_envelope *Copy;
 
-    float        SavedPitchMod;
+    if (!Envelopes || !NumEnvelopes) return NULL;
 
-    char         bStillOnHomeRow;
+    Copy = malloc(sizeof(xrns_envelope) * NumEnvelopes);
+    memcpy(Copy, Envelopes, sizeof(xrns_envelope) * NumEnvelopes);
 
-    LerpFloat    CurrentPanning;
-    char         bPanningSlide;
-    float        PanningSlideAmount;
-  
-    /* Qx commands in their various forms will cause samplers
-     * to delay their start. 
-     */
-    int          QxValue;
-    int          QCounter;
-    int          FracDelay;
-    char         bQPrepped;
-    char         bQReadyForCalc;
+    for (i = 0; i < NumEnvelopes; i++)
+    {
+        CacheWriteEnvelope(Graph, &Copy[i]);
+    }
 
-    /* Pattern commands that effect the active samplers:
-     *
-     * D & U: These change the slide destination (a relative offset).
-     * V: Sets the vibrato settings (additive, resets every row)
-     *
-     */
+    Offset = CacheAppend(Graph, Copy, sizeof(xrns_envelope) * NumEnvelopes);
+    free(Copy);
 
-    char  bIsSliding;
-    float CurrentSlideOffset;
-    float CurrentSlideStart;
-    float CurrentSlideDest;
+    return Offset;
+}
 
-    /* Volume slide.
-     */
-    char  bVolumeIsSliding;
-    float VolumeSlideOffset;
-    float VolumeSlideStart;
-    int   VolumeSlideDest;
-    char  bVolumeSlideStartedWithActiveNote;
+static void *CacheWriteInstruments
+    (xrns_growing_buffer *Graph
+    ,xrns_growing_buffer *SampleData
+    ,xrns_instrument     *Instruments
+    ,unsigned int         NumInstruments
+    )
+{
+    unsigned int i, j;
+    void *Offset;
+    xrns_instrument *Copy;
 
-    char  SlideTick;
+    if (!Instruments || !NumInstruments) return NULL;
 
-    int   CurrentVibratoSpeed;
-    int   CurrentVibratoDepth;
-    float VibratoTick;
-    float VibratoOffset;
+    Copy = malloc(sizeof(xrns_instrument) * NumInstruments);
+    memcpy(Copy, Instruments, sizeof(xrns_instrument) * NumInstruments);
 
-    char  bIsNoteOff;
+    for (i = 0; i < NumInstruments; i++)
+    {
+        xrns_instrument *Instrument = &Copy[i];
+        xrns_sample     *Samples    = malloc(sizeof(xrns_sample) * (Instrument->NumSamples + 1));
+        xrns_modulation_set *ModulationSets = malloc(sizeof(xrns_modulation_set) * (Instrument->NumModulationSets + 1));
 
-    /* Cx command cuts the volume to Volume on Tick Offset
-     */
-    int           CxVolume;
-    int           CxOffset;
-    char          bCxKill;
+        memcpy(Samples, Instrument->Samples, sizeof(xrns_sample) * Instrument->NumSamples);
+        memcpy(ModulationSets, Instrument->ModulationSets, sizeof(xrns_modulation_set) * Instrument->NumModulationSets);
 
-    /* Re-triggers.
-     */
-    int           RetriggerRate;
-    int           RetriggerVolumeIsAdditive;
-    float         RetriggerVolume;
-    unsigned int  WetVolume;
-    char          bRetriggerOnZero;
+        for (j = 0; j < Instrument->NumSamples; j++)
+        {
+            xrns_sample *Sample = &Samples[j];
+            size_t Bytes = CacheSampleDataBytes(Sample);
 
-    /* Tremolo
-     */
-    int           CurrentTremoloSpeed;
-    int           CurrentTremoloDepth;
-    float         TremoloTick;
-    float         TremoloAmount;
+            Sample->Name = CacheAppendString(Graph, Sample->Name);
 
-    /* Pitch gliding.
-     */
-    char          bInstantSlide;
-    int           PitchSlideSpeed;
-    unsigned int  PitchGoal16th;
-    char          bIsPitchGliding;
-    float         GlideNote; /* units of 16th semitones */
-    char          bHitWithGCommand;
+            if (Sample->PCMFloat)
+            {
+                Sample->PCMFloat = CacheAppend(SampleData, Sample->PCMFloat - XRNS_PCM_GUARD_FRAMES, Bytes);
+            }
+            else if (Sample->PCM)
+            {
+                Sample->PCM = CacheAppend(SampleData, Sample->PCM - XRNS_PCM_GUARD_FRAMES * Sample->NumChannels, Bytes);
+            }
 
-    /* Temporary storage for the correct computation of
-     * the Bxx and Sxx commands.
-     */
-    int           BxxValue;
-    int           SxxValue;
+            Sample->PCMAllocation = NULL;
+        }
 
-} xrns_sampler;
+        for (j = 0; j < Instrument->NumModulationSets; j++)
+        {
+            CacheWriteEnvelope(Graph, &ModulationSets[j].Volume);
+            CacheWriteEnvelope(Graph, &ModulationSets[j].Panning);
+            CacheWriteEnvelope(Graph, &ModulationSets[j].Pitch);
+        }
 
-typedef struct
-{
-    int          MostRecentlyAllocatedSampler;
-    int          MostRecentlyPlayingSampler;
-    int          PitchToGlideTo;
-    unsigned int NumSamplesOfXFade;
-    xrns_sampler Samplers[XRNS_MAX_SAMPLERS_PER_COLUMN];
-} xrns_sampler_bank;
+        Instrument->Name            = CacheAppendString(Graph, Instrument->Name);
+        Instrument->SampleSplitMaps = CacheAppend(Graph, Instrument->SampleSplitMaps, sizeof(xrns_ssm) * Instrument->NumSampleSplitMaps);
+        Instrument->SliceRegions    = CacheAppend(Graph, Instrument->SliceRegions, sizeof(unsigned int) * Instrument->NumSliceRegions);
+        Instrument->Samples         = CacheAppend(Graph, Samples, sizeof(xrns_sample) * Instrument->NumSamples);
+        Instrument->ModulationSets  = CacheAppend(Graph, ModulationSets, sizeof(xrns_modulation_set) * Instrument->NumModulationSets);
 
-typedef struct 
-{
-    LerpFloat        CurrentPreVolume;
-    LerpFloat        CurrentGamePostVolume;
-    LerpFloat        CurrentPanning;
-    float            CurrentPostVolume;
-    float            CurrentWidth;
-    char             bIsMuted;
-    int              CurrentNoteIndex;
-    unsigned int     LastInstrumentToBeUsed[XRNS_MAX_COLUMNS_PER_TRACK];
-    unsigned int     LastEffectToBeUsed[XRNS_MAX_COLUMNS_PER_TRACK + 1][XRNS_STORED_EFFECT_NUM];
-    unsigned int     LastVolumeToBeUsed[XRNS_MAX_COLUMNS_PER_TRACK];
-    unsigned int     LastPanningToBeUsed[XRNS_MAX_COLUMNS_PER_TRACK];
-    int             *DSPEffectEnableFlags;
-    dsp_effect      *DSPEffects;
-    xrns_ringbuffer  RawAudio;
-} xrns_track_playback_state;
+        free(Samples);
+        free(ModulationSets);
+    }
 
-#pragma pack(push, 1) 
-typedef struct
-{
-    int32_t Value;
-    int32_t Octave;
-    int32_t Row;
-    int32_t Column;
-    int32_t Instrument;
-    int32_t Track;
-} xrns_note_from_caller;
-#pragma pack(pop)
+    Offset = CacheAppend(Graph, Copy, sizeof(xrns_instrument) * NumInstruments);
+    free(Copy);
 
-struct _XRNSPlaybackState
+    return Offset;
+}
+
+static void *CacheWritePatterns(xrns_growing_buffer *Graph, xrns_pattern *Patterns, unsigned int NumPatterns, unsigned int NumTracks)
 {
-    char         bSongStopped;
-    double       OutputSampleRate;
+    unsigned int i, j;
+    void *Offset;
+    xrns_pattern *Copy;
+    xrns_track   *Tracks;
 
-    float        CurrentBPMAugmentation;
+    if (!Patterns || !NumPatterns) return NULL;
 
-    /* Caller can redirect flow of the song by setting the next
-     * pattern index to something.
-     */
-    int          PatternHasBeenCued;
-    unsigned int CuedPatternIndex;
+    Copy   = malloc(sizeof(xrns_pattern) * NumPatterns);
+    Tracks = malloc(sizeof(xrns_track) * (NumTracks + 1));
+    memcpy(Copy, Patterns, sizeof(xrns_pattern) * NumPatterns);
 
-    /* These are inclusive, and are used to restrict the flow
-     * through the pattern sequence.
-     */
-    unsigned int PatternSequenceLoopStart;
-    unsigned int PatternSequenceLoopEnd;
+    for (i = 0; i < NumPatterns; i++)
+    {
+        xrns_pattern *Pattern = &Copy[i];
 
-    /* These "Next" things are for someone wanting to know what the next row is, so
-     * it can be mutated beforehand.
-     */
-    unsigned int NextPatternIndex;
-    unsigned int NextRowIndex;
+        memcpy(Tracks, Pattern->Tracks, sizeof(xrns_track) * NumTracks);
 
-    unsigned int CurrentPatternIndex;
-    unsigned int CurrentRow;
+        for (j = 0; j < NumTracks; j++)
+        {
+            Tracks[j].Notes     = CacheAppend(Graph, Tracks[j].Notes, sizeof(xrns_note) * Tracks[j].NumNotes);
+            Tracks[j].Envelopes = CacheWriteEnvelopes(Graph, Tracks[j].Envelopes, Tracks[j].NumEnvelopes);
+        }
 
-    unsigned int CurrentTick;
-    float        CurrentBPM;
-    unsigned int CurrentLinesPerBeat;
-    unsigned int CurrentTicksPerLine;
+        Pattern->Name   = CacheAppendString(Graph, Pattern->Name);
+        Pattern->Tracks = CacheAppend(Graph, Tracks, sizeof(xrns_track) * NumTracks);
+    }
 
-    double       CurrentTickDuration;
-    double       CurrentLineDuration;
+    Offset = CacheAppend(Graph, Copy, sizeof(xrns_pattern) * NumPatterns);
+    free(Tracks);
+    free(Copy);
 
-    unsigned int CurrentSample;
+    return Offset;
+}
 
-    char         bFirstPlay;
-    char         bEvenEarlierFirstPlay;
+int SaveSongCache(xrns_document *xdoc, char *p_filename)
+{
+    TracyCZoneN(ctx, "Save Song Cache", 1);
 
-    /* this is an offset in fractional samples that aligns
-     * the next pattern of notes.
-     */
-    double       XRNSGridOffset;
+    unsigned int i;
+    xrns_growing_buffer Graph;
+    xrns_growing_buffer SampleData;
+    xrns_cache_header   Header;
+    xrns_document       Document = *xdoc;
+    FILE *F;
+    int bWritten;
 
-    double       LocationOfNextTick;
-    double       LocationOfNextLine;
+    xrns_growing_buffer_init(&Graph, Megabytes(1));
+    xrns_growing_buffer_init(&SampleData, Megabytes(4));
 
-    double       BaseOfCurrentlyPlayingLine;
+    /* Keep offset 0 unused, so no pointer gets written as 1 by accident of it being first. */
+    xrns_growing_buffer_append(&Graph, CachePadding, XRNS_CACHE_ALIGNMENT);
+    xrns_growing_buffer_append(&SampleData, CachePadding, XRNS_CACHE_ALIGNMENT);
 
-    xrns_document *xdoc;
+    Document.SongName    = CacheAppendString(&Graph, xdoc->SongName);
+    Document.Artist      = CacheAppendString(&Graph, xdoc->Artist);
+    Document.Instruments = CacheWriteInstruments(&Graph, &SampleData, xdoc->Instruments, xdoc->NumInstruments);
+    Document.PatternPool = CacheWritePatterns(&Graph, xdoc->PatternPool, xdoc->NumPatterns, xdoc->NumTracks);
 
-    /* Each column in each track will need some state for what is currently playing.
-     * We will use a sampler per column per track. 
-     *       SamplerBanks[Track] -> (SamplerBank x NumCols)
-     */
-    xrns_sampler_bank **SamplerBanks;
+    if (xdoc->PatternSequence && xdoc->PatternSequenceLength)
+    {
+        xrns_pattern_sequence_entry *Sequence = malloc(sizeof(xrns_pattern_sequence_entry) * xdoc->PatternSequenceLength);
+        memcpy(Sequence, xdoc->PatternSequence, sizeof(xrns_pattern_sequence_entry) * xdoc->PatternSequenceLength);
 
-    unsigned int NumSamplesOfXFade;
-    xrns_track_playback_state **TrackStates;
+        for (i = 0; i < xdoc->PatternSequenceLength; i++)
+        {
+            Sequence[i].SectionName = CacheAppendString(&Graph, Sequence[i].SectionName);
+            Sequence[i].MutedTracks = CacheAppend(&Graph, Sequence[i].MutedTracks, sizeof(unsigned int) * Sequence[i].NumMutedTracks);
+        }
 
-    galloc_ctx *g;
+        Document.PatternSequence = CacheAppend(&Graph, Sequence, sizeof(xrns_pattern_sequence_entry) * xdoc->PatternSequenceLength);
+        free(Sequence);
+    }
 
-    unsigned int SerializedSongLengthInBytes;
-    char         bSongHasBeenSerialized;
-    void        *SerializedSongMemory;
+    if (xdoc->Tracks && xdoc->NumTracks)
+    {
+        xrns_track_desc *Tracks = malloc(sizeof(xrns_track_desc) * xdoc->NumTracks);
+        memcpy(Tracks, xdoc->Tracks, sizeof(xrns_track_desc) * xdoc->NumTracks);
 
-    xrns_ringbuffer Output;
+        for (i = 0; i < xdoc->NumTracks; i++)
+        {
+            Tracks[i].Name           = CacheAppendString(&Graph, Tracks[i].Name);
+            Tracks[i].DSPEffectDescs = CacheAppend(&Graph, Tracks[i].DSPEffectDescs, sizeof(dsp_effect_desc) * Tracks[i].NumDSPEffectUnits);
+        }
 
-    xrns_note_from_caller *CallerNotes;
-    unsigned int           NumCallerNotes;
+        Document.Tracks = CacheAppend(&Graph, Tracks, sizeof(xrns_track_desc) * xdoc->NumTracks);
+        free(Tracks);
+    }
 
-    xrns_sampler_info ActiveSamplers[XRNS_ACTIVE_SAMPLER_COUNT];
-    unsigned int      NumActiveSamplers;
+    memset(&Header, 0, sizeof(xrns_cache_header));
+    memcpy(Header.Magic, "XRNSCACH", 8);
+    Header.Version          = XRNS_CACHE_VERSION;
+    Header.PointerSize      = sizeof(void *);
+    CacheLayoutSizes(Header.LayoutSizes);
+    Header.DocumentOffset   = (uintptr_t) CacheAppend(&Graph, &Document, sizeof(xrns_document)) - 1;
+    Header.GraphOffset      = sizeof(xrns_cache_header);
+    Header.GraphBytes       = Graph.CurrentSize;
+    Header.SampleDataOffset = Header.GraphOffset + Header.GraphBytes;
+    Header.SampleDataBytes  = SampleData.CurrentSize;
 
-    void *ScratchMemory;
+    F = fopen(p_filename, "wb");
+    bWritten = F
+            && fwrite(&Header, 1, sizeof(xrns_cache_header), F) == sizeof(xrns_cache_header)
+            && fwrite(Graph.Memory, 1, Graph.CurrentSize, F) == Graph.CurrentSize
+            && fwrite(SampleData.Memory, 1, SampleData.CurrentSize, F) == SampleData.CurrentSize;
+    if (F) fclose(F);
 
-    pooled_threads_ctx *Workers;
+    xrns_growing_buffer_free(&Graph);
+    xrns_growing_buffer_free(&SampleData);
 
-    int bStopAtEndOfSong;
-};
+    TracyCZoneEnd(ctx);
 
-unsigned int NoteToHzAssumingA440(int note_id)
+    return bWritten;
+}
+
+/* Fills in xdoc from a cache written by SaveSongCache(), returns 0 if it's not a cache this build can load. */
+int LoadSongCache(galloc_ctx *g, void *mem, size_t mem_sz, xrns_document *xdoc)
 {
-    if (note_id > 0 && note_id < 120)
+    TracyCZoneN(ctx, "Load Song Cache", 1);
+
+    unsigned int i, j, k;
+    xrns_cache_header  Header;
+    uint32_t           LayoutSizes[8];
+    xrns_cache_section Graph;
+    xrns_cache_section SampleData;
+
+    if (mem_sz < sizeof(xrns_cache_header))
     {
-        return PianoPitches[note_id];
+        TracyCZoneEnd(ctx);
+        return 0;
     }
 
-    return 0;
-}
-
-void ResetLerp(LerpFloat *L, float Val, float alpha)
-{
-    L->Val    = Val;
-    L->Target = Val;
-    L->alpha  = alpha;
-}
+    memcpy(&Header, mem, sizeof(xrns_cache_header));
+    CacheLayoutSizes(LayoutSizes);
 
-void RunLerp(LerpFloat *L)
-{
-    if (fabsf(L->Val - L->Target) < 1.0e-6)
+    if (   memcmp(Header.Magic, "XRNSCACH", 8)
+        || Header.Version != XRNS_CACHE_VERSION
+        || Header.PointerSize != sizeof(void *)
+        || memcmp(Header.LayoutSizes, LayoutSizes, sizeof(LayoutSizes))
+        || Header.GraphBytes > mem_sz || Header.GraphOffset > mem_sz - Header.GraphBytes
+        || Header.SampleDataBytes > mem_sz || Header.SampleDataOffset > mem_sz - Header.SampleDataBytes
+        || Header.GraphBytes < sizeof(xrns_document)
+        || Header.DocumentOffset > Header.GraphBytes - sizeof(xrns_document)
+        || Header.GraphBytes + 64 > galloc_bytes_left(g)
+       )
     {
-        L->Val = L->Target;
+        TracyCZoneEnd(ctx);
+        return 0;
     }
 
-    L->Val = L->Val * L->alpha + L->Target * (1.0f - L->alpha);
-}
+    Graph.Base         = galloc_aligned(g, Header.GraphBytes, 64);
+    Graph.Bytes        = Header.GraphBytes;
+    Graph.Claimed      = calloc(Header.GraphBytes / XRNS_CACHE_ALIGNMENT + 1, 1);
+    Graph.bBad         = !Graph.Claimed;
+    SampleData.Base    = (char *) mem + Header.SampleDataOffset;
+    SampleData.Bytes   = Header.SampleDataBytes;
+    SampleData.Claimed = NULL;
+    SampleData.bBad    = 0;
 
-/* Panning law for the panning column is log: 3.0 + 10.0 * log10(xx/128)
- * where xx goes from 0 to 128 (all Left to all Right).
- *
- * Special case for xx == 64, dead center, we force the gains to be 1.0 and 1.0.
- * 
- */
-xrns_panning_gains PanningGainFromZeroToOne(float step)
-{
-    xrns_panning_gains g;
-    if (step < 1e-6f)
+    memcpy(Graph.Base, (char *) mem + Header.GraphOffset, Header.GraphBytes);
+
+    *xdoc = *(xrns_document *) (Graph.Base + Header.DocumentOffset);
+    CacheClaim(&Graph, Header.DocumentOffset, sizeof(xrns_document));
+
+    xdoc->SongName        = CacheResolveString(&Graph, xdoc->SongName);
+    xdoc->Artist          = CacheResolveString(&Graph, xdoc->Artist);
+    xdoc->Instruments     = CacheResolve(&Graph, xdoc->Instruments, xdoc->NumInstruments, sizeof(xrns_instrument));
+    xdoc->PatternPool     = CacheResolve(&Graph, xdoc->PatternPool, xdoc->NumPatterns, sizeof(xrns_pattern));
+    xdoc->PatternSequence = CacheResolve(&Graph, xdoc->PatternSequence, xdoc->PatternSequenceLength, sizeof(xrns_pattern_sequence_entry));
+    xdoc->Tracks          = CacheResolve(&Graph, xdoc->Tracks, xdoc->NumTracks, sizeof(xrns_track_desc));
+
+    for (i = 0; !Graph.bBad && i < xdoc->NumInstruments; i++)
     {
-        g.Left  = 1.4125f;
-        g.Right = 0.0f;
-        return g;
+        xrns_instrument *Instrument = &xdoc->Instruments[i];
+
+        Instrument->Name            = CacheResolveString(&Graph, Instrument->Name);
+        Instrument->Samples         = CacheResolve(&Graph, Instrument->Samples, Instrument->NumSamples, sizeof(xrns_sample));
+        Instrument->SampleSplitMaps = CacheResolve(&Graph, Instrument->SampleSplitMaps, Instrument->NumSampleSplitMaps, sizeof(xrns_ssm));
+        Instrument->SliceRegions    = CacheResolve(&Graph, Instrument->SliceRegions, Instrument->NumSliceRegions, sizeof(unsigned int));
+        Instrument->ModulationSets  = CacheResolve(&Graph, Instrument->ModulationSets, Instrument->NumModulationSets, sizeof(xrns_modulation_set));
+
+        for (j = 0; !Graph.bBad && j < Instrument->NumSamples; j++)
+        {
+            xrns_sample *Sample = &Instrument->Samples[j];
+
+            Sample->Name          = CacheResolveString(&Graph, Sample->Name);
+            Sample->PCMAllocation = NULL;
+
+            /* Only checked here, the sample data is copied out once everything else has been. */
+            if ((Sample->PCMFloat || Sample->PCM) && (Sample->NumChannels < 1 || Sample->NumChannels > 2))
+                Graph.bBad = 1;
+            else if (Sample->PCMFloat)
+                CacheResolve(&SampleData, Sample->PCMFloat, CacheSampleDataBytes(Sample), 1);
+            else if (Sample->PCM)
+                CacheResolve(&SampleData, Sample->PCM, CacheSampleDataBytes(Sample), 1);
+        }
+
+        for (j = 0; !Graph.bBad && j < Instrument->NumModulationSets; j++)
+        {
+            CacheReadEnvelope(&Graph, &Instrument->ModulationSets[j].Volume);
+            CacheReadEnvelope(&Graph, &Instrument->ModulationSets[j].Panning);
+            CacheReadEnvelope(&Graph, &Instrument->ModulationSets[j].Pitch);
+        }
     }
-    else if (fabsf(step - 0.5f) < 1e-6f)
+
+    for (i = 0; !Graph.bBad && i < xdoc->NumPatterns; i++)
     {
-        g.Left  = 1.0f;
-        g.Right = 1.0f;
-        return g;
+        xrns_pattern *Pattern = &xdoc->PatternPool[i];
+
+        Pattern->Name   = CacheResolveString(&Graph, Pattern->Name);
+        Pattern->Tracks = CacheResolve(&Graph, Pattern->Tracks, xdoc->NumTracks, sizeof(xrns_track));
+
+        for (j = 0; !Graph.bBad && j < xdoc->NumTracks; j++)
+        {
+            xrns_track *Track = &Pattern->Tracks[j];
+
+            Track->Notes     = CacheResolve(&Graph, Track->Notes, Track->NumNotes, sizeof(xrns_note));
+            Track->Envelopes = CacheResolve(&Graph, Track->Envelopes, Track->NumEnvelopes, sizeof(xrns_envelope));
+
+            for (k = 0; !Graph.bBad && k < Track->NumEnvelopes; k++)
+            {
+                CacheReadEnvelope(&Graph, &Track->Envelopes[k]);
+            }
+        }
     }
-    else if (fabsf(step - 1.0f) < 1e-6f)
+
+    for (i = 0; !Graph.bBad && i < xdoc->PatternSequenceLength; i++)
     {
-        g.Left  = 0.0f;
-        g.Right = 1.4125f;
-        return g;
+        xrns_pattern_sequence_entry *Entry = &xdoc->PatternSequence[i];
+
+        Entry->SectionName = CacheResolveString(&Graph, Entry->SectionName);
+        Entry->MutedTracks = CacheResolve(&Graph, Entry->MutedTracks, Entry->NumMutedTracks, sizeof(unsigned int));
+
+        if (Entry->PatternIdx >= xdoc->NumPatterns) Graph.bBad = 1;
     }
-    else
+
+    if (xdoc->MasterTrackIdx >= xdoc->NumTracks) Graph.bBad = 1;
+
+    for (i = 0; !Graph.bBad && i < xdoc->NumTracks; i++)
     {
-        g.Left  = 3.0f + 10.0f * log10f(1.0f - step);
-        g.Right = 3.0f + 10.0f * log10f(step);
-        g.Left  = powf(10.0f, g.Left/20.0f);
-        g.Right = powf(10.0f, g.Right/20.0f);
-        return g;
+        xrns_track_desc *TrackDesc = &xdoc->Tracks[i];
+
+        TrackDesc->Name           = CacheResolveString(&Graph, TrackDesc->Name);
+        TrackDesc->DSPEffectDescs = CacheResolve(&Graph, TrackDesc->DSPEffectDescs, TrackDesc->NumDSPEffectUnits, sizeof(dsp_effect_desc));
+
+        for (j = 0; !Graph.bBad && j < TrackDesc->NumDSPEffectUnits; j++)
+        {
+            int Type = TrackDesc->DSPEffectDescs[j].Type;
+            if (Type != XRNS_EFFECT_FILTER && Type != XRNS_EFFECT_REVERB && Type != XRNS_EFFECT_SEND) Graph.bBad = 1;
+        }
     }
-}
 
-/* 0x00 = Left 
- * 0x40 = Center
- * 0x80 = Right
- */
-xrns_panning_gains PanningGainFromColNumber(float step)
-{
-    return PanningGainFromZeroToOne(step/128.0f);
-}
+    free(Graph.Claimed);
 
-xrns_panning_gains PanningGainFromNeg1To1(float step)
-{
-    return PanningGainFromZeroToOne((step + 1.0f)/2.0f);
-}
+    if (Graph.bBad || SampleData.bBad)
+    {
+        TracyCZoneEnd(ctx);
+        return 0;
+    }
 
-void InitialiseSampler(xrns_sampler *Sampler)
-{
-    memset(Sampler, 0, sizeof(xrns_sampler));
-    Sampler->CxVolume            = 0xF;
-    Sampler->CxOffset            = -1;
-    Sampler->bCxKill             =  0;
-    Sampler->BxxValue            = -1;
-    Sampler->SxxValue            = -1;
-    for (int j = 0; j < XRNS_MAX_SAMPLES_PLAYING; j++)
+    /* Same allocations as populateInstrumentSample(), so they're freed the same way. */
+    for (i = 0; i < xdoc->NumInstruments; i++)
+    {
+        xrns_instrument *Instrument = &xdoc->Instruments[i];
+
+        for (j = 0; j < Instrument->NumSamples; j++)
+        {
+            xrns_sample *Sample = &Instrument->Samples[j];
+            size_t Bytes = CacheSampleDataBytes(Sample);
+
+            if (Sample->PCMFloat)
+            {
+                char  *Allocation = malloc(Bytes + 32);
+                float *Planes     = (float *) (((unsigned long long) Allocation + 31) & ~31ull);
+
+                memcpy(Planes, CacheResolve(&SampleData, Sample->PCMFloat, Bytes, 1), Bytes);
+
+                Sample->PCMAllocation = Allocation;
+                Sample->PCMFloat      = Planes + XRNS_PCM_GUARD_FRAMES;
+            }
+            else if (Sample->PCM)
+            {
+                int16_t *GuardedPCM = malloc(Bytes);
+
+                memcpy(GuardedPCM, CacheResolve(&SampleData, Sample->PCM, Bytes, 1), Bytes);
+
+                Sample->PCMAllocation = GuardedPCM;
+                Sample->PCM           = GuardedPCM + XRNS_PCM_GUARD_FRAMES * Sample->NumChannels;
+            }
+        }
+    }
+
+    TracyCZoneEnd(ctx);
+
+    return 1;
+}
+
+/* ====================================================================================================================
+ * ====================================================================================================================
+ * ====================================================================================================================
+ * XRNS Playback Engine 
+ * ====================================================================================================================
+ */
+
+#define PITCHING_TABLE_LENGTH (193)
+static const double PitchingTable[PITCHING_TABLE_LENGTH] = 
+{
+    0.00390625,
+    0.00413852771234,
+    0.00438461737621,
+    0.00464534029298,
+    0.00492156660115,
+    0.00521421818035,
+    0.00552427172802,
+    0.00585276201905,
+    0.00620078535925,
+    0.00656950324417,
+    0.00696014623547,
+    0.00737401806783,
+    0.0078125,
+    0.00827705542468,
+    0.00876923475242,
+    0.00929068058596,
+    0.0098431332023,
+    0.0104284363607,
+    0.011048543456,
+    0.0117055240381,
+    0.0124015707185,
+    0.0131390064883,
+    0.0139202924709,
+    0.0147480361357,
+    0.015625,
+    0.0165541108494,
+    0.0175384695048,
+    0.0185813611719,
+    0.0196862664046,
+    0.0208568727214,
+    0.0220970869121,
+    0.0234110480762,
+    0.024803141437,
+    0.0262780129767,
+    0.0278405849419,
+    0.0294960722713,
+    0.03125,
+    0.0331082216987,
+    0.0350769390097,
+    0.0371627223438,
+    0.0393725328092,
+    0.0417137454428,
+    0.0441941738242,
+    0.0468220961524,
+    0.049606282874,
+    0.0525560259534,
+    0.0556811698838,
+    0.0589921445426,
+    0.0625,
+    0.0662164433975,
+    0.0701538780193,
+    0.0743254446877,
+    0.0787450656184,
+    0.0834274908856,
+    0.0883883476483,
+    0.0936441923048,
+    0.099212565748,
+    0.105112051907,
+    0.111362339768,
+    0.117984289085,
+    0.125,
+    0.132432886795,
+    0.140307756039,
+    0.148650889375,
+    0.157490131237,
+    0.166854981771,
+    0.176776695297,
+    0.18728838461,
+    0.198425131496,
+    0.210224103813,
+    0.222724679535,
+    0.23596857817,
+    0.25,
+    0.26486577359,
+    0.280615512077,
+    0.297301778751,
+    0.314980262474,
+    0.333709963543,
+    0.353553390593,
+    0.374576769219,
+    0.396850262992,
+    0.420448207627,
+    0.44544935907,
+    0.471937156341,
+    0.5,
+    0.52973154718,
+    0.561231024155,
+    0.594603557501,
+    0.629960524947,
+    0.667419927085,
+    0.707106781187,
+    0.749153538438,
+    0.793700525984,
+    0.840896415254,
+    0.89089871814,
+    0.943874312682,
+    1.0,
+    1.05946309436,
+    1.12246204831,
+    1.189207115,
+    1.25992104989,
+    1.33483985417,
+    1.41421356237,
+    1.49830707688,
+    1.58740105197,
+    1.68179283051,
+    1.78179743628,
+    1.88774862536,
+    2.0,
+    2.11892618872,
+    2.24492409662,
+    2.37841423001,
+    2.51984209979,
+    2.66967970834,
+    2.82842712475,
+    2.99661415375,
+    3.17480210394,
+    3.36358566101,
+    3.56359487256,
+    3.77549725073,
+    4.0,
+    4.23785237744,
+    4.48984819324,
+    4.75682846001,
+    5.03968419958,
+    5.33935941668,
+    5.65685424949,
+    5.99322830751,
+    6.34960420787,
+    6.72717132203,
+    7.12718974512,
+    7.55099450145,
+    8.0,
+    8.47570475487,
+    8.97969638647,
+    9.51365692002,
+    10.0793683992,
+    10.6787188334,
+    11.313708499,
+    11.986456615,
+    12.6992084157,
+    13.4543426441,
+    14.2543794902,
+    15.1019890029,
+    16.0,
+    16.9514095097,
+    17.9593927729,
+    19.02731384,
+    20.1587367983,
+    21.3574376667,
+    22.627416998,
+    23.97291323,
+    25.3984168315,
+    26.9086852881,
+    28.5087589805,
+    30.2039780058,
+    32.0,
+    33.9028190195,
+    35.9187855459,
+    38.0546276801,
+    40.3174735966,
+    42.7148753334,
+    45.2548339959,
+    47.9458264601,
+    50.796833663,
+    53.8173705762,
+    57.017517961,
+    60.4079560116,
+    64.0,
+    67.805638039,
+    71.8375710918,
+    76.1092553602,
+    80.6349471933,
+    85.4297506669,
+    90.5096679919,
+    95.8916529201,
+    101.593667326,
+    107.634741152,
+    114.035035922,
+    120.815912023,
+    128.0,
+    135.611276078,
+    143.675142184,
+    152.21851072,
+    161.269894387,
+    170.859501334,
+    181.019335984,
+    191.78330584,
+    203.187334652,
+    215.269482305,
+    228.070071844,
+    241.631824047,
+    256.0
+};
+
+static const float PianoPitches[120] = 
+{
+    25.9565f,
+    27.5000f,
+    29.1352f,
+    30.8677f,
+    32.7032f,
+    34.6478f,
+    36.7081f,
+    38.8909f,
+    41.2034f,
+    43.6535f,
+    46.2493f,
+    48.9994f,
+    51.9131f,
+    55.0000f,
+    58.2705f,
+    61.7354f,
+    65.4064f,
+    69.2957f,
+    73.4162f,
+    77.7817f,
+    82.4069f,
+    87.3071f,
+    92.4986f,
+    97.9989f,
+    103.8262f,
+    110.0000f,
+    116.5409f,
+    123.4708f,
+    130.8128f,
+    138.5913f,
+    146.8324f,
+    155.5635f,
+    164.8138f,
+    174.6141f,
+    184.9972f,
+    195.9977f,
+    207.6523f,
+    220.0000f,
+    233.0819f,
+    246.9417f,
+    261.6256f,
+    277.1826f,
+    293.6648f,
+    311.1270f,
+    329.6276f,
+    349.2282f,
+    369.9944f,
+    391.9954f,
+    415.3047f,
+    440.0000f,
+    466.1638f,
+    493.8833f,
+    523.2511f,
+    554.3653f,
+    587.3295f,
+    622.2540f,
+    659.2551f,
+    698.4565f,
+    739.9888f,
+    783.9909f,
+    830.6094f,
+    880.0000f,
+    932.3275f,
+    987.7666f,
+    1046.5023f,
+    1108.7305f,
+    1174.6591f,
+    1244.5079f,
+    1318.5102f,
+    1396.9129f,
+    1479.9777f,
+    1567.9817f,
+    1661.2188f,
+    1760.0000f,
+    1864.6550f,
+    1975.5332f,
+    2093.0045f,
+    2217.4610f,
+    2349.3181f,
+    2489.0159f,
+    2637.0205f,
+    2793.8259f,
+    2959.9554f,
+    3135.9635f,
+    3322.4376f,
+    3520.0000f,
+    3729.3101f,
+    3951.0664f,
+    4186.0090f,
+    4434.9221f,
+    4698.6363f,
+    4978.0317f,
+    5274.0409f,
+    5587.6517f,
+    5919.9108f,
+    6271.9270f,
+    6644.8752f,
+    7040.0000f,
+    7458.6202f,
+    7902.1328f,
+    8372.0181f,
+    8869.8442f,
+    9397.2726f,
+    9956.0635f,
+    10548.0818f,
+    11175.3034f,
+    11839.8215f,
+    12543.8540f,
+    13289.7503f,
+    14080.0000f,
+    14917.2404f,
+    15804.2656f,
+    16744.0362f,
+    17739.6884f,
+    18794.5451f,
+    19912.1270f,
+    21096.1636f,
+    22350.6068f,
+    23679.6431f,
+    25087.7079f
+};
+
+/* Reads past the end of a slice come back as silence. */
+static const int16_t XRNSSilentFrame[2] = {0, 0};
+
+/* The playhead never strays more than a frame outside of the sample, which the guard frames 
+ * around the PCM cover, so no bounds check is needed here.
+ */
+static inline const int16_t *VoiceFramePointer(const int16_t *pcm, int Frame, int NumChannels)
+{
+    return pcm + NumChannels * Frame;
+}
+
+/* Everything the voice kernels need to render one playing sample over a span, left behind frame by 
+ * frame by RenderSamplerSpan(). Base and Next point at the frames to interpolate between. For cubic 
+ * and sinc, Base points at the first of the taps instead, which are gathered into TapScratch when they 
+ * don't sit contiguously in the sample data.
+ *
+ * Float samples (XRNS_LOAD_FLOAT_SAMPLES) use BaseF and NextF, pointing into the left channel's plane,
+ * with the right channel PlaneStride floats further on. For cubic and sinc, NextF points at the right 
+ * channel's taps instead, since gathered taps don't share the sample's PlaneStride.
+ */
+typedef struct
+{
+    union
+    {
+        const int16_t *Base[XRNS_MAX_SPAN_FRAMES];
+        const float   *BaseF[XRNS_MAX_SPAN_FRAMES];
+    };
+    union
+    {
+        const int16_t *Next[XRNS_MAX_SPAN_FRAMES];
+        const float   *NextF[XRNS_MAX_SPAN_FRAMES];
+    };
+    float          Alpha[XRNS_MAX_SPAN_FRAMES];
+    float          GainL[XRNS_MAX_SPAN_FRAMES];
+    float          GainR[XRNS_MAX_SPAN_FRAMES];
+    int            NumFrames;
+    int            NumChannels;
+    int            InterpolationMode;
+    int            bFloat;
+    int            PlaneStride;
+    union
+    {
+        int16_t    TapScratch[XRNS_MAX_SPAN_FRAMES][2 * XRNS_SINC_TAPS];
+        float      TapScratchF[XRNS_MAX_SPAN_FRAMES][2 * XRNS_SINC_TAPS];
+    };
+} xrns_voice_span;
+
+/* A worker's share of a level of tracks, see RenderTracks(). */
+typedef struct
+{
+    XRNSPlaybackState *xstate;
+    xrns_pattern      *Pattern;
+    xrns_voice_span   *VoiceSpans;
+    const int         *Tracks;
+    int                NumTracks;
+    int                Stride;
+    int                SpanLength;
+} xrns_track_render_block;
+
+float XRNSCubicTable[(XRNS_INTERPOLATION_PHASES + 1) * XRNS_CUBIC_TAPS];
+float XRNSSincTable[(XRNS_INTERPOLATION_PHASES + 1) * XRNS_SINC_TAPS];
+
+/* Row p of each table holds the taps for interpolating a fraction p/XRNS_INTERPOLATION_PHASES of the
+ * way between the middle two frames. Cubic is a Catmull-Rom (Hermite) spline, sinc is Blackman 
+ * windowed and each row is normalised for unity gain at DC.
+ */
+void InitialiseInterpolationTables(void)
+{
+    static int bInitialised = 0;
+    int p, k;
+
+    if (bInitialised) return;
+
+    for (p = 0; p <= XRNS_INTERPOLATION_PHASES; p++)
+    {
+        double  x = p / (double) XRNS_INTERPOLATION_PHASES;
+        float  *Cubic = &XRNSCubicTable[p * XRNS_CUBIC_TAPS];
+        float  *Sinc  = &XRNSSincTable[p * XRNS_SINC_TAPS];
+        double  Sum = 0.0;
+
+        Cubic[0] = -0.5 * x * x * x +       x * x - 0.5 * x;
+        Cubic[1] =  1.5 * x * x * x - 2.5 * x * x + 1.0;
+        Cubic[2] = -1.5 * x * x * x + 2.0 * x * x + 0.5 * x;
+        Cubic[3] =  0.5 * x * x * x - 0.5 * x * x;
+
+        for (k = 0; k < XRNS_SINC_TAPS; k++)
+        {
+            double d = (k - (XRNS_SINC_TAPS / 2 - 1)) - x;
+            double u = d / (XRNS_SINC_TAPS / 2);
+            double h = (fabs(d) < 1e-9) ? 1.0 : sin(3.14159265358979 * d) / (3.14159265358979 * d);
+            double w = 0.42 + 0.5 * cos(3.14159265358979 * u) + 0.08 * cos(2.0 * 3.14159265358979 * u);
+
+            Sum += (Sinc[k] = h * w);
+        }
+
+        for (k = 0; k < XRNS_SINC_TAPS; k++)
+        {
+            Sinc[k] /= Sum;
+        }
+    }
+
+    bInitialised = 1;
+}
+
+typedef struct
+{
+    float Left;
+    float Right;
+} xrns_panning_gains;
+
+typedef struct
+{
+    float Val;
+    float Target;
+    float alpha;
+} LerpFloat;
+
+typedef struct
+{
+    double        p;
+    unsigned int  PrevPointIdx;
+    char          PlaybackDirection;
+    char          bSustaining;
+
+    /* Control rate state, see ControlRateEnvelope(). */
+    char          bPrimed;
+    int           ControlFramesLeft;
+    double        Value;
+    double        Step;
+    double        Target;
+} xrns_envelope_playback_state;
+
+/* The parts of rendering a playing sample that only change when it moves to another instrument, 
+ * sample or slice (or the output rate changes). See VoiceRenderParams(), which fills these in the 
+ * first time the voice is rendered after a note-on or Sxx.
+ */
+typedef struct
+{
+    unsigned int          Instrument;
+    unsigned int          SampleIndex;
+    unsigned int          BaseNote;
+    char                  bPlay0Slice;
+    float                 OutputSampleRate;
+
+    int16_t              *pcm;
+    float                *pcmf;
+    int                   PlaneStride;
+    int                   NumChannels;
+    int                   SampleRateHz;
+    int                   LengthSamples;
+    int                   MaxLengthSamples;
+    int                   SliceStart;
+    int                   GuardBefore;
+    int                   GuardAfter;
+    double                RateRatio;
+    float                 OriginalHz;
+    xrns_panning_gains    SamplePan;
+    xrns_modulation_set  *ModulationSet;
+} xrns_voice_params;
+
+typedef struct
+{
+    /* Envelope Positions */
+    xrns_envelope_playback_state VolumeEnvelope;
+    xrns_envelope_playback_state PanningEnvelope;
+    xrns_envelope_playback_state PitchEnvelope;
+
+    char         Active;
+    char         bPlaying;
+
+    char         bMapped;
+
+    /* used to trigger the stuff before the 1st slice, if S00 is used on
+     * the "root" sample of a sliced instrument.
+     */
+    char         bPlay0Slice;
+
+    double       PlaybackPosition;
+
+    unsigned int CurrentSample;
+    unsigned int CurrentBaseNote;
+    unsigned int SamplesPlayedFor;
+    char         PlaybackDirection;
+
+    double       SxxStartPosition;
+    char         SxxPlaybackDirection;
+
+    /* Set the bounds on a sample,
+     * the most interesting case is when a slice of
+     * a non-aliased sliced instrument (the base sample)
+     * is triggered. There are actually three different
+     * points the sample may end at depending on the playback
+     * direction.
+     */
+    float        BackPosition0;
+    float        BackPosition1;
+    float        FrontPosition0;
+
+    int          CrossFade;
+    int          CrossFadeDuration;
+    int          IntroCrossFade;
+    int          IntroCrossFadeDuration;
+
+    char         bIntroIsCrossFading;
+    char         bIsCrossFading;
+
+    xrns_voice_params Params;
+
+} xrns_sample_playback_state;
+
+typedef struct
+{
+    xrns_sample_playback_state
+        PlaybackStates[XRNS_MAX_SAMPLES_PLAYING];
+
+    char         Active;
+    char         bPlaying;
+    
+    unsigned int CurrentNote;
+    unsigned int CurrentInstrument;
+    LerpFloat    CurrentVolume;
+
+    xrns_note    OriginalNote;
+
+    float        SavedPitchMod;
+
+    char         bStillOnHomeRow;
+
+    LerpFloat    CurrentPanning;
+    char         bPanningSlide;
+    float        PanningSlideAmount;
+  
+    /* Qx commands in their various forms will cause samplers
+     * to delay their start. 
+     */
+    int          QxValue;
+    int          QCounter;
+    int          FracDelay;
+    char         bQPrepped;
+    char         bQReadyForCalc;
+
+    /* Pattern commands that effect the active samplers:
+     *
+     * D & U: These change the slide destination (a relative offset).
+     * V: Sets the vibrato settings (additive, resets every row)
+     *
+     */
+
+    char  bIsSliding;
+    float CurrentSlideOffset;
+    float CurrentSlideStart;
+    float CurrentSlideDest;
+
+    /* Volume slide.
+     */
+    char  bVolumeIsSliding;
+    float VolumeSlideOffset;
+    float VolumeSlideStart;
+    int   VolumeSlideDest;
+    char  bVolumeSlideStartedWithActiveNote;
+
+    char  SlideTick;
+
+    int   CurrentVibratoSpeed;
+    int   CurrentVibratoDepth;
+    float VibratoTick;
+    float VibratoOffset;
+
+    char  bIsNoteOff;
+
+    /* Cx command cuts the volume to Volume on Tick Offset
+     */
+    int           CxVolume;
+    int           CxOffset;
+    char          bCxKill;
+
+    /* Re-triggers.
+     */
+    int           RetriggerRate;
+    int           RetriggerVolumeIsAdditive;
+    float         RetriggerVolume;
+    unsigned int  WetVolume;
+    char          bRetriggerOnZero;
+
+    /* Tremolo
+     */
+    int           CurrentTremoloSpeed;
+    int           CurrentTremoloDepth;
+    float         TremoloTick;
+    float         TremoloAmount;
+
+    /* Pitch gliding.
+     */
+    char          bInstantSlide;
+    int           PitchSlideSpeed;
+    unsigned int  PitchGoal16th;
+    char          bIsPitchGliding;
+    float         GlideNote; /* units of 16th semitones */
+    char          bHitWithGCommand;
+
+    /* Temporary storage for the correct computation of
+     * the Bxx and Sxx commands.
+     */
+    int           BxxValue;
+    int           SxxValue;
+
+    /* One bit per playback state that is Active or bPlaying, so the render loop
+     * only visits samples that are actually sounding.
+     */
+    uint16_t      PlayingSamples;
+
+    /* CurrentPanning.Val that PanningGains was last worked out for. */
+    float              PanningGainsVal;
+    xrns_panning_gains PanningGains;
+
+} xrns_sampler;
+
+typedef struct
+{
+    int          MostRecentlyAllocatedSampler;
+    int          MostRecentlyPlayingSampler;
+    int          PitchToGlideTo;
+    unsigned int NumSamplesOfXFade;
+
+    /* One bit per sampler that has been triggered and hasn't finished yet (see SamplerIsLive()).
+     * Bits are set on note-on/off and cleared by run_engine() once the voice ends, everything that 
+     * walks the samplers of a column uses this to skip the idle ones.
+     */
+    uint16_t     LiveSamplers;
+    xrns_sampler Samplers[XRNS_MAX_SAMPLERS_PER_COLUMN];
+} xrns_sampler_bank;
+
+/* Where a track automation envelope was last read, see SampleAutomation().
+ */
+typedef struct
+{
+    xrns_envelope *Envelope;
+    unsigned int   PrevPointIdx;
+} xrns_automation_cursor;
+
+/* Where a send device puts what it sends, see RenderTrackSpan().
+ */
+typedef struct
+{
+    int    Track;
+    float *Audio[2];
+} xrns_send_tap;
+
+typedef struct 
+{
+    LerpFloat        CurrentPreVolume;
+    LerpFloat        CurrentGamePostVolume;
+    LerpFloat        CurrentPanning;
+    float            CurrentPostVolume;
+    float            CurrentWidth;
+    char             bIsMuted;
+    int              CurrentNoteIndex;
+    unsigned int     LastInstrumentToBeUsed[XRNS_MAX_COLUMNS_PER_TRACK];
+    unsigned int     LastEffectToBeUsed[XRNS_MAX_COLUMNS_PER_TRACK + 1][XRNS_STORED_EFFECT_NUM];
+    unsigned int     LastVolumeToBeUsed[XRNS_MAX_COLUMNS_PER_TRACK];
+    unsigned int     LastPanningToBeUsed[XRNS_MAX_COLUMNS_PER_TRACK];
+    int             *DSPEffectEnableFlags;
+    dsp_effect      *DSPEffects;
+    xrns_ringbuffer  RawAudio;
+
+    /* Indexed like DSPEffects. Track is the send track a send device goes to, or -1 for anything that
+     * doesn't send anywhere, which has no Audio.
+     */
+    xrns_send_tap   *SendTaps;
+
+    /* Per-frame values for the span being rendered, see run_engine().
+     * SpanPreVolume has one extra entry at the front, for the value from before the span.
+     */
+    float              *SpanPreVolume;
+    float              *SpanPostVolume;
+    xrns_panning_gains *SpanPanning;
+    float              *SpanAudio[2];
+
+    /* One cursor per automation envelope, indexed like the envelopes of the track in the playing
+     * pattern. Sized for the pattern with the most envelopes on this track.
+     */
+    xrns_automation_cursor *AutomationCursors;
+
+    /* How many frames the effect chain's output has been under XRNS_SILENCE_THRESHOLD for, counted up to 
+     * XRNS_EFFECT_SLEEP_SECONDS worth, see RenderTrackSpan().
+     */
+    int              SilentTailFrames;
+} xrns_track_playback_state;
+
+#pragma pack(push, 1) 
+typedef struct
+{
+    int32_t Value;
+    int32_t Octave;
+    int32_t Row;
+    int32_t Column;
+    int32_t Instrument;
+    int32_t Track;
+} xrns_note_from_caller;
+#pragma pack(pop)
+
+/* A stem registered with xrns_register_stem(), one bit for each track that's summed into it. */
+typedef struct
+{
+    uint64_t     TrackMask[XRNS_TRACK_MASK_WORDS];
+} xrns_stem;
+
+struct _XRNSPlaybackState
+{
+    char         bSongStopped;
+    double       OutputSampleRate;
+
+    float        CurrentBPMAugmentation;
+
+    /* Caller can redirect flow of the song by setting the next
+     * pattern index to something.
+     */
+    int          PatternHasBeenCued;
+    unsigned int CuedPatternIndex;
+
+    /* These are inclusive, and are used to restrict the flow
+     * through the pattern sequence.
+     */
+    unsigned int PatternSequenceLoopStart;
+    unsigned int PatternSequenceLoopEnd;
+
+    /* These "Next" things are for someone wanting to know what the next row is, so
+     * it can be mutated beforehand.
+     */
+    unsigned int NextPatternIndex;
+    unsigned int NextRowIndex;
+
+    unsigned int CurrentPatternIndex;
+    unsigned int CurrentRow;
+
+    unsigned int CurrentTick;
+    float        CurrentBPM;
+    unsigned int CurrentLinesPerBeat;
+    unsigned int CurrentTicksPerLine;
+
+    double       CurrentTickDuration;
+    double       CurrentLineDuration;
+
+    unsigned int CurrentSample;
+
+    char         bFirstPlay;
+    char         bEvenEarlierFirstPlay;
+
+    /* this is an offset in fractional samples that aligns
+     * the next pattern of notes.
+     */
+    double       XRNSGridOffset;
+
+    double       LocationOfNextTick;
+    double       LocationOfNextLine;
+
+    double       BaseOfCurrentlyPlayingLine;
+
+    xrns_document *xdoc;
+
+    /* Each column in each track will need some state for what is currently playing.
+     * We will use a sampler per column per track. 
+     *       SamplerBanks[Track] -> (SamplerBank x NumCols)
+     */
+    xrns_sampler_bank **SamplerBanks;
+
+    unsigned int NumSamplesOfXFade;
+    xrns_track_playback_state **TrackStates;
+
+    galloc_ctx *g;
+
+    unsigned int SerializedSongLengthInBytes;
+    char         bSongHasBeenSerialized;
+    void        *SerializedSongMemory;
+
+    xrns_ringbuffer Output;
+
+    /* Set for the duration of xrns_render(), the master output goes straight into the caller's buffer
+     * instead of Output, and the per-track ringbuffers aren't filled.
+     */
+    float          *DirectOutput;
+    unsigned int    DirectOutputFrames;
+    unsigned int    DirectOutputWritten;
+    char            bDirectOutputPlanar;
+
+    /* Stems are summed from the track spans as they're rendered, into DirectStems[handle] (planar, 
+     * DirectOutputFrames of left then right) for each handle the caller gave a buffer for.
+     */
+    xrns_stem       Stems[XRNS_MAX_STEMS];
+    int             NumStems;
+    float         **DirectStems;
+
+    xrns_note_from_caller *CallerNotes;
+    unsigned int           NumCallerNotes;
+
+    xrns_sampler_info ActiveSamplers[XRNS_ACTIVE_SAMPLER_COUNT];
+    unsigned int      NumActiveSamplers;
+
+    void *ScratchMemory;
+
+    /* One per playing sample of a sampler, see RenderSamplerSpan(). There is a set of these
+     * per render block. They and the RenderBlocks are too big for the arena, so they share
+     * RenderAllocation instead.
+     */
+    xrns_voice_span *VoiceSpans;
+    void            *RenderAllocation;
+
+    pooled_threads_ctx *Workers;
+
+    /* Tracks in the order they get rendered, a level of the group hierarchy at a time. Tracks that 
+     * aren't groups are on level 0, and a group's level is one more than its deepest child's.
+     * Level L is TrackRenderOrder[TrackLevelStart[L]] up to TrackRenderOrder[TrackLevelStart[L + 1]].
+     */
+    int         *TrackRenderOrder;
+    int         *TrackLevelStart;
+    int          NumTrackLevels;
+
+    int                      NumRenderBlocks;
+    xrns_track_render_block *RenderBlocks;
+    work_table              *RenderJobs;
+
+    int bStopAtEndOfSong;
+};
+
+unsigned int NoteToHzAssumingA440(int note_id)
+{
+    if (note_id > 0 && note_id < 120)
+    {
+        return PianoPitches[note_id];
+    }
+
+    return 0;
+}
+
+void ResetLerp(LerpFloat *L, float Val, float alpha)
+{
+    L->Val    = Val;
+    L->Target = Val;
+    L->alpha  = alpha;
+}
+
+void RunLerp(LerpFloat *L)
+{
+    if (fabsf(L->Val - L->Target) < 1.0e-6)
+    {
+        L->Val = L->Target;
+    }
+
+    L->Val = L->Val * L->alpha + L->Target * (1.0f - L->alpha);
+}
+
+/* Panning law for the panning column is log: 3.0 + 10.0 * log10(xx/128)
+ * where xx goes from 0 to 128 (all Left to all Right).
+ *
+ * Special case for xx == 64, dead center, we force the gains to be 1.0 and 1.0.
+ *
+ * As a gain that is 10^(3/20) * sqrt(xx/128), so there's no need for log10f and powf.
+ */
+xrns_panning_gains PanningGainFromZeroToOne(float step)
+{
+    xrns_panning_gains g;
+    if (step < 1e-6f)
+    {
+        g.Left  = 1.4125f;
+        g.Right = 0.0f;
+        return g;
+    }
+    else if (fabsf(step - 0.5f) < 1e-6f)
+    {
+        g.Left  = 1.0f;
+        g.Right = 1.0f;
+        return g;
+    }
+    else if (fabsf(step - 1.0f) < 1e-6f)
+    {
+        g.Left  = 0.0f;
+        g.Right = 1.4125f;
+        return g;
+    }
+    else
+    {
+        g.Left  = XRNS_PAN_LAW_GAIN * sqrtf(1.0f - step);
+        g.Right = XRNS_PAN_LAW_GAIN * sqrtf(step);
+        return g;
+    }
+}
+
+/* 0x00 = Left 
+ * 0x40 = Center
+ * 0x80 = Right
+ */
+xrns_panning_gains PanningGainFromColNumber(float step)
+{
+    return PanningGainFromZeroToOne(step/128.0f);
+}
+
+xrns_panning_gains PanningGainFromNeg1To1(float step)
+{
+    return PanningGainFromZeroToOne((step + 1.0f)/2.0f);
+}
+
+void InitialiseSampler(xrns_sampler *Sampler)
+{
+    memset(Sampler, 0, sizeof(xrns_sampler));
+    Sampler->CxVolume            = 0xF;
+    Sampler->CxOffset            = -1;
+    Sampler->bCxKill             =  0;
+    Sampler->BxxValue            = -1;
+    Sampler->SxxValue            = -1;
+    Sampler->PanningGainsVal     = -1.0f;
+    for (int j = 0; j < XRNS_MAX_SAMPLES_PLAYING; j++)
     {
         xrns_sample_playback_state *PlaybackState = &Sampler->PlaybackStates[j];
         PlaybackState->CurrentSample  = -1;
@@ -4013,6 +5870,30 @@ void InitialiseSampler(xrns_sampler *Sampler)
     ResetLerp(&Sampler->CurrentVolume,  0x100, 0.96f);
 }
 
+/* A sampler is live from the moment a note is put into it until its delay has run out and all
+ * of its samples have stopped. Idle samplers can only be woken up by SamplerBlankTriggerNewNote().
+ */
+static inline int SamplerIsLive(const xrns_sampler *Sampler)
+{
+    return Sampler->Active || Sampler->bPlaying || Sampler->bQPrepped || Sampler->bQReadyForCalc;
+}
+
+/* Returns the first live sampler at or after s, or XRNS_MAX_SAMPLERS_PER_COLUMN if there are none.
+ * The mask is re-read every time, so samplers triggered part way through a walk still get visited.
+ */
+static inline int NextLiveSampler(const xrns_sampler_bank *SamplerBank, int s)
+{
+    unsigned int Live = (s < XRNS_MAX_SAMPLERS_PER_COLUMN) ? (SamplerBank->LiveSamplers >> s) : 0;
+    return Live ? s + LowestSetBit(Live) : XRNS_MAX_SAMPLERS_PER_COLUMN;
+}
+
+static inline void StopSamplePlayback(xrns_sampler *Sampler, int j)
+{
+    Sampler->PlaybackStates[j].bPlaying = 0;
+    Sampler->PlaybackStates[j].Active   = 0;
+    Sampler->PlayingSamples &= ~(1u << j);
+}
+
 static double PresentLineDuration(XRNSPlaybackState *xstate)
 {
     if (!xstate->CurrentLinesPerBeat)    return 1.0;
@@ -4293,7 +6174,7 @@ double CurveSample
     return InterpolatedVal;
 }
 
-double WalkEnvelopeStateless(xrns_envelope *Desc, double Position)
+double EvaluateEnvelope(xrns_envelope *Desc, double Position)
 {
     float Bez;
     float Val0;
@@ -4338,6 +6219,132 @@ double WalkEnvelopeStateless(xrns_envelope *Desc, double Position)
         );    
 }
 
+/* Table lookup for a baked envelope, linear between entries.
+ */
+static inline float EnvelopeTableSample(const xrns_envelope *Desc, double Position)
+{
+    float x = (float) Position * Desc->TableScale;
+
+    if (x <= 0.0f)
+        return Desc->Table[0];
+
+    if (x >= (float) (Desc->TableLength - 1))
+        return Desc->Table[Desc->TableLength - 1];
+
+    unsigned int i = (unsigned int) x;
+    float        t = x - (float) i;
+
+    return Desc->Table[i] + t * (Desc->Table[i + 1] - Desc->Table[i]);
+}
+
+/* Reads a track automation envelope at Position (in 1/256th rows). The point search carries on from
+ * where the last read on this cursor left off, instead of scanning from the first point.
+ */
+double SampleAutomation(xrns_automation_cursor *Cursor, xrns_envelope *Desc, double Position)
+{
+    if (Desc->Table)
+        return EnvelopeTableSample(Desc, Position);
+
+    if (Cursor->Envelope != Desc)
+    {
+        Cursor->Envelope     = Desc;
+        Cursor->PrevPointIdx = 0;
+    }
+
+    unsigned int Prev = Cursor->PrevPointIdx;
+
+    while (Prev > 0 && Desc->Points[Prev].Pos > Position)
+        Prev--;
+
+    while (Prev + 1 < Desc->NumPoints && Desc->Points[Prev + 1].Pos <= Position)
+        Prev++;
+
+    unsigned int Next = (Prev + 1 < Desc->NumPoints) ? Prev + 1 : Prev;
+
+    Cursor->PrevPointIdx = Prev;
+
+    return CurveSample
+        (Desc
+        ,Position
+        ,Desc->Points[Prev].Bez
+        ,Desc->Points[Prev].Val
+        ,Desc->Points[Next].Val
+        ,Desc->Points[Prev].Pos
+        ,Desc->Points[Next].Pos
+        );
+}
+
+/* Lines and curves are baked into a table with one entry per envelope unit (1ms, 1/256th beat or 
+ * 1/256th line), so playback doesn't need to call pow() or solve cubics. Long envelopes get a 
+ * coarser power of two step so no table is longer than XRNS_ENVELOPE_TABLE_MAX_LENGTH. Points 
+ * envelopes are a plain step function and are left alone. A table that doesn't fit in *BytesLeft
+ * isn't baked, and the envelope is evaluated with CurveSample() instead.
+ */
+void BakeEnvelope(galloc_ctx *g, xrns_envelope *Desc, size_t *BytesLeft)
+{
+    if (Desc->Table || Desc->NumPoints < 2 || Desc->CurveType == XRNS_CURVE_TYPE_POINTS)
+        return;
+
+    unsigned int Span = Desc->Points[Desc->NumPoints - 1].Pos;
+    unsigned int Step = 1;
+
+    while (Span / Step + 2 > XRNS_ENVELOPE_TABLE_MAX_LENGTH)
+    {
+        Step <<= 1;
+    }
+
+    if (sizeof(float) * (Span / Step + 2) > *BytesLeft)
+        return;
+
+    Desc->TableLength = Span / Step + 2;
+    Desc->TableScale  = 1.0f / Step;
+    Desc->Table       = galloc(g, sizeof(float) * Desc->TableLength);
+
+    *BytesLeft -= sizeof(float) * Desc->TableLength;
+
+    for (unsigned int i = 0; i < Desc->TableLength; i++)
+    {
+        Desc->Table[i] = (float) EvaluateEnvelope(Desc, (double) i * Step);
+    }
+}
+
+/* Bakes at most BytesLeft worth of tables. The instruments' envelopes go first, they are read for 
+ * every playing voice.
+ */
+void BakeEnvelopes(galloc_ctx *g, xrns_document *xdoc, size_t BytesLeft)
+{
+    TracyCZoneN(ctx, "Bake Envelopes", 1);
+
+    unsigned int i, j, k;
+
+    for (i = 0; i < xdoc->NumInstruments; i++)
+    {
+        xrns_instrument *Instrument = &xdoc->Instruments[i];
+        for (j = 0; j < Instrument->NumModulationSets; j++)
+        {
+            xrns_modulation_set *ModulationSet = &Instrument->ModulationSets[j];
+            if (ModulationSet->bVolumeEnvelopePresent)  BakeEnvelope(g, &ModulationSet->Volume, &BytesLeft);
+            if (ModulationSet->bPanningEnvelopePresent) BakeEnvelope(g, &ModulationSet->Panning, &BytesLeft);
+            if (ModulationSet->bPitchEnvelopePresent)   BakeEnvelope(g, &ModulationSet->Pitch, &BytesLeft);
+        }
+    }
+
+    for (i = 0; i < xdoc->NumPatterns; i++)
+    {
+        xrns_pattern *Pattern = &xdoc->PatternPool[i];
+        for (j = 0; j < xdoc->NumTracks; j++)
+        {
+            xrns_track *Track = &Pattern->Tracks[j];
+            for (k = 0; k < Track->NumEnvelopes; k++)
+            {
+                BakeEnvelope(g, &Track->Envelopes[k], &BytesLeft);
+            }
+        }
+    }
+
+    TracyCZoneEnd(ctx);
+}
+
 /* dt_in_seconds will be 1/fs if this is called every sample
  */
 double WalkEnvelope(XRNSPlaybackState *xstate,
@@ -4422,10 +6429,20 @@ double WalkEnvelope(XRNSPlaybackState *xstate,
         }
     }
 
-    if (bWrappedNextPoint)
+    /* At control rate a single step can cross more than one point.
+     */
+    while (bWrappedNextPoint)
     {
         Envelope->PrevPointIdx = NextPointIdx;
         NextPointIdx = NextEnvelopeSample(Desc, Envelope);
+
+        if (NextPointIdx == Envelope->PrevPointIdx)
+            break;
+
+        if (Envelope->PlaybackDirection == XRNS_FORWARD)
+            bWrappedNextPoint = (ProposedNewPosition >= Desc->Points[NextPointIdx].Pos);
+        else
+            bWrappedNextPoint = (ProposedNewPosition <= Desc->Points[NextPointIdx].Pos);
     }
 
     if (Desc->bSustainOn && bWrappedSustainPosition && !bIgnoreSustain)
@@ -4514,15 +6531,17 @@ double WalkEnvelope(XRNSPlaybackState *xstate,
 
     /* Sample from the curves.
      */
-    float InterpolatedVal = CurveSample
-        (Desc
-        ,ProposedNewPosition
-        ,Bez
-        ,Val0
-        ,Val1
-        ,Pos0
-        ,Pos1
-        );
+    float InterpolatedVal = Desc->Table
+        ? EnvelopeTableSample(Desc, ProposedNewPosition)
+        : CurveSample
+            (Desc
+            ,ProposedNewPosition
+            ,Bez
+            ,Val0
+            ,Val1
+            ,Pos0
+            ,Pos1
+            );
 
     Envelope->p = ProposedNewPosition;
 
@@ -4531,6 +6550,49 @@ double WalkEnvelope(XRNSPlaybackState *xstate,
     return InterpolatedVal;
 }
 
+/* Modulation envelopes only need to be evaluated at control rate. Every XRNS_ENVELOPE_CONTROL_FRAMES
+ * frames the curve is walked forward by a whole control period, and the per-frame value
+ * is a linear ramp towards it. Sustain and loop handling stay inside WalkEnvelope().
+ */
+static inline double ControlRateEnvelope
+    (XRNSPlaybackState *xstate
+    ,xrns_envelope *Desc
+    ,xrns_envelope_playback_state *Envelope
+    ,int bIgnoreSustain
+    )
+{
+    if (!Envelope->bPrimed)
+    {
+        Envelope->Value   = WalkEnvelope(xstate, Desc, Envelope, 1.0/(xstate->OutputSampleRate), bIgnoreSustain);
+        Envelope->Target  = Envelope->Value;
+        Envelope->bPrimed = 1;
+        Envelope->ControlFramesLeft = 0;
+    }
+
+    if (Envelope->ControlFramesLeft == 0)
+    {
+        Envelope->Target = WalkEnvelope
+            (xstate
+            ,Desc
+            ,Envelope
+            ,XRNS_ENVELOPE_CONTROL_FRAMES/(double)(xstate->OutputSampleRate)
+            ,bIgnoreSustain
+            );
+
+        Envelope->Step = (Envelope->Target - Envelope->Value) / XRNS_ENVELOPE_CONTROL_FRAMES;
+        Envelope->ControlFramesLeft = XRNS_ENVELOPE_CONTROL_FRAMES;
+    }
+
+    double Value = Envelope->Value;
+
+    if (--Envelope->ControlFramesLeft == 0)
+        Envelope->Value = Envelope->Target;
+    else
+        Envelope->Value += Envelope->Step;
+
+    return Value;
+}
+
 void PerformNewNoteActionOnSamplerBank
     (XRNSPlaybackState *xstate
     ,xrns_document *xdoc
@@ -4670,6 +6732,7 @@ void SamplerBlankTriggerNewNote(XRNSPlaybackState *xstate,
     {
         i = (i + 1) % XRNS_MAX_SAMPLERS_PER_COLUMN;
         SamplerBank->MostRecentlyAllocatedSampler = i;
+        SamplerBank->LiveSamplers |= (1u << i);
 
         xrns_sampler *Sampler = &SamplerBank->Samplers[i];
 
@@ -4741,6 +6804,7 @@ void SamplerBlankTriggerNewNote(XRNSPlaybackState *xstate,
 
     i = (i + 1) % XRNS_MAX_SAMPLERS_PER_COLUMN;
     SamplerBank->MostRecentlyAllocatedSampler = i;
+    SamplerBank->LiveSamplers |= (1u << i);
     xrns_sampler *Sampler = &SamplerBank->Samplers[i];
 
     j = 0;
@@ -4875,40 +6939,209 @@ void InitialiseTrackState(xrns_track_playback_state *TrackState, xrns_track_desc
     TrackState->bIsMuted = 0;
 }
 
-void CreateXRNSPlaybackState(galloc_ctx *g, XRNSPlaybackState *xstate, xrns_document *xdoc, float Fs)
+/* Tell an effect the highest value the song takes each of its parameters to, from the initial value,
+ * the automation and any effect-column device commands (1xyy) on the track. Effects that size memory
+ * from a parameter (WestVerb's density) allocate for that here rather than while rendering.
+ */
+void ReserveEffectParameterPeaks(xrns_document *xdoc, int TrackIdx, int EffectIdx, dsp_effect *DSP)
+{
+    dsp_effect_desc *EffectDesc = &xdoc->Tracks[TrackIdx].DSPEffectDescs[EffectIdx];
+    float Peaks[sizeof(EffectDesc->Parameters) / sizeof(EffectDesc->Parameters[0])];
+    int i, j, k;
+
+    if (!DSP->ReserveParameter) return;
+
+    for (k = 0; k < DSP->NumParameters; k++)
+    {
+        Peaks[k] = EffectDesc->Parameters[k];
+    }
+
+    for (i = 0; i < xdoc->NumPatterns; i++)
+    {
+        xrns_track *TrackData = &xdoc->PatternPool[i].Tracks[TrackIdx];
+
+        for (j = 0; j < TrackData->NumEnvelopes; j++)
+        {
+            xrns_envelope *Envelope = &TrackData->Envelopes[j];
+            int ParameterIndex = Envelope->ParameterIndex - 1;
+
+            if (   Envelope->DeviceIndex != EffectIdx + 1
+                || ParameterIndex < 0
+                || ParameterIndex >= DSP->NumParameters
+               )
+            {
+                continue;
+            }
+
+            for (k = 0; k < Envelope->NumPoints; k++)
+            {
+                if (Envelope->Points[k].Val > Peaks[ParameterIndex]) Peaks[ParameterIndex] = Envelope->Points[k].Val;
+            }
+        }
+
+        for (j = 0; j < TrackData->NumNotes; j++)
+        {
+            xrns_note *Note = &TrackData->Notes[j];
+            int ParameterIndex = Note->EffectTypeC[1] - '1';
+            float Value;
+
+            if (   Note->Type != XRNS_NOTE_EFFECT
+                || Note->EffectTypeC[0] - '1' != EffectIdx
+                || ParameterIndex < 0
+                || ParameterIndex >= DSP->NumParameters
+               )
+            {
+                continue;
+            }
+
+            Value = (Note->EffectValue == XRNS_MISSING_VALUE) ? 0.0f : Note->EffectValue / 255.0f;
+            if (Value > Peaks[ParameterIndex]) Peaks[ParameterIndex] = Value;
+        }
+    }
+
+    for (k = 0; k < DSP->NumParameters; k++)
+    {
+        DSP->ReserveParameter(DSP->State, k, Peaks[k]);
+    }
+}
+
+unsigned int MaxTrackEnvelopes(xrns_document *xdoc, int TrackIdx)
+{
+    unsigned int MaxEnvelopes = 0;
+
+    for (int i = 0; i < xdoc->NumPatterns; i++)
+    {
+        if (xdoc->PatternPool[i].Tracks[TrackIdx].NumEnvelopes > MaxEnvelopes)
+            MaxEnvelopes = xdoc->PatternPool[i].Tracks[TrackIdx].NumEnvelopes;
+    }
+
+    return MaxEnvelopes;
+}
+
+/* The most CreateXRNSPlaybackState() takes from the arena, not counting the baked envelopes. Aligned 
+ * allocations are counted with their worst case padding. Keep this in step with the allocations there.
+ */
+size_t PlaybackStateArenaBytes(xrns_document *xdoc)
+{
+    size_t Bytes = 0;
+    size_t TotalColumns = 0;
+
+    Bytes += sizeof(xrns_sampler_bank *) * xdoc->NumTracks;
+    Bytes += sizeof(xrns_track_playback_state *) * xdoc->NumTracks;
+
+    for (int i = 0; i < xdoc->NumTracks; i++)
+    {
+        xrns_track_desc *TrackDesc = &xdoc->Tracks[i];
+
+        Bytes += sizeof(xrns_sampler_bank) * TrackDesc->NumColumns + 64;
+        Bytes += sizeof(xrns_track_playback_state) + 64;
+        Bytes += sizeof(float) * (XRNS_MAX_SPAN_FRAMES + 1);
+        Bytes += sizeof(float) * XRNS_MAX_SPAN_FRAMES;
+        Bytes += sizeof(xrns_panning_gains) * XRNS_MAX_SPAN_FRAMES;
+        Bytes += 2 * (sizeof(float) * XRNS_MAX_SPAN_FRAMES + 64);
+        Bytes += sizeof(xrns_automation_cursor) * MaxTrackEnvelopes(xdoc, i);
+        Bytes += (sizeof(dsp_effect) + sizeof(int *) + sizeof(xrns_send_tap)) * TrackDesc->NumDSPEffectUnits;
+
+        for (int j = 0; j < TrackDesc->NumDSPEffectUnits; j++)
+        {
+            if (TrackDesc->DSPEffectDescs[j].Type == XRNS_EFFECT_SEND)
+                Bytes += 2 * (sizeof(float) * XRNS_MAX_SPAN_FRAMES + 64);
+        }
+
+        TotalColumns += TrackDesc->NumColumns + TrackDesc->NumEffectColumns;
+    }
+
+    Bytes += TotalColumns * (sizeof(xrns_note_from_caller) + sizeof(xrns_note));
+
+    /* TrackLevel, TrackRenderOrder and TrackLevelStart, there are at most as many levels as tracks. */
+    Bytes += sizeof(int) * (3 * xdoc->NumTracks + 1);
+
+    return Bytes;
+}
+
+/* The track a send device on TrackIdx goes to, or -1. DestSendTrack counts the send tracks from 0. A send
+ * only ever goes to a later track, and never from the master (which returns the sends), so the routing 
+ * can't loop.
+ */
+int SendDeviceDestination(xrns_document *xdoc, int TrackIdx, dsp_effect_desc *EffectDesc)
+{
+    int i, SendIdx = 0;
+
+    if (TrackIdx == xdoc->MasterTrackIdx) return -1;
+
+    for (i = 0; i < xdoc->NumTracks; i++)
+    {
+        if (!xdoc->Tracks[i].bIsSend) continue;
+
+        if (SendIdx++ == EffectDesc->SendTrack)
+        {
+            return (i > TrackIdx) ? i : -1;
+        }
+    }
+
+    return -1;
+}
+
+/* Returns 0 if the song's playback state doesn't fit in what is left of the arena, in which case
+ * nothing has been allocated.
+ */
+int CreateXRNSPlaybackState(galloc_ctx *g, XRNSPlaybackState *xstate, xrns_document *xdoc, float Fs)
 {
     int i, j, k, TotalColumns = 0;
+
+    size_t StateBytes = PlaybackStateArenaBytes(xdoc);
+
+    if (StateBytes > galloc_bytes_left(g))
+    {
+        return 0;
+    }
+
     xstate->xdoc = xdoc;
     xstate->bFirstPlay = 1;
     xstate->bEvenEarlierFirstPlay = 1;
     xstate->OutputSampleRate = Fs;
     xstate->NumSamplesOfXFade = floor(Fs * XRNS_XFADE_MS / (1000.0));
 
+    /* The tables get whatever the rest of the playback state leaves of the arena. */
+    BakeEnvelopes(g, xdoc, galloc_bytes_left(g) - StateBytes);
+
     xstate->SamplerBanks = galloc(g, sizeof(xrns_sampler_bank *) * xdoc->NumTracks);
     xstate->TrackStates = galloc(g, sizeof(xrns_track_playback_state *) * xdoc->NumTracks);
 
     for (i = 0; i < xdoc->NumTracks; i++)
     {
-        xstate->SamplerBanks[i] = galloc(g, sizeof(xrns_sampler_bank) * xdoc->Tracks[i].NumColumns);
+        xstate->SamplerBanks[i] = galloc_aligned(g, sizeof(xrns_sampler_bank) * xdoc->Tracks[i].NumColumns, 64);
         TotalColumns += xdoc->Tracks[i].NumColumns + xdoc->Tracks[i].NumEffectColumns;
 
         for (j = 0; j < xdoc->Tracks[i].NumColumns; j++)
         {
             /* @Optimization: Why do the sampler banks need this? */
             xstate->SamplerBanks[i][j].NumSamplesOfXFade = xstate->NumSamplesOfXFade;
+            xstate->SamplerBanks[i][j].LiveSamplers = 0;
             for (k = 0; k < XRNS_MAX_SAMPLERS_PER_COLUMN; k++)
             {
                 InitialiseSampler(&xstate->SamplerBanks[i][j].Samplers[k]);
             }
         }
 
-        xstate->TrackStates[i] = galloc(g, sizeof(xrns_track_playback_state));
+        /* Tracks are rendered on different threads, so keep them on their own cache lines. */
+        xstate->TrackStates[i] = galloc_aligned(g, sizeof(xrns_track_playback_state), 64);
         InitialiseTrackState(xstate->TrackStates[i], &xdoc->Tracks[i]);
 
         InitRingBuffer(&xstate->TrackStates[i]->RawAudio);
 
+        xstate->TrackStates[i]->SpanPreVolume  = galloc(g, sizeof(float) * (XRNS_MAX_SPAN_FRAMES + 1));
+        xstate->TrackStates[i]->SpanPostVolume = galloc(g, sizeof(float) * XRNS_MAX_SPAN_FRAMES);
+        xstate->TrackStates[i]->SpanPanning    = galloc(g, sizeof(xrns_panning_gains) * XRNS_MAX_SPAN_FRAMES);
+        xstate->TrackStates[i]->SpanAudio[0]   = galloc_aligned(g, sizeof(float) * XRNS_MAX_SPAN_FRAMES, 64);
+        xstate->TrackStates[i]->SpanAudio[1]   = galloc_aligned(g, sizeof(float) * XRNS_MAX_SPAN_FRAMES, 64);
+
+        xstate->TrackStates[i]->AutomationCursors = galloc
+            (g, sizeof(xrns_automation_cursor) * MaxTrackEnvelopes(xdoc, i));
+
         xstate->TrackStates[i]->DSPEffects = galloc(g, sizeof(dsp_effect) * xdoc->Tracks[i].NumDSPEffectUnits);
         xstate->TrackStates[i]->DSPEffectEnableFlags = galloc(g, sizeof(int *) * xdoc->Tracks[i].NumDSPEffectUnits);
+        xstate->TrackStates[i]->SendTaps = galloc(g, sizeof(xrns_send_tap) * xdoc->Tracks[i].NumDSPEffectUnits);
 
         for (j = 0; j < xdoc->Tracks[i].NumDSPEffectUnits; j++)
         {
@@ -4927,6 +7160,11 @@ void CreateXRNSPlaybackState(galloc_ctx *g, XRNSPlaybackState *xstate, xrns_docu
                     WestVerbPopulateDSPStruct(DSP);
                     break;
                 }
+                case XRNS_EFFECT_SEND:
+                {
+                    SendDevicePopulateDSPStruct(DSP);
+                    break;
+                }
             }
 
             xstate->TrackStates[i]->DSPEffectEnableFlags[j] = EffectDesc->Enabled;
@@ -4935,6 +7173,24 @@ void CreateXRNSPlaybackState(galloc_ctx *g, XRNSPlaybackState *xstate, xrns_docu
             DSP->SetSampleRate(DSP->State, xstate->OutputSampleRate);
             EffectDesc->NumParameters = DSP->NumParameters;
 
+            xrns_send_tap *Tap = &xstate->TrackStates[i]->SendTaps[j];
+            Tap->Track = -1;
+
+            if (EffectDesc->Type == XRNS_EFFECT_SEND)
+            {
+                SendDeviceSetMuteSource(DSP->State, EffectDesc->bMuteSource);
+
+                Tap->Track = SendDeviceDestination(xdoc, i, EffectDesc);
+
+                if (Tap->Track >= 0)
+                {
+                    Tap->Audio[0] = galloc_aligned(g, sizeof(float) * XRNS_MAX_SPAN_FRAMES, 64);
+                    Tap->Audio[1] = galloc_aligned(g, sizeof(float) * XRNS_MAX_SPAN_FRAMES, 64);
+                }
+            }
+
+            ReserveEffectParameterPeaks(xdoc, i, j, DSP);
+
             /* copy all the initial parameters over. */
             for (int k = 0; k < EffectDesc->NumParameters; k++)
             {
@@ -4943,11 +7199,96 @@ void CreateXRNSPlaybackState(galloc_ctx *g, XRNSPlaybackState *xstate, xrns_docu
         }
     }
 
-    InitRingBuffer(&xstate->Output);
+    InitRingBuffer(&xstate->Output);
+
+    xstate->xdoc->TotalColumns = TotalColumns;
+    xstate->CallerNotes = galloc(g, TotalColumns * sizeof(xrns_note_from_caller));
+    xstate->ScratchMemory = galloc(g, TotalColumns * sizeof(xrns_note));
+
+    /* Sort the tracks into levels of the group hierarchy for RenderTracks(). Children always come before
+     * their group, so their levels are known by the time the group is reached.
+     */
+    int *TrackLevel = galloc(g, sizeof(int) * xdoc->NumTracks);
+    int  WidestLevel = 0;
+
+    xstate->NumTrackLevels = 0;
+
+    for (i = 0; i < xdoc->NumTracks; i++)
+    {
+        xrns_track_desc *TrackDesc = &xdoc->Tracks[i];
+
+        TrackLevel[i] = 0;
+
+        for (j = 1; TrackDesc->bIsGroup && j <= TrackDesc->WrapsNPreviousTracks && i - j >= 0; j++)
+        {
+            if (TrackLevel[i - j] + 1 > TrackLevel[i]) TrackLevel[i] = TrackLevel[i - j] + 1;
+        }
+
+        if (TrackLevel[i] + 1 > xstate->NumTrackLevels) xstate->NumTrackLevels = TrackLevel[i] + 1;
+    }
+
+    /* A send track goes on a level above every track that sends to it. The sends only go to later tracks,
+     * so a track's level is settled by the time its own sends are looked at.
+     */
+    for (i = 0; i < xdoc->NumTracks; i++)
+    {
+        for (j = 0; j < xdoc->Tracks[i].NumDSPEffectUnits; j++)
+        {
+            int Dest = xstate->TrackStates[i]->SendTaps[j].Track;
+
+            if (Dest < 0 || TrackLevel[i] + 1 <= TrackLevel[Dest]) continue;
+
+            TrackLevel[Dest] = TrackLevel[i] + 1;
+
+            if (TrackLevel[Dest] + 1 > xstate->NumTrackLevels) xstate->NumTrackLevels = TrackLevel[Dest] + 1;
+        }
+    }
+
+    /* The sends come after the master, but it sums them, so it goes on a level above them. */
+    for (i = 0; i < xdoc->NumTracks; i++)
+    {
+        unsigned int Master = xdoc->MasterTrackIdx;
+
+        if (!xdoc->Tracks[i].bIsSend || TrackLevel[i] + 1 <= TrackLevel[Master]) continue;
+
+        TrackLevel[Master] = TrackLevel[i] + 1;
+
+        if (TrackLevel[Master] + 1 > xstate->NumTrackLevels) xstate->NumTrackLevels = TrackLevel[Master] + 1;
+    }
+
+    xstate->TrackRenderOrder = galloc(g, sizeof(int) * xdoc->NumTracks);
+    xstate->TrackLevelStart  = galloc(g, sizeof(int) * (xstate->NumTrackLevels + 1));
+
+    for (k = 0, j = 0; j < xstate->NumTrackLevels; j++)
+    {
+        xstate->TrackLevelStart[j] = k;
+
+        for (i = 0; i < xdoc->NumTracks; i++)
+        {
+            if (TrackLevel[i] == j) xstate->TrackRenderOrder[k++] = i;
+        }
+
+        if (k - xstate->TrackLevelStart[j] > WidestLevel) WidestLevel = k - xstate->TrackLevelStart[j];
+    }
+
+    xstate->TrackLevelStart[xstate->NumTrackLevels] = k;
 
-    xstate->xdoc->TotalColumns = TotalColumns;
-    xstate->CallerNotes = galloc(g, TotalColumns * sizeof(xrns_note_from_caller));
-    xstate->ScratchMemory = galloc(g, TotalColumns * sizeof(xrns_note));
+    xstate->NumRenderBlocks = (WidestLevel < XRNS_WORKER_THREADS) ? WidestLevel : XRNS_WORKER_THREADS;
+    if (xstate->NumRenderBlocks < 1) xstate->NumRenderBlocks = 1;
+
+    /* The voice spans hold a lot of tap scratch, so these come from the heap, lined up on cache lines. */
+    size_t RenderBlockBytes = (xstate->NumRenderBlocks * sizeof(xrns_track_render_block) + 63) & ~((size_t) 63);
+    size_t VoiceSpanBytes   = xstate->NumRenderBlocks * XRNS_MAX_SAMPLES_PLAYING * sizeof(xrns_voice_span);
+    char  *RenderMemory;
+
+    xstate->RenderAllocation = calloc(1, RenderBlockBytes + VoiceSpanBytes + 64);
+    RenderMemory             = (char *) (((unsigned long long) xstate->RenderAllocation + 63) & ~63ull);
+
+    xstate->RenderBlocks = (xrns_track_render_block *) RenderMemory;
+    xstate->VoiceSpans   = (xrns_voice_span *) (RenderMemory + RenderBlockBytes);
+    xstate->RenderJobs   = CreateWorkTable(xstate->NumRenderBlocks);
+
+    InitialiseInterpolationTables();
 
     xstate->CurrentBPMAugmentation = 100.0f;
 
@@ -4974,6 +7315,8 @@ void CreateXRNSPlaybackState(galloc_ctx *g, XRNSPlaybackState *xstate, xrns_docu
     xstate->PatternSequenceLoopEnd = xdoc->PatternSequenceLength - 1;
     xstate->PatternHasBeenCued = 0;
     xstate->CuedPatternIndex = 0;
+
+    return 1;
 }
 
 /* returns true if a pattern cue was spent */
@@ -5039,7 +7382,7 @@ void xrns_perform_tick_processing(XRNSPlaybackState *xstate)
         {
             xrns_sampler_bank *SamplerBank = &xstate->SamplerBanks[track][col];
 
-            for (s = 0; s < XRNS_MAX_SAMPLERS_PER_COLUMN; s++)
+            for (s = NextLiveSampler(SamplerBank, 0); s < XRNS_MAX_SAMPLERS_PER_COLUMN; s = NextLiveSampler(SamplerBank, s + 1))
             {
                 xrns_sampler *Sampler = &SamplerBank->Samplers[s];
 
@@ -5279,7 +7622,7 @@ void xrns_perform_tick_processing(XRNSPlaybackState *xstate)
         {
             xrns_sampler_bank *SamplerBank = &xstate->SamplerBanks[track][col];
 
-            for (int i = 0; i < XRNS_MAX_SAMPLERS_PER_COLUMN; i++)
+            for (int i = NextLiveSampler(SamplerBank, 0); i < XRNS_MAX_SAMPLERS_PER_COLUMN; i = NextLiveSampler(SamplerBank, i + 1))
             {
                 xrns_sampler *Sampler = &SamplerBank->Samplers[i];
 
@@ -5303,7 +7646,8 @@ void ResetEffectStatesOnColumnSamplers(XRNSPlaybackState *xstate, int track_idx,
     xrns_sampler_bank *SamplerBank = &xstate->SamplerBanks[track_idx][col_idx];
     xrns_track_playback_state *Track = xstate->TrackStates[track_idx];
 
-    for (i = 0; i < XRNS_MAX_SAMPLERS_PER_COLUMN; i++)
+    /* Idle samplers get all of this wiped by InitialiseSampler() when they are next triggered. */
+    for (i = NextLiveSampler(SamplerBank, 0); i < XRNS_MAX_SAMPLERS_PER_COLUMN; i = NextLiveSampler(SamplerBank, i + 1))
     {
         xrns_sampler *Sampler = &SamplerBank->Samplers[i];
         Sampler->bIsSliding          = 0;
@@ -5423,8 +7767,7 @@ void FinaliseEffectCommands(XRNSPlaybackState *xstate, int track_idx)
                          * seems like a strange edge-case. 00'th slice being hit with
                          * a reverse, even after it's started to play out.
                          */
-                        PlaybackState->bPlaying = 0;
-                        PlaybackState->Active = 0;
+                        StopSamplePlayback(Sampler, j);
                     }
                 }
                 else if (Sampler->BxxValue == 1)
@@ -5664,1701 +8007,2523 @@ void SetEffectCommandOnColumnSamplers
                     break;
                 }
 
-                case 'I':
+                case 'I':
+                {
+                    EffectTypeIdx = EFFECT_ID_0I;
+                    value = 16*Hex2Int(FieldToLookAt[1]);
+                    break;
+                }
+
+                case 'G':
+                {
+                    EffectTypeIdx = EFFECT_ID_0G;
+                    value = 16*Hex2Int(FieldToLookAt[1]);
+
+                    /* treat GF in the panning/volume columns as an instant slide */
+                    if (value == 0xF0)
+                    {
+                        value = 0xFF;
+                    }
+
+                    break;
+                }
+
+                default:
+                {
+                    continue;
+                    break;
+                }
+            }
+        }
+
+        /* Commands that store their values in the Effects column:
+         * U, D, G, V, I, O, T and N => 6 values
+         * 
+         * Commands that store their values in the Volume column:
+         * I, O, U, D, G
+         *
+         * Commands that store their values in the Panning column:
+         * J, K, U, D, G
+         *
+         * U and D commands share storage. I and O commands share storage.
+         * 
+         * Volume command effects all share the same storage.
+         * Panning command effects all share the same storage.
+         */
+
+        for (i = 0; i < XRNS_MAX_SAMPLERS_PER_COLUMN; i++)
+        {
+            xrns_sampler *Sampler = &SamplerBank->Samplers[i];
+
+            switch (EffectTypeIdx)
+            {
+                case EFFECT_ID_0G:
+                {
+                    unsigned int *TrackLast = LastEffectValues;
+                    if (bIsEffectsColumn)
+                    {
+                        TrackLast = &LastEffectValues[XRNS_STORED_EFFECT_xG];
+                    }
+
+                    value = HandleMissingAnd00LastEffect(TrackLast, value);
+                    xrns_sampler *PreviousSampler = &SamplerBank->Samplers[SamplerBank->MostRecentlyPlayingSampler];
+
+                    if ((PreviousSampler->CurrentInstrument == Sampler->CurrentInstrument) &&
+                       (PreviousSampler->Active))
+                    {
+                        if (value == 0xFF)
+                        {
+                            Sampler->bInstantSlide = 1;
+                        }
+
+                        Sampler->PitchSlideSpeed += value;
+                        Sampler->bIsPitchGliding = 1;
+
+                        if (Sampler->bStillOnHomeRow)
+                        {
+                            Sampler->bHitWithGCommand = 1;
+                        }
+                    }
+
+                    break;
+                }
+
+                case EFFECT_ID_0D:
+                {
+                    unsigned int *TrackLast = LastEffectValues;
+                    if (bIsEffectsColumn)
+                    {
+                        TrackLast = &LastEffectValues[XRNS_STORED_EFFECT_DU];
+                    }
+                    value = HandleMissingAnd00LastEffect(TrackLast, value);
+                    Sampler->bIsSliding = 1;
+                    Sampler->CurrentSlideDest -= value;
+                    break;
+                }
+
+                case EFFECT_ID_0U:
+                {
+                    unsigned int *TrackLast = LastEffectValues;
+                    if (bIsEffectsColumn)
+                    {
+                        TrackLast = &LastEffectValues[XRNS_STORED_EFFECT_DU];
+                    }
+                    value = HandleMissingAnd00LastEffect(TrackLast, value);
+                    Sampler->bIsSliding = 1;
+                    Sampler->CurrentSlideDest += value;
+                    break;
+                }
+
+                case EFFECT_ID_0O:
+                {
+                    unsigned int *TrackLast = LastEffectValues;
+                    if (bIsEffectsColumn)
+                    {
+                        TrackLast = &LastEffectValues[XRNS_STORED_EFFECT_IO];
+                    }
+                    value = HandleMissingAnd00LastEffect(TrackLast, value);
+
+                    Sampler->VolumeSlideDest -= value;
+                    Sampler->VolumeSlideStart = Sampler->CurrentVolume.Target;
+                    Sampler->bVolumeIsSliding = 1;
+
+                    Sampler->bVolumeSlideStartedWithActiveNote = Sampler->Active;
+
+                    break;
+                }
+
+                case EFFECT_ID_0I:
+                {
+                    unsigned int *TrackLast = LastEffectValues;
+                    if (bIsEffectsColumn)
+                    {
+                        TrackLast = &LastEffectValues[XRNS_STORED_EFFECT_IO];
+                    }
+
+                    value = HandleMissingAnd00LastEffect(TrackLast, value);
+
+                    Sampler->VolumeSlideDest += value;
+                    Sampler->VolumeSlideStart = Sampler->CurrentVolume.Target;
+                    Sampler->bVolumeIsSliding = 1;
+
+                    Sampler->bVolumeSlideStartedWithActiveNote = Sampler->Active;
+
+                    break;
+                }
+
+                case EFFECT_ID_0V:
+                {
+                    unsigned int *TrackLast = LastEffectValues;
+                    if (bIsEffectsColumn)
+                    {
+                        TrackLast = &LastEffectValues[XRNS_STORED_EFFECT_xV];
+                    }
+
+                    int speed = value / 16;
+                    int depth = value % 16;
+
+                    if ((XRNS_MISSING_VALUE == value) || !speed) speed = (*TrackLast) / 16;
+                    if ((XRNS_MISSING_VALUE == value) || !depth) depth = (*TrackLast) % 16;
+
+                    *TrackLast = depth + 16*speed;
+
+                    Sampler->CurrentVibratoSpeed += speed;
+                    Sampler->CurrentVibratoDepth += depth;
+                    break;
+                }
+
+                case EFFECT_ID_0T:
+                {
+                    unsigned int *TrackLast = LastEffectValues;
+                    if (bIsEffectsColumn)
+                    {
+                        TrackLast = &LastEffectValues[XRNS_STORED_EFFECT_xT];
+                    }
+
+                    int speed = value / 16;
+                    int depth = value % 16;
+
+                    if ((XRNS_MISSING_VALUE == value) || !speed) speed = (*TrackLast) / 16;
+                    if ((XRNS_MISSING_VALUE == value) || !depth) depth = (*TrackLast) % 16;
+
+                    *TrackLast = depth + 16*speed;
+
+                    Sampler->CurrentTremoloSpeed += speed;
+                    Sampler->CurrentTremoloDepth += depth;
+
+                    break;
+                }
+
+                case EFFECT_ID_0Q:
+                {
+                    Sampler->QxValue = value;
+                    break;
+                }
+
+                case EFFECT_ID_0C:
+                {
+                    if (value == XRNS_MISSING_VALUE)
+                    {
+                        Sampler->CxVolume = 0;
+                        Sampler->CxOffset = 0;
+                    }
+                    else
+                    {
+                        Sampler->CxVolume = value / 16;
+                        Sampler->CxOffset = value % 16;                        
+                    }
+
+                    Sampler->bCxKill = bCxKill;
+
+                    break;
+                }
+
+                case EFFECT_ID_0P:
+                {
+                    if (value == XRNS_MISSING_VALUE)
+                    {
+                        /* 00 is omitted, and it corresponds to hard pan left */
+                        Track->CurrentPanning.Target = -1.0f;
+                    }
+                    else if (value == 0x80)
+                    {
+                        Track->CurrentPanning.Target = 0.0f;
+                    }
+                    else
+                    {
+                        Track->CurrentPanning.Target = value / ((float) 0xFF);
+                    }
+
+                    break;
+                }
+
+                case EFFECT_ID_0J:
+                {
+                    unsigned int *TrackLast = LastEffectValues;
+                    value = Handle00LastEffect(TrackLast, value);
+                    Sampler->bPanningSlide = 1;
+                    Sampler->PanningSlideAmount = -1.0f * value;
+                    break;
+                }
+
+                case EFFECT_ID_0K:
+                {
+                    unsigned int *TrackLast = LastEffectValues;
+                    TrackLast = &Track->LastEffectToBeUsed[col_idx][XRNS_STORED_EFFECT_PAN];
+                    value = Handle00LastEffect(TrackLast, value);
+                    Sampler->bPanningSlide = 1;
+                    Sampler->PanningSlideAmount = value;
+                    break;
+                }
+
+                case EFFECT_ID_0B:
                 {
-                    EffectTypeIdx = EFFECT_ID_0I;
-                    value = 16*Hex2Int(FieldToLookAt[1]);
+                    Sampler->BxxValue = value;
                     break;
                 }
 
-                case 'G':
+                case EFFECT_ID_0L:
                 {
-                    EffectTypeIdx = EFFECT_ID_0G;
-                    value = 16*Hex2Int(FieldToLookAt[1]);
-
-                    /* treat GF in the panning/volume columns as an instant slide */
-                    if (value == 0xF0)
+                    if (value == 0 || (value == XRNS_MISSING_VALUE))
                     {
-                        value = 0xFF;
+                        Track->CurrentPreVolume.Target = 0.0f;
+                    }
+                    else
+                    {
+                        float VolumedB = 0.0f;
+
+                        if (value >= 0xC0)
+                        {
+                            /* 0.07357f = 3.0 / (63.0 ^ 0.895) */
+                            VolumedB = powf((float)value - 192.0f, 0.895f) * 0.07357f;
+                        }
+                        else
+                        {
+                            VolumedB = -21.6034f + 10.0f * log10f((float)value * (float)value / (255.0f));
+                        }
+
+                        Track->CurrentPreVolume.Target = powf(10.0f, VolumedB / 20.0f);
                     }
 
                     break;
                 }
 
-                default:
+                case EFFECT_ID_0R:
                 {
-                    continue;
-                    break;
-                }
-            }
-        }
+                    Sampler->RetriggerRate = value % 16;
+                    int RetriggerVolumeFactor = value / 16;
 
-        /* Commands that store their values in the Effects column:
-         * U, D, G, V, I, O, T and N => 6 values
-         * 
-         * Commands that store their values in the Volume column:
-         * I, O, U, D, G
-         *
-         * Commands that store their values in the Panning column:
-         * J, K, U, D, G
-         *
-         * U and D commands share storage. I and O commands share storage.
-         * 
-         * Volume command effects all share the same storage.
-         * Panning command effects all share the same storage.
-         */
+                    int NumRetrigs = (xstate->CurrentTicksPerLine + Sampler->RetriggerRate - 1)/Sampler->RetriggerRate;
 
-        for (i = 0; i < XRNS_MAX_SAMPLERS_PER_COLUMN; i++)
-        {
-            xrns_sampler *Sampler = &SamplerBank->Samplers[i];
+                    Sampler->WetVolume = Sampler->OriginalNote.Volume;
 
-            switch (EffectTypeIdx)
-            {
-                case EFFECT_ID_0G:
-                {
-                    unsigned int *TrackLast = LastEffectValues;
-                    if (bIsEffectsColumn)
+                    if (Sampler->bStillOnHomeRow)
                     {
-                        TrackLast = &LastEffectValues[XRNS_STORED_EFFECT_xG];
+                        Sampler->bRetriggerOnZero = 0;
+                    }
+                    else
+                    {
+                        Sampler->bRetriggerOnZero = 1;
                     }
 
-                    value = HandleMissingAnd00LastEffect(TrackLast, value);
-                    xrns_sampler *PreviousSampler = &SamplerBank->Samplers[SamplerBank->MostRecentlyPlayingSampler];
-
-                    if ((PreviousSampler->CurrentInstrument == Sampler->CurrentInstrument) &&
-                       (PreviousSampler->Active))
+                    switch (RetriggerVolumeFactor)
                     {
-                        if (value == 0xFF)
+                        case 0x0:
                         {
-                            Sampler->bInstantSlide = 1;
+                            Sampler->RetriggerVolumeIsAdditive = 0;
+                            Sampler->RetriggerVolume           = 1.0f;
+                            break;
                         }
-
-                        Sampler->PitchSlideSpeed += value;
-                        Sampler->bIsPitchGliding = 1;
-
-                        if (Sampler->bStillOnHomeRow)
+                        case 0x1:
                         {
-                            Sampler->bHitWithGCommand = 1;
+                            Sampler->RetriggerVolumeIsAdditive = 1;
+                            Sampler->RetriggerVolume           = -1.0f/32.0f;
+                            break;
+                        }
+                        case 0x2:
+                        {
+                            Sampler->RetriggerVolumeIsAdditive = 1;
+                            Sampler->RetriggerVolume           = -1.0f/16.0f;
+                            break;
+                        }
+                        case 0x3:
+                        {
+                            Sampler->RetriggerVolumeIsAdditive = 1;
+                            Sampler->RetriggerVolume           = -1.0f/8.0f;
+                            break;
+                        }
+                        case 0x4:
+                        {
+                            Sampler->RetriggerVolumeIsAdditive = 1;
+                            Sampler->RetriggerVolume           = -1.0f/4.0f;
+                            break;
+                        }
+                        case 0x5:
+                        {
+                            Sampler->RetriggerVolumeIsAdditive = 1;
+                            Sampler->RetriggerVolume           = -1.0f/2.0f;
+                            break;
+                        }
+                        case 0x6:
+                        {
+                            Sampler->RetriggerVolumeIsAdditive = 0;
+                            Sampler->RetriggerVolume           = 2.0f/3.0f;
+                            break;
+                        }
+                        case 0x7:
+                        {
+                            Sampler->RetriggerVolumeIsAdditive = 0;
+                            Sampler->RetriggerVolume           = 1.0f/2.0f;
+                            break;
+                        }
+                        case 0x8:
+                        {
+                            Sampler->RetriggerVolumeIsAdditive = 0;
+                            Sampler->RetriggerVolume           = 1.0f;
+                            break;
+                        }
+                        case 0x9:
+                        {
+                            Sampler->RetriggerVolumeIsAdditive = 1;
+                            Sampler->RetriggerVolume           = 1.0f/32.0f;
+                            break;
+                        }
+                        case 0xA:
+                        {
+                            Sampler->RetriggerVolumeIsAdditive = 1;
+                            Sampler->RetriggerVolume           = 1.0f/16.0f;
+                            break;
+                        }
+                        case 0xB:
+                        {
+                            Sampler->RetriggerVolumeIsAdditive = 1;
+                            Sampler->RetriggerVolume           = 1.0f/8.0f;
+                            break;
+                        }
+                        case 0xC:
+                        {
+                            Sampler->RetriggerVolumeIsAdditive = 1;
+                            Sampler->RetriggerVolume           = 1.0f/4.0f;
+                            break;
+                        }
+                        case 0xD:
+                        {
+                            Sampler->RetriggerVolumeIsAdditive = 1;
+                            Sampler->RetriggerVolume           = 1.0f/2.0f;
+                            break;
+                        }
+                        case 0xE:
+                        {
+                            Sampler->RetriggerVolumeIsAdditive = 0;
+                            Sampler->RetriggerVolume           = 3.0f/2.0f;
+                            break;
+                        }
+                        case 0xF:
+                        {
+                            Sampler->RetriggerVolumeIsAdditive = 0;
+                            Sampler->RetriggerVolume           = 2.0f;
+                            break;
+                        }
+                        default:
+                        {
+                            break;
                         }
                     }
-
+                   
                     break;
                 }
 
-                case EFFECT_ID_0D:
+                case EFFECT_ID_0M:
                 {
-                    unsigned int *TrackLast = LastEffectValues;
-                    if (bIsEffectsColumn)
-                    {
-                        TrackLast = &LastEffectValues[XRNS_STORED_EFFECT_DU];
-                    }
-                    value = HandleMissingAnd00LastEffect(TrackLast, value);
-                    Sampler->bIsSliding = 1;
-                    Sampler->CurrentSlideDest -= value;
+                    if (value == XRNS_MISSING_VALUE) value = 0;
+                    Sampler->CurrentVolume.Target = value;
                     break;
                 }
 
-                case EFFECT_ID_0U:
+                case EFFECT_ID_0S:
                 {
-                    unsigned int *TrackLast = LastEffectValues;
-                    if (bIsEffectsColumn)
-                    {
-                        TrackLast = &LastEffectValues[XRNS_STORED_EFFECT_DU];
-                    }
-                    value = HandleMissingAnd00LastEffect(TrackLast, value);
-                    Sampler->bIsSliding = 1;
-                    Sampler->CurrentSlideDest += value;
+                    Sampler->SxxValue = value;
                     break;
                 }
 
-                case EFFECT_ID_0O:
+                default:
                 {
-                    unsigned int *TrackLast = LastEffectValues;
-                    if (bIsEffectsColumn)
-                    {
-                        TrackLast = &LastEffectValues[XRNS_STORED_EFFECT_IO];
-                    }
-                    value = HandleMissingAnd00LastEffect(TrackLast, value);
+                    break;
+                }
+            }
+        }
+    }
+}
 
-                    Sampler->VolumeSlideDest -= value;
-                    Sampler->VolumeSlideStart = Sampler->CurrentVolume.Target;
-                    Sampler->bVolumeIsSliding = 1;
+/* This function should look at the CurrentRow and trigger all of the samples/effects
+ * in the song data. It must also merge any caller notes that were added dynamically.
+ */
+void xrns_update_notes_and_effects(XRNSPlaybackState *xstate, int bFreshPattern)
+{
+    int track, m, i, j, col, a;
+    unsigned int PatternIdx = xstate->xdoc->PatternSequence[xstate->CurrentPatternIndex].PatternIdx;
+    xrns_pattern *Pattern = &xstate->xdoc->PatternPool[PatternIdx];
+    xrns_note *UnifiedNotes = (xrns_note *) xstate->ScratchMemory;
+    unsigned int NumUnifiedNotes = 0;
 
-                    Sampler->bVolumeSlideStartedWithActiveNote = Sampler->Active;
+    /* Most effects that operate on samplers reset on new rows.
+     * For instance the Vibrato command drops unless the effect
+     * is re-applied on subsequent rows (often with V00 to repeat values).
+     */
+    for (track = 0; track < xstate->xdoc->NumTracks; track++)
+    {
+        xrns_track_desc *TrackDesc = &xstate->xdoc->Tracks[track];
+        for (col = 0; col < TrackDesc->NumColumns; col++)
+        {
+            ResetEffectStatesOnColumnSamplers(xstate, track, col);
+        }
+    }
 
-                    break;
-                }
+    for (track = 0; track < xstate->xdoc->NumTracks; track++)
+    {
+        NumUnifiedNotes = 0;
+
+        xrns_track *Track = &Pattern->Tracks[track];
+        xrns_track_playback_state *TrackState = xstate->TrackStates[track];
 
-                case EFFECT_ID_0I:
-                {
-                    unsigned int *TrackLast = LastEffectValues;
-                    if (bIsEffectsColumn)
-                    {
-                        TrackLast = &LastEffectValues[XRNS_STORED_EFFECT_IO];
-                    }
+        if (Track->bIsAlias && Track->AliasIdx < xstate->xdoc->NumPatterns)
+        {
+            Track = &xstate->xdoc->PatternPool[Track->AliasIdx].Tracks[track];
+        }
+        xrns_track_desc *TrackDesc = &xstate->xdoc->Tracks[track];
 
-                    value = HandleMissingAnd00LastEffect(TrackLast, value);
+        if (bFreshPattern)
+        {
+            xrns_pattern_sequence_entry *Pattern = &xstate->xdoc->PatternSequence[xstate->CurrentPatternIndex];
 
-                    Sampler->VolumeSlideDest += value;
-                    Sampler->VolumeSlideStart = Sampler->CurrentVolume.Target;
-                    Sampler->bVolumeIsSliding = 1;
+            /* we hit row 0 of a new pattern. */
+            TrackState->CurrentNoteIndex = 0;
 
-                    Sampler->bVolumeSlideStartedWithActiveNote = Sampler->Active;
+            /* Tracks can be muted depending on where we are in the sequence. */
+            xstate->TrackStates[track]->bIsMuted = 0;
+            for (m = 0; m < Pattern->NumMutedTracks; m++)
+            {
+                TrackState->bIsMuted |= (Pattern->MutedTracks[m] == (unsigned int) track);
+            }
+        }
 
-                    break;
-                }
+        /* Here's where we need to use the RingIdx notes, they take priority.
+         *
+         * The original XRNS notes are sorted by row, but the notes from the caller may not be.
+         * 
+         * Build a list of notes for this row, on this track, replacing/booting
+         * notes if they appear in the caller's delta.
+         *
+         */
+        unsigned int idx = TrackState->CurrentNoteIndex;
 
-                case EFFECT_ID_0V:
-                {
-                    unsigned int *TrackLast = LastEffectValues;
-                    if (bIsEffectsColumn)
-                    {
-                        TrackLast = &LastEffectValues[XRNS_STORED_EFFECT_xV];
-                    }
+        /* Add the original notes from the XRNS, with effects coming first. 
+         */
+        if ((idx != Track->NumNotes) && (Track->NumNotes != 0))
+        {
+            while (idx < Track->NumNotes && Track->Notes[idx].Line == xstate->CurrentRow)
+            {
+                xrns_note *Note = &Track->Notes[idx];
+                UnifiedNotes[NumUnifiedNotes] = *Note;
+                NumUnifiedNotes++;
+                idx++;
+            }
 
-                    int speed = value / 16;
-                    int depth = value % 16;
+            TrackState->CurrentNoteIndex = idx;
+        }
 
-                    if ((XRNS_MISSING_VALUE == value) || !speed) speed = (*TrackLast) / 16;
-                    if ((XRNS_MISSING_VALUE == value) || !depth) depth = (*TrackLast) % 16;
+        /* Now sweep through with the delta notes, replacing clashes. */
+        unsigned int NumOriginalNotes = NumUnifiedNotes;
+#ifdef INLCUDE_FLATBUFFER_INTERFACE
+        for (i = 0; i < xstate->NumCallerNotes; i++)
+        {
+            xrns_note_from_caller *CallerNote = &xstate->CallerNotes[i];
 
-                    *TrackLast = depth + 16*speed;
+            if (CallerNote->Track != track)
+            {
+                continue;
+            }
 
-                    Sampler->CurrentVibratoSpeed += speed;
-                    Sampler->CurrentVibratoDepth += depth;
-                    break;
-                }
+            int bNoteReplaced = 0;
 
-                case EFFECT_ID_0T:
+            for (j = 0; j < NumOriginalNotes; j++)
+            {
+                if ((CallerNote->Column == UnifiedNotes[j].Column)
+                    && (CallerNote->Row == UnifiedNotes[j].Line)
+                    && (UnifiedNotes[j].Type != XRNS_NOTE_EFFECT))
                 {
-                    unsigned int *TrackLast = LastEffectValues;
-                    if (bIsEffectsColumn)
+                    /* Replace. */
+                    UnifiedNotes[j].Instrument = CallerNote->Instrument;
+
+                    if (CallerNote->Value == XRNSSong_NoteValue_NOTE_BLANK)
                     {
-                        TrackLast = &LastEffectValues[XRNS_STORED_EFFECT_xT];
+                        UnifiedNotes[j].Note = XRNS_NOTE_BLANK;
                     }
+                    else if (CallerNote->Value == XRNSSong_NoteValue_NOTE_OFF)
+                    {
+                        UnifiedNotes[j].Note = XRNS_NOTE_OFF;
+                    }
+                    else
+                    {
+                        UnifiedNotes[j].Note = CallerNote->Value + 12*CallerNote->Octave;    
+                    }                    
 
-                    int speed = value / 16;
-                    int depth = value % 16;
-
-                    if ((XRNS_MISSING_VALUE == value) || !speed) speed = (*TrackLast) / 16;
-                    if ((XRNS_MISSING_VALUE == value) || !depth) depth = (*TrackLast) % 16;
+                    bNoteReplaced = 1;
+                    break;
+                }
+            }
 
-                    *TrackLast = depth + 16*speed;
+            if (!bNoteReplaced)
+            {
+                xrns_note NewNote;
+                InitNote(&NewNote);
 
-                    Sampler->CurrentTremoloSpeed += speed;
-                    Sampler->CurrentTremoloDepth += depth;
+                NewNote.Type       = XRNS_NOTE_REAL;
+                NewNote.Column     = CallerNote->Column;
+                NewNote.Line       = CallerNote->Row;
+                NewNote.Instrument = CallerNote->Instrument;
 
-                    break;
+                if (CallerNote->Value == XRNSSong_NoteValue_NOTE_BLANK)
+                {
+                    NewNote.Note = XRNS_NOTE_BLANK;
                 }
-
-                case EFFECT_ID_0Q:
+                else if (CallerNote->Value == XRNSSong_NoteValue_NOTE_OFF)
                 {
-                    Sampler->QxValue = value;
-                    break;
+                    NewNote.Note = XRNS_NOTE_OFF;
                 }
-
-                case EFFECT_ID_0C:
+                else
                 {
-                    if (value == XRNS_MISSING_VALUE)
-                    {
-                        Sampler->CxVolume = 0;
-                        Sampler->CxOffset = 0;
-                    }
-                    else
-                    {
-                        Sampler->CxVolume = value / 16;
-                        Sampler->CxOffset = value % 16;                        
-                    }
+                    NewNote.Note = CallerNote->Value + 12*CallerNote->Octave;    
+                }
 
-                    Sampler->bCxKill = bCxKill;
+                UnifiedNotes[NumUnifiedNotes] = NewNote;
+                NumUnifiedNotes++;
+            }
+        }
+#endif
 
-                    break;
-                }
+        for (i = 0; i < NumUnifiedNotes; i++)
+        {
+            xrns_note *Note = &UnifiedNotes[i];
 
-                case EFFECT_ID_0P:
+            if (Note->Type == XRNS_NOTE_EFFECT)
+            {
+                /* Certain effects apply to the track, DSPs, or global state.
+                 * We handle these effects here.
+                 *
+                 * Effects that modify the playback of the notes in the particular track
+                 * are skipped here, but will be accumulated across all the relevant 
+                 * columns/track groups and applied at once.
+                 */
+
+                if (Note->EffectTypeIdx == EFFECT_ID_ZT)
                 {
-                    if (value == XRNS_MISSING_VALUE)
-                    {
-                        /* 00 is omitted, and it corresponds to hard pan left */
-                        Track->CurrentPanning.Target = -1.0f;
-                    }
-                    else if (value == 0x80)
+                    if (Note->EffectValue == XRNS_MISSING_VALUE)
                     {
-                        Track->CurrentPanning.Target = 0.0f;
+                        xstate->CurrentBPM = 0;
+                        xstate->bSongStopped = 1;
                     }
                     else
                     {
-                        Track->CurrentPanning.Target = value / ((float) 0xFF);
+                        xstate->CurrentBPM = Note->EffectValue;
                     }
 
-                    break;
+                    RecomputeDurations(xstate);
                 }
 
-                case EFFECT_ID_0J:
+                if (Note->EffectTypeIdx == EFFECT_ID_ZL)
                 {
-                    unsigned int *TrackLast = LastEffectValues;
-                    value = Handle00LastEffect(TrackLast, value);
-                    Sampler->bPanningSlide = 1;
-                    Sampler->PanningSlideAmount = -1.0f * value;
-                    break;
-                }
+                    xstate->CurrentLinesPerBeat = Note->EffectValue;
 
-                case EFFECT_ID_0K:
+                    if (xstate->CurrentLinesPerBeat == XRNS_MISSING_VALUE)
+                        xstate->CurrentLinesPerBeat = 0;
+
+                    if (!xstate->CurrentLinesPerBeat)
+                        xstate->bSongStopped = 1;
+
+                    RecomputeDurations(xstate);
+                }
+                if (Note->EffectTypeIdx == EFFECT_ID_ZK)
                 {
-                    unsigned int *TrackLast = LastEffectValues;
-                    TrackLast = &Track->LastEffectToBeUsed[col_idx][XRNS_STORED_EFFECT_PAN];
-                    value = Handle00LastEffect(TrackLast, value);
-                    Sampler->bPanningSlide = 1;
-                    Sampler->PanningSlideAmount = value;
-                    break;
+                    if (Note->EffectValue && Note->EffectValue != XRNS_MISSING_VALUE)
+                        xstate->CurrentTicksPerLine = Note->EffectValue;
+
+                    RecomputeDurations(xstate);
                 }
 
-                case EFFECT_ID_0B:
+                /* Certain effects apply to the active samplers contained within the
+                 * scope of this effect. Track effects hit all the active samplers on the track,
+                 * and track effects on a track group will hit all the tracks contained.
+                 * 
+                 * In Renoise 3.x, notes can have effects paired with them directly. 
+                 * These are handled as the note is parsed.
+                 *
+                 */
+
+                if (Note->Type == XRNS_NOTE_EFFECT)
                 {
-                    Sampler->BxxValue = value;
-                    break;
+                    /* Check for and handle DSP parameter changes, they have 
+                     * commands that look like 1103 => DSP 1, Param 1, Value
+                     */
+
+                    if (Note->EffectTypeC[0] != '0' && Note->EffectTypeC[0] != 'Z')
+                    {
+                        int DSPIndex = Note->EffectTypeC[0] - '1';
+                        int DSPParam = Note->EffectTypeC[1] - '0';
+                        int ActualEffectValue = (Note->EffectValue == XRNS_MISSING_VALUE) ? 0 : Note->EffectValue;
+
+                        if (DSPParam == 0)
+                        {
+                            /* turns the DSP effect on and off */
+                            xstate->TrackStates[track]->DSPEffectEnableFlags[DSPIndex] = !!(ActualEffectValue);
+                        }
+                        else if (DSPIndex < xstate->xdoc->Tracks[track].NumDSPEffectUnits)
+                        {
+                            dsp_effect_desc *EffectDesc = &xstate->xdoc->Tracks[track].DSPEffectDescs[DSPIndex];
+                            dsp_effect             *DSP = &xstate->TrackStates[track]->DSPEffects[DSPIndex];
+
+                            if ((DSPParam - 1) < DSP->NumParameters)
+                            {
+                                DSP->SetParameter(DSP->State, DSPParam - 1, ActualEffectValue / 255.0f);
+                            }
+                        }
+                    }
+                    else
+                    {
+                        for (a = track; a >= 0 && a >= track - TrackDesc->WrapsNPreviousTracks; a--)
+                        {
+                            xrns_track_desc *TrackDesc = &xstate->xdoc->Tracks[a];
+                            for (col = 0; col < TrackDesc->NumColumns; col++)
+                            {
+                                SetEffectCommandOnColumnSamplers(xstate, a, col, Note, 1);
+                            }
+                        }
+                    }
                 }
-
-                case EFFECT_ID_0L:
+            }
+            else
+            {
+                xrns_sampler_bank *SamplerBank = &xstate->SamplerBanks[track][Note->Column];
+                if (Note->Note == XRNS_NOTE_BLANK || Note->Note == XRNS_MISSING_VALUE)
                 {
-                    if (value == 0 || (value == XRNS_MISSING_VALUE))
+                    /* Commands in the volume column behave differently depending on
+                     * whether they are paired with a note or not. Volume commands 
+                     * attached to a note only affect that note. Otherwise, they address
+                     * _all_ the live samples in the column.
+                     *
+                     * If the delay column has a value inside, the vol/pan stuff is also
+                     * delayed.
+                     */
+                    if (Note->Delay != XRNS_MISSING_VALUE && Note->Delay)
                     {
-                        Track->CurrentPreVolume.Target = 0.0f;
+                        SamplerBlankTriggerNewNote(xstate, SamplerBank, *Note, track, NULL);
+                        continue;
                     }
                     else
                     {
-                        float VolumedB = 0.0f;
-
-                        if (value >= 0xC0)
+                        if (Note->Volume <= 0x80)
                         {
-                            /* 0.07357f = 3.0 / (63.0 ^ 0.895) */
-                            VolumedB = powf((float)value - 192.0f, 0.895f) * 0.07357f;
+                            int s;
+                            for (s = 0; s < XRNS_MAX_SAMPLERS_PER_COLUMN; s++)
+                            {
+                                xrns_sampler *Sampler = &SamplerBank->Samplers[s];
+                                if (Sampler->Active)
+                                {
+                                    Sampler->CurrentVolume.Target = Note->Volume * 2u;
+                                }
+                            }
                         }
-                        else
+
+                        if (Note->Panning <= 0x80)
                         {
-                            VolumedB = -21.6034f + 10.0f * log10f((float)value * (float)value / (255.0f));
+                            int s;
+                            for (s = 0; s < XRNS_MAX_SAMPLERS_PER_COLUMN; s++)
+                            {
+                                xrns_sampler *Sampler = &SamplerBank->Samplers[s];
+                                if (Sampler->Active)
+                                {
+                                    Sampler->CurrentPanning.Target = Note->Panning;
+                                }
+                            }
                         }
 
-                        Track->CurrentPreVolume.Target = powf(10.0f, VolumedB / 20.0f);
+                        SetEffectCommandOnColumnSamplers(xstate, track, Note->Column, Note, 0);
+                        continue;
                     }
-
-                    break;
                 }
 
-                case EFFECT_ID_0R:
-                {
-                    Sampler->RetriggerRate = value % 16;
-                    int RetriggerVolumeFactor = value / 16;
+                SamplerBlankTriggerNewNote(xstate, SamplerBank, *Note, track, NULL);
+                SetEffectCommandOnColumnSamplers(xstate, track, Note->Column, Note, 0);
+            }
+        }
+    }
 
-                    int NumRetrigs = (xstate->CurrentTicksPerLine + Sampler->RetriggerRate - 1)/Sampler->RetriggerRate;
+    /* some effects need to be calculated with the benefit of knowing ALL the effects */
+    for (track = 0; track < xstate->xdoc->NumTracks; track++)
+    {
+        FinaliseEffectCommands(xstate, track);
+    }
 
-                    Sampler->WetVolume = Sampler->OriginalNote.Volume;
+    xstate->NumCallerNotes = 0;
+}
 
-                    if (Sampler->bStillOnHomeRow)
-                    {
-                        Sampler->bRetriggerOnZero = 0;
-                    }
-                    else
-                    {
-                        Sampler->bRetriggerOnZero = 1;
-                    }
+static inline double 
+SampleLoopWrapPosition
+    (xrns_sample *Sample
+    ,char        *PlaybackDirection
+    ,double       ProposedNewPosition
+    )
+{
+    int bFullyUnwound = 0;
 
-                    switch (RetriggerVolumeFactor)
-                    {
-                        case 0x0:
-                        {
-                            Sampler->RetriggerVolumeIsAdditive = 0;
-                            Sampler->RetriggerVolume           = 1.0f;
-                            break;
-                        }
-                        case 0x1:
-                        {
-                            Sampler->RetriggerVolumeIsAdditive = 1;
-                            Sampler->RetriggerVolume           = -1.0f/32.0f;
-                            break;
-                        }
-                        case 0x2:
-                        {
-                            Sampler->RetriggerVolumeIsAdditive = 1;
-                            Sampler->RetriggerVolume           = -1.0f/16.0f;
-                            break;
-                        }
-                        case 0x3:
-                        {
-                            Sampler->RetriggerVolumeIsAdditive = 1;
-                            Sampler->RetriggerVolume           = -1.0f/8.0f;
-                            break;
-                        }
-                        case 0x4:
-                        {
-                            Sampler->RetriggerVolumeIsAdditive = 1;
-                            Sampler->RetriggerVolume           = -1.0f/4.0f;
-                            break;
-                        }
-                        case 0x5:
-                        {
-                            Sampler->RetriggerVolumeIsAdditive = 1;
-                            Sampler->RetriggerVolume           = -1.0f/2.0f;
-                            break;
-                        }
-                        case 0x6:
-                        {
-                            Sampler->RetriggerVolumeIsAdditive = 0;
-                            Sampler->RetriggerVolume           = 2.0f/3.0f;
-                            break;
-                        }
-                        case 0x7:
-                        {
-                            Sampler->RetriggerVolumeIsAdditive = 0;
-                            Sampler->RetriggerVolume           = 1.0f/2.0f;
-                            break;
-                        }
-                        case 0x8:
-                        {
-                            Sampler->RetriggerVolumeIsAdditive = 0;
-                            Sampler->RetriggerVolume           = 1.0f;
-                            break;
-                        }
-                        case 0x9:
-                        {
-                            Sampler->RetriggerVolumeIsAdditive = 1;
-                            Sampler->RetriggerVolume           = 1.0f/32.0f;
-                            break;
-                        }
-                        case 0xA:
-                        {
-                            Sampler->RetriggerVolumeIsAdditive = 1;
-                            Sampler->RetriggerVolume           = 1.0f/16.0f;
-                            break;
-                        }
-                        case 0xB:
-                        {
-                            Sampler->RetriggerVolumeIsAdditive = 1;
-                            Sampler->RetriggerVolume           = 1.0f/8.0f;
-                            break;
-                        }
-                        case 0xC:
-                        {
-                            Sampler->RetriggerVolumeIsAdditive = 1;
-                            Sampler->RetriggerVolume           = 1.0f/4.0f;
-                            break;
-                        }
-                        case 0xD:
-                        {
-                            Sampler->RetriggerVolumeIsAdditive = 1;
-                            Sampler->RetriggerVolume           = 1.0f/2.0f;
-                            break;
-                        }
-                        case 0xE:
-                        {
-                            Sampler->RetriggerVolumeIsAdditive = 0;
-                            Sampler->RetriggerVolume           = 3.0f/2.0f;
-                            break;
-                        }
-                        case 0xF:
-                        {
-                            Sampler->RetriggerVolumeIsAdditive = 0;
-                            Sampler->RetriggerVolume           = 2.0f;
-                            break;
-                        }
-                        default:
-                        {
-                            break;
-                        }
-                    }
-                   
-                    break;
+    while (!bFullyUnwound)
+    {
+        int bWrappedLoopPosition = 0;
+        
+        if ((*PlaybackDirection == XRNS_FORWARD) && (ProposedNewPosition >= Sample->LoopEnd))
+        {
+            bWrappedLoopPosition = 1;
+        }
+        else if ((*PlaybackDirection == XRNS_BACKWARD) && (ProposedNewPosition < Sample->LoopStart))
+        {
+            bWrappedLoopPosition = 1;
+        }
+
+        if (bWrappedLoopPosition)
+        {
+            if (*PlaybackDirection == XRNS_FORWARD)
+            {
+                double OverHang = ProposedNewPosition - Sample->LoopEnd;
+
+                if (Sample->LoopMode == XRNS_LOOP_MODE_FORWARD)
+                {
+                    ProposedNewPosition = Sample->LoopStart + OverHang;
+                } else if (Sample->LoopMode == XRNS_LOOP_MODE_BACKWARD)
+                {
+                    ProposedNewPosition = Sample->LoopEnd - OverHang;
+                    *PlaybackDirection = XRNS_BACKWARD;
+                } else if (Sample->LoopMode == XRNS_LOOP_MODE_PINGPONG)
+                {
+                    ProposedNewPosition = Sample->LoopEnd - OverHang;
+                    *PlaybackDirection = XRNS_BACKWARD;
+                }
+            }
+            else if (*PlaybackDirection == XRNS_BACKWARD)
+            {
+                double OverHang = Sample->LoopStart - ProposedNewPosition;
+
+                if (Sample->LoopMode == XRNS_LOOP_MODE_BACKWARD)
+                {
+                    ProposedNewPosition = Sample->LoopEnd - OverHang;
+                } else if (Sample->LoopMode == XRNS_LOOP_MODE_PINGPONG)
+                {
+                    ProposedNewPosition = Sample->LoopStart + OverHang;
+                    *PlaybackDirection = XRNS_FORWARD;
+                } else if (Sample->LoopMode == XRNS_LOOP_MODE_FORWARD)
+                {
+                    ProposedNewPosition = Sample->LoopStart + OverHang;
+                    *PlaybackDirection = XRNS_FORWARD;
                 }
+            }
+        }
+        else
+        {
+            bFullyUnwound = 1;
+        }
+    }
+
+    return ProposedNewPosition;
+}
+
+static inline double 
+SampleLoopWrapping
+    (xrns_sample *Sample
+    ,xrns_sample_playback_state *PlaybackState
+    ,double ProposedNewPosition
+    )
+{
+    return SampleLoopWrapPosition(Sample, &PlaybackState->PlaybackDirection, ProposedNewPosition);
+}
 
-                case EFFECT_ID_0M:
-                {
-                    if (value == XRNS_MISSING_VALUE) value = 0;
-                    Sampler->CurrentVolume.Target = value;
-                    break;
-                }
+/* Position through the current pattern in 256ths of a row, FrameOffset frames on from CurrentSample.
+ * This is what the track automation envelopes are indexed by.
+ */
+float PatternProgressIn256thRows(XRNSPlaybackState *xstate, int FrameOffset)
+{
+    unsigned int CurrentSample = xstate->CurrentSample + FrameOffset;
+    float ProgressThroughPatternIn256thRows = xstate->CurrentRow * 256;
 
-                case EFFECT_ID_0S:
-                {
-                    Sampler->SxxValue = value;
-                    break;
-                }
+    ProgressThroughPatternIn256thRows 
+        += 256.0 - (256 * (xstate->LocationOfNextLine - CurrentSample) / xstate->CurrentLineDuration);
 
-                default:
-                {
-                    break;
-                }
+    return ProgressThroughPatternIn256thRows;
+}
+
+/* How many frames until CurrentSample (tested after it is incremented) reaches Location, at least 1.
+ * Rounding can only make this come out early, which costs a short span but is otherwise harmless.
+ */
+int FramesUntilSampleReaches(unsigned int CurrentSample, double Location, int MaximumFrames)
+{
+    double Frames = ceil(Location - (double) CurrentSample);
+
+    if (Frames < 1.0) return 1;
+    if (Frames < MaximumFrames) return (int) Frames;
+    return MaximumFrames;
+}
+
+/* run_engine() renders in spans, where nothing but the voices themselves changes for the length of the 
+ * span. A span ends on the frame where time walking would act (new tick, new line, or the frame where 
+ * the caller wants to be told a line is coming up), and just before any Qx delayed note or effect 
+ * becomes due. A due Qx trigger gets a span of one frame to itself so that it lands in the same order,
+ * relative to the other samplers, as it would have when rendering frame by frame.
+ */
+int FramesUntilNextEvent(XRNSPlaybackState *xstate, int bExitingBeforeLine, int MaximumFrames)
+{
+    unsigned int PatternIdx = xstate->xdoc->PatternSequence[xstate->CurrentPatternIndex].PatternIdx;
+    int          bOnLastRow = (xstate->CurrentRow == xstate->xdoc->PatternPool[PatternIdx].NumberOfLines - 1);
+    int              Frames = MaximumFrames;
+
+    Frames = FramesUntilSampleReaches(xstate->CurrentSample, xstate->LocationOfNextTick, Frames);
+    Frames = FramesUntilSampleReaches(xstate->CurrentSample, xstate->LocationOfNextLine, Frames);
+
+    if (bExitingBeforeLine || (bOnLastRow && xstate->XRNSGridOffset < 0))
+    {
+        Frames = FramesUntilSampleReaches(xstate->CurrentSample, xstate->LocationOfNextLine - 1.0, Frames);
+    }
+
+    for (int track = 0; track < xstate->xdoc->NumTracks; track++)
+    {
+        for (int col = 0; col < xstate->xdoc->Tracks[track].NumColumns; col++)
+        {
+            xrns_sampler_bank *SamplerBank = &xstate->SamplerBanks[track][col];
+
+            for (int s = NextLiveSampler(SamplerBank, 0); s < XRNS_MAX_SAMPLERS_PER_COLUMN; s = NextLiveSampler(SamplerBank, s + 1))
+            {
+                xrns_sampler *Sampler = &SamplerBank->Samplers[s];
+
+                if (!Sampler->bQPrepped) continue;
+                if (Sampler->QCounter <= 1) return 1;
+                if (Sampler->QCounter - 1 < Frames) Frames = Sampler->QCounter - 1;
             }
         }
     }
+
+    return Frames;
 }
 
-/* This function should look at the CurrentRow and trigger all of the samples/effects
- * in the song data. It must also merge any caller notes that were added dynamically.
+/* Voice kernels. These do the sample fetching, interpolation and mixing into the track's dry span 
+ * for one playing sample, XRNS_SIMD_WIDTH frames at a time. SSE2 is the baseline, AVX2 is used when 
+ * the compiler has been told it is available (/arch:AVX2 or -mavx2).
  */
-void xrns_update_notes_and_effects(XRNSPlaybackState *xstate, int bFreshPattern)
+#if defined(__AVX2__)
+#define XRNS_SIMD_WIDTH    (8)
+typedef __m256 xrns_vf;
+#define XRNSLoadF(p)       _mm256_loadu_ps(p)
+#define XRNSStoreF(p, v)   _mm256_storeu_ps(p, v)
+#define XRNSSetF(x)        _mm256_set1_ps(x)
+#define XRNSAddF(a, b)     _mm256_add_ps(a, b)
+#define XRNSSubF(a, b)     _mm256_sub_ps(a, b)
+#define XRNSMulF(a, b)     _mm256_mul_ps(a, b)
+#else
+#define XRNS_SIMD_WIDTH    (4)
+typedef __m128 xrns_vf;
+#define XRNSLoadF(p)       _mm_loadu_ps(p)
+#define XRNSStoreF(p, v)   _mm_storeu_ps(p, v)
+#define XRNSSetF(x)        _mm_set1_ps(x)
+#define XRNSAddF(a, b)     _mm_add_ps(a, b)
+#define XRNSSubF(a, b)     _mm_sub_ps(a, b)
+#define XRNSMulF(a, b)     _mm_mul_ps(a, b)
+#endif
+
+static inline xrns_vf VoiceFetch(const int16_t * const *Frames, int Channel)
 {
-    int track, m, i, j, col, a;
-    unsigned int PatternIdx = xstate->xdoc->PatternSequence[xstate->CurrentPatternIndex].PatternIdx;
-    xrns_pattern *Pattern = &xstate->xdoc->PatternPool[PatternIdx];
-    xrns_note *UnifiedNotes = (xrns_note *) xstate->ScratchMemory;
-    unsigned int NumUnifiedNotes = 0;
+#if defined(__AVX2__)
+    return _mm256_cvtepi32_ps(_mm256_set_epi32
+        (Frames[7][Channel], Frames[6][Channel], Frames[5][Channel], Frames[4][Channel]
+        ,Frames[3][Channel], Frames[2][Channel], Frames[1][Channel], Frames[0][Channel]));
+#else
+    return _mm_cvtepi32_ps(_mm_set_epi32
+        (Frames[3][Channel], Frames[2][Channel], Frames[1][Channel], Frames[0][Channel]));
+#endif
+}
 
-    /* Most effects that operate on samplers reset on new rows.
-     * For instance the Vibrato command drops unless the effect
-     * is re-applied on subsequent rows (often with V00 to repeat values).
-     */
-    for (track = 0; track < xstate->xdoc->NumTracks; track++)
+static inline xrns_vf VoiceInterpolate(const xrns_voice_span *Span, int f, int Channel)
+{
+    xrns_vf Alpha = XRNSLoadF(&Span->Alpha[f]);
+    xrns_vf  Base = VoiceFetch(&Span->Base[f], Channel);
+    xrns_vf  Next = VoiceFetch(&Span->Next[f], Channel);
+
+    return XRNSAddF(XRNSMulF(Base, XRNSSubF(XRNSSetF(1.0f), Alpha)), XRNSMulF(Next, Alpha));
+}
+
+void VoiceKernelMono(const xrns_voice_span *Span, float *DryL, float *DryR)
+{
+    int f = 0;
+
+    if (Span->InterpolationMode == XRNS_INTERPOLATION_NONE)
     {
-        xrns_track_desc *TrackDesc = &xstate->xdoc->Tracks[track];
-        for (col = 0; col < TrackDesc->NumColumns; col++)
+        for (; f + XRNS_SIMD_WIDTH <= Span->NumFrames; f += XRNS_SIMD_WIDTH)
         {
-            ResetEffectStatesOnColumnSamplers(xstate, track, col);
+            xrns_vf v = VoiceFetch(&Span->Base[f], 0);
+            XRNSStoreF(&DryL[f], XRNSAddF(XRNSLoadF(&DryL[f]), XRNSMulF(XRNSLoadF(&Span->GainL[f]), v)));
+            XRNSStoreF(&DryR[f], XRNSAddF(XRNSLoadF(&DryR[f]), XRNSMulF(XRNSLoadF(&Span->GainR[f]), v)));
+        }
+    }
+    else
+    {
+        for (; f + XRNS_SIMD_WIDTH <= Span->NumFrames; f += XRNS_SIMD_WIDTH)
+        {
+            xrns_vf v = VoiceInterpolate(Span, f, 0);
+            XRNSStoreF(&DryL[f], XRNSAddF(XRNSLoadF(&DryL[f]), XRNSMulF(XRNSLoadF(&Span->GainL[f]), v)));
+            XRNSStoreF(&DryR[f], XRNSAddF(XRNSLoadF(&DryR[f]), XRNSMulF(XRNSLoadF(&Span->GainR[f]), v)));
         }
     }
 
-    for (track = 0; track < xstate->xdoc->NumTracks; track++)
+    for (; f < Span->NumFrames; f++)
     {
-        NumUnifiedNotes = 0;
+        float Alpha = Span->Alpha[f];
+        float     v = Span->Base[f][0] * (1.0f - Alpha) + Span->Next[f][0] * Alpha;
+        DryL[f] += Span->GainL[f] * v;
+        DryR[f] += Span->GainR[f] * v;
+    }
+}
 
-        xrns_track *Track = &Pattern->Tracks[track];
-        xrns_track_playback_state *TrackState = xstate->TrackStates[track];
+void VoiceKernelStereo(const xrns_voice_span *Span, float *DryL, float *DryR)
+{
+    int f = 0;
 
-        if (Track->bIsAlias && Track->AliasIdx < xstate->xdoc->NumPatterns)
+    if (Span->InterpolationMode == XRNS_INTERPOLATION_NONE)
+    {
+        for (; f + XRNS_SIMD_WIDTH <= Span->NumFrames; f += XRNS_SIMD_WIDTH)
         {
-            Track = &xstate->xdoc->PatternPool[Track->AliasIdx].Tracks[track];
+            xrns_vf l = VoiceFetch(&Span->Base[f], 0);
+            xrns_vf r = VoiceFetch(&Span->Base[f], 1);
+            XRNSStoreF(&DryL[f], XRNSAddF(XRNSLoadF(&DryL[f]), XRNSMulF(XRNSLoadF(&Span->GainL[f]), l)));
+            XRNSStoreF(&DryR[f], XRNSAddF(XRNSLoadF(&DryR[f]), XRNSMulF(XRNSLoadF(&Span->GainR[f]), r)));
         }
-        xrns_track_desc *TrackDesc = &xstate->xdoc->Tracks[track];
+    }
+    else
+    {
+        for (; f + XRNS_SIMD_WIDTH <= Span->NumFrames; f += XRNS_SIMD_WIDTH)
+        {
+            xrns_vf l = VoiceInterpolate(Span, f, 0);
+            xrns_vf r = VoiceInterpolate(Span, f, 1);
+            XRNSStoreF(&DryL[f], XRNSAddF(XRNSLoadF(&DryL[f]), XRNSMulF(XRNSLoadF(&Span->GainL[f]), l)));
+            XRNSStoreF(&DryR[f], XRNSAddF(XRNSLoadF(&DryR[f]), XRNSMulF(XRNSLoadF(&Span->GainR[f]), r)));
+        }
+    }
 
-        if (bFreshPattern)
+    for (; f < Span->NumFrames; f++)
+    {
+        float Alpha = Span->Alpha[f];
+        DryL[f] += Span->GainL[f] * (Span->Base[f][0] * (1.0f - Alpha) + Span->Next[f][0] * Alpha);
+        DryR[f] += Span->GainR[f] * (Span->Base[f][1] * (1.0f - Alpha) + Span->Next[f][1] * Alpha);
+    }
+}
+
+/* Float samples need no conversion, the channels are Offset apart in the planar data. */
+static inline xrns_vf VoiceFetchFloat(const float * const *Frames, int Offset)
+{
+#if defined(__AVX2__)
+    return _mm256_set_ps
+        (Frames[7][Offset], Frames[6][Offset], Frames[5][Offset], Frames[4][Offset]
+        ,Frames[3][Offset], Frames[2][Offset], Frames[1][Offset], Frames[0][Offset]);
+#else
+    return _mm_set_ps(Frames[3][Offset], Frames[2][Offset], Frames[1][Offset], Frames[0][Offset]);
+#endif
+}
+
+static inline xrns_vf VoiceInterpolateFloat(const xrns_voice_span *Span, int f, int Offset)
+{
+    xrns_vf Alpha = XRNSLoadF(&Span->Alpha[f]);
+    xrns_vf  Base = VoiceFetchFloat(&Span->BaseF[f], Offset);
+    xrns_vf  Next = VoiceFetchFloat(&Span->NextF[f], Offset);
+
+    return XRNSAddF(XRNSMulF(Base, XRNSSubF(XRNSSetF(1.0f), Alpha)), XRNSMulF(Next, Alpha));
+}
+
+/* None and linear interpolation for float samples, mono or stereo. */
+void VoiceKernelFloat(const xrns_voice_span *Span, float *DryL, float *DryR)
+{
+    int            f = 0;
+    int        Right = Span->PlaneStride;
+    int      bStereo = (Span->NumChannels == 2);
+    int bInterpolate = (Span->InterpolationMode != XRNS_INTERPOLATION_NONE);
+
+    for (; f + XRNS_SIMD_WIDTH <= Span->NumFrames; f += XRNS_SIMD_WIDTH)
+    {
+        xrns_vf l = bInterpolate ? VoiceInterpolateFloat(Span, f, 0) : VoiceFetchFloat(&Span->BaseF[f], 0);
+        xrns_vf r = l;
+
+        if (bStereo)
         {
-            xrns_pattern_sequence_entry *Pattern = &xstate->xdoc->PatternSequence[xstate->CurrentPatternIndex];
+            r = bInterpolate ? VoiceInterpolateFloat(Span, f, Right) : VoiceFetchFloat(&Span->BaseF[f], Right);
+        }
 
-            /* we hit row 0 of a new pattern. */
-            TrackState->CurrentNoteIndex = 0;
+        XRNSStoreF(&DryL[f], XRNSAddF(XRNSLoadF(&DryL[f]), XRNSMulF(XRNSLoadF(&Span->GainL[f]), l)));
+        XRNSStoreF(&DryR[f], XRNSAddF(XRNSLoadF(&DryR[f]), XRNSMulF(XRNSLoadF(&Span->GainR[f]), r)));
+    }
 
-            /* Tracks can be muted depending on where we are in the sequence. */
-            xstate->TrackStates[track]->bIsMuted = 0;
-            for (m = 0; m < Pattern->NumMutedTracks; m++)
+    for (; f < Span->NumFrames; f++)
+    {
+        float Alpha = Span->Alpha[f];
+        float     l = Span->BaseF[f][0]     * (1.0f - Alpha) + Span->NextF[f][0]     * Alpha;
+        float     r = Span->BaseF[f][Right] * (1.0f - Alpha) + Span->NextF[f][Right] * Alpha;
+        DryL[f] += Span->GainL[f] * l;
+        DryR[f] += Span->GainR[f] * r;
+    }
+}
+
+/* Points Span->Base[f] at the Taps frames around the playback position, with Span->Alpha[f] the fraction
+ * between the middle two. Away from the ends of the sample and the loop points, the taps are read 
+ * straight out of the sample data. Otherwise they are gathered into the span's scratch space in order 
+ * of playback, with the frames ahead of the playhead following the loop.
+ *
+ * If pcmf is given, the sample is planar float and BaseF[f] and NextF[f] get the left and right taps.
+ */
+void VoiceGatherTaps
+    (xrns_voice_span            *Span
+    ,int                         f
+    ,int                         Taps
+    ,const int16_t              *pcm
+    ,const float                *pcmf
+    ,int                         PlaneStride
+    ,int                         NumChannels
+    ,int                         LengthSamples
+    ,int                         GuardBefore
+    ,int                         GuardAfter
+    ,xrns_sample                *Sample
+    ,xrns_sample_playback_state *PlaybackState
+    ,int                         bLooping
+    )
+{
+    int          Half = Taps / 2;
+    double   Position = PlaybackState->PlaybackPosition;
+    double      Floor = floor(Position);
+    long long   First = (long long) Floor - (Half - 1);
+    long long    Last = (long long) Floor + Half;
+    int      bForward = (PlaybackState->PlaybackDirection == XRNS_FORWARD);
+    int bClearOfLoops = !bLooping || (bForward ? (Last < Sample->LoopEnd) : (First >= Sample->LoopStart));
+
+    if (First >= -GuardBefore && Last < LengthSamples + GuardAfter && bClearOfLoops)
+    {
+        if (pcmf)
+        {
+            Span->BaseF[f] = pcmf + First;
+            Span->NextF[f] = pcmf + PlaneStride + First;
+        }
+        else
+        {
+            Span->Base[f]  = pcm + NumChannels * First;
+        }
+        Span->Alpha[f] = Position - Floor;
+    }
+    else
+    {
+        int16_t  *Scratch = &Span->TapScratch[f][0];
+        float   *ScratchF = &Span->TapScratchF[f][0];
+        double       Base = bForward ? Floor : ceil(Position);
+
+        for (int k = 0; k < Taps; k++)
+        {
+            int        Offset = k - (Half - 1);
+            double      Frame = Base + (bForward ? Offset : -Offset);
+            char    Direction = PlaybackState->PlaybackDirection;
+
+            if (Offset > 0 && bLooping)
             {
-                TrackState->bIsMuted |= (Pattern->MutedTracks[m] == (unsigned int) track);
+                Frame = SampleLoopWrapPosition(Sample, &Direction, Frame);
+            }
+
+            int bOutside = (Frame < 0 || Frame >= LengthSamples);
+
+            if (pcmf)
+            {
+                ScratchF[k]                  = bOutside ? 0.0f : pcmf[(long long) Frame];
+                ScratchF[XRNS_SINC_TAPS + k] = bOutside ? 0.0f : pcmf[(long long) Frame + PlaneStride];
+            }
+            else
+            {
+                for (int ch = 0; ch < NumChannels; ch++)
+                {
+                    Scratch[NumChannels * k + ch] = bOutside ? 0 : pcm[NumChannels * (long long) Frame + ch];
+                }
             }
         }
 
-        /* Here's where we need to use the RingIdx notes, they take priority.
-         *
-         * The original XRNS notes are sorted by row, but the notes from the caller may not be.
-         * 
-         * Build a list of notes for this row, on this track, replacing/booting
-         * notes if they appear in the caller's delta.
-         *
-         */
-        unsigned int idx = TrackState->CurrentNoteIndex;
+        if (pcmf)
+        {
+            Span->BaseF[f] = ScratchF;
+            Span->NextF[f] = ScratchF + XRNS_SINC_TAPS;
+        }
+        else
+        {
+            Span->Base[f]  = Scratch;
+        }
+        Span->Alpha[f] = bForward ? (Position - Floor) : (Base - Position);
+    }
+}
 
-        /* Add the original notes from the XRNS, with effects coming first. 
-         */
-        if ((idx != Track->NumNotes) && (Track->NumNotes != 0))
+/* Four frames worth of one channel, as floats. */
+static inline __m128 VoiceLoadTaps(const int16_t *Frames, int NumChannels, int Channel)
+{
+    if (NumChannels == 2)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *) Frames);
+        v = Channel ? _mm_srai_epi32(v, 16) : _mm_srai_epi32(_mm_slli_epi32(v, 16), 16);
+        return _mm_cvtepi32_ps(v);
+    }
+    else
+    {
+        __m128i v = _mm_loadl_epi64((const __m128i *) Frames);
+        return _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16));
+    }
+}
+
+static inline float HorizontalSum(__m128 v)
+{
+    v = _mm_add_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 0, 3, 2)));
+    v = _mm_add_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtss_f32(v);
+}
+
+/* Cubic and sinc, a dot product of the taps with a row of Table per frame. */
+void VoiceKernelPolyphase(const xrns_voice_span *Span, const float *Table, int Taps, float *DryL, float *DryR)
+{
+    int NumChannels = Span->NumChannels;
+
+    for (int f = 0; f < Span->NumFrames; f++)
+    {
+        float  Phase    = Span->Alpha[f] * XRNS_INTERPOLATION_PHASES;
+        int    PhaseIdx = (int) Phase;
+
+        if (PhaseIdx >= XRNS_INTERPOLATION_PHASES) PhaseIdx = XRNS_INTERPOLATION_PHASES - 1;
+
+        __m128       Frac = _mm_set1_ps(Phase - PhaseIdx);
+        const float   *C0 = &Table[PhaseIdx * Taps];
+        const float   *C1 = C0 + Taps;
+        __m128       AccL = _mm_setzero_ps();
+        __m128       AccR = _mm_setzero_ps();
+
+        for (int k = 0; k < Taps; k += 4)
         {
-            while (idx < Track->NumNotes && Track->Notes[idx].Line == xstate->CurrentRow)
+            __m128           c0 = _mm_loadu_ps(&C0[k]);
+            __m128        Coefs = _mm_add_ps(c0, _mm_mul_ps(Frac, _mm_sub_ps(_mm_loadu_ps(&C1[k]), c0)));
+            const int16_t *Frames = Span->Base[f] + k * NumChannels;
+
+            AccL = _mm_add_ps(AccL, _mm_mul_ps(Coefs, VoiceLoadTaps(Frames, NumChannels, 0)));
+
+            if (NumChannels == 2)
             {
-                xrns_note *Note = &Track->Notes[idx];
-                UnifiedNotes[NumUnifiedNotes] = *Note;
-                NumUnifiedNotes++;
-                idx++;
+                AccR = _mm_add_ps(AccR, _mm_mul_ps(Coefs, VoiceLoadTaps(Frames, NumChannels, 1)));
             }
+        }
 
-            TrackState->CurrentNoteIndex = idx;
+        float l = HorizontalSum(AccL);
+        float r = (NumChannels == 2) ? HorizontalSum(AccR) : l;
+
+        DryL[f] += Span->GainL[f] * l;
+        DryR[f] += Span->GainR[f] * r;
+    }
+}
+
+/* The same as VoiceKernelPolyphase(), for float samples. */
+void VoiceKernelPolyphaseFloat(const xrns_voice_span *Span, const float *Table, int Taps, float *DryL, float *DryR)
+{
+    int bStereo = (Span->NumChannels == 2);
+
+    for (int f = 0; f < Span->NumFrames; f++)
+    {
+        float  Phase    = Span->Alpha[f] * XRNS_INTERPOLATION_PHASES;
+        int    PhaseIdx = (int) Phase;
+
+        if (PhaseIdx >= XRNS_INTERPOLATION_PHASES) PhaseIdx = XRNS_INTERPOLATION_PHASES - 1;
+
+        __m128       Frac = _mm_set1_ps(Phase - PhaseIdx);
+        const float   *C0 = &Table[PhaseIdx * Taps];
+        const float   *C1 = C0 + Taps;
+        __m128       AccL = _mm_setzero_ps();
+        __m128       AccR = _mm_setzero_ps();
+
+        for (int k = 0; k < Taps; k += 4)
+        {
+            __m128    c0 = _mm_loadu_ps(&C0[k]);
+            __m128 Coefs = _mm_add_ps(c0, _mm_mul_ps(Frac, _mm_sub_ps(_mm_loadu_ps(&C1[k]), c0)));
+
+            AccL = _mm_add_ps(AccL, _mm_mul_ps(Coefs, _mm_loadu_ps(Span->BaseF[f] + k)));
+
+            if (bStereo)
+            {
+                AccR = _mm_add_ps(AccR, _mm_mul_ps(Coefs, _mm_loadu_ps(Span->NextF[f] + k)));
+            }
         }
 
-        /* Now sweep through with the delta notes, replacing clashes. */
-        unsigned int NumOriginalNotes = NumUnifiedNotes;
-#ifdef INLCUDE_FLATBUFFER_INTERFACE
-        for (i = 0; i < xstate->NumCallerNotes; i++)
+        float l = HorizontalSum(AccL);
+        float r = bStereo ? HorizontalSum(AccR) : l;
+
+        DryL[f] += Span->GainL[f] * l;
+        DryR[f] += Span->GainR[f] * r;
+    }
+}
+
+/* Returns the render parameters of a playing sample, working them out again only if the voice
+ * has moved to a different sample since they were last filled.
+ */
+const xrns_voice_params *VoiceRenderParams
+    (XRNSPlaybackState          *xstate
+    ,xrns_sampler               *Sampler
+    ,xrns_sample_playback_state *PlaybackState
+    )
+{
+    xrns_voice_params *Params = &PlaybackState->Params;
+
+    if (   Params->Instrument       == Sampler->CurrentInstrument
+        && Params->SampleIndex      == PlaybackState->CurrentSample
+        && Params->BaseNote         == PlaybackState->CurrentBaseNote
+        && Params->bPlay0Slice      == PlaybackState->bPlay0Slice
+        && Params->OutputSampleRate == xstate->OutputSampleRate)
+    {
+        return Params;
+    }
+
+    xrns_instrument *Instrument = &xstate->xdoc->Instruments[Sampler->CurrentInstrument];
+    xrns_sample     *Sample     = &Instrument->Samples[PlaybackState->CurrentSample];
+    xrns_sample     *Source     = Sample;
+
+    Params->Instrument       = Sampler->CurrentInstrument;
+    Params->SampleIndex      = PlaybackState->CurrentSample;
+    Params->BaseNote         = PlaybackState->CurrentBaseNote;
+    Params->bPlay0Slice      = PlaybackState->bPlay0Slice;
+    Params->OutputSampleRate = xstate->OutputSampleRate;
+
+    /* supposed to be the length of the whole sample, if it's a sliced sample,
+     * it should be the length of the base sample.
+     */
+    Params->LengthSamples    = Sample->LengthSamples;
+
+    if (Sample->bIsAlisedSample || PlaybackState->bPlay0Slice)
+    {
+        Source = &Instrument->Samples[0];
+
+        if (PlaybackState->CurrentSample == Instrument->NumSamples - 1)
         {
-            xrns_note_from_caller *CallerNote = &xstate->CallerNotes[i];
+            /* take the length of the full sample */
+            Params->LengthSamples = Source->LengthSamples - Sample->SampleStart;
+        }
+        else
+        {
+            Params->LengthSamples = Instrument->Samples[PlaybackState->CurrentSample + 1].SampleStart - Sample->SampleStart;
+        }
+    }
+
+    Params->pcm              = Source->PCM;
+    Params->pcmf             = Source->PCMFloat;
+    Params->PlaneStride      = Source->PlaneStride;
+    Params->NumChannels      = Source->NumChannels;
+    Params->SampleRateHz     = Source->SampleRateHz;
+    Params->MaxLengthSamples = Source->LengthSamples;
+    Params->SliceStart       = Sample->SampleStart;
+
+    /* Taps can only be read straight from the guard frames where the slice ends with the PCM, 
+     * inside of a sliced sample the neighbouring slice is in the way.
+     */
+    Params->GuardBefore = (Params->SliceStart == 0) ? XRNS_PCM_GUARD_FRAMES : 0;
+    Params->GuardAfter  = (Params->SliceStart + Params->LengthSamples == Params->MaxLengthSamples) 
+                        ? XRNS_PCM_GUARD_FRAMES : 0;
+
+    Params->RateRatio     = (double) Params->SampleRateHz / xstate->OutputSampleRate;
+    Params->OriginalHz    = NoteToHzAssumingA440(PlaybackState->CurrentBaseNote);
+    Params->SamplePan     = PanningGainFromZeroToOne(Sample->Panning);
+    Params->ModulationSet = (Instrument->NumModulationSets && Sample->ModulationSetIndex != -1)
+                          ? &Instrument->ModulationSets[Sample->ModulationSetIndex]
+                          : NULL;
+
+    return Params;
+}
+
+/* Renders every playing sample of a sampler for NumFrames frames, summing into DryL and DryR.
+ * The per-frame track volume and panning come from the span buffers filled in by run_engine().
+ */
+void RenderSamplerSpan
+    (XRNSPlaybackState *xstate
+    ,int                track
+    ,xrns_sampler      *Sampler
+    ,xrns_voice_span   *VoiceSpans
+    ,float             *DryL
+    ,float             *DryR
+    ,const float       *MasterPreVolume
+    ,int                NumFrames
+    )
+{
+    xrns_track_playback_state *Track = xstate->TrackStates[track];
+    int SampleIndex = -1;
+    int BaseNote = -1;
+
+    TracyCZoneN(ctxx, "Sampler Playback", 1);
+
+    /* Samples only ever stop during the span, so these are the only voice spans that get used. */
+    unsigned int SpanSamples = Sampler->PlayingSamples;
+
+    for (unsigned int Playing = SpanSamples; Playing; Playing &= Playing - 1)
+    {
+        VoiceSpans[LowestSetBit(Playing)].NumFrames = 0;
+    }
+
+    for (int f = 0; f < NumFrames && Sampler->bPlaying; f++)
+    {
+        for (unsigned int Playing = Sampler->PlayingSamples; Playing; Playing &= Playing - 1)
+        {
+            int j = LowestSetBit(Playing);
+            xrns_sample_playback_state *PlaybackState = &Sampler->PlaybackStates[j];
+            if (!PlaybackState->bPlaying) continue;
+            SampleIndex = PlaybackState->CurrentSample;
+            if (SampleIndex == -1) continue;
+
+            xrns_instrument *Instrument = &xstate->xdoc->Instruments[Sampler->CurrentInstrument];
+            BaseNote = PlaybackState->CurrentBaseNote;
+
+            PlaybackState->SamplesPlayedFor++;
+
+            xrns_sample * Sample = &Instrument->Samples[SampleIndex];
 
-            if (CallerNote->Track != track)
-            {
-                continue;
-            }
+            const xrns_voice_params *Params = VoiceRenderParams(xstate, Sampler, PlaybackState);
 
-            int bNoteReplaced = 0;
+            int16_t *pcm               = Params->pcm;
+            float *pcmf                = Params->pcmf;
+            int NumChannels            = Params->NumChannels;
+            int LengthSamples          = Params->LengthSamples;
+            int MaxLengthSamples       = Params->MaxLengthSamples;
 
-            for (j = 0; j < NumOriginalNotes; j++)
+            int bSampleIsPlayingLoopRelease = (PlaybackState->bIsCrossFading && Sample->LoopRelease);
+
+            if (!pcm && !pcmf) continue; /* no actual PCM data was loaded for this instrument ... */
+
+            xrns_modulation_set *ModulationSet = Params->ModulationSet;
+
+            /* Every sample can have a modulation set attached.
+             */
+
+            /* Volume envelope.
+             *       Points on the automation curves can be on 1/256ths of a beat, or on 1ms time.
+             *       Also, according to the plots, the actual curves are only sampled at that
+             *       resolution as well. Linear interpolation appears to be used inbetween,
+             *       so the curves are evaluated at control rate and ramped per frame.
+             */
+            float VolumePercent = 1.0f;
+            int bOnLastEnvelopePoint = 0;
+
+            if (ModulationSet)
             {
-                if ((CallerNote->Column == UnifiedNotes[j].Column)
-                    && (CallerNote->Row == UnifiedNotes[j].Line)
-                    && (UnifiedNotes[j].Type != XRNS_NOTE_EFFECT))
+                xrns_envelope *Envelope = &ModulationSet->Volume;
+                if (ModulationSet->bVolumeEnvelopePresent)
                 {
-                    /* Replace. */
-                    UnifiedNotes[j].Instrument = CallerNote->Instrument;
-
-                    if (CallerNote->Value == XRNSSong_NoteValue_NOTE_BLANK)
-                    {
-                        UnifiedNotes[j].Note = XRNS_NOTE_BLANK;
-                    }
-                    else if (CallerNote->Value == XRNSSong_NoteValue_NOTE_OFF)
-                    {
-                        UnifiedNotes[j].Note = XRNS_NOTE_OFF;
-                    }
-                    else
-                    {
-                        UnifiedNotes[j].Note = CallerNote->Value + 12*CallerNote->Octave;    
-                    }                    
+                    VolumePercent = ControlRateEnvelope
+                        (xstate
+                        ,Envelope
+                        ,&PlaybackState->VolumeEnvelope
+                        ,PlaybackState->bIsCrossFading
+                        );
 
-                    bNoteReplaced = 1;
-                    break;
+                    bOnLastEnvelopePoint = OnLastEnvelopePoint(Envelope, &PlaybackState->VolumeEnvelope);
                 }
             }
 
-            if (!bNoteReplaced)
+            // @Optimization: I've stuck the scaling factor for int to float here.
+            const float RenoiseOutputGain = pcmf ? 1.0f : XRNS_OUTPUT_GAIN;
+            float CrossFadeLevel = RenoiseOutputGain
+                                 * MasterPreVolume[f]
+                                 * VolumePercent;
+
+            if (Sampler->CurrentTremoloDepth)
             {
-                xrns_note NewNote;
-                InitNote(&NewNote);
+                CrossFadeLevel *= fabs(Sampler->TremoloAmount);
+            }
 
-                NewNote.Type       = XRNS_NOTE_REAL;
-                NewNote.Column     = CallerNote->Column;
-                NewNote.Line       = CallerNote->Row;
-                NewNote.Instrument = CallerNote->Instrument;
+            float IntroCrossFadeLevel = 1.0f;
 
-                if (CallerNote->Value == XRNSSong_NoteValue_NOTE_BLANK)
+            if (PlaybackState->bIsCrossFading)
+            {
+                if (PlaybackState->CrossFadeDuration == 0)
                 {
-                    NewNote.Note = XRNS_NOTE_BLANK;
+                    CrossFadeLevel *= 0.0f;
                 }
-                else if (CallerNote->Value == XRNSSong_NoteValue_NOTE_OFF)
+                else if (PlaybackState->CrossFadeDuration == -1)
                 {
-                    NewNote.Note = XRNS_NOTE_OFF;
+                    /* infinite */
+                    CrossFadeLevel *= 1.0f;
                 }
                 else
                 {
-                    NewNote.Note = CallerNote->Value + 12*CallerNote->Octave;    
+                    CrossFadeLevel *= PlaybackState->CrossFade / ((float) PlaybackState->CrossFadeDuration);
                 }
 
-                UnifiedNotes[NumUnifiedNotes] = NewNote;
-                NumUnifiedNotes++;
+                /* If we are out of envelope data, and the crossfade gets really low,
+                 * we can just chop the note.
+                 */
+                if (bOnLastEnvelopePoint && CrossFadeLevel < 1e-9f)
+                {
+                    PlaybackState->CrossFade = 0;
+                }
             }
-        }
-#endif
 
-        for (i = 0; i < NumUnifiedNotes; i++)
-        {
-            xrns_note *Note = &UnifiedNotes[i];
+            if (PlaybackState->bIntroIsCrossFading)
+            {
+                if (PlaybackState->IntroCrossFadeDuration == 0)
+                {
+                    IntroCrossFadeLevel *= 0.0f;
+                }
+                else
+                {
+                    IntroCrossFadeLevel *= PlaybackState->IntroCrossFade
+                                         / ((float) PlaybackState->IntroCrossFadeDuration);
+                }
+            }
 
-            if (Note->Type == XRNS_NOTE_EFFECT)
+            CrossFadeLevel *= IntroCrossFadeLevel;
+
+            CrossFadeLevel *= Track->SpanPreVolume[f + 1];
+
+            if (Track->bIsMuted)
+                CrossFadeLevel = 0.0f;
+
+            CrossFadeLevel *= Sample->Volume;
+
+            /* Various panning gains are possible to see here.
+             *
+             * 1. Samples may have a static pan value (-50 <-> 50) set.
+             *    (values in the XRNS file will be -1.0 vs. 1.0)
+             * 2. Samples may have a panning modulation curve that maps into the range
+             *    (-50 <-> 50).
+             * 3. Samplers may have a current panning effect applied in the pattern data. This
+             *    may only be set in the panning column, and can have set/adjust. These are set in
+             *    steps of 64 (0x00 <-> 0x80).
+             * 4. Tracks may have a panning value set pre-DSP chain. This is automated with xJxx.
+             *    This is also from (-50 <-> 50).
+             * 5. Tracks may also have a post panning value. (-50 <-> 50)
+             *
+             * These all map to gains of +3dB to -inf, and stack multiplicatively.
+             */
+
+            /* Handle panning from sources 1, 2, 3, 4. The sample's own pan is fixed, and the column
+             * pan only needs working out again when its lerp moves.
+             */
+            if (Sampler->PanningGainsVal != Sampler->CurrentPanning.Val)
             {
-                /* Certain effects apply to the track, DSPs, or global state.
-                 * We handle these effects here.
-                 *
-                 * Effects that modify the playback of the notes in the particular track
-                 * are skipped here, but will be accumulated across all the relevant 
-                 * columns/track groups and applied at once.
-                 */
+                Sampler->PanningGainsVal = Sampler->CurrentPanning.Val;
+                Sampler->PanningGains    = PanningGainFromColNumber(Sampler->CurrentPanning.Val);
+            }
 
-                if (Note->EffectTypeIdx == EFFECT_ID_ZT)
+            xrns_panning_gains SamplePan     = Params->SamplePan;
+            xrns_panning_gains ModulationPan = {1.0f, 1.0f};
+            xrns_panning_gains SamplerPan    = Sampler->PanningGains;
+            xrns_panning_gains TrackPan      = Track->SpanPanning[f];
+
+            RunLerp(&Sampler->CurrentPanning);
+            RunLerp(&Sampler->CurrentVolume);
+
+            if (ModulationSet)
+            {
+                xrns_envelope *Envelope = &ModulationSet->Panning;
+
+                if (ModulationSet->bPanningEnvelopePresent)
                 {
-                    if (Note->EffectValue == XRNS_MISSING_VALUE)
-                    {
-                        xstate->CurrentBPM = 0;
-                        xstate->bSongStopped = 1;
-                    }
-                    else
-                    {
-                        xstate->CurrentBPM = Note->EffectValue;
-                    }
+                    float PanningEnvelopeValue = ControlRateEnvelope
+                        (xstate
+                        ,Envelope
+                        ,&PlaybackState->PanningEnvelope
+                        ,PlaybackState->bIsCrossFading
+                        );
 
-                    RecomputeDurations(xstate);
+                    ModulationPan = PanningGainFromZeroToOne(PanningEnvelopeValue);
                 }
+            }
 
-                if (Note->EffectTypeIdx == EFFECT_ID_ZL)
-                {
-                    xstate->CurrentLinesPerBeat = Note->EffectValue;
+            float LeftPanGain = SamplePan.Left * ModulationPan.Left * SamplerPan.Left * TrackPan.Left;
+            float RightPanGain = SamplePan.Right * ModulationPan.Right * SamplerPan.Right * TrackPan.Right;
 
-                    if (xstate->CurrentLinesPerBeat == XRNS_MISSING_VALUE)
-                        xstate->CurrentLinesPerBeat = 0;
+            /* Leave the fetch positions and gains for this frame behind for the voice kernels. */
+            xrns_voice_span *Span = &VoiceSpans[j];
 
-                    if (!xstate->CurrentLinesPerBeat)
-                        xstate->bSongStopped = 1;
+            float Vol = (CrossFadeLevel * ((float) Sampler->CurrentVolume.Val)) / 255.0f;
 
-                    RecomputeDurations(xstate);
-                }
-                if (Note->EffectTypeIdx == EFFECT_ID_ZK)
-                {
-                    if (Note->EffectValue && Note->EffectValue != XRNS_MISSING_VALUE)
-                        xstate->CurrentTicksPerLine = Note->EffectValue;
+            Span->GainL[f]          = LeftPanGain  * Vol;
+            Span->GainR[f]          = RightPanGain * Vol;
+            Span->NumChannels       = NumChannels;
+            Span->InterpolationMode = Sample->InterpolationMode;
+            Span->NumFrames         = f + 1;
+            Span->bFloat            = (pcmf != NULL);
+            Span->PlaneStride       = Params->PlaneStride;
 
-                    RecomputeDurations(xstate);
-                }
+            if (Sample->InterpolationMode == XRNS_INTERPOLATION_NONE)
+            {
+                int pbsample = (int) round(PlaybackState->PlaybackPosition);
 
-                /* Certain effects apply to the active samplers contained within the
-                 * scope of this effect. Track effects hit all the active samplers on the track,
-                 * and track effects on a track group will hit all the tracks contained.
-                 * 
-                 * In Renoise 3.x, notes can have effects paired with them directly. 
-                 * These are handled as the note is parsed.
-                 *
+                /* A loop end past the end of the sample takes the playhead further out than the guard
+                 * frames go, it plays silence out there.
                  */
+                int bOutside = (pbsample < 0 || pbsample >= MaxLengthSamples);
 
-                if (Note->Type == XRNS_NOTE_EFFECT)
+                if (pcmf)
                 {
-                    /* Check for and handle DSP parameter changes, they have 
-                     * commands that look like 1103 => DSP 1, Param 1, Value
-                     */
-
-                    if (Note->EffectTypeC[0] != '0' && Note->EffectTypeC[0] != 'Z')
-                    {
-                        int DSPIndex = Note->EffectTypeC[0] - '1';
-                        int DSPParam = Note->EffectTypeC[1] - '0';
-                        int ActualEffectValue = (Note->EffectValue == XRNS_MISSING_VALUE) ? 0 : Note->EffectValue;
+                    Span->BaseF[f] = bOutside ? pcmf + MaxLengthSamples : pcmf + pbsample;
+                    Span->NextF[f] = Span->BaseF[f];
+                }
+                else
+                {
+                    Span->Base[f]  = bOutside ? XRNSSilentFrame : VoiceFramePointer(pcm, pbsample, NumChannels);
+                    Span->Next[f]  = Span->Base[f];
+                }
+                Span->Alpha[f] = 0.0f;
+            } 
+            else if (Sample->InterpolationMode == XRNS_INTERPOLATION_LINEAR)
+            {
+                unsigned int OffsetIntoSample = Params->SliceStart;
 
-                        if (DSPParam == 0)
-                        {
-                            /* turns the DSP effect on and off */
-                            xstate->TrackStates[track]->DSPEffectEnableFlags[DSPIndex] = !!(ActualEffectValue);
-                        }
-                        else if (DSPIndex < xstate->xdoc->Tracks[track].NumDSPEffectUnits)
-                        {
-                            dsp_effect_desc *EffectDesc = &xstate->xdoc->Tracks[track].DSPEffectDescs[DSPIndex];
-                            dsp_effect             *DSP = &xstate->TrackStates[track]->DSPEffects[DSPIndex];
+                float base_sample_floating;
+                unsigned int base_sample;
+                float alpha;
 
-                            if ((DSPParam - 1) < DSP->NumParameters)
-                            {
-                                DSP->SetParameter(DSP->State, DSPParam - 1, ActualEffectValue / 255.0f);
-                            }
-                        }
-                    }
-                    else
-                    {
-                        for (a = track; a >= 0 && a >= track - TrackDesc->WrapsNPreviousTracks; a--)
-                        {
-                            xrns_track_desc *TrackDesc = &xstate->xdoc->Tracks[a];
-                            for (col = 0; col < TrackDesc->NumColumns; col++)
-                            {
-                                SetEffectCommandOnColumnSamplers(xstate, a, col, Note, 1);
-                            }
-                        }
-                    }
+                if (PlaybackState->PlaybackDirection == XRNS_FORWARD)
+                {
+                    base_sample_floating = floor(PlaybackState->PlaybackPosition);
+                    base_sample = (unsigned int) base_sample_floating;
+                    alpha = PlaybackState->PlaybackPosition - base_sample_floating;
                 }
-            }
-            else
-            {
-                xrns_sampler_bank *SamplerBank = &xstate->SamplerBanks[track][Note->Column];
-                if (Note->Note == XRNS_NOTE_BLANK || Note->Note == XRNS_MISSING_VALUE)
+                else
                 {
-                    /* Commands in the volume column behave differently depending on
-                     * whether they are paired with a note or not. Volume commands 
-                     * attached to a note only affect that note. Otherwise, they address
-                     * _all_ the live samples in the column.
-                     *
-                     * If the delay column has a value inside, the vol/pan stuff is also
-                     * delayed.
-                     */
-                    if (Note->Delay != XRNS_MISSING_VALUE && Note->Delay)
+                    base_sample_floating = ceil(PlaybackState->PlaybackPosition);
+                    base_sample = (unsigned int) base_sample_floating;
+                    alpha = base_sample_floating - PlaybackState->PlaybackPosition;
+                }
+
+                unsigned int next_sample;
+
+                if (bSampleIsPlayingLoopRelease || Sample->LoopMode == XRNS_LOOP_MODE_OFF)
+                {
+                    if (PlaybackState->PlaybackDirection == XRNS_FORWARD)
                     {
-                        SamplerBlankTriggerNewNote(xstate, SamplerBank, *Note, track, NULL);
-                        continue;
+                        if (base_sample == LengthSamples - 1)
+                            next_sample = base_sample;
+                        else
+                            next_sample = base_sample + 1;
                     }
                     else
                     {
-                        if (Note->Volume <= 0x80)
-                        {
-                            int s;
-                            for (s = 0; s < XRNS_MAX_SAMPLERS_PER_COLUMN; s++)
-                            {
-                                xrns_sampler *Sampler = &SamplerBank->Samplers[s];
-                                if (Sampler->Active)
-                                {
-                                    Sampler->CurrentVolume.Target = Note->Volume * 2u;
-                                }
-                            }
-                        }
-
-                        if (Note->Panning <= 0x80)
-                        {
-                            int s;
-                            for (s = 0; s < XRNS_MAX_SAMPLERS_PER_COLUMN; s++)
-                            {
-                                xrns_sampler *Sampler = &SamplerBank->Samplers[s];
-                                if (Sampler->Active)
-                                {
-                                    Sampler->CurrentPanning.Target = Note->Panning;
-                                }
-                            }
-                        }
-
-                        SetEffectCommandOnColumnSamplers(xstate, track, Note->Column, Note, 0);
-                        continue;
+                        if (base_sample == 0)
+                            next_sample = base_sample;
+                        else
+                            next_sample = base_sample - 1;
                     }
                 }
+                else
+                {
+                    if (PlaybackState->PlaybackDirection == XRNS_FORWARD)
+                    {
+                        next_sample = base_sample + 1;
+                    }
+                    else
+                    {
+                        next_sample = base_sample - 1;
+                    }
 
-                SamplerBlankTriggerNewNote(xstate, SamplerBank, *Note, track, NULL);
-                SetEffectCommandOnColumnSamplers(xstate, track, Note->Column, Note, 0);
-            }
-        }
-    }
-
-    /* some effects need to be calculated with the benefit of knowing ALL the effects */
-    for (track = 0; track < xstate->xdoc->NumTracks; track++)
-    {
-        FinaliseEffectCommands(xstate, track);
-    }
-
-    xstate->NumCallerNotes = 0;
-}
-
-static inline double 
-SampleLoopWrapping
-    (xrns_sample *Sample
-    ,xrns_sample_playback_state *PlaybackState
-    ,double ProposedNewPosition
-    )
-{
-    int bFullyUnwound = 0;
-
-    while (!bFullyUnwound)
-    {
-        int bWrappedLoopPosition = 0;
-        
-        if ((PlaybackState->PlaybackDirection == XRNS_FORWARD) && (ProposedNewPosition >= Sample->LoopEnd))
-        {
-            bWrappedLoopPosition = 1;
-        }
-        else if ((PlaybackState->PlaybackDirection == XRNS_BACKWARD) && (ProposedNewPosition < Sample->LoopStart))
-        {
-            bWrappedLoopPosition = 1;
-        }
-
-        if (bWrappedLoopPosition)
-        {
-            if (PlaybackState->PlaybackDirection == XRNS_FORWARD)
-            {
-                double OverHang = ProposedNewPosition - Sample->LoopEnd;
+                    /* only looking ahead, this mustn't turn the playhead around */
+                    char Direction = PlaybackState->PlaybackDirection;
+                    next_sample = (unsigned int) SampleLoopWrapPosition(Sample, &Direction, next_sample);
+                }
 
-                if (Sample->LoopMode == XRNS_LOOP_MODE_FORWARD)
-                {
-                    ProposedNewPosition = Sample->LoopStart + OverHang;
-                } else if (Sample->LoopMode == XRNS_LOOP_MODE_BACKWARD)
+                /* as above, a loop can take the playhead past the end of the sample */
+                int bOutside = (OffsetIntoSample + base_sample >= MaxLengthSamples);
+
+                if (pcmf)
                 {
-                    ProposedNewPosition = Sample->LoopEnd - OverHang;
-                    PlaybackState->PlaybackDirection = XRNS_BACKWARD;
-                } else if (Sample->LoopMode == XRNS_LOOP_MODE_PINGPONG)
+                    /* the first guard frame stands in for silence, in both planes */
+                    Span->BaseF[f] = bOutside 
+                                   ? pcmf + MaxLengthSamples
+                                   : pcmf + (int) (OffsetIntoSample + base_sample);
+                    Span->NextF[f] = (next_sample >= LengthSamples) 
+                                   ? pcmf + MaxLengthSamples
+                                   : pcmf + (int) (OffsetIntoSample + next_sample);
+                }
+                else
                 {
-                    ProposedNewPosition = Sample->LoopEnd - OverHang;
-                    PlaybackState->PlaybackDirection = XRNS_BACKWARD;
+                    Span->Base[f]  = bOutside
+                                   ? XRNSSilentFrame
+                                   : VoiceFramePointer(pcm, OffsetIntoSample + base_sample, NumChannels);
+                    Span->Next[f]  = (next_sample >= LengthSamples) 
+                                   ? XRNSSilentFrame
+                                   : VoiceFramePointer(pcm, OffsetIntoSample + next_sample, NumChannels);
                 }
+                Span->Alpha[f] = alpha;
             }
-            else if (PlaybackState->PlaybackDirection == XRNS_BACKWARD)
+            else
             {
-                double OverHang = Sample->LoopStart - ProposedNewPosition;
+                int Taps = (Sample->InterpolationMode == XRNS_INTERPOLATION_SINC) ? XRNS_SINC_TAPS : XRNS_CUBIC_TAPS;
+                int bLooping = (!bSampleIsPlayingLoopRelease && Sample->LoopMode != XRNS_LOOP_MODE_OFF);
+                int SliceStart = Params->SliceStart;
 
-                if (Sample->LoopMode == XRNS_LOOP_MODE_BACKWARD)
-                {
-                    ProposedNewPosition = Sample->LoopEnd - OverHang;
-                } else if (Sample->LoopMode == XRNS_LOOP_MODE_PINGPONG)
-                {
-                    ProposedNewPosition = Sample->LoopStart + OverHang;
-                    PlaybackState->PlaybackDirection = XRNS_FORWARD;
-                } else if (Sample->LoopMode == XRNS_LOOP_MODE_FORWARD)
-                {
-                    ProposedNewPosition = Sample->LoopStart + OverHang;
-                    PlaybackState->PlaybackDirection = XRNS_FORWARD;
-                }
+                VoiceGatherTaps
+                    (Span, f, Taps
+                    ,pcmf ? NULL : pcm + NumChannels * SliceStart
+                    ,pcmf ? pcmf + SliceStart : NULL
+                    ,Params->PlaneStride, NumChannels, LengthSamples
+                    ,Params->GuardBefore, Params->GuardAfter, Sample, PlaybackState, bLooping
+                    );
             }
-        }
-        else
-        {
-            bFullyUnwound = 1;
-        }
-    }
-
-    return ProposedNewPosition;
-}
-
-int run_engine
-    (XRNSPlaybackState *xstate
-    ,int                bExitingAfterTick
-    ,int                bExitingAfterLine
-    ,int                bExitingBeforeLine
-    ,int                MaximumSamples
-    )
-{
-    TracyCZoneN(main_ctx, "Run Engine", 1);
 
-    int return_code = XRNS_SUCCESS;
+            /* Note - BaseNote = the relative pitch to apply to the sample
+             * Instead of stepping by 1 sample, we need to step by the tuning..
+             *
+             * 2.0^((AbsoluatePitchOnPiano - DesiredTone)/12);
+             *
+             * Since the sample is "at" the AbsoluatePitchOnPiano, and the BaseNote is set
+             * to this number, and we know DesiredTone, we just need to look this function up
+             * in a pitching table.
+             *
+             */
 
-    int bTimeToExit = 0;
-    int SamplesGenerated = 0;
+            /* Piggyback on this for the different sample rates.
+             */
 
-    if (xstate->Output.RingBufferFreeSamples == 0) bTimeToExit = 1;
+            /* Fine pitch is effected by a combination of note effects, modulation curves,
+             * and instrument settings.
+             *
+             * If the sum of these pitch adjustments is larger than one semitone, we adjust our
+             * index into the pitch table. The fractional remainder is then lerped between
+             * adjacent values in the table.
+             */
 
-    if (xstate->bSongStopped)
-    {
-        float __x = 0.0f;
-        for (int x = 0; x < MaximumSamples; x++)
-            PushRingBuffer(&xstate->Output, &__x, 1);
-        return return_code;
-    }
+            int IntegerPartOfPitch = (Sampler->CurrentNote - BaseNote + Sample->Transpose);
+            double PitchAdjustment = (Sampler->GlideNote / 16.0) + (Sampler->CurrentSlideOffset / 16.0);
 
-    if (xstate->bEvenEarlierFirstPlay)
-    {
-        if (xstate->PatternHasBeenCued)
-        {
-            /* if a pattern was cued before playing began, we should jump there first. */
-            xstate->CurrentPatternIndex = xstate->CuedPatternIndex;
-            xstate->PatternHasBeenCued = 0;
-        }
+            /* Pitch envelopes also apply.
+             */
+            double PitchEnvelopeValue = 1.0f;
 
-        xstate->CurrentBPM          = xstate->xdoc->BeatsPerMin;
-        xstate->CurrentLinesPerBeat = xstate->xdoc->LinesPerBeat;
-        xstate->CurrentTicksPerLine = xstate->xdoc->TicksPerLine;
-        xstate->CurrentSample       = 0;
-        xstate->BaseOfCurrentlyPlayingLine = 0.0;
-        xstate->bEvenEarlierFirstPlay = 0;
+            if (ModulationSet)
+            {
+                xrns_envelope *Envelope = &ModulationSet->Pitch;
 
-        RecomputeDurations(xstate);
+                if (ModulationSet->bPitchEnvelopePresent)
+                {
+                    double NewEnv = ControlRateEnvelope
+                        (xstate
+                        ,Envelope
+                        ,&PlaybackState->PitchEnvelope
+                        ,PlaybackState->bIsCrossFading
+                        );
 
-        if (bExitingBeforeLine)
-        {
-            bTimeToExit = 1;
-            return XRNS_WOULD_WRAP_ROW;
-        }
-    }
+                    PitchEnvelopeValue = ((double) ModulationSet->PitchModulationRange)
+                                       * (2.0f * NewEnv - 1.0f);
+                    PitchAdjustment   += PitchEnvelopeValue;
+                }
+            }
 
-    if (xstate->bFirstPlay)
-    {
-        /* update notes, instruments, etc .. */
-        /* evaluate all effect changes, including tempo! */
-        xrns_update_notes_and_effects(xstate, 1);
-        xrns_perform_tick_processing(xstate); /* always a tick on a line */
+            if (!Sample->BeatSyncIsActive)
+            {
+                PitchAdjustment += (Sample->Finetune / 128.0);
+            }
 
-        RecomputeDurations(xstate);
+            if (Sampler->CurrentVibratoDepth != 0)
+            {
+                PitchAdjustment += (Sampler->VibratoOffset / 100.0f);
+            }
 
-        double DurationOfThisLine  = xstate->CurrentLineDuration;
-        xstate->LocationOfNextLine = xstate->XRNSGridOffset + DurationOfThisLine;
-        xstate->LocationOfNextTick = xstate->CurrentTickDuration;
-        xstate->bFirstPlay = 0;
+            /* Get the Hz of the sample if it is played back as the basenote.
+             * Apply the key, transpose, and everything else ...
+             */
 
-        if (bExitingAfterLine || bExitingAfterTick)
-        {
-            bTimeToExit = 1;
-        }
-    }
+            float OriginalHz = Params->OriginalHz;
 
-    while(!bTimeToExit)
-    {
-        int i;
-        float *p_samples = &xstate->Output.OutputRingBuffer[2 * xstate->Output.RingBufferWritePtr];
+            if (PitchAdjustment > 1.0)
+            {
+                IntegerPartOfPitch += floor(PitchAdjustment);
+                PitchAdjustment    -= floor(PitchAdjustment);
+            }
+            else if (PitchAdjustment < -1.0)
+            {
+                IntegerPartOfPitch += -floor(-PitchAdjustment);
+                PitchAdjustment    +=  floor(-PitchAdjustment);
+            }
 
-        p_samples[0] = 0.0f;
-        p_samples[1] = 0.0f;
+            int PitchTableIdx = 96 + IntegerPartOfPitch;
 
-        int CurrentLevel = xstate->xdoc->Tracks[0].Depth;
+            if (PitchTableIdx < 0)
+                PitchTableIdx = 0;
+            if (PitchTableIdx >= PITCHING_TABLE_LENGTH)
+                PitchTableIdx = PITCHING_TABLE_LENGTH - 1;
 
-        float TempBuffers[XRNS_MAX_NESTING_DEPTH][2] = {0};
+            double KeyPitch = PitchingTable[PitchTableIdx];
 
-        /* Generate a sample into the output buffer. */
-        for (int track = 0; track < xstate->xdoc->NumTracks; track++)
-        {   
-            float *tsample;
-            float  Dry[2];
+            if (Sample->BeatSyncIsActive)
+            {
+                /* Work out the re-pitch....  */
+                double DurationOfBeatSyncLines = Sample->BeatSyncLines * xstate->CurrentLineDuration
+                                               / xstate->OutputSampleRate;
 
-            TracyCZoneN(ctx, "Track Preamble", 1);
+                KeyPitch = ((double) LengthSamples / (DurationOfBeatSyncLines * ((double)Params->SampleRateHz)));
+            }
 
-            xrns_track_playback_state *Track = xstate->TrackStates[track];
-            xrns_track_desc      *TrackDesc2 = &xstate->xdoc->Tracks[track];
-            unsigned int PatternIdx = xstate->xdoc->PatternSequence[xstate->CurrentPatternIndex].PatternIdx;
-            xrns_pattern *Pattern = &xstate->xdoc->PatternPool[PatternIdx];
-            xrns_track *TrackData = &Pattern->Tracks[track];
+            if (PitchAdjustment > 0 && PitchTableIdx < PITCHING_TABLE_LENGTH - 1)
+            {
+                KeyPitch = (KeyPitch * (1.0 - PitchAdjustment))
+                         + (PitchAdjustment) * PitchingTable[PitchTableIdx + 1];
+            }
+            else if (PitchAdjustment < 0 && PitchTableIdx > 0)
+            {
+                KeyPitch = (KeyPitch * (1.0 + PitchAdjustment))
+                         + (-PitchAdjustment) * PitchingTable[PitchTableIdx - 1];
+            }
 
-            Dry[0] = 0.0f;
-            Dry[1] = 0.0f;
+            double dt = KeyPitch * Params->RateRatio;
 
-            double DurationOfThisLine2 = xstate->CurrentLineDuration;
-            float ProgressThroughPatternIn256thRows = xstate->CurrentRow * 256;
+            Sampler->SavedPitchMod = OriginalHz * dt;
 
-            ProgressThroughPatternIn256thRows 
-                += 256.0 - (256 * (xstate->LocationOfNextLine - xstate->CurrentSample) / DurationOfThisLine2);
+            double PrevPos = PlaybackState->PlaybackPosition;
 
-            /* handle the track automation curves. */
-            for (i = 0; i < TrackData->NumEnvelopes; i++)
+            if (PlaybackState->PlaybackDirection == XRNS_FORWARD)
+            {
+                PlaybackState->PlaybackPosition += dt;
+            }
+            else
             {
-                xrns_envelope *Envelope = &TrackData->Envelopes[i];
+                PlaybackState->PlaybackPosition -= dt;
+            }
 
-                if (Envelope->NumPoints == 0) continue;
+            if (!bSampleIsPlayingLoopRelease && Sample->LoopMode != XRNS_LOOP_MODE_OFF)
+            {
+                PlaybackState->PlaybackPosition
+                    = SampleLoopWrapping(Sample, PlaybackState, PlaybackState->PlaybackPosition);
+            }
 
-                if (Envelope->DeviceIndex == 0)
+            /* exiting the sample boundaries always ends the note, sample looping
+             * will keep the playhead in-bounds.
+             */
+            if (bSampleIsPlayingLoopRelease || Sample->LoopMode == XRNS_LOOP_MODE_OFF)
+            {
+                if (PlaybackState->PlaybackDirection == XRNS_FORWARD)
                 {
-                    /* this is the standard Renoise device */
-                    switch (Envelope->ParameterIndex)
+                    if (   PrevPos < PlaybackState->FrontPosition0
+                        && PlaybackState->PlaybackPosition >= PlaybackState->FrontPosition0)
                     {
-                        case 1: /* panning */
-                        {
-                            double v = WalkEnvelopeStateless(Envelope, ProgressThroughPatternIn256thRows);
-                            Track->CurrentPanning.Target = 2.0 * v - 1.0;
-                            break;
-                        }
-                        case 2: /* volume */
-                        {
-                            double v = WalkEnvelopeStateless(Envelope, ProgressThroughPatternIn256thRows) * 1.414f;
-                            Track->CurrentPreVolume.Target = v;
-                            break;
-                        }
-                        case 3: /* width (ignored) */
-                        {
-                            break;
-                        }
+                        StopSamplePlayback(Sampler, j);
                     }
                 }
-                else
+                else if (PlaybackState->PlaybackDirection == XRNS_BACKWARD)
                 {
-                    int DSPIndex = Envelope->DeviceIndex - 1;
-                    /* this will be a track FX unit */
-                    if (DSPIndex >= 0 && DSPIndex < TrackDesc2->NumDSPEffectUnits)
+                    if (   PrevPos > PlaybackState->BackPosition0
+                        && PlaybackState->PlaybackPosition <= PlaybackState->BackPosition0)
                     {
-                        dsp_effect_desc *EffectDesc = &xstate->xdoc->Tracks[track].DSPEffectDescs[DSPIndex];
-                        dsp_effect             *DSP = &xstate->TrackStates[track]->DSPEffects[DSPIndex];
+                        StopSamplePlayback(Sampler, j);
+                    }
 
-                        if (Envelope->ParameterIndex - 1 < DSP->NumParameters)
-                        {
-                            double v = WalkEnvelopeStateless(Envelope, ProgressThroughPatternIn256thRows);
-                            DSP->SetParameter(DSP->State, Envelope->ParameterIndex - 1, v);
-                        }
+                    if (   PrevPos > PlaybackState->BackPosition1
+                        && PlaybackState->PlaybackPosition <= PlaybackState->BackPosition1)
+                    {
+                        StopSamplePlayback(Sampler, j);
                     }
                 }
             }
 
-            RunLerp(&Track->CurrentPanning);
-            RunLerp(&Track->CurrentPreVolume);
-            RunLerp(&Track->CurrentGamePostVolume);
+            if (PlaybackState->bIsCrossFading)
+            {
+                if (PlaybackState->CrossFade > 0)
+                {
+                    PlaybackState->CrossFade--;
+                }
+                else
+                {
+                    PlaybackState->bIsCrossFading = 0;
+                    StopSamplePlayback(Sampler, j);
+                }
+            }
 
-            if (CurrentLevel < xstate->xdoc->Tracks[track].Depth)
+            if (PlaybackState->bIntroIsCrossFading)
             {
-                /* Clear into the next depth down, ready for future summing...
-                 */
-                CurrentLevel = xstate->xdoc->Tracks[track].Depth;
-                TempBuffers[CurrentLevel][0] = 0.0f;
-                TempBuffers[CurrentLevel][1] = 0.0f;
+                if (PlaybackState->IntroCrossFade < PlaybackState->IntroCrossFadeDuration)
+                {
+                    PlaybackState->IntroCrossFade++;
+                }
+                else
+                {
+                    PlaybackState->bIntroIsCrossFading = 0;
+                }
             }
-            else if (CurrentLevel > xstate->xdoc->Tracks[track].Depth)
+
+            if (!Sampler->PlayingSamples)
             {
-                /* When ascending up one level, sum the result from the 
-                 * current depth up to the new depth.
-                 */
-                TempBuffers[xstate->xdoc->Tracks[track].Depth][0] += TempBuffers[CurrentLevel][0];
-                TempBuffers[xstate->xdoc->Tracks[track].Depth][1] += TempBuffers[CurrentLevel][1];
-                CurrentLevel = xstate->xdoc->Tracks[track].Depth;
+                Sampler->bPlaying = 0;
+                Sampler->Active = 0;
             }
 
-            tsample = TempBuffers[CurrentLevel];
+        }
+    }
+
+    /* Playing samples only ever stop inside a span, so each one covers frames [0, NumFrames). */
+    for (unsigned int Playing = SpanSamples; Playing; Playing &= Playing - 1)
+    {
+        xrns_voice_span *Span = &VoiceSpans[LowestSetBit(Playing)];
 
-            TracyCZoneEnd(ctx);
+        if (!Span->NumFrames) continue;
 
-            for (int col = 0; col < xstate->xdoc->Tracks[track].NumColumns; col++)
+        if (Span->bFloat)
+        {
+            if (Span->InterpolationMode == XRNS_INTERPOLATION_CUBIC)
+            {
+                VoiceKernelPolyphaseFloat(Span, XRNSCubicTable, XRNS_CUBIC_TAPS, DryL, DryR);
+            }
+            else if (Span->InterpolationMode == XRNS_INTERPOLATION_SINC)
+            {
+                VoiceKernelPolyphaseFloat(Span, XRNSSincTable, XRNS_SINC_TAPS, DryL, DryR);
+            }
+            else
             {
-                int SampleIndex = -1;
-                int BaseNote = -1;
+                VoiceKernelFloat(Span, DryL, DryR);
+            }
+        }
+        else if (Span->InterpolationMode == XRNS_INTERPOLATION_CUBIC)
+        {
+            VoiceKernelPolyphase(Span, XRNSCubicTable, XRNS_CUBIC_TAPS, DryL, DryR);
+        }
+        else if (Span->InterpolationMode == XRNS_INTERPOLATION_SINC)
+        {
+            VoiceKernelPolyphase(Span, XRNSSincTable, XRNS_SINC_TAPS, DryL, DryR);
+        }
+        else if (Span->NumChannels == 2)
+        {
+            VoiceKernelStereo(Span, DryL, DryR);
+        }
+        else
+        {
+            VoiceKernelMono(Span, DryL, DryR);
+        }
+    }
 
-                xrns_sampler_bank *SamplerBank = &xstate->SamplerBanks[track][col];
+    TracyCZoneEnd(ctxx);
+}
 
-                for (int s = 0; s < XRNS_MAX_SAMPLERS_PER_COLUMN; s++)
-                {
-                    xrns_sampler *Sampler = &SamplerBank->Samplers[s];
+/* Decaying filter and reverb state turns into denormals, which are very slow on x86. Rendering runs
+ * with flush-to-zero and denormals-are-zero on, on whichever thread it happens to be, and puts the
+ * thread's previous mode back afterwards.
+ */
+static inline unsigned int EnterDenormalFreeMode(void)
+{
+    unsigned int SavedCSR = _mm_getcsr();
+    _mm_setcsr(SavedCSR | _MM_FLUSH_ZERO_ON | _MM_DENORMALS_ZERO_ON);
+    return SavedCSR;
+}
 
-                    if (Sampler->QCounter)
-                    {
-                        Sampler->QCounter--;
-                    }
+static inline void LeaveDenormalFreeMode(unsigned int SavedCSR)
+{
+    _mm_setcsr(SavedCSR);
+}
 
-                    if (!Sampler->QCounter && Sampler->bQPrepped)
-                    {
-                        Sampler->bQPrepped = 0;
+/* Whether every frame of a span is below XRNS_SILENCE_THRESHOLD. */
+static inline int SpanIsSilent(const float *Left, const float *Right, int NumFrames)
+{
+    for (int f = 0; f < NumFrames; f++)
+    {
+        if (fabsf(Left[f]) >= XRNS_SILENCE_THRESHOLD || fabsf(Right[f]) >= XRNS_SILENCE_THRESHOLD)
+            return 0;
+    }
+    return 1;
+}
+
+/* Renders one track's span into its SpanAudio and ringbuffer: the track's own voices, the sum of its 
+ * children for a group or of the sends routed to it for a send track, then the effect chain, post panning
+ * and post volume. Nothing outside of the track is written to apart from VoiceSpans (the send taps belong
+ * to the track that sends), so tracks can be rendered alongside each other, see RenderTracks().
+ */
+void RenderTrackSpan
+    (XRNSPlaybackState *xstate
+    ,int                track
+    ,xrns_pattern      *Pattern
+    ,xrns_voice_span   *VoiceSpans
+    ,int                SpanLength
+    )
+{
+    xrns_track_playback_state *MasterTrack = xstate->TrackStates[xstate->xdoc->MasterTrackIdx];
+    int i;
 
-                        int OriginalNote = Sampler->OriginalNote.Note;
+    xrns_track_playback_state *Track = xstate->TrackStates[track];
+    xrns_track_desc       *TrackDesc = &xstate->xdoc->Tracks[track];
+    xrns_track            *TrackData = &Pattern->Tracks[track];
 
-                        if (OriginalNote == XRNS_NOTE_BLANK || OriginalNote == XRNS_MISSING_VALUE)
+    float *DryL = Track->SpanAudio[0];
+    float *DryR = Track->SpanAudio[1];
+
+    /* The master runs its smoothing last in a frame, so the other tracks see its previous value. */
+    float *MasterPreVolume = (track == xstate->xdoc->MasterTrackIdx) ? &MasterTrack->SpanPreVolume[1] 
+                                                                      : &MasterTrack->SpanPreVolume[0];
+
+    memset(DryL, 0, sizeof(float) * SpanLength);
+    memset(DryR, 0, sizeof(float) * SpanLength);
+
+    for (int col = 0; col < TrackDesc->NumColumns; col++)
+    {
+        xrns_sampler_bank *SamplerBank = &xstate->SamplerBanks[track][col];
+
+        for (int s = NextLiveSampler(SamplerBank, 0); s < XRNS_MAX_SAMPLERS_PER_COLUMN; s = NextLiveSampler(SamplerBank, s + 1))
+        {
+            xrns_sampler *Sampler = &SamplerBank->Samplers[s];
+
+            if (Sampler->QCounter)
+            {
+                Sampler->QCounter--;
+            }
+
+            if (!Sampler->QCounter && Sampler->bQPrepped)
+            {
+                Sampler->bQPrepped = 0;
+
+                int OriginalNote = Sampler->OriginalNote.Note;
+
+                if (OriginalNote == XRNS_NOTE_BLANK || OriginalNote == XRNS_MISSING_VALUE)
+                {
+                    if (Sampler->OriginalNote.Volume <= 0x80)
+                    {
+                        int s;
+                        for (s = NextLiveSampler(SamplerBank, 0); s < XRNS_MAX_SAMPLERS_PER_COLUMN; s = NextLiveSampler(SamplerBank, s + 1))
                         {
-                            if (Sampler->OriginalNote.Volume <= 0x80)
+                            xrns_sampler *Sampler2 = &SamplerBank->Samplers[s];
+                            if (Sampler2->Active)
                             {
-                                int s;
-                                for (s = 0; s < XRNS_MAX_SAMPLERS_PER_COLUMN; s++)
-                                {
-                                    xrns_sampler *Sampler2 = &SamplerBank->Samplers[s];
-                                    if (Sampler2->Active)
-                                    {
-                                        Sampler2->CurrentVolume.Target = Sampler->OriginalNote.Volume * 2u;
-                                    }
-                                }
+                                Sampler2->CurrentVolume.Target = Sampler->OriginalNote.Volume * 2u;
                             }
+                        }
+                    }
 
-                            if (Sampler->OriginalNote.Panning <= 0x80)
+                    if (Sampler->OriginalNote.Panning <= 0x80)
+                    {
+                        int s;
+                        for (s = NextLiveSampler(SamplerBank, 0); s < XRNS_MAX_SAMPLERS_PER_COLUMN; s = NextLiveSampler(SamplerBank, s + 1))
+                        {
+                            xrns_sampler *Sampler2 = &SamplerBank->Samplers[s];
+                            if (Sampler2->Active)
                             {
-                                int s;
-                                for (s = 0; s < XRNS_MAX_SAMPLERS_PER_COLUMN; s++)
-                                {
-                                    xrns_sampler *Sampler2 = &SamplerBank->Samplers[s];
-                                    if (Sampler2->Active)
-                                    {
-                                        Sampler2->CurrentPanning.Target = Sampler->OriginalNote.Panning;
-                                    }
-                                }
+                                Sampler2->CurrentPanning.Target = Sampler->OriginalNote.Panning;
                             }
-
-                            SetEffectCommandOnColumnSamplers
-                                (xstate
-                                ,track
-                                ,Sampler->OriginalNote.Column
-                                ,&Sampler->OriginalNote
-                                ,0
-                                );
                         }
-                        else
+                    }
+
+                    SetEffectCommandOnColumnSamplers
+                        (xstate
+                        ,track
+                        ,Sampler->OriginalNote.Column
+                        ,&Sampler->OriginalNote
+                        ,0
+                        );
+                }
+                else
+                {
+                    if (Sampler->bHitWithGCommand)
+                    {
+                        int MostRecentlyPlayingSampler = SamplerBank->MostRecentlyPlayingSampler;
+                        xrns_sampler *RecentSampler = &SamplerBank->Samplers[MostRecentlyPlayingSampler];
+                        RecentSampler->CurrentVolume.Target = Sampler->CurrentVolume.Target;
+                        RecentSampler->CurrentPanning.Target = Sampler->CurrentPanning.Target;
+                    }
+                    else
+                    {
+                        PerformNewNoteActionOnSamplerBank
+                            (xstate
+                            ,xstate->xdoc
+                            ,SamplerBank
+                            ,Sampler->bIsNoteOff
+                            );
+
+                        if (Sampler->PlaybackStates[0].CurrentSample != -1)
                         {
-                            if (Sampler->bHitWithGCommand)
+                            Sampler->Active   = 1;
+                            Sampler->bPlaying = (!Sampler->bIsNoteOff);
+                            for (int j = 0; j < XRNS_MAX_SAMPLES_PLAYING; j++)
                             {
-                                int MostRecentlyPlayingSampler = SamplerBank->MostRecentlyPlayingSampler;
-                                xrns_sampler *RecentSampler = &SamplerBank->Samplers[MostRecentlyPlayingSampler];
-                                RecentSampler->CurrentVolume.Target = Sampler->CurrentVolume.Target;
-                                RecentSampler->CurrentPanning.Target = Sampler->CurrentPanning.Target;
-                            }
-                            else
-                            {
-                                PerformNewNoteActionOnSamplerBank
-                                    (xstate
-                                    ,xstate->xdoc
-                                    ,SamplerBank
-                                    ,Sampler->bIsNoteOff
-                                    );
-
-                                if (Sampler->PlaybackStates[0].CurrentSample != -1)
+                                xrns_sample_playback_state *PlaybackState = &Sampler->PlaybackStates[j];
+                                if (PlaybackState->bMapped)
                                 {
-                                    Sampler->Active   = 1;
-                                    Sampler->bPlaying = (!Sampler->bIsNoteOff);
-                                    for (int j = 0; j < XRNS_MAX_SAMPLES_PLAYING; j++)
-                                    {
-                                        xrns_sample_playback_state *PlaybackState = &Sampler->PlaybackStates[j];
-                                        if (PlaybackState->bMapped)
-                                        {
-                                            PlaybackState->Active = Sampler->Active;
-                                            PlaybackState->bPlaying = Sampler->bPlaying;
-                                        }
-                                    }
+                                    PlaybackState->Active = Sampler->Active;
+                                    PlaybackState->bPlaying = Sampler->bPlaying;
+                                    Sampler->PlayingSamples |= (1u << j);
                                 }
-
-                                SamplerBank->MostRecentlyPlayingSampler = s;
                             }
                         }
+
+                        SamplerBank->MostRecentlyPlayingSampler = s;
                     }
+                }
+            }
 
-                    if (!Sampler->bPlaying) continue;
+            /* FramesUntilNextEvent() makes sure nothing else comes due inside this span. */
+            if (Sampler->QCounter)
+            {
+                Sampler->QCounter = (Sampler->QCounter > SpanLength - 1) ? Sampler->QCounter - (SpanLength - 1) : 0;
+            }
 
-                    int j;
-                    for (j = 0; j < XRNS_MAX_SAMPLES_PLAYING; j++)
-                    {
-                        xrns_sample_playback_state *PlaybackState = &Sampler->PlaybackStates[j];
-                        if (!PlaybackState->bPlaying) continue;
-                        SampleIndex = PlaybackState->CurrentSample;
-                        if (SampleIndex == -1) continue;
+            if (Sampler->bPlaying)
+            {
+                RenderSamplerSpan(xstate, track, Sampler, VoiceSpans, DryL, DryR, MasterPreVolume, SpanLength);
+            }
 
-                        xrns_instrument *Instrument = &xstate->xdoc->Instruments[Sampler->CurrentInstrument];
-                        BaseNote = PlaybackState->CurrentBaseNote;
+            if (!SamplerIsLive(Sampler))
+            {
+                SamplerBank->LiveSamplers &= ~(1u << s);
+            }
+        }
+    }
 
-                        PlaybackState->SamplesPlayedFor++;
+    /* sum all the nested tracks together for this group track */
+    if (TrackDesc->bIsGroup)
+    {
+        int _trackIndex;
 
-                        xrns_sample * Sample = &Instrument->Samples[SampleIndex];
+        memset(DryL, 0, sizeof(float) * SpanLength);
+        memset(DryR, 0, sizeof(float) * SpanLength);
+        
+        for (_trackIndex = 1; _trackIndex <= TrackDesc->WrapsNPreviousTracks; _trackIndex++)
+        {
+            if (track - _trackIndex < 0) continue;
 
-                        int16_t *pcm               = Sample->PCM;
-                        int SampleRateHz           = Sample->SampleRateHz;
-                        int NumChannels            = Sample->NumChannels;
-                        int LengthSamples          = Sample->LengthSamples;
+            xrns_track_desc       *PrevTrackDesc = &xstate->xdoc->Tracks[track - _trackIndex];
+            xrns_track_playback_state *PrevTrack = xstate->TrackStates[track - _trackIndex];
 
-                        /* supposed to be the length of the whole sample, if it's a sliced sample, 
-                         * it should be the length of the base sample.
-                         */
-                        int MaxLengthSamples       = Sample->LengthSamples;
+            for (int f = 0; f < SpanLength; f++)
+            {
+                DryL[f] += PrevTrack->SpanAudio[0][f];
+                DryR[f] += PrevTrack->SpanAudio[1][f];
+            }
 
-                        int bSampleIsPlayingLoopRelease = (PlaybackState->bIsCrossFading && Sample->LoopRelease);
+            if (PrevTrackDesc->bIsGroup)
+            {
+                /* group already captured all the sub-track's audio */
+                _trackIndex += PrevTrackDesc->WrapsNPreviousTracks;
+            }
+        }
 
-                        if (Sample->bIsAlisedSample || PlaybackState->bPlay0Slice)
-                        {
-                            pcm           = Instrument->Samples[0].PCM;
-                            SampleRateHz  = Instrument->Samples[0].SampleRateHz;
-                            NumChannels   = Instrument->Samples[0].NumChannels;
+        /* The sends come after the master, which returns them along with the tracks it wraps. */
+        for (_trackIndex = 0; track == xstate->xdoc->MasterTrackIdx && _trackIndex < xstate->xdoc->NumTracks; _trackIndex++)
+        {
+            if (!xstate->xdoc->Tracks[_trackIndex].bIsSend) continue;
 
-                            MaxLengthSamples = Instrument->Samples[0].LengthSamples;
+            xrns_track_playback_state *SendTrack = xstate->TrackStates[_trackIndex];
 
-                            if (SampleIndex == Instrument->NumSamples - 1)
-                            {
-                                /* take the length of the full sample */
-                                LengthSamples = MaxLengthSamples - Sample->SampleStart;
-                            }
-                            else
-                            {
-                                LengthSamples = Instrument->Samples[SampleIndex + 1].SampleStart - Sample->SampleStart;
-                            }
-                        }
+            for (int f = 0; f < SpanLength; f++)
+            {
+                DryL[f] += SendTrack->SpanAudio[0][f];
+                DryR[f] += SendTrack->SpanAudio[1][f];
+            }
+        }
+    }
 
-                        if (!pcm) continue; /* no actual PCM data was loaded for this instrument ... */
+    /* A send track takes in whatever the send devices routed to it sent this span. They are all on 
+     * earlier tracks, and on lower levels, so they're done.
+     */
+    if (TrackDesc->bIsSend)
+    {
+        for (int Source = 0; Source < track; Source++)
+        {
+            xrns_track_playback_state *SourceTrack = xstate->TrackStates[Source];
 
-                        TracyCZoneN(ctxx, "Sampler Playback", 1);
+            for (i = 0; i < xstate->xdoc->Tracks[Source].NumDSPEffectUnits; i++)
+            {
+                xrns_send_tap *Tap = &SourceTrack->SendTaps[i];
 
-                        /* Every sample can have a modulation set attached.
-                         */
+                if (Tap->Track != track) continue;
 
-                        /* Volume envelope. @Optimization
-                         *       Points on the automation curves can be on 1/256ths of a beat, or on 1ms time.
-                         *       Also, according to the plots, the actual curves are only sampled at that
-                         *       resolution as well. Linear interpolation appears to be used inbetween.
-                         *       So we have to at least call this every sample, to get the linearly interpolated values,
-                         *       however the actual curve evaluations don't need to happen that often.
-                         */
-                        float VolumePercent = 1.0f;
-                        int bOnLastEnvelopePoint = 0;
+                for (int f = 0; f < SpanLength; f++)
+                {
+                    DryL[f] += Tap->Audio[0][f];
+                    DryR[f] += Tap->Audio[1][f];
+                }
+            }
+        }
+    }
 
-                        if (Instrument->NumModulationSets && (Sample->ModulationSetIndex != -1))
-                        {
-                            xrns_modulation_set *ModulationSet  
-                                = &Instrument->ModulationSets[Sample->ModulationSetIndex];
+    /* Each send device on this track writes the span into its tap a block at a time. One that is switched
+     * off or asleep sends silence.
+     */
+    for (i = 0; i < TrackDesc->NumDSPEffectUnits; i++)
+    {
+        xrns_send_tap *Tap = &Track->SendTaps[i];
 
-                            xrns_envelope *Envelope = &ModulationSet->Volume;
-                            if (Envelope && ModulationSet->bVolumeEnvelopePresent)
-                            {
-                                VolumePercent = WalkEnvelope
-                                    (xstate
-                                    ,Envelope
-                                    ,&PlaybackState->VolumeEnvelope
-                                    ,1.0/(xstate->OutputSampleRate)
-                                    ,PlaybackState->bIsCrossFading
-                                    );
-
-                                bOnLastEnvelopePoint = OnLastEnvelopePoint(Envelope, &PlaybackState->VolumeEnvelope);
-                            }
-                        }
+        if (Tap->Track < 0) continue;
 
-                        // @Optimization: I've stuck the scaling factor for int to float here.
-                        const float RenoiseOutputGain = 0.5011872336272722f * (3.0517578125e-5f);
-                        float CrossFadeLevel = RenoiseOutputGain
-                                             * xstate->TrackStates[xstate->xdoc->NumTracks-1]->CurrentPreVolume.Val
-                                             * VolumePercent;
+        memset(Tap->Audio[0], 0, sizeof(float) * SpanLength);
+        memset(Tap->Audio[1], 0, sizeof(float) * SpanLength);
+        SendDeviceSetTap(Track->DSPEffects[i].State, Tap->Audio[0], Tap->Audio[1]);
+    }
 
-                        if (Sampler->CurrentTremoloDepth)
-                        {
-                            CrossFadeLevel *= fabs(Sampler->TremoloAmount);
-                        }
-                        
-                        float IntroCrossFadeLevel = 1.0f;
+    /* Now that all the columns have summed their stuff into the span, we run it through the effect chain
+     * before summing it into the output.
+     */
+    xrns_panning_gains PostTrackPan = PanningGainFromZeroToOne(TrackDesc->PostPanning);
 
-                        if (PlaybackState->bIsCrossFading)
-                        {
-                            if (PlaybackState->CrossFadeDuration == 0)
-                            {
-                                CrossFadeLevel *= 0.0f;
-                            }
-                            else if (PlaybackState->CrossFadeDuration == -1)
-                            {
-                                /* infinite */
-                                CrossFadeLevel *= 1.0f;
-                            }
-                            else
-                            {
-                                CrossFadeLevel *= PlaybackState->CrossFade / ((float) PlaybackState->CrossFadeDuration);
-                            }
+    /* A silent input into an effect chain whose tail has died away can only come out silent, so the
+     * chain sleeps until something audible comes in. Spans can be a single frame long and a delay line
+     * can be quiet at its output while still holding signal, so the tail has to have been silent for 
+     * a good while first, counted in frames. The automation still runs so the effects are up to date 
+     * when it wakes.
+     */
+    int SleepFrames    = (int) (xstate->OutputSampleRate * XRNS_EFFECT_SLEEP_SECONDS);
+    int SilentFrames   = Track->SilentTailFrames;
+    int bAsleep        = (SilentFrames >= SleepFrames) && SpanIsSilent(DryL, DryR, SpanLength);
 
-                            /* If we are out of envelope data, and the crossfade gets really low, 
-                             * we can just chop the note.
-                             */
-                            if (bOnLastEnvelopePoint && CrossFadeLevel < 1e-9f)
-                            {
-                                PlaybackState->CrossFade = 0;
-                            }
-                        }
+    if (bAsleep)
+    {
+        memset(DryL, 0, sizeof(float) * SpanLength);
+        memset(DryR, 0, sizeof(float) * SpanLength);
+    }
 
-                        if (PlaybackState->bIntroIsCrossFading)
-                        {
-                            if (PlaybackState->IntroCrossFadeDuration == 0)
-                            {
-                                IntroCrossFadeLevel *= 0.0f;
-                            }
-                            else
-                            {
-                                IntroCrossFadeLevel *= PlaybackState->IntroCrossFade 
-                                                     / ((float) PlaybackState->IntroCrossFadeDuration);
-                            }
-                        }                    
+    /* The effects run a block at a time, each block starting on an automation control point. */
+    for (int Block = 0; Block < SpanLength; Block += XRNS_AUTOMATION_CONTROL_FRAMES)
+    {
+        int BlockLength = SpanLength - Block;
+        if (BlockLength > XRNS_AUTOMATION_CONTROL_FRAMES) BlockLength = XRNS_AUTOMATION_CONTROL_FRAMES;
 
-                        CrossFadeLevel *= IntroCrossFadeLevel;
+        /* effect unit automation, only pushed to the effect when it moves */
+        for (i = 0; i < TrackData->NumEnvelopes; i++)
+        {
+            xrns_envelope *Envelope = &TrackData->Envelopes[i];
+            int DSPIndex = Envelope->DeviceIndex - 1;
 
-                        CrossFadeLevel *= xstate->TrackStates[track]->CurrentPreVolume.Val;
+            if (Envelope->NumPoints == 0 || Envelope->DeviceIndex == 0) continue;
 
-                        if (xstate->TrackStates[track]->bIsMuted)
-                            CrossFadeLevel = 0.0f;
+            if (DSPIndex >= 0 && DSPIndex < TrackDesc->NumDSPEffectUnits)
+            {
+                dsp_effect *DSP = &Track->DSPEffects[DSPIndex];
+                int ParameterIndex = Envelope->ParameterIndex - 1;
 
-                        CrossFadeLevel *= Sample->Volume;
+                if (ParameterIndex < DSP->NumParameters)
+                {
+                    float v = SampleAutomation
+                        (&Track->AutomationCursors[i]
+                        ,Envelope
+                        ,PatternProgressIn256thRows(xstate, Block)
+                        );
 
-                        /* Various panning gains are possible to see here.
-                         *
-                         * 1. Samples may have a static pan value (-50 <-> 50) set. 
-                         *    (values in the XRNS file will be -1.0 vs. 1.0)
-                         * 2. Samples may have a panning modulation curve that maps into the range
-                         *    (-50 <-> 50).
-                         * 3. Samplers may have a current panning effect applied in the pattern data. This
-                         *    may only be set in the panning column, and can have set/adjust. These are set in 
-                         *    steps of 64 (0x00 <-> 0x80).
-                         * 4. Tracks may have a panning value set pre-DSP chain. This is automated with xJxx. 
-                         *    This is also from (-50 <-> 50).
-                         * 5. Tracks may also have a post panning value. (-50 <-> 50)
-                         *
-                         * These all map to gains of +3dB to -inf, and stack multiplicatively.
-                         */
+                    if (fabsf(v - DSP->GetParameter(DSP->State, ParameterIndex)) > XRNS_AUTOMATION_THRESHOLD)
+                    {
+                        DSP->SetParameter(DSP->State, ParameterIndex, v);
+                    }
+                }
+            }
+        }
 
-                        /* Handle panning from sources 1, 2, 3, 4 */
-                        // @Optimization: Maybe don't do these every sample?
+        if (bAsleep) continue;
 
-                        int PostPanningValue = xstate->TrackStates[track]->CurrentPanning.Val;
+        float *Channels[2];
+        Channels[0] = &DryL[Block];
+        Channels[1] = &DryR[Block];
 
-                        xrns_panning_gains SamplePan     = PanningGainFromZeroToOne(Sample->Panning);
-                        xrns_panning_gains ModulationPan = {1.0f, 1.0f};
-                        xrns_panning_gains SamplerPan    = PanningGainFromColNumber(Sampler->CurrentPanning.Val);
-                        xrns_panning_gains TrackPan      = PanningGainFromNeg1To1(PostPanningValue);
+        for (int effect = 0; effect < TrackDesc->NumDSPEffectUnits; effect++)
+        {
+            if (!Track->DSPEffectEnableFlags[effect])
+            {
+                continue;
+            }
 
-                        RunLerp(&Sampler->CurrentPanning);
-                        RunLerp(&Sampler->CurrentVolume);
+            dsp_effect *DSPEffect = &Track->DSPEffects[effect];
+            DSPEffect->Process(DSPEffect->State, &Channels[0], &Channels[0], BlockLength);
+        }
+    }
 
-                        if (Instrument->NumModulationSets && (Sample->ModulationSetIndex != -1))
-                        {
-                            xrns_modulation_set *ModulationSet 
-                                = &Instrument->ModulationSets[Sample->ModulationSetIndex];
+    for (int f = 0; !bAsleep && f < SpanLength; f++)
+    {
+        if (fabsf(DryL[f]) >= XRNS_SILENCE_THRESHOLD || fabsf(DryR[f]) >= XRNS_SILENCE_THRESHOLD)
+            SilentFrames = 0;
+        else if (SilentFrames < SleepFrames)
+            SilentFrames++;
 
-                            xrns_envelope *Envelope = &ModulationSet->Panning;
+        DryL[f] *= PostTrackPan.Left  * Track->SpanPostVolume[f];
+        DryR[f] *= PostTrackPan.Right * Track->SpanPostVolume[f];
+    }
 
-                            if (Envelope && ModulationSet->bPanningEnvelopePresent)
-                            {
-                                float PanningEnvelopeValue = WalkEnvelope
-                                    (xstate
-                                    ,Envelope
-                                    ,&PlaybackState->PanningEnvelope
-                                    ,1.0/(xstate->OutputSampleRate)
-                                    ,PlaybackState->bIsCrossFading
-                                    );
-
-                                ModulationPan = PanningGainFromZeroToOne(PanningEnvelopeValue);
-                            }
-                        }
+    /* A send that mutes the track can leave it silent while the tail before the send still rings out. */
+    for (i = 0; !bAsleep && i < TrackDesc->NumDSPEffectUnits; i++)
+    {
+        xrns_send_tap *Tap = &Track->SendTaps[i];
 
-                        float LeftPanGain = SamplePan.Left * ModulationPan.Left * SamplerPan.Left * TrackPan.Left;
-                        float RightPanGain = SamplePan.Right * ModulationPan.Right * SamplerPan.Right * TrackPan.Right;
+        if (Tap->Track >= 0 && !SpanIsSilent(Tap->Audio[0], Tap->Audio[1], SpanLength)) SilentFrames = 0;
+    }
 
-                        if (Sample->InterpolationMode == XRNS_INTERPOLATION_NONE)
-                        {
-                            unsigned int pbsample = round(PlaybackState->PlaybackPosition);
+    Track->SilentTailFrames = SilentFrames;
 
-                            float Vol = (CrossFadeLevel * ((float) Sampler->CurrentVolume.Val)) / 255.0f;
+    /* For this track, commit the samples into the ringbuffer. Nobody can ask for them in the middle
+     * of xrns_render(), so they are skipped then.
+     */
+    if (!xstate->DirectOutput)
+    {
+        PushRingBufferPlanar(&Track->RawAudio, DryL, DryR, SpanLength);
+    }
+}
 
-                            if (NumChannels == 2)
-                            {
-                                Dry[0] += LeftPanGain  * XRNS_ACCESS_STEREO_SAMPLE(2 * pbsample + 0) * Vol;
-                                Dry[1] += RightPanGain * XRNS_ACCESS_STEREO_SAMPLE(2 * pbsample + 1) * Vol;
-                            }
-                            else
-                            {
-                                Dry[0] += LeftPanGain  * XRNS_ACCESS_MONO_SAMPLE(pbsample) * Vol;
-                                Dry[1] += RightPanGain * XRNS_ACCESS_MONO_SAMPLE(pbsample) * Vol;
-                            }
-                        } 
-                        else if (   Sample->InterpolationMode == XRNS_INTERPOLATION_LINEAR
-                                 || Sample->InterpolationMode == XRNS_INTERPOLATION_CUBIC)
-                        {
-                            float BaseSampleL;
-                            float BaseSampleR;
-                            float NextSampleL;
-                            float NextSampleR;
+void *RenderTrackBlock(xrns_track_render_block *Block)
+{
+    TracyCZoneN(ctx, "Track Block", 1);
 
-                            xrns_sample *CurrentSample = &Instrument->Samples[PlaybackState->CurrentSample];
+    unsigned int SavedCSR = EnterDenormalFreeMode();
 
-                            unsigned int OffsetIntoSample = CurrentSample->SampleStart;
+    for (int t = 0; t < Block->NumTracks; t += Block->Stride)
+    {
+        RenderTrackSpan(Block->xstate, Block->Tracks[t], Block->Pattern, Block->VoiceSpans, Block->SpanLength);
+    }
 
-                            float base_sample_floating;
-                            unsigned int base_sample;
-                            float alpha;
+    LeaveDenormalFreeMode(SavedCSR);
 
-                            if (PlaybackState->PlaybackDirection == XRNS_FORWARD)
-                            {
-                                base_sample_floating = floor(PlaybackState->PlaybackPosition);
-                                base_sample = (unsigned int) base_sample_floating;
-                                alpha = PlaybackState->PlaybackPosition - base_sample_floating;
-                            }
-                            else
-                            {
-                                base_sample_floating = ceil(PlaybackState->PlaybackPosition);
-                                base_sample = (unsigned int) base_sample_floating;
-                                alpha = base_sample_floating - PlaybackState->PlaybackPosition;
-                            }
+    TracyCZoneEnd(ctx);
 
-                            unsigned int next_sample;
+    return NULL;
+}
 
-                            if (bSampleIsPlayingLoopRelease || Sample->LoopMode == XRNS_LOOP_MODE_OFF)
-                            {
-                                if (PlaybackState->PlaybackDirection == XRNS_FORWARD)
-                                {
-                                    if (base_sample == LengthSamples - 1)
-                                        next_sample = base_sample;
-                                    else 
-                                        next_sample = base_sample + 1;                                
-                                }
-                                else
-                                {
-                                    if (base_sample == 0)
-                                        next_sample = base_sample;
-                                    else 
-                                        next_sample = base_sample - 1;
-                                }
-                            }
-                            else
-                            {
-                                if (PlaybackState->PlaybackDirection == XRNS_FORWARD)
-                                {
-                                    next_sample = base_sample + 1;
-                                }
-                                else
-                                {
-                                    next_sample = base_sample - 1;
-                                }
+/* Renders every track for the span, a level of the group hierarchy at a time. The tracks within a level 
+ * don't depend on each other, so when there are enough of them they are dealt out in blocks to the worker
+ * threads, each block with its own set of voice spans.
+ */
+void RenderTracks(XRNSPlaybackState *xstate, xrns_pattern *Pattern, int SpanLength)
+{
+    unsigned int SavedCSR = EnterDenormalFreeMode();
 
-                                next_sample = (unsigned int) SampleLoopWrapping(Sample, PlaybackState, next_sample);
-                            }                            
-                            
-                            if (NumChannels == 2)
-                            {
-                                BaseSampleL = XRNS_ACCESS_STEREO_SAMPLE(2 * (OffsetIntoSample + base_sample) + 0);
-                                BaseSampleR = XRNS_ACCESS_STEREO_SAMPLE(2 * (OffsetIntoSample + base_sample) + 1);
+    for (int Level = 0; Level < xstate->NumTrackLevels; Level++)
+    {
+        int   *Tracks = &xstate->TrackRenderOrder[xstate->TrackLevelStart[Level]];
+        int NumTracks = xstate->TrackLevelStart[Level + 1] - xstate->TrackLevelStart[Level];
+        int NumBlocks = (NumTracks < xstate->NumRenderBlocks) ? NumTracks : xstate->NumRenderBlocks;
 
-                                if (next_sample >= LengthSamples)
-                                {
-                                    NextSampleL = 0.0f;
-                                    NextSampleR = 0.0f;
-                                }
-                                else
-                                {
-                                    NextSampleL = XRNS_ACCESS_STEREO_SAMPLE(2 * (OffsetIntoSample + next_sample) + 0);
-                                    NextSampleR = XRNS_ACCESS_STEREO_SAMPLE(2 * (OffsetIntoSample + next_sample) + 1);
-                                }                        
-                            }
-                            else
-                            {
-                                BaseSampleL = XRNS_ACCESS_MONO_SAMPLE(OffsetIntoSample + base_sample);
+        if (NumBlocks < 2 || SpanLength < XRNS_MIN_PARALLEL_SPAN_FRAMES || !xstate->Workers)
+        {
+            for (int t = 0; t < NumTracks; t++)
+            {
+                RenderTrackSpan(xstate, Tracks[t], Pattern, xstate->VoiceSpans, SpanLength);
+            }
+            continue;
+        }
 
-                                if (next_sample >= LengthSamples)
-                                {
-                                    NextSampleL = 0.0f;
-                                }
-                                else
-                                {
-                                    NextSampleL = XRNS_ACCESS_MONO_SAMPLE(OffsetIntoSample + next_sample);
-                                }
-                            }
+        work_table *Jobs = xstate->RenderJobs;
+        Jobs->NumJobs = NumBlocks;
 
-                            float Vol = (CrossFadeLevel * ((float) Sampler->CurrentVolume.Val)) / 255.0f;
+        for (int b = 0; b < NumBlocks; b++)
+        {
+            xrns_track_render_block *Block = &xstate->RenderBlocks[b];
+
+            Block->xstate     = xstate;
+            Block->Pattern    = Pattern;
+            Block->VoiceSpans = &xstate->VoiceSpans[b * XRNS_MAX_SAMPLES_PLAYING];
+            Block->Tracks     = &Tracks[b];
+            Block->NumTracks  = NumTracks - b;
+            Block->Stride     = NumBlocks;
+            Block->SpanLength = SpanLength;
+
+            Jobs->Jobs[b].WorkFunction = (xrns_worker_fcn) RenderTrackBlock;
+            Jobs->Jobs[b].Data         = Block;
+            Jobs->Jobs[b].FreeData     = NULL;
+            Jobs->Jobs[b].bInProgress  = 0;
+            Jobs->Jobs[b].bCompleted   = 0;
+        }
 
-                            if (NumChannels == 2)
-                            {
-                                Dry[0] += LeftPanGain  * (BaseSampleL * (1.0f - alpha) + NextSampleL * alpha) * Vol;
-                                Dry[1] += RightPanGain * (BaseSampleR * (1.0f - alpha) + NextSampleR * alpha) * Vol;
-                            }
-                            else
-                            {
-                                float v = (BaseSampleL * (1.0f - alpha) + NextSampleL * alpha) * Vol;
-                                Dry[0] += LeftPanGain  * v;
-                                Dry[1] += RightPanGain * v;
-                            }
-                        }
+        FarmPooledThreads(xstate->Workers, Jobs);
+    }
 
-                        /* Note - BaseNote = the relative pitch to apply to the sample
-                         * Instead of stepping by 1 sample, we need to step by the tuning..
-                         *
-                         * 2.0^((AbsoluatePitchOnPiano - DesiredTone)/12);
-                         *
-                         * Since the sample is "at" the AbsoluatePitchOnPiano, and the BaseNote is set
-                         * to this number, and we know DesiredTone, we just need to look this function up
-                         * in a pitching table. 
-                         *
-                         */
+    LeaveDenormalFreeMode(SavedCSR);
+}
 
-                        /* Piggyback on this for the different sample rates.
-                         */
+/* Appends frames to the caller's buffer during xrns_render(). */
+void WriteDirectOutput(XRNSPlaybackState *xstate, const float *Left, const float *Right, unsigned int NumFrames)
+{
+    unsigned int Offset = xstate->DirectOutputWritten;
 
-                        /* Fine pitch is effected by a combination of note effects, modulation curves, 
-                         * and instrument settings.
-                         *
-                         * If the sum of these pitch adjustments is larger than one semitone, we adjust our 
-                         * index into the pitch table. The fractional remainder is then lerped between
-                         * adjacent values in the table.
-                         */
+    if (xstate->bDirectOutputPlanar)
+    {
+        memcpy(xstate->DirectOutput + Offset, Left, NumFrames * sizeof(float));
+        memcpy(xstate->DirectOutput + xstate->DirectOutputFrames + Offset, Right, NumFrames * sizeof(float));
+    }
+    else
+    {
+        float *Dest = xstate->DirectOutput + 2 * Offset;
+        for (unsigned int i = 0; i < NumFrames; i++)
+        {
+            Dest[2*i + 0] = Left[i];
+            Dest[2*i + 1] = Right[i];
+        }
+    }
 
-                        int IntegerPartOfPitch = (Sampler->CurrentNote - BaseNote + Sample->Transpose);
-                        double PitchAdjustment = (Sampler->GlideNote / 16.0) + (Sampler->CurrentSlideOffset / 16.0);
+    xstate->DirectOutputWritten += NumFrames;
+}
 
-                        /* Pitch envelopes also apply.
-                         */
-                        double PitchEnvelopeValue = 1.0f;
+/* Sums the span each stem's tracks just rendered into the caller's stem buffers, during xrns_render_stems().
+ */
+void AccumulateStemSpans(XRNSPlaybackState *xstate, unsigned int NumFrames)
+{
+    TracyCZoneN(ctx, "Stems", 1);
 
-                        if (Instrument->NumModulationSets && (Sample->ModulationSetIndex != -1))
-                        {
-                            xrns_modulation_set *ModulationSet 
-                                = &Instrument->ModulationSets[Sample->ModulationSetIndex];
+    unsigned int Offset = xstate->DirectOutputWritten;
 
-                            xrns_envelope *Envelope = &ModulationSet->Pitch;
+    for (int h = 0; h < xstate->NumStems; h++)
+    {
+        if (!xstate->DirectStems[h]) continue;
 
-                            if (Envelope && ModulationSet->bPitchEnvelopePresent)
-                            {
-                                double NewEnv = WalkEnvelope
-                                    (xstate
-                                    ,Envelope
-                                    ,&PlaybackState->PitchEnvelope
-                                    ,1.0/(xstate->OutputSampleRate)
-                                    ,PlaybackState->bIsCrossFading
-                                    );
-
-                                PitchEnvelopeValue = ((double) ModulationSet->PitchModulationRange)
-                                                   * (2.0f * NewEnv - 1.0f);
-                                PitchAdjustment   += PitchEnvelopeValue;
-                            }
-                        }
+        float *StemL = xstate->DirectStems[h] + Offset;
+        float *StemR = xstate->DirectStems[h] + xstate->DirectOutputFrames + Offset;
 
-                        if (!Sample->BeatSyncIsActive)
-                        {
-                            PitchAdjustment += (Sample->Finetune / 128.0);
-                        }
+        for (int w = 0; w < XRNS_TRACK_MASK_WORDS; w++)
+        {
+            for (uint64_t Tracks = xstate->Stems[h].TrackMask[w]; Tracks; Tracks &= Tracks - 1)
+            {
+                xrns_track_playback_state *Track = xstate->TrackStates[64 * w + LowestSetBit64(Tracks)];
 
-                        if (Sampler->CurrentVibratoDepth != 0)
-                        {
-                            PitchAdjustment += (Sampler->VibratoOffset / 100.0f);
-                        }
+                for (unsigned int f = 0; f < NumFrames; f++)
+                {
+                    StemL[f] += Track->SpanAudio[0][f];
+                    StemR[f] += Track->SpanAudio[1][f];
+                }
+            }
+        }
+    }
 
-                        /* Get the Hz of the sample if it is played back as the basenote.
-                         * Apply the key, transpose, and everything else ...
-                         */
+    TracyCZoneEnd(ctx);
+}
+
+int run_engine
+    (XRNSPlaybackState *xstate
+    ,int                bExitingAfterTick
+    ,int                bExitingAfterLine
+    ,int                bExitingBeforeLine
+    ,int                MaximumSamples
+    )
+{
+    TracyCZoneN(main_ctx, "Run Engine", 1);
 
-                        float OriginalHz = NoteToHzAssumingA440(BaseNote);
+    int return_code = XRNS_SUCCESS;
 
-                        if (PitchAdjustment > 1.0)
-                        {
-                            IntegerPartOfPitch += floor(PitchAdjustment);
-                            PitchAdjustment    -= floor(PitchAdjustment);
-                        }
-                        else if (PitchAdjustment < -1.0)
-                        {
-                            IntegerPartOfPitch += -floor(-PitchAdjustment);
-                            PitchAdjustment    +=  floor(-PitchAdjustment);
-                        }
+    int bTimeToExit = 0;
+    int SamplesGenerated = 0;
+
+    if (!xstate->DirectOutput && xstate->Output.RingBufferFreeSamples == 0) bTimeToExit = 1;
+
+    if (xstate->bSongStopped)
+    {
+        if (!xstate->DirectOutput)
+        {
+            PushRingBufferSilence(&xstate->Output, MaximumSamples);
+        }
+        return return_code;
+    }
+
+    if (xstate->bEvenEarlierFirstPlay)
+    {
+        if (xstate->PatternHasBeenCued)
+        {
+            /* if a pattern was cued before playing began, we should jump there first. */
+            xstate->CurrentPatternIndex = xstate->CuedPatternIndex;
+            xstate->PatternHasBeenCued = 0;
+        }
+
+        xstate->CurrentBPM          = xstate->xdoc->BeatsPerMin;
+        xstate->CurrentLinesPerBeat = xstate->xdoc->LinesPerBeat;
+        xstate->CurrentTicksPerLine = xstate->xdoc->TicksPerLine;
+        xstate->CurrentSample       = 0;
+        xstate->BaseOfCurrentlyPlayingLine = 0.0;
+        xstate->bEvenEarlierFirstPlay = 0;
 
-                        int PitchTableIdx = 96 + IntegerPartOfPitch;
+        RecomputeDurations(xstate);
 
-                        if (PitchTableIdx < 0)                       
-                            PitchTableIdx = 0;
-                        if (PitchTableIdx >= PITCHING_TABLE_LENGTH)
-                            PitchTableIdx = PITCHING_TABLE_LENGTH - 1;
+        if (bExitingBeforeLine)
+        {
+            bTimeToExit = 1;
+            return XRNS_WOULD_WRAP_ROW;
+        }
+    }
 
-                        double KeyPitch = PitchingTable[PitchTableIdx];
+    if (xstate->bFirstPlay)
+    {
+        /* update notes, instruments, etc .. */
+        /* evaluate all effect changes, including tempo! */
+        xrns_update_notes_and_effects(xstate, 1);
+        xrns_perform_tick_processing(xstate); /* always a tick on a line */
 
-                        if (Sample->BeatSyncIsActive)
-                        {
-                            /* Work out the re-pitch....  */
-                            double DurationOfBeatSyncLines = Sample->BeatSyncLines * xstate->CurrentLineDuration 
-                                                           / xstate->OutputSampleRate;
+        RecomputeDurations(xstate);
 
-                            KeyPitch = ((double) LengthSamples / (DurationOfBeatSyncLines * ((double)SampleRateHz)));
-                        }
+        double DurationOfThisLine  = xstate->CurrentLineDuration;
+        xstate->LocationOfNextLine = xstate->XRNSGridOffset + DurationOfThisLine;
+        xstate->LocationOfNextTick = xstate->CurrentTickDuration;
+        xstate->bFirstPlay = 0;
 
-                        if (PitchAdjustment > 0 && PitchTableIdx < PITCHING_TABLE_LENGTH - 1)
-                        {
-                            KeyPitch = (KeyPitch * (1.0 - PitchAdjustment)) 
-                                     + (PitchAdjustment) * PitchingTable[PitchTableIdx + 1];
-                        }
-                        else if (PitchAdjustment < 0 && PitchTableIdx > 0)
-                        {
-                            KeyPitch = (KeyPitch * (1.0 + PitchAdjustment)) 
-                                     + (-PitchAdjustment) * PitchingTable[PitchTableIdx - 1];
-                        }                        
+        if (bExitingAfterLine || bExitingAfterTick)
+        {
+            bTimeToExit = 1;
+        }
+    }
 
-                        double dt = KeyPitch * ((double)SampleRateHz / xstate->OutputSampleRate);
+    while(!bTimeToExit)
+    {
+        int i;
+        int SpanLength = MaximumSamples - SamplesGenerated;
 
-                        Sampler->SavedPitchMod = OriginalHz * dt;
+        if (SpanLength > XRNS_MAX_SPAN_FRAMES) SpanLength = XRNS_MAX_SPAN_FRAMES;
+        if (SpanLength < 1)                    SpanLength = 1;
 
-                        double PrevPos = PlaybackState->PlaybackPosition;
+        SpanLength = FramesUntilNextEvent(xstate, bExitingBeforeLine, SpanLength);
 
-                        if (PlaybackState->PlaybackDirection == XRNS_FORWARD)
-                        {
-                            PlaybackState->PlaybackPosition += dt;
-                        }
-                        else
-                        {
-                            PlaybackState->PlaybackPosition -= dt;
-                        }
+        xrns_pattern *Pattern = &xstate->xdoc->PatternPool[xstate->xdoc->PatternSequence[xstate->CurrentPatternIndex].PatternIdx];
+        xrns_track_playback_state *MasterTrack = xstate->TrackStates[xstate->xdoc->MasterTrackIdx];
 
-                        if (!bSampleIsPlayingLoopRelease && Sample->LoopMode != XRNS_LOOP_MODE_OFF)
-                        {
-                            PlaybackState->PlaybackPosition 
-                                = SampleLoopWrapping(Sample, PlaybackState, PlaybackState->PlaybackPosition);
-                        }
+        /* Run the track automation and smoothing over the whole span first, none of it depends on the 
+         * voices. SpanPreVolume[0] holds the value from before the span.
+         */
+        for (int track = 0; track < xstate->xdoc->NumTracks; track++)
+        {
+            TracyCZoneN(ctx, "Track Preamble", 1);
 
-                        /* exiting the sample boundaries always ends the note, sample looping
-                         * will keep the playhead in-bounds.
-                         */
-                        if (bSampleIsPlayingLoopRelease || Sample->LoopMode == XRNS_LOOP_MODE_OFF)
-                        {
-                            if (PlaybackState->PlaybackDirection == XRNS_FORWARD)
-                            {
-                                if (   PrevPos < PlaybackState->FrontPosition0 
-                                    && PlaybackState->PlaybackPosition >= PlaybackState->FrontPosition0)
-                                {
-                                    PlaybackState->bPlaying = 0;
-                                    PlaybackState->Active = 0;
-                                }
-                            }
-                            else if (PlaybackState->PlaybackDirection == XRNS_BACKWARD)
-                            {
-                                if (   PrevPos > PlaybackState->BackPosition0 
-                                    && PlaybackState->PlaybackPosition <= PlaybackState->BackPosition0)
-                                {
-                                    PlaybackState->bPlaying = 0;
-                                    PlaybackState->Active = 0;
-                                }
+            xrns_track_playback_state *Track = xstate->TrackStates[track];
+            xrns_track *TrackData = &Pattern->Tracks[track];
 
-                                if (   PrevPos > PlaybackState->BackPosition1 
-                                    && PlaybackState->PlaybackPosition <= PlaybackState->BackPosition1)
-                                {
-                                    PlaybackState->bPlaying = 0;
-                                    PlaybackState->Active = 0;
-                                }
-                            }
-                        }
+            Track->SpanPreVolume[0] = Track->CurrentPreVolume.Val;
 
-                        if (PlaybackState->bIsCrossFading)
-                        {
-                            if (PlaybackState->CrossFade > 0)
-                            {
-                                PlaybackState->CrossFade--;
-                            }
-                            else
-                            {
-                                PlaybackState->bPlaying = 0;
-                                PlaybackState->bIsCrossFading = 0;
-                                PlaybackState->Active = 0;
-                            }
-                        }
+            for (int f = 0; f < SpanLength; f++)
+            {
+                /* handle the track automation curves at control rate, the lerps smooth them out.
+                 * The effect units are handled with their processing.
+                 */
+                for (i = 0; (f % XRNS_AUTOMATION_CONTROL_FRAMES) == 0 && i < TrackData->NumEnvelopes; i++)
+                {
+                    xrns_envelope *Envelope = &TrackData->Envelopes[i];
+
+                    if (Envelope->NumPoints == 0 || Envelope->DeviceIndex != 0) continue;
 
-                        if (PlaybackState->bIntroIsCrossFading)
+                    /* this is the standard Renoise device */
+                    switch (Envelope->ParameterIndex)
+                    {
+                        case 1: /* panning */
                         {
-                            if (PlaybackState->IntroCrossFade < PlaybackState->IntroCrossFadeDuration)
-                            {
-                                PlaybackState->IntroCrossFade++;
-                            }
-                            else
-                            {
-                                PlaybackState->bIntroIsCrossFading = 0;
-                            }
+                            double v = SampleAutomation(&Track->AutomationCursors[i], Envelope, PatternProgressIn256thRows(xstate, f));
+                            Track->CurrentPanning.Target = 2.0 * v - 1.0;
+                            break;
                         }
-
-                        int bAllDone = 1;
-                        for (int jj = 0; jj < XRNS_MAX_SAMPLES_PLAYING; jj++)
+                        case 2: /* volume */
                         {
-                            if (Sampler->PlaybackStates[jj].bPlaying || Sampler->PlaybackStates[jj].Active)
-                                bAllDone = 0;
+                            double v = SampleAutomation(&Track->AutomationCursors[i], Envelope, PatternProgressIn256thRows(xstate, f)) * 1.414f;
+                            Track->CurrentPreVolume.Target = v;
+                            break;
                         }
-                        if (bAllDone)
+                        case 3: /* width (ignored) */
                         {
-                            Sampler->bPlaying = 0;
-                            Sampler->Active = 0;
+                            break;
                         }
-
-                        TracyCZoneEnd(ctxx);
-                    }                    
-                }
-            }
-
-            xrns_track_desc *TrackDesc = &xstate->xdoc->Tracks[track];
-            xrns_panning_gains PostTrackPan = PanningGainFromZeroToOne(TrackDesc->PostPanning);
-            float                PostVolume = xstate->TrackStates[track]->CurrentGamePostVolume.Val
-                                            * xstate->TrackStates[track]->CurrentPostVolume;
-            
-            /* sum all the nested tracks together for this group track */
-            if (TrackDesc->bIsGroup)
-            {
-                int _trackIndex;
-                Dry[0] = 0.0f;
-                Dry[1] = 0.0f;
-                
-                for (_trackIndex = 1; _trackIndex <= TrackDesc->WrapsNPreviousTracks; _trackIndex++)
-                {
-                    if (track - _trackIndex < 0) continue;
-
-                    xrns_track_desc       *PrevTrackDesc = &xstate->xdoc->Tracks[track - _trackIndex];
-                    xrns_track_playback_state *PrevTrack = xstate->TrackStates[track - _trackIndex];
-
-                    int PrevIdx = PrevTrack->RawAudio.RingBufferWritePtr;
-                    if (!PrevIdx)
-                    {
-                        PrevIdx = PrevTrack->RawAudio.RingBufferSz - 1;
-                    }
-                    else
-                    {
-                        PrevIdx--;   
-                    }
-
-                    Dry[0] += PrevTrack->RawAudio.OutputRingBuffer[2*PrevIdx + 0];
-                    Dry[1] += PrevTrack->RawAudio.OutputRingBuffer[2*PrevIdx + 1];
-
-                    if (PrevTrackDesc->bIsGroup)
-                    {
-                        /* group already captured all the sub-track's audio */
-                        _trackIndex += PrevTrackDesc->WrapsNPreviousTracks;
                     }
                 }
-            }
-
-            /* Now that all the columns have summed their stuff into tsample, we run it through the effect chain
-             * before summing it into the output.
-             */
-            for (int effect = 0; effect < xstate->xdoc->Tracks[track].NumDSPEffectUnits; effect++)
-            {
-                if (!xstate->TrackStates[track]->DSPEffectEnableFlags[effect])
-                {
-                    continue;
-                }
 
-                float *temp[2];
-                temp[0] = &Dry[0];
-                temp[1] = &Dry[1];
+                RunLerp(&Track->CurrentPanning);
+                RunLerp(&Track->CurrentPreVolume);
+                RunLerp(&Track->CurrentGamePostVolume);
 
-                dsp_effect *DSPEffect = &xstate->TrackStates[track]->DSPEffects[effect];
-                DSPEffect->Process(DSPEffect->State, &temp[0], &temp[0], 1);
+                Track->SpanPreVolume[f + 1] = Track->CurrentPreVolume.Val;
+                Track->SpanPanning[f]       = PanningGainFromNeg1To1((int) Track->CurrentPanning.Val);
+                Track->SpanPostVolume[f]    = Track->CurrentGamePostVolume.Val * Track->CurrentPostVolume;
             }
 
-            Dry[0] *= PostTrackPan.Left  * PostVolume;
-            Dry[1] *= PostTrackPan.Right * PostVolume;
+            TracyCZoneEnd(ctx);
+        }
 
-            /* For this track, commit the samples into the ringbuffer.
-             */
-            PushRingBuffer(&xstate->TrackStates[track]->RawAudio, Dry, 1);
+        /* Generate the span into each track's ringbuffer, and the master's into the output. */
+        RenderTracks(xstate, Pattern, SpanLength);
+
+        if (xstate->DirectOutput && xstate->DirectStems)
+        {
+            AccumulateStemSpans(xstate, SpanLength);
         }
 
-        xrns_track_playback_state *MasterTrack = xstate->TrackStates[xstate->xdoc->NumTracks-1];
+        /* limiter here! */
+        xstate->CurrentSample += SpanLength;
 
-        int PrevIdx2 = MasterTrack->RawAudio.RingBufferWritePtr;
-        if (!PrevIdx2)
+        if (xstate->DirectOutput)
         {
-            PrevIdx2 = MasterTrack->RawAudio.RingBufferSz - 1;
+            WriteDirectOutput(xstate, MasterTrack->SpanAudio[0], MasterTrack->SpanAudio[1], SpanLength);
         }
         else
         {
-            PrevIdx2--;
+            PushRingBufferPlanar(&xstate->Output, MasterTrack->SpanAudio[0], MasterTrack->SpanAudio[1], SpanLength);
         }
 
-        /* limiter here! */
-        xstate->CurrentSample++;
-
-        PushRingBuffer(&xstate->Output, &MasterTrack->RawAudio.OutputRingBuffer[2*PrevIdx2 + 0], 1);
-
         /*
         * [xxxxxxxxxxxx][xxxxxxxxxxx]
-        *             |..| 
+        *             |..|
         *  1. ask what row needs data
         *  2. provide notes
         *  3. synth last sample of previous row (meaning we have to keep the previous frame of custom notes alive)
@@ -7374,12 +10539,12 @@ int run_engine
         int bOnLastRow                       = (xstate->CurrentRow == NumberOfLines - 1);
         int bSampleIncrementWouldWrapLine    = (xstate->CurrentSample >= xstate->LocationOfNextLine);
         int bSampleIncrementWouldWrapTick    = (xstate->CurrentSample >= xstate->LocationOfNextTick);
-        int bSampleIncrementWouldWrapPattern = (  (xstate->XRNSGridOffset >= 0 && bSampleIncrementWouldWrapLine) 
+        int bSampleIncrementWouldWrapPattern = (  (xstate->XRNSGridOffset >= 0 && bSampleIncrementWouldWrapLine)
                                                || (xstate->XRNSGridOffset < 0 && bSampleIncrementWouldWrapLinePre));
 
         if (bExitingBeforeLine && !bSampleIncrementWouldWrapLine)
         {
-            /* Exit before the **next** sample (next time we get here) would trigger a new row. 
+            /* Exit before the **next** sample (next time we get here) would trigger a new row.
              * We exit in time to give the caller the chance to update the notes.
              */
             int bNextSampleIncrementWouldWrapLine = ((xstate->CurrentSample + 1) >= xstate->LocationOfNextLine);
@@ -7394,7 +10559,7 @@ int run_engine
         {
             int bEndOfSong;
 
-            /* we are now on the next pattern! */    
+            /* we are now on the next pattern! */
             if (GetNextPatternAndRowIndex(xstate, &xstate->CurrentPatternIndex, &xstate->CurrentRow, &bEndOfSong))
             {
                 xstate->PatternHasBeenCued = 0;
@@ -7421,7 +10586,7 @@ int run_engine
             if (bExitingAfterTick || bExitingAfterLine)
             {
                 bTimeToExit = 1;
-            }      
+            }
         }
         else if (!bOnLastRow && bSampleIncrementWouldWrapLine)
         {
@@ -7450,12 +10615,12 @@ int run_engine
             if (bExitingAfterTick || bExitingAfterLine)
             {
                 bTimeToExit = 1;
-            }            
+            }
         } else if (bSampleIncrementWouldWrapTick)
         {
             xstate->CurrentTick++;
             xrns_perform_tick_processing(xstate);
-            xstate->LocationOfNextTick = xstate->BaseOfCurrentlyPlayingLine 
+            xstate->LocationOfNextTick = xstate->BaseOfCurrentlyPlayingLine
                                        + (xstate->CurrentTick + 1) * xstate->CurrentTickDuration;
 
             if (bExitingAfterTick)
@@ -7463,7 +10628,7 @@ int run_engine
                 bTimeToExit = 1;
             }
         }
-        SamplesGenerated++;
+        SamplesGenerated += SpanLength;
         if (SamplesGenerated >= MaximumSamples)
         {
             bTimeToExit = 1;
@@ -7625,6 +10790,8 @@ XRNS_DLL_EXPORT void xrns_free_playback_state(XRNSPlaybackState *xstate)
     int h, j = 0;
 
     FreePooledThreads(xstate->Workers);
+    if (xstate->RenderJobs) FreeWorkTable(xstate->RenderJobs);
+    free(xstate->RenderAllocation);
 
     /* free everything created by the FLAC decoder */
     for (h = 0; h < xstate->xdoc->NumInstruments; h++)
@@ -7633,7 +10800,7 @@ XRNS_DLL_EXPORT void xrns_free_playback_state(XRNSPlaybackState *xstate)
         for (j = 0; j < Instrument->NumSamples; j++)
         {
             xrns_sample *Sample = &Instrument->Samples[j];
-            if (Sample->PCM && !Sample->bIsAlisedSample) ma_free(Sample->PCM, NULL);
+            if (Sample->PCMAllocation && !Sample->bIsAlisedSample) free(Sample->PCMAllocation);
         }
     }
 
@@ -7682,11 +10849,18 @@ XRNS_DLL_EXPORT int xrns_set_output_sample_rate(XRNSPlaybackState *xstate, float
 
 void print_galloc_bytes_used(galloc_ctx *g);
 
-XRNS_DLL_EXPORT XRNSPlaybackState * xrns_create_playback_state_from_bytes(void *p_bytes, unsigned int num_bytes)
+/* Builds a playback state from either a .xrns archive or a song cache (see SaveSongCache()) in memory.
+ */
+static XRNSPlaybackState *CreatePlaybackStateFromBytes
+    (void         *p_bytes
+    ,size_t        num_bytes
+    ,unsigned int  LoadFlags
+    ,int           bFromCache
+    )
 {
     TracyCZoneN(ctx, "Create Playback", 1);
 
-    pooled_threads_ctx *Workers = CreatePooledThreads(8);
+    pooled_threads_ctx *Workers = CreatePooledThreads(XRNS_WORKER_THREADS);
 
     galloc_ctx *galloc_context = malloc(sizeof(galloc_ctx));
 
@@ -7709,8 +10883,10 @@ XRNS_DLL_EXPORT XRNSPlaybackState * xrns_create_playback_state_from_bytes(void *
     xrns_document *Master = malloc(sizeof(xrns_document));
     memset(Master, 0, sizeof(xrns_document));
 
-    if (!populateXRNSDocument(galloc_context, p_bytes, (size_t) num_bytes, Master, Workers))
+    if (bFromCache ? !LoadSongCache(galloc_context, p_bytes, num_bytes, Master)
+                   : !populateXRNSDocument(galloc_context, p_bytes, num_bytes, Master, Workers, LoadFlags))
     {
+        FreePooledThreads(Workers);
         free(galloc_context->BaseAddress);
         free(galloc_context);
         free(Master);
@@ -7720,10 +10896,11 @@ XRNS_DLL_EXPORT XRNSPlaybackState * xrns_create_playback_state_from_bytes(void *
     XRNSPlaybackState *xplay = malloc(sizeof(XRNSPlaybackState));
     memset(xplay, 0, sizeof(XRNSPlaybackState));
 
-    CreateXRNSPlaybackState(galloc_context, xplay, Master, 48000.0f);
-
+    xplay->xdoc    = Master;
     xplay->Workers = Workers;
-    xplay->g = galloc_context;
+    xplay->g       = galloc_context;
+
+    int bCreated = CreateXRNSPlaybackState(galloc_context, xplay, Master, 48000.0f);
 
     TracyCZoneEnd(ctx);
 
@@ -7735,26 +10912,87 @@ XRNS_DLL_EXPORT XRNSPlaybackState * xrns_create_playback_state_from_bytes(void *
         ,galloc_context->MaximumSizeBytes / ((float) Megabytes(1))
         );
 
-    if (BytesUsed > galloc_context->MaximumSizeBytes)
+    if (!bCreated || BytesUsed > galloc_context->MaximumSizeBytes)
     {
+        xrns_free_playback_state(xplay);
         return NULL;
     }   
 
     return xplay;
 }
 
-XRNS_DLL_EXPORT XRNSPlaybackState * xrns_create_playback_state(char *p_filename)
+/* LoadFlags is a combination of the XRNS_LOAD_ flags in xrns_player.h, or 0 for the defaults.
+ */
+XRNS_DLL_EXPORT XRNSPlaybackState * xrns_create_playback_state_from_bytes_with_flags
+    (void         *p_bytes
+    ,unsigned int  num_bytes
+    ,unsigned int  LoadFlags
+    )
+{
+    return CreatePlaybackStateFromBytes(p_bytes, num_bytes, LoadFlags, 0);
+}
+
+XRNS_DLL_EXPORT XRNSPlaybackState * xrns_create_playback_state_from_bytes(void *p_bytes, unsigned int num_bytes)
+{
+    return xrns_create_playback_state_from_bytes_with_flags(p_bytes, num_bytes, 0);
+}
+
+XRNS_DLL_EXPORT XRNSPlaybackState * xrns_create_playback_state_with_flags(char *p_filename, unsigned int LoadFlags)
 {
     TracyCZoneN(ctx, "Create Playback From File", 1);
-    void *masterXRNS;
-    long masterXRNSSize;
-    masterXRNS = xrns_read_entire_file(p_filename, &masterXRNSSize);
-    XRNSPlaybackState *RetState = xrns_create_playback_state_from_bytes(masterXRNS, masterXRNSSize);
-    free(masterXRNS);
+    xrns_mapped_file masterXRNS;
+    XRNSPlaybackState *RetState = NULL;
+
+    if (xrns_map_entire_file(p_filename, &masterXRNS))
+    {
+        RetState = xrns_create_playback_state_from_bytes_with_flags(masterXRNS.p_mem, masterXRNS.file_size, LoadFlags);
+        xrns_unmap_entire_file(&masterXRNS);
+    }
+
+    TracyCZoneEnd(ctx);
+    return RetState;
+}
+
+XRNS_DLL_EXPORT XRNSPlaybackState * xrns_create_playback_state(char *p_filename)
+{
+    return xrns_create_playback_state_with_flags(p_filename, 0);
+}
+
+/* Loads a song cache written by xrns_save_song_cache(). Samples come back in whatever format the song
+ * was loaded with when the cache was saved. Returns NULL if the file can't be read, or was written by 
+ * a build with a different layout, in which case load the .xrns again and save a new cache.
+ */
+XRNS_DLL_EXPORT XRNSPlaybackState * xrns_create_playback_state_from_cache(char *p_filename)
+{
+    TracyCZoneN(ctx, "Create Playback From Cache", 1);
+    xrns_mapped_file Cache;
+    XRNSPlaybackState *RetState = NULL;
+
+    if (xrns_map_entire_file(p_filename, &Cache))
+    {
+        RetState = CreatePlaybackStateFromBytes(Cache.p_mem, Cache.file_size, 0, 1);
+        xrns_unmap_entire_file(&Cache);
+    }
+
     TracyCZoneEnd(ctx);
     return RetState;
 }
 
+/* Writes the loaded song out as a cache for xrns_create_playback_state_from_cache(), which loads it
+ * without parsing any XML or decoding any samples. Best called straight after the song is loaded.
+ *
+ * Return Codes:
+ *              XRNS_ERR_NULL_STATE
+ *              XRNS_ERR_INVALID_INPUT_PARAM (the file couldn't be written)
+ */
+XRNS_DLL_EXPORT int xrns_save_song_cache(XRNSPlaybackState *xstate, char *p_filename)
+{
+    if (!xstate) return XRNS_ERR_NULL_STATE;
+    if (!p_filename) return XRNS_ERR_INVALID_INPUT_PARAM;
+
+    return SaveSongCache(xstate->xdoc, p_filename) ? XRNS_SUCCESS : XRNS_ERR_INVALID_INPUT_PARAM;
+}
+
 /* Returns an index greater than or equal to 0 on success, corresponding to the pattern index
  * of the pattern that will play on the next row. This index should be used to index the global
  * pattern pool.
@@ -7827,7 +11065,7 @@ XRNS_DLL_EXPORT int32_t xrns_get_current_tick_index(XRNSPlaybackState *xstate)
 XRNS_DLL_EXPORT int32_t xrns_query_available_samples(XRNSPlaybackState *xstate)
 {
     if (!xstate) return XRNS_ERR_NULL_STATE;
-    return (xstate->Output.RingBufferSz - xstate->Output.RingBufferFreeSamples);
+    return RingBufferAvailableSamples(&xstate->Output);
 }
 
 /* Generates samples into the outgoing ringbuffer until a new tick is reached, or the ringbuffer 
@@ -7955,17 +11193,12 @@ XRNS_DLL_EXPORT int xrns_produce_samples(XRNSPlaybackState *xstate, unsigned int
 {
     if (!xstate) return XRNS_ERR_NULL_STATE;
 
-    if (xstate->Output.RingBufferSz - xstate->Output.RingBufferFreeSamples < num_samples)
+    if (RingBufferAvailableSamples(&xstate->Output) < num_samples)
     {
         return XRNS_ERR_OUT_OF_SAMPLES;
     }
 
-    for (int s = 0, r = xstate->Output.RingBufferReadPtr; s < num_samples; s++)
-    {
-        p_samples[2*s + 0] = xstate->Output.OutputRingBuffer[2*r + 0];
-        p_samples[2*s + 1] = xstate->Output.OutputRingBuffer[2*r + 1];
-        r = (r + 1) % xstate->Output.RingBufferSz;
-    }
+    PeekRingBuffer(&xstate->Output, p_samples, num_samples);
 
     return XRNS_SUCCESS;
 }
@@ -8015,7 +11248,7 @@ xrns_produce_samples_submix
 
     memset(p_samples, 0, sizeof(float) * 2 * num_samples);
 
-    if (xstate->Output.RingBufferSz - xstate->Output.RingBufferFreeSamples < num_samples)
+    if (RingBufferAvailableSamples(&xstate->Output) < num_samples)
     {
         /* caller should make more calls to xrns_do_one_row/xrns_do_one_tick to produce more samples */
         return XRNS_ERR_OUT_OF_SAMPLES;
@@ -8030,12 +11263,7 @@ xrns_produce_samples_submix
             if (!TrackDesc->Name) continue;
             if (strstr(TrackDesc->Name, pp_track_names[ch]))
             {
-                for (int s = 0, r = Track->RawAudio.RingBufferReadPtr; s < num_samples; s++)
-                {
-                    p_samples[2*s + 0] += Track->RawAudio.OutputRingBuffer[2*r + 0];
-                    p_samples[2*s + 1] += Track->RawAudio.OutputRingBuffer[2*r + 1];
-                    r = (r + 1) % Track->RawAudio.RingBufferSz;
-                }
+                AccumulateRingBuffer(&Track->RawAudio, p_samples, num_samples);
                 continue;
             }
         }
@@ -8058,28 +11286,176 @@ XRNS_DLL_EXPORT int32_t xrns_done_producing_samples(XRNSPlaybackState *xstate, u
 {
     if (!xstate) return XRNS_ERR_NULL_STATE;
 
-    if (xstate->Output.RingBufferSz - xstate->Output.RingBufferFreeSamples < num_samples)
+    if (RingBufferAvailableSamples(&xstate->Output) < num_samples)
     {
         return XRNS_ERR_OUT_OF_SAMPLES;
     }
 
     for (int t = 0; t < xstate->xdoc->NumTracks; t++)
     {
-        xrns_track_playback_state *Track = xstate->TrackStates[t];
+        ConsumeRingBuffer(&xstate->TrackStates[t]->RawAudio, num_samples);
+    }
+
+    ConsumeRingBuffer(&xstate->Output, num_samples);
+
+    return XRNS_SUCCESS;
+}
+
+/* Renders num_frames of stereo audio straight into p_samples, without going through the outgoing
+ * ringbuffer. If b_planar is zero the frames are interleaved, otherwise p_samples holds num_frames of
+ * the left channel followed by num_frames of the right. Anything still waiting in the ringbuffer from
+ * the xrns_do_* functions is handed over first. xrns_produce_samples_submix() can't see audio 
+ * rendered this way, use xrns_render_stems() instead. Once the song has stopped, the rest of the 
+ * buffer is filled with silence.
+ *
+ * Return Codes:
+ *              XRNS_SUCCESS
+ *              XRNS_ERR_NULL_STATE
+ *              XRNS_ERR_INVALID_INPUT_PARAM
+ */
+XRNS_DLL_EXPORT int xrns_render(XRNSPlaybackState *xstate, unsigned int num_frames, float *p_samples, int b_planar)
+{
+    return xrns_render_stems(xstate, num_frames, p_samples, b_planar, NULL);
+}
+
+/* Same as xrns_render(), and also fills in stems registered with xrns_register_stem() in the same 
+ * pass. pp_stems[handle] is either NULL, or a planar buffer of num_frames of left followed by 
+ * num_frames of right to write that stem into. pp_stems may be NULL if no stems are wanted.
+ *
+ * Return Codes:
+ *              XRNS_SUCCESS
+ *              XRNS_ERR_NULL_STATE
+ *              XRNS_ERR_INVALID_INPUT_PARAM
+ */
+XRNS_DLL_EXPORT int xrns_render_stems
+    (XRNSPlaybackState *xstate
+    ,unsigned int num_frames
+    ,float *p_samples
+    ,int b_planar
+    ,float **pp_stems
+    )
+{
+    if (!xstate) return XRNS_ERR_NULL_STATE;
+    if (!p_samples) return XRNS_ERR_INVALID_INPUT_PARAM;
+
+    xstate->DirectOutput        = p_samples;
+    xstate->DirectOutputFrames  = num_frames;
+    xstate->DirectOutputWritten = 0;
+    xstate->bDirectOutputPlanar = !!b_planar;
+    xstate->DirectStems         = pp_stems;
+
+    for (int h = 0; pp_stems && h < xstate->NumStems; h++)
+    {
+        if (pp_stems[h]) memset(pp_stems[h], 0, sizeof(float) * 2 * num_frames);
+    }
+
+    unsigned int Buffered = RingBufferAvailableSamples(&xstate->Output);
+    if (Buffered > num_frames) Buffered = num_frames;
+
+    for (int h = 0; pp_stems && Buffered && h < xstate->NumStems; h++)
+    {
+        if (!pp_stems[h]) continue;
 
-        for (int s = 0; s < num_samples; s++)
+        for (int w = 0; w < XRNS_TRACK_MASK_WORDS; w++)
         {
-            Track->RawAudio.RingBufferReadPtr = (Track->RawAudio.RingBufferReadPtr + 1) % Track->RawAudio.RingBufferSz;
-            Track->RawAudio.RingBufferFreeSamples++;
-        }        
+            for (uint64_t Tracks = xstate->Stems[h].TrackMask[w]; Tracks; Tracks &= Tracks - 1)
+            {
+                xrns_ringbuffer *RawAudio = &xstate->TrackStates[64 * w + LowestSetBit64(Tracks)]->RawAudio;
+
+                for (unsigned int s = 0; s < Buffered; s++)
+                {
+                    const float *Frame = &RawAudio->OutputRingBuffer[2 * ((RawAudio->RingBufferReadPtr + s) & RawAudio->RingBufferMask)];
+                    pp_stems[h][s]              += Frame[0];
+                    pp_stems[h][num_frames + s] += Frame[1];
+                }
+            }
+        }
+    }
+
+    for (unsigned int s = 0; s < Buffered; s++)
+    {
+        const float *Frame = &xstate->Output.OutputRingBuffer[2 * ((xstate->Output.RingBufferReadPtr + s) & xstate->Output.RingBufferMask)];
+        WriteDirectOutput(xstate, &Frame[0], &Frame[1], 1);
+    }
+
+    if (Buffered)
+    {
+        xrns_done_producing_samples(xstate, Buffered);
+    }
+
+    while (xstate->DirectOutputWritten < num_frames && !xstate->bSongStopped)
+    {
+        unsigned int Before = xstate->DirectOutputWritten;
+
+        run_engine(xstate, 0, 0, 0, num_frames - xstate->DirectOutputWritten);
+
+        if (xstate->DirectOutputWritten == Before)
+            break;
+    }
+
+    while (xstate->DirectOutputWritten < num_frames)
+    {
+        static const float Silence[XRNS_MAX_SPAN_FRAMES];
+        unsigned int n = num_frames - xstate->DirectOutputWritten;
+        if (n > XRNS_MAX_SPAN_FRAMES) n = XRNS_MAX_SPAN_FRAMES;
+        WriteDirectOutput(xstate, Silence, Silence, n);
+    }
+
+    xstate->DirectOutput = NULL;
+    xstate->DirectStems  = NULL;
+
+    return XRNS_SUCCESS;
+}
+
+/* Registers a stem for xrns_render_stems(), made of every track whose name contains one of the
+ * num_track_names strings in pp_track_names (the same matching as xrns_produce_samples_submix()).
+ * The names are only matched here, once. Returns the stem's handle, counting up from 0.
+ *
+ * Return Codes:
+ *              XRNS_ERR_NULL_STATE
+ *              XRNS_ERR_INVALID_INPUT_PARAM
+ *              XRNS_ERR_INVALID_TRACK_NAME
+ */
+XRNS_DLL_EXPORT int xrns_register_stem(XRNSPlaybackState *xstate, char **pp_track_names, int num_track_names)
+{
+    if (!xstate) return XRNS_ERR_NULL_STATE;
+
+    if (!pp_track_names || num_track_names <= 0 || xstate->NumStems == XRNS_MAX_STEMS)
+    {
+        return XRNS_ERR_INVALID_INPUT_PARAM;
+    }
+
+    for (int ch = 0; ch < num_track_names; ch++)
+    {
+        if (!pp_track_names[ch]) return XRNS_ERR_INVALID_TRACK_NAME;
     }
 
-    for (int s = 0; s < num_samples; s++)
+    xrns_stem *Stem = &xstate->Stems[xstate->NumStems];
+    memset(Stem, 0, sizeof(xrns_stem));
+
+    for (int track = 0; track < xstate->xdoc->NumTracks; track++)
     {
-        xstate->Output.RingBufferReadPtr = (xstate->Output.RingBufferReadPtr + 1) % xstate->Output.RingBufferSz;
-        xstate->Output.RingBufferFreeSamples++;
+        xrns_track_desc *TrackDesc = &xstate->xdoc->Tracks[track];
+        if (!TrackDesc->Name) continue;
+
+        for (int ch = 0; ch < num_track_names; ch++)
+        {
+            if (strstr(TrackDesc->Name, pp_track_names[ch]))
+            {
+                Stem->TrackMask[track / 64] |= (uint64_t) 1 << (track % 64);
+            }
+        }
     }
 
+    return xstate->NumStems++;
+}
+
+/* Forgets every registered stem, handles start from 0 again afterwards.
+ */
+XRNS_DLL_EXPORT int xrns_clear_stems(XRNSPlaybackState *xstate)
+{
+    if (!xstate) return XRNS_ERR_NULL_STATE;
+    xstate->NumStems = 0;
     return XRNS_SUCCESS;
 }
 
@@ -8130,7 +11506,7 @@ XRNS_DLL_EXPORT int32_t xrns_prepare_active_notes(XRNSPlaybackState *xstate)
         {
             xrns_sampler_bank *SamplerBank = &xstate->SamplerBanks[track][col];
 
-            for (s = 0; s < XRNS_MAX_SAMPLERS_PER_COLUMN; s++)
+            for (s = NextLiveSampler(SamplerBank, 0); s < XRNS_MAX_SAMPLERS_PER_COLUMN; s = NextLiveSampler(SamplerBank, s + 1))
             {
                 xrns_sampler *Sampler = &SamplerBank->Samplers[s];
 
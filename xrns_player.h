@@ -55,11 +55,26 @@
 #define XRNS_ERR_TRACK_NOT_FOUND      (-6) 
 #define XRNS_ERR_PARSING_FAIL         (-7) 
 
+/* Load flags, for the _with_flags versions of the create functions.
+ *
+ * XRNS_LOAD_FLOAT_SAMPLES: Keep samples as planar float32 with the output gain already applied,
+ *                          instead of int16. Twice the memory, but less work per rendered frame.
+ */
+#define XRNS_LOAD_FLOAT_SAMPLES       (1 << 0)
+
 typedef struct _XRNSPlaybackState XRNSPlaybackState;
 
 XRNS_DLL_EXPORT XRNSPlaybackState * xrns_create_playback_state(char *p_filename);
+XRNS_DLL_EXPORT XRNSPlaybackState * xrns_create_playback_state_with_flags(char *p_filename, unsigned int flags);
 XRNS_DLL_EXPORT XRNSPlaybackState * xrns_create_playback_state_from_bytes(void *p_bytes, unsigned int num_bytes);
-XRNS_DLL_EXPORT int                 xrns_produce_samples(void *xstate, unsigned int num_samples, float *p_samples);
-XRNS_DLL_EXPORT void                xrns_free_playback_state(void *xstate);
+XRNS_DLL_EXPORT XRNSPlaybackState * xrns_create_playback_state_from_bytes_with_flags(void *p_bytes, unsigned int num_bytes, unsigned int flags);
+XRNS_DLL_EXPORT XRNSPlaybackState * xrns_create_playback_state_from_cache(char *p_filename);
+XRNS_DLL_EXPORT int                 xrns_save_song_cache(XRNSPlaybackState *xstate, char *p_filename);
+XRNS_DLL_EXPORT int                 xrns_produce_samples(XRNSPlaybackState *xstate, unsigned int num_samples, float *p_samples);
+XRNS_DLL_EXPORT int                 xrns_render(XRNSPlaybackState *xstate, unsigned int num_frames, float *p_samples, int b_planar);
+XRNS_DLL_EXPORT int                 xrns_render_stems(XRNSPlaybackState *xstate, unsigned int num_frames, float *p_samples, int b_planar, float **pp_stems);
+XRNS_DLL_EXPORT int                 xrns_register_stem(XRNSPlaybackState *xstate, char **pp_track_names, int num_track_names);
+XRNS_DLL_EXPORT int                 xrns_clear_stems(XRNSPlaybackState *xstate);
+XRNS_DLL_EXPORT void                xrns_free_playback_state(XRNSPlaybackState *xstate);
 
 #endif